@@ -0,0 +1,47 @@
+#version 450 core
+// Converts level of prefiltered environment cube map into level of octahedral map (layer of 2D array texture).
+// Level has one texel border which repeats texels across octahedron edges, see octahedralUV() in pbr_fs.glsl.
+
+layout(binding=0) uniform samplerCube inputTexture;
+layout(binding=0, rgba16f) restrict writeonly uniform image2D outputTexture;
+
+// Level of input cube map matching roughness of output level.
+layout(location=0) uniform float sourceLod;
+
+// Direction of point of octahedral map, Z is the axis of octahedron.
+vec3 octahedralDirection(vec2 uv)
+{
+	vec2 f = 2.0 * uv - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+layout(local_size_x=8, local_size_y=8, local_size_z=1) in;
+void main(void)
+{
+	ivec2 size = imageSize(outputTexture);
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(pos, size)))
+	{
+		return;
+	}
+
+	vec2 uv = (vec2(pos) + 0.5) / vec2(size);
+	if (size.x > 2)
+	{
+		// Border texels are outside of [0, 1], octahedral map is mirrored across its edges
+		uv = (vec2(pos) - 0.5) / vec2(size - 2);
+		if (uv.x < 0.0 || uv.x > 1.0)
+		{
+			uv = vec2(uv.x < 0.0 ? -uv.x : 2.0 - uv.x, 1.0 - uv.y);
+		}
+		if (uv.y < 0.0 || uv.y > 1.0)
+		{
+			uv = vec2(1.0 - uv.x, uv.y < 0.0 ? -uv.y : 2.0 - uv.y);
+		}
+	}
+
+	imageStore(outputTexture, pos, textureLod(inputTexture, octahedralDirection(uv), sourceLod));
+}
@@ -0,0 +1,117 @@
+#version 450 core
+// Tests bounding box of every draw against hierarchical depth buffer of objects visible in the previous frame.
+// Writes instance count of draws visible now (drawn next frame first and by transparent pass) and of draws
+// that became visible (drawn in the second phase of this frame).
+
+layout(local_size_x=64, local_size_y=1, local_size_z=1) in;
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+struct DrawBounds
+{
+	vec4 boundsMin;
+	vec4 boundsMax;
+};
+
+struct DrawData
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	uvec4 materialIndex;
+};
+
+layout(std140, binding=0) uniform TransformUniforms
+{
+	mat4 viewProjectionMatrix;
+};
+
+layout(std430, binding=0) readonly buffer SourceCommands
+{
+	DrawCommand commands[];		// instance count is 0 for draws culled on CPU
+};
+layout(std430, binding=1) buffer VisibleCommands
+{
+	DrawCommand visibleCommands[];
+};
+layout(std430, binding=2) writeonly buffer NewlyVisibleCommands
+{
+	DrawCommand newlyVisibleCommands[];
+};
+layout(std430, binding=3) readonly buffer BoundsBuffer
+{
+	DrawBounds bounds[];
+};
+layout(std430, binding=4) readonly buffer DrawDataBuffer
+{
+	DrawData draws[];		// indexed by base instance of draw
+};
+
+layout(binding=0) uniform sampler2D depthPyramid;
+
+layout(location=0) uniform int numDraws;
+
+bool isVisible(DrawBounds b, mat4 modelMatrix)
+{
+	mat4 mvp = viewProjectionMatrix * modelMatrix;
+	vec2 rectMin = vec2(1.0), rectMax = vec2(0.0);
+	float minDepth = 1.0;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = vec3((i & 1) != 0 ? b.boundsMax.x : b.boundsMin.x,
+						   (i & 2) != 0 ? b.boundsMax.y : b.boundsMin.y,
+						   (i & 4) != 0 ? b.boundsMax.z : b.boundsMin.z);
+		vec4 clip = mvp * vec4(corner, 1.0);
+		if (clip.w <= 0.0001)
+		{
+			return true;	// crosses near plane
+		}
+		vec3 ndc = clip.xyz / clip.w;
+		rectMin = min(rectMin, ndc.xy * 0.5 + 0.5);
+		rectMax = max(rectMax, ndc.xy * 0.5 + 0.5);
+		minDepth = min(minDepth, ndc.z * 0.5 + 0.5);
+	}
+	if (any(lessThan(rectMax, vec2(0.0))) || any(greaterThan(rectMin, vec2(1.0))))
+	{
+		return false;		// outside of view
+	}
+	rectMin = clamp(rectMin, 0.0, 1.0);
+	rectMax = clamp(rectMax, 0.0, 1.0);
+
+	// Level where rectangle covers at most 2x2 texels
+	vec2 size = vec2(textureSize(depthPyramid, 0));
+	vec2 extent = (rectMax - rectMin) * size;
+	int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(depthPyramid) - 1);
+	ivec2 levelSize = textureSize(depthPyramid, level);
+	ivec2 p0 = min(ivec2(rectMin * size) >> level, levelSize - 1);
+	ivec2 p1 = min(ivec2(rectMax * size) >> level, levelSize - 1);
+
+	float maxDepth = 0.0;
+	for (int y = p0.y; y <= p1.y; y++)
+	{
+		for (int x = p0.x; x <= p1.x; x++)
+		{
+			maxDepth = max(maxDepth, texelFetch(depthPyramid, ivec2(x, y), level).r);
+		}
+	}
+	return minDepth <= maxDepth;
+}
+
+void main()
+{
+	int draw = int(gl_GlobalInvocationID.x);
+	if (draw >= numDraws)
+	{
+		return;
+	}
+	uint visibleBefore = visibleCommands[draw].instanceCount;
+	uint visible = (0 != commands[draw].instanceCount && isVisible(bounds[draw], draws[commands[draw].baseInstance].modelMatrix)) ? 1 : 0;
+	visibleCommands[draw].instanceCount = visible;
+	newlyVisibleCommands[draw].instanceCount = (0 != visible && 0 == visibleBefore) ? 1 : 0;
+}
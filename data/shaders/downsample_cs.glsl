@@ -0,0 +1,184 @@
+#version 450 core
+// Single pass downsampler: generates all mip levels of 2D texture or of every cube map face in one dispatch.
+// Every work group reduces 64x64 tile of level 0 into levels 1-6 through shared memory. The last work group
+// of a slice (found with atomic counter) then reduces level 6 into the remaining levels the same way.
+// Levels 7 and deeper are written into buffer and copied to texture afterwards, since image units are limited.
+// Defined by host: IMAGE_FORMAT (rgba16f or rgba8) with IMAGE_FORMAT_ID (0 or 1), CUBE for cube maps, SRGB for rgba8
+// holding sRGB encoded color (filtered in linear space), ALPHA_WEIGHTED to weight color by alpha (e.g. coverage), so
+// that empty texels don't darken edges.
+
+layout(local_size_x=256, local_size_y=1, local_size_z=1) in;
+
+#ifdef CUBE
+#define IMAGE_TYPE imageCube
+#define COORD(p) ivec3(p, gl_WorkGroupID.z)
+#else
+#define IMAGE_TYPE image2D
+#define COORD(p) (p)
+#endif
+
+layout(binding=0, IMAGE_FORMAT) restrict readonly uniform IMAGE_TYPE level0;
+layout(binding=1, IMAGE_FORMAT) restrict writeonly uniform IMAGE_TYPE level1;
+layout(binding=2, IMAGE_FORMAT) restrict writeonly uniform IMAGE_TYPE level2;
+layout(binding=3, IMAGE_FORMAT) restrict writeonly uniform IMAGE_TYPE level3;
+layout(binding=4, IMAGE_FORMAT) restrict writeonly uniform IMAGE_TYPE level4;
+layout(binding=5, IMAGE_FORMAT) restrict writeonly uniform IMAGE_TYPE level5;
+layout(binding=6, IMAGE_FORMAT) coherent restrict uniform IMAGE_TYPE level6;	// read back by the last work group
+
+// Levels 7 and deeper, level by level, slices of a level are consecutive, texels are packed.
+layout(std430, binding=0) restrict writeonly buffer TailBuffer
+{
+	uint tail[];
+};
+
+// Finished work groups of every slice, zero before dispatch.
+layout(std430, binding=1) restrict buffer CounterBuffer
+{
+	uint counters[];
+};
+
+// Number of levels to generate (all levels except level 0).
+layout(location=0) uniform int numLevels;
+
+const int FirstTailLevel = 7;
+
+shared vec4 tile[16][16];
+shared bool lastGroup;
+
+ivec2 levelSize(int level)
+{
+	return max(ivec2(1), imageSize(level0).xy >> level);
+}
+
+int texelUints()
+{
+	return (IMAGE_FORMAT_ID == 0) ? 2 : 1;
+}
+
+// Filtered values are linear and premultiplied by alpha if ALPHA_WEIGHTED, stored values are as in texture
+vec4 toFiltered(vec4 color)
+{
+#ifdef SRGB
+	color.rgb = mix(color.rgb / 12.92, pow((color.rgb + 0.055) / 1.055, vec3(2.4)), greaterThan(color.rgb, vec3(0.04045)));
+#endif
+#ifdef ALPHA_WEIGHTED
+	color.rgb *= color.a;
+#endif
+	return color;
+}
+
+vec4 toStored(vec4 color)
+{
+#ifdef ALPHA_WEIGHTED
+	color.rgb = (color.a > 0.0) ? color.rgb / color.a : vec3(0.0);
+#endif
+#ifdef SRGB
+	color.rgb = mix(color.rgb * 12.92, 1.055 * pow(color.rgb, vec3(1.0 / 2.4)) - 0.055, greaterThan(color.rgb, vec3(0.0031308)));
+#endif
+	return color;
+}
+
+void storeTail(int level, ivec2 p, vec4 color)
+{
+	int offset = 0;
+	for (int l = FirstTailLevel; l < level; l++)
+	{
+		ivec2 size = levelSize(l);
+		offset += size.x * size.y * int(gl_NumWorkGroups.z);
+	}
+	ivec2 size = levelSize(level);
+	offset = (offset + size.x * size.y * int(gl_WorkGroupID.z) + p.y * size.x + p.x) * texelUints();
+#if IMAGE_FORMAT_ID == 0
+	tail[offset] = packHalf2x16(color.rg);
+	tail[offset + 1] = packHalf2x16(color.ba);
+#else
+	tail[offset] = packUnorm4x8(color);
+#endif
+}
+
+void storeLevel(int level, ivec2 p, vec4 color)
+{
+	if (level > numLevels || any(greaterThanEqual(p, levelSize(level))))
+	{
+		return;
+	}
+	color = toStored(color);
+	if (1 == level)      imageStore(level1, COORD(p), color);
+	else if (2 == level) imageStore(level2, COORD(p), color);
+	else if (3 == level) imageStore(level3, COORD(p), color);
+	else if (4 == level) imageStore(level4, COORD(p), color);
+	else if (5 == level) imageStore(level5, COORD(p), color);
+	else if (6 == level) imageStore(level6, COORD(p), color);
+	else                 storeTail(level, p, color);
+}
+
+vec4 loadLevel(int level, ivec2 p)
+{
+	p = min(p, levelSize(level) - 1);
+	return toFiltered((0 == level) ? imageLoad(level0, COORD(p)) : imageLoad(level6, COORD(p)));
+}
+
+// Reduces 64x64 tile of source level into the next 6 levels, every thread starts with 4x4 block.
+void reduceTile(int srcLevel, ivec2 tileOrigin)
+{
+	uint t = gl_LocalInvocationIndex;
+	ivec2 block = ivec2(t % 16, t / 16);
+	ivec2 origin = tileOrigin + 4 * block;
+
+	vec4 sum = vec4(0.0);
+	for (int y = 0; y < 2; y++)
+	{
+		for (int x = 0; x < 2; x++)
+		{
+			ivec2 p = origin + 2 * ivec2(x, y);
+			vec4 c = 0.25 * (loadLevel(srcLevel, p) + loadLevel(srcLevel, p + ivec2(1, 0))
+							 + loadLevel(srcLevel, p + ivec2(0, 1)) + loadLevel(srcLevel, p + ivec2(1, 1)));
+			storeLevel(srcLevel + 1, tileOrigin / 2 + 2 * block + ivec2(x, y), c);
+			sum += c;
+		}
+	}
+	tile[block.y][block.x] = 0.25 * sum;
+	storeLevel(srcLevel + 2, tileOrigin / 4 + block, 0.25 * sum);
+	barrier();
+
+	for (int k = 3, n = 8; k <= 6; k++, n /= 2)
+	{
+		ivec2 p = ivec2(t % n, t / n);
+		vec4 c = vec4(0.0);
+		if (t < uint(n * n))
+		{
+			c = 0.25 * (tile[2 * p.y][2 * p.x] + tile[2 * p.y][2 * p.x + 1]
+						+ tile[2 * p.y + 1][2 * p.x] + tile[2 * p.y + 1][2 * p.x + 1]);
+			storeLevel(srcLevel + k, (tileOrigin >> k) + p, c);
+		}
+		barrier();
+		if (t < uint(n * n))
+		{
+			tile[p.y][p.x] = c;
+		}
+		barrier();
+	}
+}
+
+void main()
+{
+	reduceTile(0, ivec2(gl_WorkGroupID.xy) * 64);
+	if (numLevels <= 6)
+	{
+		return;
+	}
+
+	// Level 6 written by this group is made visible before it is counted as finished
+	memoryBarrierImage();
+	barrier();
+	if (0 == gl_LocalInvocationIndex)
+	{
+		uint finished = atomicAdd(counters[gl_WorkGroupID.z], 1u);
+		lastGroup = (finished == gl_NumWorkGroups.x * gl_NumWorkGroups.y - 1u);
+	}
+	barrier();
+	if (lastGroup)
+	{
+		reduceTile(6, ivec2(0));
+	}
+}
@@ -8,8 +8,30 @@ const float PI = 3.141592;
 const float TwoPI = 2 * PI;
 
 layout(binding=0) uniform sampler2D inputTexture;
+layout(binding=1) uniform usampler2D inputTextureRGBE;	// used instead of inputTexture if inputRGBE is set
 layout(binding=0, rgba16f) restrict writeonly uniform imageCube outputTexture;
 
+layout(location=0) uniform int inputRGBE;
+
+// Fetches and decodes RGBE texel (RGB mantissas with shared exponent), wraps horizontally and clamps vertically.
+vec3 fetchRGBE(ivec2 p)
+{
+	ivec2 size = textureSize(inputTextureRGBE, 0);
+	p = ivec2((p.x % size.x + size.x) % size.x, clamp(p.y, 0, size.y - 1));
+	uvec4 rgbe = texelFetch(inputTextureRGBE, p, 0);
+	return (0u == rgbe.a) ? vec3(0.0) : vec3(rgbe.rgb) * exp2(float(rgbe.a) - 136.0);
+}
+
+// Bilinear filtering of decoded values, integer textures can't be filtered by hardware.
+vec3 sampleRGBE(vec2 uv)
+{
+	vec2 pos = uv * vec2(textureSize(inputTextureRGBE, 0)) - 0.5;
+	ivec2 p = ivec2(floor(pos));
+	vec2 f = pos - floor(pos);
+	return mix(mix(fetchRGBE(p), fetchRGBE(p + ivec2(1, 0)), f.x),
+			   mix(fetchRGBE(p + ivec2(0, 1)), fetchRGBE(p + ivec2(1, 1)), f.x), f.y);
+}
+
 // Calculate normalized sampling direction vector based on current fragment coordinates (gl_GlobalInvocationID.xyz).
 // This is essentially "inverse-sampling": we reconstruct what the sampling vector would be if we wanted it to "hit"
 // this particular fragment in a cubemap.
@@ -41,7 +63,8 @@ void main(void)
 	float theta = acos(v.y);
 
 	// Sample equirectangular texture.
-	vec4 color = texture(inputTexture, vec2(phi / TwoPI, theta / PI));
+	vec2 uv = vec2(phi / TwoPI, theta / PI);
+	vec4 color = (0 != inputRGBE) ? vec4(sampleRGBE(uv), 1.0) : texture(inputTexture, uv);
 
 	// Write out color to output cubemap.
 	imageStore(outputTexture, ivec3(gl_GlobalInvocationID), color);
@@ -0,0 +1,28 @@
+#version 450 core
+// Reduces texture feedback image to the finest UV footprint of every material (see pbr_fs.glsl).
+
+const uint Empty = 0xFFFFFFFFu;
+
+layout(local_size_x=8, local_size_y=8, local_size_z=1) in;
+
+layout(binding=0, r32ui) restrict readonly uniform uimage2D feedbackImage;
+
+layout(std430, binding=0) buffer FootprintBuffer
+{
+	uint footprints[];	// encoded footprint, Empty if material wasn't seen
+};
+
+void main()
+{
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(pos, imageSize(feedbackImage))))
+	{
+		return;
+	}
+	uint value = imageLoad(feedbackImage, pos).r;
+	uint material = value >> 8;
+	if (Empty != value && material < footprints.length())
+	{
+		atomicMin(footprints[material], value & 0xFFu);
+	}
+}
@@ -0,0 +1,49 @@
+#version 450 core
+// Builds level of hierarchical depth buffer: every texel holds the farthest depth of texels it covers in previous level.
+// Last texel of odd sized level also covers the extra row/column of previous level. With SCENE_DEPTH defined builds
+// level 0 from scene depth, multisampled depth (MULTISAMPLED defined) gives the farthest depth of pixel's samples.
+
+layout(local_size_x=8, local_size_y=8, local_size_z=1) in;
+
+#if defined(SCENE_DEPTH) && defined(MULTISAMPLED)
+layout(binding=0) uniform sampler2DMS inputDepth;
+#else
+layout(binding=0) uniform sampler2D inputDepth;		// scene depth or the pyramid itself
+#endif
+layout(binding=1, r32f) restrict writeonly uniform image2D outputDepth;	// image unit 0 is texture feedback
+
+layout(location=0) uniform int sourceLevel;
+
+void main()
+{
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(outputDepth);
+	if (any(greaterThanEqual(pos, size)))
+	{
+		return;
+	}
+
+	float depth = 0.0;
+#ifdef SCENE_DEPTH
+#ifdef MULTISAMPLED
+	for (int i = 0; i < textureSamples(inputDepth); i++)
+	{
+		depth = max(depth, texelFetch(inputDepth, pos, i).r);
+	}
+#else
+	depth = texelFetch(inputDepth, pos, 0).r;
+#endif
+#else
+	ivec2 sourceSize = textureSize(inputDepth, sourceLevel);
+	ivec2 first = 2 * pos;
+	ivec2 last = min(mix(first + 1, sourceSize - 1, equal(pos, size - 1)), sourceSize - 1);
+	for (int y = first.y; y <= last.y; y++)
+	{
+		for (int x = first.x; x <= last.x; x++)
+		{
+			depth = max(depth, texelFetch(inputDepth, ivec2(x, y), sourceLevel).r);
+		}
+	}
+#endif
+	imageStore(outputDepth, pos, vec4(depth));
+}
@@ -0,0 +1,48 @@
+#version 450 core
+// Impostor: camera facing quad over bounding sphere of object, shaded by pbr_fs.glsl compiled with IMPOSTOR.
+// Drawn without vertex attributes as triangle strip of 4 vertices.
+
+const int NumLights = 3;
+
+layout(std140, binding=0) uniform TransformUniforms
+{
+	mat4 viewProjectionMatrix;
+	mat4 modelMatrix;
+};
+
+layout(std140, binding=1) uniform ShadingUniforms
+{
+	vec4 lights[2 * NumLights];	// direction and radiance of analytical lights, see pbr_fs.glsl
+	vec3 eyePosition;
+};
+
+layout(std140, binding=4) uniform ImpostorUniforms
+{
+	vec4 centerRadius;	// object space bounding sphere
+	int gridSize;
+};
+
+layout(location=0) out Vertex
+{
+	vec3 position;
+	vec2 texcoord;
+	mat3 tangentBasis;
+} vout;
+layout(location=5) flat out uint materialIndex;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	vec3 center = vec3(modelMatrix * vec4(centerRadius.xyz, 1.0));
+	vec3 toEye = normalize(eyePosition - center);
+	vec3 up = (abs(toEye.y) > 0.999) ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(up, toEye));
+	up = cross(toEye, right);
+
+	vout.position = center + (corner.x * right + corner.y * up) * centerRadius.w;
+	vout.texcoord = corner * 0.5 + 0.5;
+	vout.tangentBasis = mat3(right, up, toEye);
+	materialIndex = 0;
+
+	gl_Position = viewProjectionMatrix * vec4(vout.position, 1.0);
+}
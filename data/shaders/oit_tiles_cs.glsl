@@ -0,0 +1,57 @@
+#version 450 core
+// Classifies 16x16 screen tiles by transparency: tile has transparent pixels if any of its pixels has nonzero OIT
+// counter. Tiles are appended to one of two lists drawn with indirect draws, tonemap_fs.glsl composites transparent
+// layers only in tiles of the first list, other tiles are only tonemapped.
+
+const int TileSize = 16;
+
+layout(local_size_x=TileSize, local_size_y=TileSize, local_size_z=1) in;
+
+layout(binding=0) uniform sampler2D counter;
+
+struct DrawArraysIndirectCommand
+{
+	uint count;
+	uint instanceCount;
+	uint first;
+	uint baseInstance;
+};
+
+// Instance counts are zero before dispatch, must match tonemap_vs.glsl
+layout(std430, binding=0) restrict buffer TileLists
+{
+	DrawArraysIndirectCommand commands[2];	// tiles with transparent pixels, opaque tiles
+	uint tiles[];	// x | y << 16, transparent tiles from the start, opaque tiles from the end
+};
+
+shared uint transparent;
+
+void main()
+{
+	if (0 == gl_LocalInvocationIndex)
+	{
+		transparent = 0;
+	}
+	barrier();
+
+	ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+	if (all(lessThan(pos, textureSize(counter, 0))) && texelFetch(counter, pos, 0).r > 0.0)
+	{
+		atomicOr(transparent, 1u);
+	}
+	barrier();
+
+	if (0 == gl_LocalInvocationIndex)
+	{
+		uint tile = gl_WorkGroupID.x | (gl_WorkGroupID.y << 16);
+		if (0u != transparent)
+		{
+			tiles[atomicAdd(commands[0].instanceCount, 1u)] = tile;
+		}
+		else
+		{
+			uint numTiles = gl_NumWorkGroups.x * gl_NumWorkGroups.y;
+			tiles[numTiles - 1u - atomicAdd(commands[1].instanceCount, 1u)] = tile;
+		}
+	}
+}
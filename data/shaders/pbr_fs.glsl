@@ -7,6 +7,11 @@
 // This implementation is based on "Real Shading in Unreal Engine 4" SIGGRAPH 2013 course notes by Epic Games.
 // See: http://blog.selfshadow.com/publications/s2013-shading-course/karis/s2013_pbs_epic_notes_v2.pdf
 
+// Defines (inserted after #version):
+// IMPOSTOR_BAKE - write albedo, object space normal, ORM and depth with coverage into impostor atlas instead of shading
+// IMPOSTOR      - shading inputs are sampled from impostor atlas, vertices come from impostor_vs.glsl
+// DEPTH_PREPASS - only alpha test, for depth prepass of opaque geometry
+
 const float PI = 3.141592;
 const float Epsilon = 0.00001;
 
@@ -27,10 +32,17 @@ layout(location=0) in Vertex
 	vec2 texcoord;
 	mat3 tangentBasis;
 } vin;
+layout(location=5) flat in uint materialIndex;
 
 layout(location=0) out vec4 color;
+#ifdef IMPOSTOR_BAKE
+layout(location=1) out vec4 bakedNormal;
+layout(location=2) out vec4 bakedOrm;
+layout(location=3) out vec4 bakedDepth;
+#else
 layout(location=1) out vec4 accumulation;
 layout(location=2) out float counter;
+#endif
 
 layout(std140, binding=1) uniform ShadingUniforms
 {
@@ -41,15 +53,238 @@ layout(std140, binding=1) uniform ShadingUniforms
 layout(std140, binding=2) uniform BaseInfoUniforms
 {
 	int opaquePass;
+	int feedbackPass;		// write texture feedback
+	ivec2 feedbackOffset;	// pixel of every feedback tile written in this frame
+	int octahedralEnvironment;	// sample environment probe from octahedral arrays instead of cube maps
+	int environmentProbe;		// layer of octahedral arrays
+	int singlePass;				// opaque and transparent geometry in one pass, see Renderer::render()
+	int sortedPass;				// transparent triangles arrive back to front and are blended into color target
+	int alphaToCoverage;		// cutout edges by coverage of multisample target instead of alpha test
+};
+
+// Texture feedback, one texel per FeedbackTileSize x FeedbackTileSize screen tile.
+// Texel holds material index (upper 24 bits) and log2 of UV footprint of the pixel, encoded as (log2 + 32) * 8.
+const int FeedbackTileSize = 8;
+layout(binding=0, r32ui) restrict writeonly uniform uimage2D feedbackImage;
+
+// Material flags, textures are sampled only for channels that have a map.
+const int AlbedoMap    = 1 << 0;
+const int NormalMap    = 1 << 1;
+const int MetalnessMap = 1 << 2;
+const int RoughnessMap = 1 << 3;
+const int OcclusionMap = 1 << 4;
+const int AlphaCutout  = 1 << 5;	// hard alpha edges, drawn with opaque geometry (alpha-to-coverage or alpha test)
+
+struct Material
+{
+	vec4 albedoFactor;
+	float metalnessFactor;
+	float roughnessFactor;
+	float occlusionFactor;
+	int flags;
+	ivec4 layers;	// albedo, normal and ORM layers in texture arrays
+	vec4 minLod;	// finest streamed in mip level of albedo, normal and ORM layers
 };
 
-layout(binding=0) uniform sampler2D albedoTexture;
-layout(binding=1) uniform sampler2D normalTexture;
-layout(binding=2) uniform sampler2D metalnessTexture;
-layout(binding=3) uniform sampler2D roughnessTexture;
+layout(std430, binding=0) readonly buffer MaterialBuffer
+{
+	Material materials[];
+};
+
+// Material textures are layers of texture arrays shared by materials.
+layout(binding=0) uniform sampler2DArray albedoTexture;
+layout(binding=1) uniform sampler2DArray normalTexture;	// RG, Z is reconstructed
+layout(binding=2) uniform sampler2DArray ormTexture;	// R - occlusion, G - roughness, B - metalness
 layout(binding=4) uniform samplerCube specularTexture;
 layout(binding=5) uniform samplerCube irradianceTexture;
 layout(binding=6) uniform sampler2D specularBRDF_LUT;
+layout(binding=7) uniform sampler2DArray octSpecularTexture;
+layout(binding=8) uniform sampler2DArray octIrradianceTexture;
+layout(binding=9) uniform sampler2DArray probeSpecularTexture;	// reflection probes captured at runtime
+layout(binding=10) uniform sampler2DArray probeIrradianceTexture;
+
+// Reflection probes captured at runtime, only probes that have been captured are listed.
+const int MaxReflectionProbes = 16;
+struct ReflectionProbe
+{
+	vec4 positionRadius;
+	ivec4 layer;		// layer of reflection probe arrays
+};
+layout(std140, binding=3) uniform ReflectionProbeUniforms
+{
+	ReflectionProbe probes[MaxReflectionProbes];
+	int numProbes;
+};
+
+#ifdef IMPOSTOR
+layout(std140, binding=0) uniform TransformUniforms
+{
+	mat4 viewProjectionMatrix;
+	mat4 modelMatrix;
+};
+
+// Atlas of gridSize x gridSize views, view of cell (x, y) looks from octahedralDecode((x, y) / (gridSize - 1)).
+layout(std140, binding=4) uniform ImpostorUniforms
+{
+	vec4 centerRadius;	// object space bounding sphere
+	int gridSize;
+};
+layout(binding=11) uniform sampler2D impostorAlbedo;		// alpha is coverage
+layout(binding=12) uniform sampler2D impostorNormal;	// object space normal
+layout(binding=13) uniform sampler2D impostorOrm;
+layout(binding=14) uniform sampler2D impostorDepth;	// depth premultiplied by coverage (alpha)
+#endif
+
+// Samples layer of material texture array, LOD is biased so that mip levels which aren't streamed in yet are not used.
+vec4 sampleMaterial(sampler2DArray tex, vec2 uv, int layer, float minLod)
+{
+	float lod = textureQueryLod(tex, uv).y;
+	return texture(tex, vec3(uv, layer), max(0.0, minLod - lod));
+}
+
+// Octahedral encoding of direction, Z is the axis of octahedron (see cube2oct_cs.glsl).
+vec2 octahedralEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 f = (n.z >= 0.0) ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return 0.5 * f + 0.5;
+}
+
+// Texture coordinates of direction in octahedral map level of given size, levels have one texel border.
+vec2 octahedralUV(vec3 dir, float size)
+{
+	vec2 uv = octahedralEncode(dir);
+	return (size > 2.0) ? (uv * (size - 2.0) + 1.0) / size : uv;
+}
+
+// Samples probe layer of octahedral map, levels are blended manually since their borders differ.
+vec4 sampleOctahedral(sampler2DArray tex, vec3 dir, int layer, float lod)
+{
+	float maxLevel = float(textureQueryLevels(tex) - 1);
+	float l0 = min(floor(lod), maxLevel);
+	float l1 = min(l0 + 1.0, maxLevel);
+	vec4 c0 = textureLod(tex, vec3(octahedralUV(dir, float(textureSize(tex, int(l0)).x)), layer), l0);
+	vec4 c1 = textureLod(tex, vec3(octahedralUV(dir, float(textureSize(tex, int(l1)).x)), layer), l1);
+	return mix(c0, c1, clamp(lod - l0, 0.0, 1.0));
+}
+
+// Two nearest reflection probes containing the point, layers are -1 if there is none. Weight of the nearer one
+// is 0.5 where both are at the same distance, so that surfaces don't show seams where the nearest probe changes.
+void selectProbes(vec3 p, out ivec2 layers, out float weight)
+{
+	layers = ivec2(-1);
+	vec2 nearest = vec2(1e30);
+	for (int i = 0; i < numProbes; i++)
+	{
+		float d = distance(p, probes[i].positionRadius.xyz);
+		if (d >= probes[i].positionRadius.w)
+		{
+			continue;
+		}
+		if (d < nearest.x)
+		{
+			nearest = vec2(d, nearest.x);
+			layers = ivec2(probes[i].layer.x, layers.x);
+		}
+		else if (d < nearest.y)
+		{
+			nearest.y = d;
+			layers.y = probes[i].layer.x;
+		}
+	}
+	weight = (layers.y < 0) ? 1.0 : nearest.y / max(nearest.x + nearest.y, Epsilon);
+}
+
+vec3 sampleProbes(sampler2DArray tex, vec3 dir, ivec2 layers, float weight, float lod)
+{
+	vec3 nearer = sampleOctahedral(tex, dir, layers.x, lod).rgb;
+	return (layers.y < 0) ? nearer : mix(sampleOctahedral(tex, dir, layers.y, lod).rgb, nearer, weight);
+}
+
+#ifdef IMPOSTOR
+vec3 octahedralDecode(vec2 uv)
+{
+	vec2 f = 2.0 * uv - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+// Texture coordinates of object space point in atlas cell, outside [0, 1] if point is outside the cell.
+vec2 impostorCellUV(vec3 q, vec3 right, vec3 up)
+{
+	return vec2(dot(q, right), dot(q, up)) / (2.0 * centerRadius.w) + 0.5;
+}
+
+// Samples one view of impostor: ray from eye through billboard point is intersected with plane of the view through
+// center, then with plane at depth of the view found there, so that views are aligned in spite of different
+// directions. Must match Impostor::getFrame() and projection of Impostor::Bake().
+void sampleImpostorView(ivec2 cell, vec3 point, vec3 ray, float weight,
+						inout vec4 albedo, inout vec3 normal, inout vec3 orm, inout vec4 surface)
+{
+	vec3 dir = octahedralDecode(vec2(cell) / float(gridSize - 1));
+	vec3 up = (abs(dir.y) > 0.999) ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(up, dir));
+	up = cross(dir, right);
+
+	vec3 center = centerRadius.xyz;
+	float rayDir = min(dot(ray, dir), -Epsilon);
+	vec2 uv = impostorCellUV(point + ray * (dot(center - point, dir) / rayDir) - center, right, up);
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+	{
+		return;
+	}
+	vec4 depth = texture(impostorDepth, (vec2(cell) + uv) / float(gridSize));
+	if (depth.a <= 0.0)
+	{
+		return;
+	}
+	// Depth 0 is one radius in front of center, 1 one radius behind it
+	vec3 plane = center + dir * centerRadius.w * (1.0 - 2.0 * depth.r / depth.a);
+	vec3 q = point + ray * (dot(plane - point, dir) / rayDir);
+	uv = impostorCellUV(q - center, right, up);
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+	{
+		return;
+	}
+	uv = (vec2(cell) + uv) / float(gridSize);
+	vec4 a = texture(impostorAlbedo, uv);
+	weight *= a.a;
+	albedo += vec4(a.rgb * weight, weight);
+	normal += texture(impostorNormal, uv).xyz * weight;
+	orm += texture(impostorOrm, uv).rgb * weight;
+	surface += vec4(q * weight, weight);
+}
+
+// Blends four views nearest to view direction, returns coverage.
+float sampleImpostor(inout vec3 worldPosition, out vec3 albedo, out vec3 N, out vec3 orm)
+{
+	mat4 worldToObject = inverse(modelMatrix);
+	vec3 eye = vec3(worldToObject * vec4(eyePosition, 1.0));
+	vec3 point = vec3(worldToObject * vec4(worldPosition, 1.0));
+	vec3 ray = normalize(point - eye);
+
+	vec2 grid = octahedralEncode(normalize(eye - centerRadius.xyz)) * float(gridSize - 1);
+	ivec2 cell = min(ivec2(grid), ivec2(gridSize - 2));
+	vec2 f = grid - vec2(cell);
+
+	vec4 albedoSum = vec4(0.0), surfaceSum = vec4(0.0);
+	vec3 normalSum = vec3(0.0), ormSum = vec3(0.0);
+	sampleImpostorView(cell,               point, ray, (1.0 - f.x) * (1.0 - f.y), albedoSum, normalSum, ormSum, surfaceSum);
+	sampleImpostorView(cell + ivec2(1, 0), point, ray, f.x * (1.0 - f.y),         albedoSum, normalSum, ormSum, surfaceSum);
+	sampleImpostorView(cell + ivec2(0, 1), point, ray, (1.0 - f.x) * f.y,         albedoSum, normalSum, ormSum, surfaceSum);
+	sampleImpostorView(cell + ivec2(1, 1), point, ray, f.x * f.y,                 albedoSum, normalSum, ormSum, surfaceSum);
+
+	float weight = max(albedoSum.a, Epsilon);
+	albedo = albedoSum.rgb / weight;
+	N = normalize(mat3(modelMatrix) * normalSum);
+	orm = ormSum / weight;
+	// Surface point replaces billboard point, so that shading and depth are those of the surface
+	worldPosition = vec3(modelMatrix * vec4(surfaceSum.xyz / weight, 1.0));
+	return albedoSum.a;
+}
+#endif
 
 // GGX/Towbridge-Reitz normal distribution function.
 // Uses Disney's reparametrization of alpha = roughness^2.
@@ -84,24 +319,106 @@ vec3 fresnelSchlick(vec3 F0, float cosTheta)
 
 void main()
 {
+	// UV footprint is computed before any non-uniform control flow so that derivatives are defined.
+	vec2 uvFootprint = max(abs(dFdx(vin.texcoord)), abs(dFdy(vin.texcoord)));
+	float coverage = 1.0;	// alpha written in opaque pass, turned into sample coverage
+	vec3 position = vin.position;
+
+#ifdef IMPOSTOR
+	vec3 albedo, N, orm;
+	if (sampleImpostor(position, albedo, N, orm) < 0.5)
+	{
+		discard;
+	}
+	vec4 clipPosition = viewProjectionMatrix * vec4(position, 1.0);
+	gl_FragDepth = 0.5 * clipPosition.z / clipPosition.w + 0.5;
+	vec4 albedoColor = vec4(albedo, 1.0);
+	float occlusion = orm.r;
+	float roughness = orm.g;
+	float metalness = orm.b;
+#else
 	// Sample input textures to get shading model params.
-	vec4 albedoColor = texture(albedoTexture, vin.texcoord);
+	Material material = materials[materialIndex];
+	int materialFlags = material.flags;
+	vec4 albedoColor = material.albedoFactor;
+	if (0 != (materialFlags & AlbedoMap))
+	{
+		albedoColor = sampleMaterial(albedoTexture, vin.texcoord, material.layers.x, material.minLod.x);
+	}
+	float alphaWidth = fwidth(albedoColor.a);
+	if (0 != (materialFlags & AlphaCutout))
+	{
+		// Cutout surfaces are opaque where alpha passes 0.5, edges are sharpened to about a pixel wide coverage ramp
+#ifndef IMPOSTOR_BAKE
+		if (0 == opaquePass && 0 == singlePass)
+		{
+			discard;
+		}
+		if (0 != alphaToCoverage)
+		{
+			coverage = clamp((albedoColor.a - 0.5) / max(alphaWidth, 1e-4) + 0.5, 0.0, 1.0);
+		}
+		else
+#endif
+		if (albedoColor.a < 0.5)
+		{
+			discard;
+		}
+		albedoColor.a = 1.0;
+	}
+#ifdef IMPOSTOR_BAKE
+	if (albedoColor.a < 1.0)	// only opaque surfaces are baked
+#else
 	if (/*0 == opaquePass && albedoColor.a >= 1.0
 		|| */0 != opaquePass && albedoColor.a < 1.0)
+#endif
 	{
 		discard;
 	}
 	vec3 albedo = albedoColor.rgb;
-	float metalness = texture(metalnessTexture, vin.texcoord).r;
-	float roughness = texture(roughnessTexture, vin.texcoord).r;
+#ifdef DEPTH_PREPASS
+	return;
+#endif
 
-	// Outgoing light direction (vector from world-space fragment position to the "eye").
-	vec3 Lo = normalize(eyePosition - vin.position);
+#ifndef IMPOSTOR_BAKE
+	if (0 != feedbackPass && all(equal(ivec2(gl_FragCoord.xy) % FeedbackTileSize, feedbackOffset)))
+	{
+		float footprintLog2 = log2(max(max(uvFootprint.x, uvFootprint.y), 1e-9));
+		uint code = uint(clamp((footprintLog2 + 32.0) * 8.0, 0.0, 255.0));
+		imageStore(feedbackImage, ivec2(gl_FragCoord.xy) / FeedbackTileSize, uvec4((materialIndex << 8) | code));
+	}
+#endif
+	vec3 orm = vec3(0.0);
+	if (0 != (materialFlags & (OcclusionMap | RoughnessMap | MetalnessMap)))
+	{
+		orm = sampleMaterial(ormTexture, vin.texcoord, material.layers.z, material.minLod.z).rgb;
+	}
+	float occlusion = (0 != (materialFlags & OcclusionMap)) ? orm.r : material.occlusionFactor;
+	float roughness = (0 != (materialFlags & RoughnessMap)) ? orm.g : material.roughnessFactor;
+	float metalness = (0 != (materialFlags & MetalnessMap)) ? orm.b : material.metalnessFactor;
 
 	// Get current fragment's normal and transform to world space.
-	vec3 N = normalize(2.0 * texture(normalTexture, vin.texcoord).rgb - 1.0);
-	N = normalize(vin.tangentBasis * N);
-	
+	// Without normal map use interpolated vertex normal (tangent space Z axis).
+	vec3 N = vin.tangentBasis[2];
+	if (0 != (materialFlags & NormalMap))
+	{
+		vec2 Nxy = 2.0 * sampleMaterial(normalTexture, vin.texcoord, material.layers.y, material.minLod.y).rg - 1.0;
+		N = vin.tangentBasis * vec3(Nxy, sqrt(max(0.0, 1.0 - dot(Nxy, Nxy))));
+	}
+	N = normalize(N);
+#endif
+
+#ifdef IMPOSTOR_BAKE
+	// Vertices are in object space, alpha is coverage that weights mip levels
+	color = vec4(albedo, 1.0);
+	bakedNormal = vec4(N, 1.0);
+	bakedOrm = vec4(occlusion, roughness, metalness, 1.0);
+	bakedDepth = vec4(gl_FragCoord.z, 0.0, 0.0, 1.0);
+#else
+
+	// Outgoing light direction (vector from world-space fragment position to the "eye").
+	vec3 Lo = normalize(eyePosition - position);
+
 	// Angle between surface normal and outgoing light direction.
 	float cosLo = max(0.0, dot(N, Lo));
 		
@@ -153,7 +470,23 @@ void main()
 	vec3 ambientLighting;
 	{
 		// Sample diffuse irradiance at normal direction.
-		vec3 irradiance = texture(irradianceTexture, N).rgb;
+		// Reflection probes around the surface take priority over environment, impostors are distant and use environment.
+		ivec2 probeLayers = ivec2(-1);
+		float probeWeight = 1.0;
+#ifndef IMPOSTOR
+		selectProbes(position, probeLayers, probeWeight);
+#endif
+		vec3 irradiance;
+		if (probeLayers.x >= 0)
+		{
+			irradiance = sampleProbes(probeIrradianceTexture, N, probeLayers, probeWeight, 0.0);
+		}
+		else
+		{
+			irradiance = (0 != octahedralEnvironment)
+				? sampleOctahedral(octIrradianceTexture, N, environmentProbe, 0.0).rgb
+				: texture(irradianceTexture, N).rgb;
+		}
 
 		// Calculate Fresnel term for ambient lighting.
 		// Since we use pre-filtered cubemap(s) and irradiance is coming from many directions
@@ -168,8 +501,22 @@ void main()
 		vec3 diffuseIBL = kd * albedo * irradiance;
 
 		// Sample pre-filtered specular reflection environment at correct mipmap level.
-		int specularTextureLevels = textureQueryLevels(specularTexture);
-		vec3 specularIrradiance = textureLod(specularTexture, Lr, roughness * specularTextureLevels).rgb;
+		vec3 specularIrradiance;
+		if (probeLayers.x >= 0)
+		{
+			int specularTextureLevels = textureQueryLevels(probeSpecularTexture);
+			specularIrradiance = sampleProbes(probeSpecularTexture, Lr, probeLayers, probeWeight, roughness * specularTextureLevels);
+		}
+		else if (0 != octahedralEnvironment)
+		{
+			int specularTextureLevels = textureQueryLevels(octSpecularTexture);
+			specularIrradiance = sampleOctahedral(octSpecularTexture, Lr, environmentProbe, roughness * specularTextureLevels).rgb;
+		}
+		else
+		{
+			int specularTextureLevels = textureQueryLevels(specularTexture);
+			specularIrradiance = textureLod(specularTexture, Lr, roughness * specularTextureLevels).rgb;
+		}
 
 		// Split-sum approximation factors for Cook-Torrance specular BRDF.
 		vec2 specularBRDF = texture(specularBRDF_LUT, vec2(cosLo, roughness)).rg;
@@ -178,17 +525,30 @@ void main()
 		vec3 specularIBL = (F0 * specularBRDF.x + specularBRDF.y) * specularIrradiance;
 
 		// Total ambient lighting contribution.
-		ambientLighting = diffuseIBL + specularIBL;
+		ambientLighting = (diffuseIBL + specularIBL) * occlusion;
 	}
 
 	// Final fragment color.
-	if (0 != opaquePass)
+	if (0 != singlePass)
+	{
+		// Color target is blended by source alpha, so transparent fragments keep it, OIT targets are summed up
+		bool opaque = albedoColor.a >= 1.0;
+		color = opaque ? vec4(directLighting + ambientLighting, 1.0) : vec4(0.0);
+		accumulation = opaque ? vec4(0.0) : vec4(directLighting + ambientLighting, albedoColor.a);
+		counter = opaque ? 0.0 : 1.0;
+	}
+	else if (0 != opaquePass)
+	{
+		color = vec4(directLighting + ambientLighting, coverage);
+	}
+	else if (0 != sortedPass)
 	{
-		color = vec4(directLighting + ambientLighting, 1.0);
+		color = vec4(directLighting + ambientLighting, albedoColor.a);
 	}
 	else
 	{
 		accumulation = vec4(directLighting + ambientLighting, albedoColor.a);
 		counter = 1.;
 	}
+#endif
 }
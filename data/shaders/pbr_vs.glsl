@@ -9,13 +9,29 @@ layout(location=1) in vec3 normal;
 layout(location=2) in vec3 tangent;
 layout(location=3) in vec3 bitangent;
 layout(location=4) in vec2 texcoord;
+layout(location=5) in uint drawId;	// equals base instance of the draw
 
 layout(std140, binding=0) uniform TransformUniforms
 {
 // 	mat4 skyViewProjectionMatrix;
 	mat4 viewProjectionMatrix;
+	mat4 impostorModelMatrix;	// used by impostor_vs.glsl
+};
+
+// Per draw data, written once per frame for all passes, see DrawData in opengl.hpp.
+struct DrawData
+{
 	mat4 modelMatrix;
+	mat4 normalMatrix;		// inverse transpose of model matrix
+	uvec4 materialIndex;	// x
 };
+layout(std430, binding=1) readonly buffer DrawDataBuffer
+{
+	DrawData draws[];
+};
+
+// Depth prepass and shading pass must produce the same depth
+invariant gl_Position;
 
 layout(location=0) out Vertex
 {
@@ -23,14 +39,17 @@ layout(location=0) out Vertex
 	vec2 texcoord;
 	mat3 tangentBasis;
 } vout;
+layout(location=5) flat out uint materialIndex;
 
 void main()
 {
+	mat4 modelMatrix = draws[drawId].modelMatrix;
 	vout.position = vec3(modelMatrix * vec4(position, 1.0));
 	vout.texcoord = vec2(texcoord.x, 1.0 - texcoord.y);
+	materialIndex = draws[drawId].materialIndex.x;
 
 	// Pass tangent space basis vectors (for normal mapping).
-	vout.tangentBasis = mat3(modelMatrix) * mat3(tangent, bitangent, normal);
+	vout.tangentBasis = mat3(draws[drawId].normalMatrix) * mat3(tangent, bitangent, normal);
 
 	gl_Position = viewProjectionMatrix * modelMatrix * vec4(position, 1.0);
 }
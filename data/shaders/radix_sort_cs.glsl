@@ -0,0 +1,159 @@
+#version 450 core
+// One 8 bit pass of stable LSD radix sort of key/value pairs, run as three dispatches:
+// 0 - histogram of digits of every block, 1 - exclusive prefix sum of histograms (single work group),
+// 2 - scatter of every block to its digit offsets. Histograms are digit-major, so offsets keep blocks in order.
+
+const uint Radix = 256;
+const uint GroupSize = 256;
+const uint BlockSize = 1024;	// elements per work group, must match TriangleSorter::kBlockSize
+const uint MaskWords = GroupSize / 32u;
+
+layout(local_size_x=GroupSize, local_size_y=1, local_size_z=1) in;
+
+layout(std430, binding=0) readonly buffer KeysIn
+{
+	uint keysIn[];
+};
+layout(std430, binding=1) readonly buffer ValuesIn
+{
+	uint valuesIn[];
+};
+layout(std430, binding=2) writeonly buffer KeysOut
+{
+	uint keysOut[];
+};
+layout(std430, binding=3) writeonly buffer ValuesOut
+{
+	uint valuesOut[];
+};
+layout(std430, binding=4) buffer Histograms
+{
+	uint histograms[];	// [digit * numBlocks + block]
+};
+
+layout(location=0) uniform int numElements;
+layout(location=1) uniform int shift;
+layout(location=2) uniform int stage;
+
+shared uint counts[Radix];
+shared uint digitMasks[Radix * MaskWords];	// bits of chunk elements with every digit, [digit * MaskWords + word]
+
+uint numBlocks()
+{
+	return (uint(numElements) + BlockSize - 1u) / BlockSize;
+}
+
+void histogram()
+{
+	uint t = gl_LocalInvocationIndex;
+	counts[t] = 0u;
+	barrier();
+	uint begin = gl_WorkGroupID.x * BlockSize;
+	uint end = min(begin + BlockSize, uint(numElements));
+	for (uint i = begin + t; i < end; i += GroupSize)
+	{
+		atomicAdd(counts[(keysIn[i] >> shift) & (Radix - 1u)], 1u);
+	}
+	barrier();
+	histograms[t * numBlocks() + gl_WorkGroupID.x] = counts[t];
+}
+
+void scan()
+{
+	uint t = gl_LocalInvocationIndex;
+	uint total = Radix * numBlocks();
+	uint perThread = (total + GroupSize - 1u) / GroupSize;
+	uint begin = min(t * perThread, total);
+	uint end = min(begin + perThread, total);
+
+	uint sum = 0u;
+	for (uint i = begin; i < end; i++)
+	{
+		sum += histograms[i];
+	}
+	counts[t] = sum;
+	barrier();
+	if (0 == t)
+	{
+		uint running = 0u;
+		for (uint i = 0u; i < GroupSize; i++)
+		{
+			uint count = counts[i];
+			counts[i] = running;
+			running += count;
+		}
+	}
+	barrier();
+	uint running = counts[t];
+	for (uint i = begin; i < end; i++)
+	{
+		uint count = histograms[i];
+		histograms[i] = running;
+		running += count;
+	}
+}
+
+void scatter()
+{
+	uint t = gl_LocalInvocationIndex;
+	counts[t] = histograms[t * numBlocks() + gl_WorkGroupID.x];	// output offset of every digit
+	barrier();
+
+	uint begin = gl_WorkGroupID.x * BlockSize;
+	uint end = min(begin + BlockSize, uint(numElements));
+	for (uint chunk = begin; chunk < end; chunk += GroupSize)
+	{
+		for (uint w = 0u; w < MaskWords; w++)
+		{
+			digitMasks[t * MaskWords + w] = 0u;
+		}
+		barrier();
+		uint i = chunk + t;
+		bool valid = i < end;
+		uint key = valid ? keysIn[i] : 0u;
+		uint digit = (key >> shift) & (Radix - 1u);
+		uint word = t / 32u;
+		if (valid)
+		{
+			atomicOr(digitMasks[digit * MaskWords + word], 1u << (t % 32u));
+		}
+		barrier();
+
+		if (valid)
+		{
+			// Rank is the number of preceding elements of chunk with the same digit, it keeps the sort stable
+			uint rank = uint(bitCount(digitMasks[digit * MaskWords + word] & ((1u << (t % 32u)) - 1u)));
+			for (uint w = 0u; w < word; w++)
+			{
+				rank += uint(bitCount(digitMasks[digit * MaskWords + w]));
+			}
+			uint pos = counts[digit] + rank;
+			keysOut[pos] = key;
+			valuesOut[pos] = valuesIn[i];
+		}
+		uint chunkCount = 0u;
+		for (uint w = 0u; w < MaskWords; w++)
+		{
+			chunkCount += uint(bitCount(digitMasks[t * MaskWords + w]));
+		}
+		barrier();
+		counts[t] += chunkCount;
+		barrier();
+	}
+}
+
+void main()
+{
+	if (0 == stage)
+	{
+		histogram();
+	}
+	else if (1 == stage)
+	{
+		scan();
+	}
+	else
+	{
+		scatter();
+	}
+}
@@ -7,10 +7,46 @@
 layout(location=0) in vec3 localPosition;
 layout(location=0) out vec4 color;
 
+layout(std140, binding=0) uniform SkyboxUniforms
+{
+	mat4 skyViewProjectionMatrix;
+	int octahedralEnvironment;	// sample environment probe from octahedral array instead of cube map
+	int environmentProbe;		// layer of octahedral array
+};
+
 layout(binding=0) uniform samplerCube envTexture;
+layout(binding=1) uniform sampler2DArray octEnvTexture;
+
+// Octahedral encoding of direction, Z is the axis of octahedron (see cube2oct_cs.glsl).
+vec2 octahedralEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 f = (n.z >= 0.0) ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return 0.5 * f + 0.5;
+}
+
+// Texture coordinates of direction in octahedral map level of given size, levels have one texel border.
+vec2 octahedralUV(vec3 dir, float size)
+{
+	vec2 uv = octahedralEncode(dir);
+	return (size > 2.0) ? (uv * (size - 2.0) + 1.0) / size : uv;
+}
+
+// Samples probe layer of octahedral map, levels are blended manually since their borders differ.
+vec4 sampleOctahedral(sampler2DArray tex, vec3 dir, int layer, float lod)
+{
+	float maxLevel = float(textureQueryLevels(tex) - 1);
+	float l0 = min(floor(lod), maxLevel);
+	float l1 = min(l0 + 1.0, maxLevel);
+	vec4 c0 = textureLod(tex, vec3(octahedralUV(dir, float(textureSize(tex, int(l0)).x)), layer), l0);
+	vec4 c1 = textureLod(tex, vec3(octahedralUV(dir, float(textureSize(tex, int(l1)).x)), layer), l1);
+	return mix(c0, c1, clamp(lod - l0, 0.0, 1.0));
+}
 
 void main()
 {
 	vec3 envVector = normalize(localPosition);
-	color = textureLod(envTexture, envVector, 0);
+	color = (0 != octahedralEnvironment)
+		? sampleOctahedral(octEnvTexture, envVector, environmentProbe, 0.0)
+		: textureLod(envTexture, envVector, 0);
 }
@@ -6,6 +6,8 @@
 layout(std140, binding=0) uniform SkyboxUniforms
 {
 	mat4 skyViewProjectionMatrix;
+	int octahedralEnvironment;
+	int environmentProbe;
 };
 
 layout(location=0) in vec3 position;
@@ -0,0 +1,75 @@
+#version 450 core
+// Sorted transparency: generates sort keys (view depth of triangle centroids) of a draw and, after
+// radix_sort_cs.glsl, writes its indices in sorted order after those of draws sorted before it.
+// CPU counterpart is sortTrianglesBackToFront().
+
+const int VertexStride = 14;	// floats per vertex, see Mesh::Vertex
+
+layout(local_size_x=256, local_size_y=1, local_size_z=1) in;
+
+layout(std430, binding=0) readonly buffer Vertices
+{
+	float vertices[];
+};
+layout(std430, binding=1) readonly buffer Indices
+{
+	uint indices[];		// index buffer of geometry pool
+};
+layout(std430, binding=2) buffer Keys
+{
+	uint keys[];
+};
+layout(std430, binding=3) buffer Values
+{
+	uint values[];		// triangle index within draw
+};
+layout(std430, binding=4) writeonly buffer SortedIndices
+{
+	uint sortedIndices[];
+};
+
+layout(location=0) uniform mat4 modelView;
+layout(location=1) uniform int numTriangles;
+layout(location=2) uniform int firstIndex;
+layout(location=3) uniform int baseVertex;
+layout(location=4) uniform int stage;		// 0 - generate keys, 1 - write sorted indices
+layout(location=5) uniform int firstTriangle;	// where sorted triangles of draw start in sorted indices
+
+// Maps float to uint with the same order.
+uint sortableFloat(float value)
+{
+	uint bits = floatBitsToUint(value);
+	return (0u != (bits & 0x80000000u)) ? ~bits : (bits | 0x80000000u);
+}
+
+vec3 vertexPosition(uint index)
+{
+	int offset = (baseVertex + int(index)) * VertexStride;
+	return vec3(vertices[offset], vertices[offset + 1], vertices[offset + 2]);
+}
+
+void main()
+{
+	int triangle = int(gl_GlobalInvocationID.x);
+	if (triangle >= numTriangles)
+	{
+		return;
+	}
+	if (0 == stage)
+	{
+		int first = firstIndex + 3 * triangle;
+		vec3 centroid = (vertexPosition(indices[first]) + vertexPosition(indices[first + 1])
+						 + vertexPosition(indices[first + 2])) / 3.0;
+		// Farthest triangles have the most negative view Z and come first
+		keys[triangle] = sortableFloat((modelView * vec4(centroid, 1.0)).z);
+		values[triangle] = uint(triangle);
+	}
+	else
+	{
+		int source = firstIndex + 3 * int(values[triangle]);
+		for (int i = 0; i < 3; i++)
+		{
+			sortedIndices[3 * (firstTriangle + triangle) + i] = indices[source + i];
+		}
+	}
+}
@@ -2,7 +2,7 @@
 // Physically Based Rendering
 // * Forked from Michał Siejak PBR project
 
-// Tone-mapping & gamma correction.
+// Tone-mapping & gamma correction, with OIT defined transparent layers are composited over opaque color first.
 
 const float gamma     = 2.2;
 const float exposure  = 1.0;
@@ -10,15 +10,19 @@ const float pureWhite = 1.0;
 
 layout(location=0) in  vec2 screenPosition;
 layout(binding=0) uniform sampler2D opaqueTex;
+#ifdef OIT
 layout(binding=1) uniform sampler2D accTex;
 layout(binding=2) uniform sampler2D counter;
+#endif
 
 layout(location=0) out vec4 outColor;
 
 void main()
 {
-    // Order Independent Transparency (OIT), see https://developer.download.nvidia.com/SDK/10/opengl/src/dual_depth_peeling/doc/DualDepthPeeling.pdf
 	vec4 Cbg = texture(opaqueTex, screenPosition);
+#ifdef OIT
+    // Order Independent Transparency (OIT), see https://developer.download.nvidia.com/SDK/10/opengl/src/dual_depth_peeling/doc/DualDepthPeeling.pdf
+	// Only tiles with transparent pixels are drawn with OIT defined
 	float cnt = texture(counter, screenPosition).r;
     if (cnt > 0)
     {
@@ -28,6 +32,7 @@ void main()
         float oneMinusA_N = pow(1. - A, cnt);
         Cbg = vec4(C * (1. - oneMinusA_N) + Cbg.rgb * oneMinusA_N, 1.);
     }
+#endif
 	vec3 color = Cbg.rgb * exposure;
 
 	// Reinhard tonemapping operator.
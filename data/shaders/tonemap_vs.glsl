@@ -2,25 +2,41 @@
 // Physically Based Rendering
 // * Forked from Michał Siejak PBR project
 
-// Generates vertices of a triangle that covers the whole screen in clip space.
+// Generates quad of screen tile for every instance, tiles come from lists built by oit_tiles_cs.glsl. With OIT
+// defined draws tiles with transparent pixels, otherwise opaque tiles.
+
+const int TileSize = 16;
 
 layout(location=0) out vec2 screenPosition;
 
+layout(binding=0) uniform sampler2D opaqueTex;
+
+struct DrawArraysIndirectCommand
+{
+	uint count;
+	uint instanceCount;
+	uint first;
+	uint baseInstance;
+};
+
+layout(std430, binding=0) restrict readonly buffer TileLists
+{
+	DrawArraysIndirectCommand commands[2];
+	uint tiles[];
+};
+
 void main()
 {
-	if (gl_VertexID == 0)
-	{
-		screenPosition = vec2(1.0, 2.0);
-		gl_Position = vec4(1.0, 3.0, 0.0, 1.0);
-	}
-	else if (gl_VertexID == 1)
-	{
-		screenPosition = vec2(-1.0, 0.0);
-		gl_Position = vec4(-3.0, -1.0, 0.0, 1.0);
-	}
-	else /* if (gl_VertexID == 2) */
-	{
-		screenPosition = vec2(1.0, 0.0);
-		gl_Position = vec4(1.0, -1.0, 0.0, 1.0);
-	}
+	ivec2 size = textureSize(opaqueTex, 0);
+#ifdef OIT
+	uint tile = tiles[gl_InstanceID];
+#else
+	ivec2 numTiles = (size + TileSize - 1) / TileSize;
+	uint tile = tiles[uint(numTiles.x * numTiles.y) - 1u - uint(gl_InstanceID)];
+#endif
+	// Triangle strip of tile corners, tiles at the right and top edge are clipped by viewport
+	ivec2 corner = ivec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 pixel = vec2(TileSize * (ivec2(tile & 0xFFFFu, tile >> 16) + corner));
+	screenPosition = pixel / vec2(size);
+	gl_Position = vec4(2.0 * screenPosition - 1.0, 0.0, 1.0);
 }
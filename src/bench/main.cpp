@@ -0,0 +1,111 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Benchmark of software rasterizer: frame time and scaling with number of threads.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "../common/rasterizer.hpp"
+
+namespace {
+	void printUsage()
+	{
+		std::printf("Usage: ave3d-bench [-w width] [-h height] [-frames count] [-threads max]\n"
+					"Run from data directory. Frames are rendered with 1, 2, 4 ... max threads.\n");
+	}
+
+	double elapsedMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int width = 1280, height = 720, frames = 20;
+	size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (hasValue && std::strcmp(argv[i], "-w") == 0)
+			width = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-h") == 0)
+			height = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-frames") == 0)
+			frames = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-threads") == 0)
+			maxThreads = size_t(std::max(1, std::atoi(argv[++i])));
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (width <= 0 || height <= 0 || frames <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	try
+	{
+		Rasterizer rasterizer{ width, height };
+		rasterizer.setThreads(maxThreads);
+		auto start = std::chrono::steady_clock::now();
+		rasterizer.loadScene();
+		std::printf("Scene: %zu triangles, loaded and lighting baked in %.0f ms\n", rasterizer.numTriangles(), elapsedMs(start));
+
+		// Default view of application with all lights on, model turns between frames
+		ViewSettings view;
+		view.distance = 400.0f;
+		view.fov = 35.0f;
+		SceneSettings scene;
+		scene.lights[0] = { glm::normalize(glm::vec3{-1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, true };
+		scene.lights[1] = { glm::normalize(glm::vec3{ 1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, true };
+		scene.lights[2] = { glm::normalize(glm::vec3{ 0.0f, -1.0f, 0.0f}), glm::vec3{1.0f}, true };
+
+		std::vector<size_t> threadCounts;
+		for (size_t threads = 1; threads < maxThreads; threads *= 2)
+		{
+			threadCounts.push_back(threads);
+		}
+		threadCounts.push_back(maxThreads);
+
+		std::printf("%dx%d, %d frames\n", width, height, frames);
+		std::printf("threads   ms/frame   Mpixel/s   speedup   efficiency\n");
+		double singleThreadMs = 0.0;
+		for (size_t threads : threadCounts)
+		{
+			rasterizer.setThreads(threads);
+			scene.yaw = 0.0f;
+			rasterizer.render(view, scene);		// warm up
+
+			start = std::chrono::steady_clock::now();
+			for (int frame = 0; frame < frames; ++frame)
+			{
+				scene.yaw = 360.0f * float(frame) / float(frames);
+				rasterizer.render(view, scene);
+			}
+			const double frameMs = elapsedMs(start) / frames;
+			singleThreadMs = (1 == threads) ? frameMs : singleThreadMs;
+			const double speedup = singleThreadMs / frameMs;
+			std::printf("%7zu %10.2f %10.1f %9.2f %11.0f%%\n", threads, frameMs, double(width) * height / (frameMs * 1000.0),
+						speedup, 100.0 * speedup / double(threads));
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
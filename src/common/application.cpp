@@ -19,9 +19,11 @@ namespace {
 	const float ViewFOV      = 35.0f;
 	const float OrbitSpeed   = 1.0f;
 	const float ZoomSpeed    = 32.0f;
+
+	const int BenchmarkFrames = 600;	// per transparency mode, warm up included
 }
 
-Application::Application()
+Application::Application(bool benchmark)
 	: m_window(nullptr)
 	, m_prevCursorX(0.0)
 	, m_prevCursorY(0.0)
@@ -34,6 +36,7 @@ Application::Application()
 
 	m_viewSettings.distance = ViewDistance;
 	m_viewSettings.fov      = ViewFOV;
+	m_renderSettings.benchmark = benchmark;
 
 	m_sceneSettings.lights[0] = { glm::normalize(glm::vec3{-1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, false };
 	m_sceneSettings.lights[1] = { glm::normalize(glm::vec3{ 1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, false };
@@ -62,8 +65,17 @@ void Application::run(const std::unique_ptr<RendererInterface>& renderer)
 	glfwSetFramebufferSizeCallback(m_window, framebufferSizeCallback);
 
 	m_onResize = renderer->setup();
+	int frame = 0;
 	while(!glfwWindowShouldClose(m_window)) {
-		renderer->render(m_window, m_viewSettings, m_sceneSettings);
+		renderer->render(m_window, m_viewSettings, m_sceneSettings, m_renderSettings);
+
+		if(m_renderSettings.benchmark && ++frame % BenchmarkFrames == 0) {
+			const int next = int(m_renderSettings.transparency) + 1;
+			if(next < 3)
+				m_renderSettings.transparency = RenderSettings::Transparency(next);
+			else
+				glfwSetWindowShouldClose(m_window, 1);
+		}
 
 // 		m_sceneSettings.pitch += 0.01f;
 // 		m_sceneSettings.yaw += 0.1f;
@@ -162,6 +174,37 @@ void Application::keyCallback(GLFWwindow* window, int key, int /*scancode*/, int
 		case GLFW_KEY_F3:
 			light = &self->m_sceneSettings.lights[2];
 			break;
+		case GLFW_KEY_F4:
+			self->m_renderSettings.textureFeedback = !self->m_renderSettings.textureFeedback;
+			break;
+		case GLFW_KEY_F5:
+			self->m_renderSettings.octahedralEnvironment = !self->m_renderSettings.octahedralEnvironment;
+			break;
+		case GLFW_KEY_F6:
+			self->m_renderSettings.reflectionProbes = !self->m_renderSettings.reflectionProbes;
+			break;
+		case GLFW_KEY_F7:
+			self->m_renderSettings.occlusionCulling = !self->m_renderSettings.occlusionCulling;
+			break;
+		case GLFW_KEY_F8:
+			self->m_renderSettings.gpuOcclusionCulling = !self->m_renderSettings.gpuOcclusionCulling;
+			break;
+		case GLFW_KEY_F9:
+			self->m_renderSettings.impostors = !self->m_renderSettings.impostors;
+			break;
+		case GLFW_KEY_F10:
+			self->m_renderSettings.singlePass = !self->m_renderSettings.singlePass;
+			break;
+		case GLFW_KEY_F11:
+			self->m_renderSettings.transparency =
+				RenderSettings::Transparency((int(self->m_renderSettings.transparency) + 1) % 3);
+			break;
+		case GLFW_KEY_F12:
+			self->m_renderSettings.commandLists = !self->m_renderSettings.commandLists;
+			break;
+		case GLFW_KEY_O:
+			self->m_renderSettings.occluderRow = !self->m_renderSettings.occluderRow;
+			break;
 		case GLFW_KEY_ESCAPE:
 			glfwSetWindowShouldClose(window, 1);
 			break;
@@ -11,7 +11,8 @@
 class Application
 {
 public:
-	Application();
+	// Benchmark renders every transparency mode for a while and quits, renderer reports timings
+	explicit Application(bool benchmark = false);
 	~Application();
 
 	void run(const std::unique_ptr<RendererInterface>& renderer);
@@ -29,6 +30,7 @@ private:
 
 	ViewSettings m_viewSettings;
 	SceneSettings m_sceneSettings;
+	RenderSettings m_renderSettings;
 
 	enum class InputMode
 	{
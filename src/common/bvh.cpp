@@ -0,0 +1,436 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <mutex>
+#include <thread>
+
+#include "bvh.hpp"
+#include "parallel.hpp"
+
+namespace {
+	const int NumBins = 16;
+	const uint32_t MaxLeafSize = 8;
+	// Cost of node traversal relative to triangle test
+	const float TraversalCost = 1.f;
+	// Binning of fewer triangles isn't split between threads
+	const size_t MinParallelBinning = 16384;
+	// Subtrees are built on worker threads when there are at least this many per thread
+	const size_t SubtreesPerThread = 8;
+	const size_t MinSubtreeSize = 1024;
+	// Traversal stack holds at most the nodes of one level plus one, so build keeps tree depth below its size
+	const int MaxStackDepth = 64;
+	const int MaxDepth = MaxStackDepth - 1;
+
+	// Levels of median splits below node of count triangles until leaves are small enough
+	int levelsToLeaves(uint32_t count)
+	{
+		int levels = 0;
+		for (uint64_t leafCount = MaxLeafSize; leafCount < count; leafCount *= 2)
+		{
+			levels++;
+		}
+		return levels;
+	}
+
+	inline Float4 cross0(Float4 ay, Float4 az, Float4 by, Float4 bz) { return ay * bz - az * by; }
+}
+
+Bvh::RayPacket::RayPacket()
+	: origin{ Float4{ 0.f }, Float4{ 0.f }, Float4{ 0.f } }
+	, direction{ Float4{ 0.f }, Float4{ 0.f }, Float4{ 1.f } }
+	, tMax{ 3.4e38f }
+{
+}
+
+float Bvh::Bounds::area() const
+{
+	const glm::vec3 size = glm::max(max - min, glm::vec3{ 0.f });
+	return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void Bvh::build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, size_t maxThreads)
+{
+	const uint32_t numTriangles = uint32_t(indices.size() / 3);
+	m_nodes.clear();
+	m_triangles.clear();
+	m_indices.clear();
+	if (0 == numTriangles)
+	{
+		return;
+	}
+	m_bounds.resize(numTriangles);
+	m_centroids.resize(numTriangles);
+	m_indices.resize(numTriangles);
+	parallelFor(numTriangles, 1024, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			Bounds bounds;
+			for (int k = 0; k < 3; k++)
+			{
+				bounds.grow(positions[indices[3 * i + k]]);
+			}
+			m_bounds[i] = bounds;
+			m_centroids[i] = 0.5f * (bounds.min + bounds.max);
+			m_indices[i] = uint32_t(i);
+		}
+	}, maxThreads);
+
+	// Top levels, nodes small enough are left for workers
+	struct Task
+	{
+		uint32_t node, begin, end;
+		int depth;
+	};
+	const size_t threads = (0 != maxThreads) ? maxThreads : std::max<size_t>(1, std::thread::hardware_concurrency());
+	const size_t subtreeSize = std::max(MinSubtreeSize, numTriangles / (threads * SubtreesPerThread));
+	std::vector<Task> stack{ Task{ 0, 0, numTriangles, 0 } };
+	std::vector<Task> subtrees;
+	m_nodes.assign(1, Node{});
+	while (!stack.empty())
+	{
+		const Task task = stack.back();
+		stack.pop_back();
+		if (task.end - task.begin <= subtreeSize)
+		{
+			subtrees.push_back(task);
+			continue;
+		}
+		Bounds centroids;
+		const Bounds bounds = nodeBounds(task.begin, task.end, centroids);
+		const Split split = findSplit(task.begin, task.end, centroids, maxThreads);
+		int axis = 0;
+		const uint32_t middle = splitNode(task.begin, task.end, centroids, split, task.depth, axis);
+
+		Node& node = m_nodes[task.node];
+		node.min = bounds.min;
+		node.max = bounds.max;
+		node.offset = uint32_t(m_nodes.size());
+		node.count = 0;
+		node.axis = uint16_t(axis);
+		stack.push_back(Task{ node.offset, task.begin, middle, task.depth + 1 });
+		stack.push_back(Task{ node.offset + 1, middle, task.end, task.depth + 1 });
+		m_nodes.resize(m_nodes.size() + 2);
+	}
+
+	std::vector<std::vector<Node>> subtreeNodes(subtrees.size());
+	parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			subtreeNodes[i].assign(1, Node{});
+			buildSubtree(subtreeNodes[i], 0, subtrees[i].begin, subtrees[i].end, subtrees[i].depth);
+		}
+	}, maxThreads);
+
+	// Subtree root takes place of its top level node, the rest is appended
+	for (size_t i = 0; i < subtrees.size(); i++)
+	{
+		const std::vector<Node>& nodes = subtreeNodes[i];
+		const uint32_t base = uint32_t(m_nodes.size()) - 1;
+		for (size_t j = 0; j < nodes.size(); j++)
+		{
+			Node node = nodes[j];
+			node.offset += (0 == node.count) ? base : 0;
+			if (0 == j)
+			{
+				m_nodes[subtrees[i].node] = node;
+			}
+			else
+			{
+				m_nodes.push_back(node);
+			}
+		}
+	}
+
+	m_triangles.resize(numTriangles);
+	parallelFor(numTriangles, 1024, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const uint32_t* v = &indices[3 * size_t(m_indices[i])];
+			m_triangles[i].v0 = positions[v[0]];
+			m_triangles[i].edge1 = positions[v[1]] - positions[v[0]];
+			m_triangles[i].edge2 = positions[v[2]] - positions[v[0]];
+		}
+	}, maxThreads);
+
+	m_bounds = std::vector<Bounds>{};
+	m_centroids = std::vector<glm::vec3>{};
+}
+
+Bvh::Bounds Bvh::nodeBounds(uint32_t begin, uint32_t end, Bounds& centroids) const
+{
+	Bounds bounds;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		bounds.grow(m_bounds[m_indices[i]]);
+		centroids.grow(m_centroids[m_indices[i]]);
+	}
+	return bounds;
+}
+
+Bvh::Split Bvh::findSplit(uint32_t begin, uint32_t end, const Bounds& centroids, size_t maxThreads) const
+{
+	struct Bin
+	{
+		Bounds bounds;
+		uint32_t count = 0;
+	};
+	Bin bins[3][NumBins];
+	const glm::vec3 extent = centroids.max - centroids.min;
+	const glm::vec3 scale = glm::vec3{ float(NumBins) } / glm::max(extent, glm::vec3{ 1e-30f });
+
+	// Bins of parts are filled in parallel and merged
+	std::mutex mutex;
+	parallelFor(end - begin, MinParallelBinning, [&](size_t first, size_t last)
+	{
+		Bin local[3][NumBins];
+		for (size_t i = begin + first; i < begin + last; i++)
+		{
+			const uint32_t triangle = m_indices[i];
+			const glm::vec3& c = m_centroids[triangle];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const int bin = std::min(NumBins - 1, int((c[axis] - centroids.min[axis]) * scale[axis]));
+				local[axis][bin].bounds.grow(m_bounds[triangle]);
+				local[axis][bin].count++;
+			}
+		}
+		std::lock_guard<std::mutex> lock{ mutex };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int bin = 0; bin < NumBins; bin++)
+			{
+				bins[axis][bin].bounds.grow(local[axis][bin].bounds);
+				bins[axis][bin].count += local[axis][bin].count;
+			}
+		}
+	}, maxThreads);
+
+	// Cost relative to parent area: traversal + area weighted triangle counts of children
+	Bounds parent;
+	for (int bin = 0; bin < NumBins; bin++)
+	{
+		parent.grow(bins[0][bin].bounds);
+	}
+	const float invParentArea = 1.f / std::max(parent.area(), 1e-30f);
+	const uint32_t count = end - begin;
+	Split best{ -1, 0, 0.f, 0.f };
+	float bestCost = (count <= MaxLeafSize) ? float(count) : 3.4e38f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (!(extent[axis] > 0.f))
+		{
+			continue;
+		}
+		float rightCost[NumBins];
+		Bounds right;
+		uint32_t rightCount = 0;
+		for (int bin = NumBins - 1; bin > 0; bin--)
+		{
+			right.grow(bins[axis][bin].bounds);
+			rightCount += bins[axis][bin].count;
+			rightCost[bin] = right.area() * float(rightCount);
+		}
+		Bounds left;
+		uint32_t leftCount = 0;
+		for (int bin = 0; bin < NumBins - 1; bin++)
+		{
+			left.grow(bins[axis][bin].bounds);
+			leftCount += bins[axis][bin].count;
+			if (0 == leftCount || count == leftCount)
+			{
+				continue;
+			}
+			const float cost = TraversalCost + (left.area() * float(leftCount) + rightCost[bin + 1]) * invParentArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				best = Split{ axis, bin, centroids.min[axis], scale[axis] };
+			}
+		}
+	}
+	return best;
+}
+
+uint32_t Bvh::partition(uint32_t begin, uint32_t end, const Split& split)
+{
+	// Same binning as findSplit(), so triangles go where they were counted
+	const auto middle = std::partition(m_indices.begin() + begin, m_indices.begin() + end, [&](uint32_t triangle)
+	{
+		return std::min(NumBins - 1, int((m_centroids[triangle][split.axis] - split.min) * split.scale)) <= split.bin;
+	});
+	return uint32_t(middle - m_indices.begin());
+}
+
+uint32_t Bvh::splitNode(uint32_t begin, uint32_t end, const Bounds& centroids, const Split& split, int depth, int& axis)
+{
+	uint32_t middle = (split.axis >= 0) ? partition(begin, end, split) : begin;
+	axis = std::max(0, split.axis);
+	const int levelsLeft = MaxDepth - depth - 1;	// below children
+	if (middle == begin || middle == end || levelsToLeaves(middle - begin) > levelsLeft || levelsToLeaves(end - middle) > levelsLeft)
+	{
+		// Halves along the longest axis of centroids need one level less each
+		const glm::vec3 extent = centroids.max - centroids.min;
+		axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z) ? 1 : 2;
+		middle = begin + (end - begin) / 2;
+		std::nth_element(m_indices.begin() + begin, m_indices.begin() + middle, m_indices.begin() + end,
+			[&](uint32_t a, uint32_t b) { return m_centroids[a][axis] < m_centroids[b][axis]; });
+	}
+	return middle;
+}
+
+void Bvh::buildSubtree(std::vector<Node>& nodes, uint32_t index, uint32_t begin, uint32_t end, int depth)
+{
+	Bounds centroids;
+	const Bounds bounds = nodeBounds(begin, end, centroids);
+	nodes[index].min = bounds.min;
+	nodes[index].max = bounds.max;
+	nodes[index].axis = 0;
+
+	const uint32_t count = end - begin;
+	assert(levelsToLeaves(count) <= MaxDepth - depth);
+	const Split split = (count > 2 && depth < MaxDepth) ? findSplit(begin, end, centroids, 1) : Split{ -1, 0, 0.f, 0.f };
+	if (split.axis < 0 && count <= MaxLeafSize)
+	{
+		nodes[index].offset = begin;
+		nodes[index].count = uint16_t(count);
+		return;
+	}
+	int axis = 0;
+	const uint32_t middle = splitNode(begin, end, centroids, split, depth, axis);
+
+	const uint32_t children = uint32_t(nodes.size());
+	nodes[index].offset = children;
+	nodes[index].count = 0;
+	nodes[index].axis = uint16_t(axis);
+	nodes.resize(nodes.size() + 2);
+	buildSubtree(nodes, children, begin, middle, depth + 1);
+	buildSubtree(nodes, children + 1, middle, end, depth + 1);
+}
+
+void Bvh::intersect(const RayPacket& rays, int activeMask, Hit (&hits)[PacketSize]) const
+{
+	for (Hit& hit : hits)
+	{
+		hit.triangle = ~0u;
+	}
+	if (m_nodes.empty() || 0 == activeMask)
+	{
+		return;
+	}
+
+	// Direction components near zero are replaced so slabs don't give NaN
+	Float4 invDirection[3] = { Float4{ 0.f }, Float4{ 0.f }, Float4{ 0.f } };
+	bool negative[3];
+	int firstActive = 0;
+	while (0 == (activeMask & (1 << firstActive)))
+	{
+		firstActive++;
+	}
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float d[PacketSize];
+		rays.direction[axis].store(d);
+		for (float& value : d)
+		{
+			value = 1.f / ((std::abs(value) > 1e-20f) ? value : std::copysign(1e-20f, value));
+		}
+		invDirection[axis] = Float4::load(d);
+		negative[axis] = d[firstActive] < 0.f;
+	}
+	// Inactive rays can't hit anything
+	float tMaxLanes[PacketSize];
+	rays.tMax.store(tMaxLanes);
+	for (int lane = 0; lane < PacketSize; lane++)
+	{
+		tMaxLanes[lane] = (0 != (activeMask & (1 << lane))) ? tMaxLanes[lane] : -1.f;
+	}
+	Float4 tMax = Float4::load(tMaxLanes);
+	const Float4 zero{ 0.f }, one{ 1.f };
+
+	uint32_t stack[MaxStackDepth];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = m_nodes[stack[--stackSize]];
+		const Float4 tx0 = (Float4{ node.min.x } - rays.origin[0]) * invDirection[0];
+		const Float4 tx1 = (Float4{ node.max.x } - rays.origin[0]) * invDirection[0];
+		const Float4 ty0 = (Float4{ node.min.y } - rays.origin[1]) * invDirection[1];
+		const Float4 ty1 = (Float4{ node.max.y } - rays.origin[1]) * invDirection[1];
+		const Float4 tz0 = (Float4{ node.min.z } - rays.origin[2]) * invDirection[2];
+		const Float4 tz1 = (Float4{ node.max.z } - rays.origin[2]) * invDirection[2];
+		const Float4 tEnter = max(max(min(tx0, tx1), min(ty0, ty1)), max(min(tz0, tz1), zero));
+		const Float4 tExit = min(min(max(tx0, tx1), max(ty0, ty1)), min(max(tz0, tz1), tMax));
+		if (0 == bits(greaterEqualMask(tExit, tEnter)))
+		{
+			continue;
+		}
+
+		if (0 != node.count)
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+			{
+				// Moller-Trumbore for all rays of packet
+				const Triangle& tri = m_triangles[i];
+				const Float4 e1x{ tri.edge1.x }, e1y{ tri.edge1.y }, e1z{ tri.edge1.z };
+				const Float4 e2x{ tri.edge2.x }, e2y{ tri.edge2.y }, e2z{ tri.edge2.z };
+				const Float4 px = cross0(rays.direction[1], rays.direction[2], e2y, e2z);
+				const Float4 py = cross0(rays.direction[2], rays.direction[0], e2z, e2x);
+				const Float4 pz = cross0(rays.direction[0], rays.direction[1], e2x, e2y);
+				const Float4 invDet = one / (e1x * px + e1y * py + e1z * pz);
+				const Float4 sx = rays.origin[0] - Float4{ tri.v0.x };
+				const Float4 sy = rays.origin[1] - Float4{ tri.v0.y };
+				const Float4 sz = rays.origin[2] - Float4{ tri.v0.z };
+				const Float4 u = (sx * px + sy * py + sz * pz) * invDet;
+				const Float4 qx = cross0(sy, sz, e1y, e1z);
+				const Float4 qy = cross0(sz, sx, e1z, e1x);
+				const Float4 qz = cross0(sx, sy, e1x, e1y);
+				const Float4 v = (rays.direction[0] * qx + rays.direction[1] * qy + rays.direction[2] * qz) * invDet;
+				const Float4 t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+				const Float4 inside = both(both(greaterEqualMask(u, zero), greaterEqualMask(v, zero)), greaterEqualMask(one, u + v));
+				const Float4 hitMask = both(inside, both(greaterMask(t, zero), lessMask(t, tMax)));
+				const int mask = bits(hitMask);
+				if (0 != mask)
+				{
+					float us[PacketSize], vs[PacketSize];
+					u.store(us);
+					v.store(vs);
+					for (int lane = 0; lane < PacketSize; lane++)
+					{
+						if (0 != (mask & (1 << lane)))
+						{
+							hits[lane].triangle = m_indices[i];
+							hits[lane].u = us[lane];
+							hits[lane].v = vs[lane];
+						}
+					}
+					tMax = select(hitMask, t, tMax);
+				}
+			}
+		}
+		else
+		{
+			// Build keeps depth below MaxStackDepth, so children always fit
+			assert(stackSize + 2 <= MaxStackDepth);
+			// Nearer child of first active ray is visited first
+			const bool swap = negative[node.axis];
+			stack[stackSize++] = node.offset + (swap ? 0 : 1);
+			stack[stackSize++] = node.offset + (swap ? 1 : 0);
+		}
+	}
+
+	float t[PacketSize];
+	tMax.store(t);
+	for (int lane = 0; lane < PacketSize; lane++)
+	{
+		hits[lane].t = t[lane];
+	}
+}
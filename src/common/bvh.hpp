@@ -0,0 +1,101 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+
+// Bounding volume hierarchy of triangles for ray tracing on CPU. Built with binned surface area heuristic: top levels
+// are split on calling thread with binning done in parallel, subtrees below them are built on worker threads. Rays are
+// traced in packets of four, every node and triangle is tested against all rays of packet at once.
+class Bvh
+{
+public:
+	static const int PacketSize = 4;
+
+	// Rays of packet, lanes are rays
+	struct RayPacket
+	{
+		Float4 origin[3];
+		Float4 direction[3];
+		Float4 tMax;
+
+		RayPacket();
+	};
+
+	struct Hit
+	{
+		float t;
+		uint32_t triangle;		// index of triangle given to build(), ~0u if nothing was hit
+		float u, v;				// barycentric coordinates of second and third vertex
+	};
+
+	// Three indices of positions per triangle. maxThreads 0 means one per hardware thread.
+	void build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, size_t maxThreads = 0);
+
+	// Closest hits of rays whose bit is set in activeMask, up to tMax of ray.
+	void intersect(const RayPacket& rays, int activeMask, Hit (&hits)[PacketSize]) const;
+
+	size_t numNodes() const { return m_nodes.size(); }
+
+private:
+	// Children of inner node are next to each other, first at offset, leaf has triangles [offset, offset + count)
+	struct Node
+	{
+		glm::vec3 min;
+		uint32_t offset;
+		glm::vec3 max;
+		uint16_t count;			// 0 - inner node
+		uint16_t axis;			// split axis of inner node, first child is on the lower side
+	};
+	static_assert(sizeof(Node) == 32, "Node structure size is incorrect.");
+
+	struct Bounds
+	{
+		glm::vec3 min{ 3.4e38f };
+		glm::vec3 max{ -3.4e38f };
+
+		void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void grow(const Bounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+		float area() const;
+	};
+
+	// Triangle prepared for intersection test
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	// Triangles whose centroid falls into bins up to bin go to the first child
+	struct Split
+	{
+		int axis;				// -1 - leaf is cheaper or centroids don't differ
+		int bin;
+		float min;				// bin of centroid c is (c[axis] - min) * scale
+		float scale;
+	};
+
+	Split findSplit(uint32_t begin, uint32_t end, const Bounds& centroids, size_t maxThreads) const;
+	uint32_t partition(uint32_t begin, uint32_t end, const Split& split);
+	// Splits triangles of node at depth into children and returns where the second child starts. Split is used
+	// unless a child would need more levels than are left to reach leaves, then triangles are split at the median.
+	uint32_t splitNode(uint32_t begin, uint32_t end, const Bounds& centroids, const Split& split, int depth, int& axis);
+	Bounds nodeBounds(uint32_t begin, uint32_t end, Bounds& centroids) const;
+	// Builds subtree of node at depth with triangles [begin, end) into nodes, node is nodes[index]
+	void buildSubtree(std::vector<Node>& nodes, uint32_t index, uint32_t begin, uint32_t end, int depth);
+
+	std::vector<Node> m_nodes;
+	std::vector<Triangle> m_triangles;	// in order of leaves
+	std::vector<uint32_t> m_indices;	// triangle given to build() of m_triangles
+	// Build input
+	std::vector<Bounds> m_bounds;
+	std::vector<glm::vec3> m_centroids;
+};
@@ -0,0 +1,68 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "command_list.hpp"
+#include "parallel.hpp"
+
+void CommandList::clear()
+{
+	m_words.clear();
+	m_resourceSet = UINT32_MAX;
+	m_numDraws = 0;
+}
+
+void CommandList::bindResourceSet(uint32_t id)
+{
+	if (id != m_resourceSet)
+	{
+		m_words.push_back(BindResourceSet);
+		m_words.push_back(id);
+		m_resourceSet = id;
+	}
+}
+
+void CommandList::drawIndexed(const DrawIndexedArgs& args)
+{
+	static_assert(sizeof(DrawIndexedArgs) == 4 * sizeof(uint32_t), "DrawIndexedArgs must be packed into words.");
+	m_words.push_back(DrawIndexed);
+	const size_t offset = m_words.size();
+	m_words.resize(offset + sizeof(DrawIndexedArgs) / sizeof(uint32_t));
+	std::memcpy(&m_words[offset], &args, sizeof(args));
+	m_numDraws++;
+}
+
+void CommandRecorder::record(size_t count, size_t minSlice, const RecordFunc& func)
+{
+	// One list per slice and at most one slice per hardware thread
+	const size_t threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), count / std::max<size_t>(minSlice, 1)));
+	const size_t slice = std::max<size_t>(1, (count + threads - 1) / threads);
+	m_numLists = (count + slice - 1) / slice;
+	if (m_lists.size() < m_numLists)
+	{
+		m_lists.resize(m_numLists);
+	}
+	parallelFor(m_numLists, 1, [this, count, slice, &func](size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; i++)
+		{
+			m_lists[i].clear();
+			func(m_lists[i], i * slice, std::min(count, (i + 1) * slice));
+		}
+	});
+}
+
+size_t CommandRecorder::numDraws() const
+{
+	size_t draws = 0;
+	for (size_t i = 0; i < m_numLists; i++)
+	{
+		draws += m_lists[i].numDraws();
+	}
+	return draws;
+}
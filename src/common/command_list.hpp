@@ -0,0 +1,97 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// Backend neutral list of draw commands. Commands are packed into 32 bit words, the first word of every command
+// holds opcode, payload follows. Resources are referred to by ids whose meaning is up to the backend (e.g. set of
+// texture arrays of a draw batch). Lists are recorded on worker threads and replayed on render thread.
+class CommandList
+{
+public:
+	enum Op : uint32_t
+	{
+		BindResourceSet,	// id
+		DrawIndexed,		// DrawIndexedArgs
+	};
+
+	struct DrawIndexedArgs
+	{
+		uint32_t count;
+		uint32_t firstIndex;
+		int32_t baseVertex;
+		uint32_t baseInstance;
+	};
+
+	void clear();
+	// Redundant binds of the set bound last are skipped.
+	void bindResourceSet(uint32_t id);
+	void drawIndexed(const DrawIndexedArgs& args);
+
+	size_t numDraws() const { return m_numDraws; }
+
+	// Calls backend.bindResourceSet(id) and backend.drawIndexed(args) in recorded order.
+	template<class Backend> void replay(Backend& backend) const
+	{
+		const uint32_t* word = m_words.data();
+		const uint32_t* end = word + m_words.size();
+		while (word < end)
+		{
+			switch (*word++)
+			{
+			case BindResourceSet:
+				backend.bindResourceSet(*word);
+				word += 1;
+				break;
+			case DrawIndexed:
+			{
+				DrawIndexedArgs args;
+				std::memcpy(&args, word, sizeof(args));
+				backend.drawIndexed(args);
+				word += sizeof(DrawIndexedArgs) / sizeof(uint32_t);
+				break;
+			}
+			default:
+				return;		// corrupted list
+			}
+		}
+	}
+
+private:
+	std::vector<uint32_t> m_words;
+	uint32_t m_resourceSet = UINT32_MAX;
+	size_t m_numDraws = 0;
+};
+
+// Records items [0, count) into command lists, split into slices recorded in parallel. Lists are kept between
+// frames so that their memory is reused, replaying them in order gives the same commands as serial recording.
+class CommandRecorder
+{
+public:
+	using RecordFunc = std::function<void(CommandList& list, size_t begin, size_t end)>;
+
+	void record(size_t count, size_t minSlice, const RecordFunc& func);
+
+	template<class Backend> void replay(Backend& backend) const
+	{
+		for (size_t i = 0; i < m_numLists; i++)
+		{
+			m_lists[i].replay(backend);
+		}
+	}
+
+	size_t numLists() const { return m_numLists; }
+	size_t numDraws() const;
+
+private:
+	std::vector<CommandList> m_lists;
+	size_t m_numLists = 0;
+};
@@ -0,0 +1,280 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "ibl.hpp"
+#include "image.hpp"
+#include "parallel.hpp"
+#include "surface.hpp"
+
+using namespace Shading;
+
+namespace {
+	const uint32_t NumSpecularSamples = 512;
+	const uint32_t NumIrradianceSamples = 1024;
+	const uint32_t NumBrdfSamples = 1024;
+
+	float radicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return float(bits) * 2.3283064365386963e-10f;
+	}
+
+	glm::vec2 sampleHammersley(uint32_t i, uint32_t count)
+	{
+		return glm::vec2{ float(i) / float(count), radicalInverse(i) };
+	}
+
+	// Source mip level for sample of solid angle ws, texels of level 0 have solid angle wt (GPU Gems 3, 20.4)
+	float sourceLevel(float ws, float wt)
+	{
+		return std::max(0.5f * std::log2(ws / wt) + 1.f, 0.f);
+	}
+}
+
+std::shared_ptr<IblMaps> IblMaps::bake(const std::shared_ptr<Image>& environment, size_t maxThreads)
+{
+	if (!environment || !environment->isHDR() || environment->channels() < 3)
+	{
+		throw std::runtime_error("Environment map must be HDR image");
+	}
+	std::shared_ptr<IblMaps> maps{ new IblMaps };
+	maps->m_environment = environment;
+	maps->bakeRadiance(maxThreads);
+	maps->bakeSpecular(maxThreads);
+	maps->bakeIrradiance(maxThreads);
+	maps->bakeBrdfLut(maxThreads);
+	return maps;
+}
+
+glm::vec3 IblMaps::environment(const glm::vec3& dir) const
+{
+	// Equirectangular lookup as in equirect2cube_cs.glsl, wraps horizontally
+	const int width = m_environment->width(), height = m_environment->height(), channels = m_environment->channels();
+	const float* pixels = m_environment->pixels<float>();
+	const float u = std::atan2(dir.z, dir.x) / TwoPI;
+	const float v = std::acos(glm::clamp(dir.y, -1.f, 1.f)) / PI;
+	const float x = (u - std::floor(u)) * width - 0.5f;
+	const float y = glm::clamp(v * height - 0.5f, 0.f, float(height - 1));
+	const int x0 = int(std::floor(x)), y0 = int(y);
+	const int y1 = std::min(y0 + 1, height - 1);
+	const float fx = x - float(x0), fy = y - float(y0);
+	const auto texel = [&](int tx, int ty)
+	{
+		const float* p = pixels + (size_t(ty) * width + size_t((tx + width) % width)) * channels;
+		return glm::vec3{ p[0], p[1], p[2] };
+	};
+	return glm::mix(glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx), glm::mix(texel(x0, y1), texel(x0 + 1, y1), fx), fy);
+}
+
+glm::vec3 IblMaps::irradiance(const glm::vec3& N) const
+{
+	return sample(m_irradiance, N);
+}
+
+glm::vec3 IblMaps::specular(const glm::vec3& dir, float lod) const
+{
+	return sampleLod(m_specular, dir, lod);
+}
+
+glm::vec2 IblMaps::brdf(float cosLo, float roughness) const
+{
+	// Texel (x, y) holds cosLo = x / size and roughness = y / size, like spbrdf_cs.glsl
+	const float x = glm::clamp(cosLo * BrdfLutSize - 0.5f, 0.f, float(BrdfLutSize - 1));
+	const float y = glm::clamp(roughness * BrdfLutSize - 0.5f, 0.f, float(BrdfLutSize - 1));
+	const int x0 = int(x), y0 = int(y);
+	const int x1 = std::min(x0 + 1, BrdfLutSize - 1), y1 = std::min(y0 + 1, BrdfLutSize - 1);
+	const float fx = x - float(x0), fy = y - float(y0);
+	return glm::mix(glm::mix(m_brdfLut[y0 * BrdfLutSize + x0], m_brdfLut[y0 * BrdfLutSize + x1], fx),
+					glm::mix(m_brdfLut[y1 * BrdfLutSize + x0], m_brdfLut[y1 * BrdfLutSize + x1], fx), fy);
+}
+
+glm::vec2 IblMaps::octahedralEncode(const glm::vec3& dir)
+{
+	const glm::vec3 n = dir / (std::abs(dir.x) + std::abs(dir.y) + std::abs(dir.z));
+	const glm::vec2 f = (n.z >= 0.f) ? glm::vec2{ n.x, n.y }
+		: (1.f - glm::abs(glm::vec2{ n.y, n.x })) * glm::vec2{ n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f };
+	return 0.5f * f + 0.5f;
+}
+
+glm::vec3 IblMaps::octahedralDecode(const glm::vec2& uv)
+{
+	const glm::vec2 f = 2.f * uv - 1.f;
+	glm::vec3 n{ f.x, f.y, 1.f - std::abs(f.x) - std::abs(f.y) };
+	const float t = std::max(-n.z, 0.f);
+	n.x += (n.x >= 0.f) ? -t : t;
+	n.y += (n.y >= 0.f) ? -t : t;
+	return glm::normalize(n);
+}
+
+glm::vec3 IblMaps::sample(const Map& map, const glm::vec3& dir)
+{
+	const glm::vec2 uv = octahedralEncode(dir);
+	const float x = glm::clamp(uv.x * map.size - 0.5f, 0.f, float(map.size - 1));
+	const float y = glm::clamp(uv.y * map.size - 0.5f, 0.f, float(map.size - 1));
+	const int x0 = int(x), y0 = int(y);
+	const int x1 = std::min(x0 + 1, map.size - 1), y1 = std::min(y0 + 1, map.size - 1);
+	const float fx = x - float(x0), fy = y - float(y0);
+	const glm::vec3* texels = map.texels.data();
+	return glm::mix(glm::mix(texels[y0 * map.size + x0], texels[y0 * map.size + x1], fx),
+					glm::mix(texels[y1 * map.size + x0], texels[y1 * map.size + x1], fx), fy);
+}
+
+glm::vec3 IblMaps::sampleLod(const std::vector<Map>& levels, const glm::vec3& dir, float lod)
+{
+	const float maxLevel = float(levels.size() - 1);
+	const float l0 = std::min(std::floor(std::max(lod, 0.f)), maxLevel);
+	const float l1 = std::min(l0 + 1.f, maxLevel);
+	const glm::vec3 c0 = sample(levels[size_t(l0)], dir);
+	return (l1 == l0) ? c0 : glm::mix(c0, sample(levels[size_t(l1)], dir), glm::clamp(lod - l0, 0.f, 1.f));
+}
+
+void IblMaps::bakeRadiance(size_t maxThreads)
+{
+	// Level 0 averages 2x2 environment samples per texel, smaller levels are box filtered
+	m_radiance.assign(1, Map{ SpecularSize, std::vector<glm::vec3>(size_t(SpecularSize) * SpecularSize) });
+	Map& base = m_radiance[0];
+	parallelFor(size_t(SpecularSize), 8, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			for (int x = 0; x < SpecularSize; x++)
+			{
+				glm::vec3 color{ 0.f };
+				for (int s = 0; s < 4; s++)
+				{
+					const glm::vec2 uv{ (float(x) + 0.25f + 0.5f * float(s & 1)) / SpecularSize,
+										(float(y) + 0.25f + 0.5f * float(s >> 1)) / SpecularSize };
+					color += environment(octahedralDecode(uv));
+				}
+				base.texels[y * SpecularSize + x] = 0.25f * color;
+			}
+		}
+	}, maxThreads);
+
+	for (int size = SpecularSize / 2; size >= 1; size /= 2)
+	{
+		const Map& src = m_radiance.back();
+		Map dst{ size, std::vector<glm::vec3>(size_t(size) * size) };
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				const glm::vec3* row0 = &src.texels[size_t(2 * y) * src.size + 2 * x];
+				const glm::vec3* row1 = row0 + src.size;
+				dst.texels[size_t(y) * size + x] = 0.25f * (row0[0] + row0[1] + row1[0] + row1[1]);
+			}
+		}
+		m_radiance.push_back(std::move(dst));
+	}
+}
+
+void IblMaps::bakeSpecular(size_t maxThreads)
+{
+	// Same as spmap_cs.glsl: GGX importance sampling with mip filtered source, zero viewing angle
+	const int levels = int(m_radiance.size());
+	const float wt = 4.f * PI / (float(SpecularSize) * SpecularSize);
+	m_specular.assign(1, m_radiance[0]);
+	for (int level = 1; level < levels; level++)
+	{
+		const int size = SpecularSize >> level;
+		const float roughness = float(level) / float(levels - 1);
+		Map map{ size, std::vector<glm::vec3>(size_t(size) * size) };
+		parallelFor(size_t(size) * size, 16, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const glm::vec3 N = octahedralDecode(glm::vec2{ float(i % size) + 0.5f, float(i / size) + 0.5f } / float(size));
+				const glm::mat3 basis = tangentBasis(N);
+				glm::vec3 color{ 0.f };
+				float weight = 0.f;
+				for (uint32_t s = 0; s < NumSpecularSamples; s++)
+				{
+					const glm::vec2 u = sampleHammersley(s, NumSpecularSamples);
+					const glm::vec3 Lh = basis * sampleGGX(u.x, u.y, roughness);
+					const glm::vec3 Li = 2.f * glm::dot(N, Lh) * Lh - N;
+					const float cosLi = glm::dot(N, Li);
+					if (cosLi > 0.f)
+					{
+						const float pdf = ndfGGX(std::max(glm::dot(N, Lh), 0.f), roughness) * 0.25f;
+						const float ws = 1.f / (float(NumSpecularSamples) * pdf);
+						color += sampleLod(m_radiance, Li, sourceLevel(ws, wt)) * cosLi;
+						weight += cosLi;
+					}
+				}
+				map.texels[i] = color / std::max(weight, Epsilon);
+			}
+		}, maxThreads);
+		m_specular.push_back(std::move(map));
+	}
+}
+
+void IblMaps::bakeIrradiance(size_t maxThreads)
+{
+	// Cosine weighted samples, so that irradiance is plain mean of radiance (irmap_cs.glsl samples uniformly)
+	const float wt = 4.f * PI / (float(SpecularSize) * SpecularSize);
+	m_irradiance = Map{ IrradianceSize, std::vector<glm::vec3>(size_t(IrradianceSize) * IrradianceSize) };
+	parallelFor(m_irradiance.texels.size(), 16, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const glm::vec2 uv = glm::vec2{ float(i % IrradianceSize) + 0.5f, float(i / IrradianceSize) + 0.5f } / float(IrradianceSize);
+			const glm::vec3 N = octahedralDecode(uv);
+			const glm::mat3 basis = tangentBasis(N);
+			glm::vec3 color{ 0.f };
+			for (uint32_t s = 0; s < NumIrradianceSamples; s++)
+			{
+				const glm::vec2 u = sampleHammersley(s, NumIrradianceSamples);
+				const float r = std::sqrt(u.x);
+				const float phi = TwoPI * u.y;
+				const float cosTheta = std::sqrt(std::max(0.f, 1.f - u.x));
+				const float ws = PI / (float(NumIrradianceSamples) * std::max(cosTheta, Epsilon));
+				color += sampleLod(m_radiance, basis * glm::vec3{ r * std::cos(phi), r * std::sin(phi), cosTheta }, sourceLevel(ws, wt));
+			}
+			m_irradiance.texels[i] = color / float(NumIrradianceSamples);
+		}
+	}, maxThreads);
+}
+
+void IblMaps::bakeBrdfLut(size_t maxThreads)
+{
+	// Same as spbrdf_cs.glsl
+	m_brdfLut.assign(size_t(BrdfLutSize) * BrdfLutSize, glm::vec2{ 0.f });
+	parallelFor(m_brdfLut.size(), 64, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const float cosLo = std::max(float(i % BrdfLutSize) / BrdfLutSize, Epsilon);
+			const float roughness = float(i / BrdfLutSize) / BrdfLutSize;
+			const float k = (roughness * roughness) / 2.f;
+			const glm::vec3 Lo{ std::sqrt(1.f - cosLo * cosLo), 0.f, cosLo };
+			glm::vec2 dfg{ 0.f };
+			for (uint32_t s = 0; s < NumBrdfSamples; s++)
+			{
+				const glm::vec2 u = sampleHammersley(s, NumBrdfSamples);
+				const glm::vec3 Lh = sampleGGX(u.x, u.y, roughness);
+				const glm::vec3 Li = 2.f * glm::dot(Lo, Lh) * Lh - Lo;
+				const float cosLi = Li.z;
+				const float cosLh = Lh.z;
+				const float cosLoLh = std::max(glm::dot(Lo, Lh), 0.f);
+				if (cosLi > 0.f)
+				{
+					const float G = gaSchlickG1(cosLi, k) * gaSchlickG1(cosLo, k);
+					const float Gv = G * cosLoLh / (cosLh * cosLo);
+					const float Fc = std::pow(1.f - cosLoLh, 5.f);
+					dfg += glm::vec2{ (1.f - Fc) * Gv, Fc * Gv };
+				}
+			}
+			m_brdfLut[i] = dfg / float(NumBrdfSamples);
+		}
+	}, maxThreads);
+}
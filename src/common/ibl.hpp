@@ -0,0 +1,61 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Image;
+
+// Image based lighting baked on CPU, counterpart of spmap_cs.glsl, irmap_cs.glsl and spbrdf_cs.glsl for renderers
+// without GPU. Prefiltered specular and irradiance maps are octahedral (Z is the axis, as in cube2oct_cs.glsl),
+// without border, sampled bilinearly. Bake runs in parallel.
+class IblMaps
+{
+public:
+	static const int SpecularSize = 256;
+	static const int IrradianceSize = 32;
+	static const int BrdfLutSize = 64;
+
+	// Environment is equirectangular HDR image with at least three channels.
+	static std::shared_ptr<IblMaps> bake(const std::shared_ptr<Image>& environment, size_t maxThreads = 0);
+
+	// Unfiltered environment in direction, for background.
+	glm::vec3 environment(const glm::vec3& dir) const;
+	// Diffuse irradiance around normal, scaled as irradiance map of pbr_fs.glsl (no 1/PI).
+	glm::vec3 irradiance(const glm::vec3& N) const;
+	// Prefiltered environment, level i is filtered for roughness i / (levels - 1) like Environment of OpenGL renderer.
+	glm::vec3 specular(const glm::vec3& dir, float lod) const;
+	int specularLevels() const { return int(m_specular.size()); }
+	// Split-sum scale and bias of F0.
+	glm::vec2 brdf(float cosLo, float roughness) const;
+
+private:
+	struct Map
+	{
+		int size;
+		std::vector<glm::vec3> texels;
+	};
+
+	IblMaps() = default;
+
+	static glm::vec2 octahedralEncode(const glm::vec3& dir);
+	static glm::vec3 octahedralDecode(const glm::vec2& uv);
+	static glm::vec3 sample(const Map& map, const glm::vec3& dir);
+	static glm::vec3 sampleLod(const std::vector<Map>& levels, const glm::vec3& dir, float lod);
+
+	void bakeRadiance(size_t maxThreads);
+	void bakeSpecular(size_t maxThreads);
+	void bakeIrradiance(size_t maxThreads);
+	void bakeBrdfLut(size_t maxThreads);
+
+	std::shared_ptr<Image> m_environment;
+	std::vector<Map> m_radiance;	// box filtered mip chain of environment, source of prefiltering
+	std::vector<Map> m_specular;
+	Map m_irradiance;
+	std::vector<glm::vec2> m_brdfLut;	// x - cosLo, y - roughness
+};
@@ -4,6 +4,13 @@
  */
 
 #include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <stb_image.h>
 
 #include "image.hpp"
@@ -14,6 +21,7 @@ Image::Image()
 	, m_height(0)
 	, m_channels(0)
 	, m_hdr(false)
+	, m_rgbe(false)
 {
 }
 
@@ -61,3 +69,256 @@ std::shared_ptr<Image> Image::fromFile(const std::string& filename, int channels
 	}
 	return image;
 }
+
+std::shared_ptr<Image> Image::fromRgbeFile(const std::string& filename)
+{
+	std::cout << "Loading image: " << filename << std::endl;
+
+	std::ifstream file{filename, std::ios::binary};
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to load image file: " + filename);
+	}
+	const std::vector<unsigned char> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	const auto fail = [&filename](const char* reason) { return std::runtime_error(std::string(reason) + ": " + filename); };
+
+	// Header lines end with empty line, then resolution line follows
+	size_t pos = 0;
+	const auto readLine = [&data, &pos]()
+	{
+		std::string line;
+		while (pos < data.size() && '\n' != data[pos])
+		{
+			line += char(data[pos++]);
+		}
+		pos++;
+		return line;
+	};
+	if (0 != readLine().compare(0, 2, "#?"))
+	{
+		throw fail("Not a Radiance HDR file");
+	}
+	for (std::string line = readLine(); !line.empty(); line = readLine())
+	{
+		if (0 == line.compare(0, 7, "FORMAT=") && line != "FORMAT=32-bit_rle_rgbe")
+		{
+			throw fail("Unsupported Radiance HDR pixel format");
+		}
+	}
+	std::shared_ptr<Image> image { new Image };
+	if (2 != sscanf(readLine().c_str(), "-Y %d +X %d", &image->m_height, &image->m_width)
+		|| image->m_width <= 0 || image->m_height <= 0)
+	{
+		throw fail("Unsupported Radiance HDR orientation");
+	}
+	image->m_channels = 4;
+	image->m_rgbe = true;
+
+	const size_t width = size_t(image->m_width);
+	unsigned char *dst = new unsigned char[width * size_t(image->m_height) * 4];
+	image->m_pixels = std::shared_ptr<void>(dst, [](void *Ptr) { delete[] static_cast<unsigned char*>(Ptr); });
+
+	for (int y = 0; y < image->m_height; y++, dst += width * 4)
+	{
+		if (pos + 4 > data.size())
+		{
+			throw fail("Truncated Radiance HDR file");
+		}
+		if (width >= 8 && width < 0x8000 && 2 == data[pos] && 2 == data[pos + 1]
+			&& width == (size_t(data[pos + 2]) << 8 | data[pos + 3]))
+		{
+			// Adaptive run length encoding, every component is encoded separately
+			pos += 4;
+			for (size_t c = 0; c < 4; c++)
+			{
+				for (size_t x = 0; x < width; )
+				{
+					if (pos >= data.size())
+					{
+						throw fail("Truncated Radiance HDR file");
+					}
+					size_t count = data[pos++];
+					const bool run = count > 128;
+					count = run ? count - 128 : count;
+					if (0 == count || x + count > width || pos + (run ? 1 : count) > data.size())
+					{
+						throw fail("Corrupted Radiance HDR file");
+					}
+					for (size_t i = 0; i < count; i++, x++)
+					{
+						dst[x * 4 + c] = data[run ? pos : pos + i];
+					}
+					pos += run ? 1 : count;
+				}
+			}
+		}
+		else
+		{
+			// Flat pixels, (1, 1, 1, n) repeats previous pixel (old run length encoding)
+			int shift = 0;
+			for (size_t x = 0; x < width; )
+			{
+				if (pos + 4 > data.size())
+				{
+					throw fail("Truncated Radiance HDR file");
+				}
+				if (1 == data[pos] && 1 == data[pos + 1] && 1 == data[pos + 2] && x > 0)
+				{
+					// Consecutive runs extend the count by a byte each, longer than 32 bits is never valid
+					if (shift > 24)
+					{
+						throw fail("Corrupted Radiance HDR file");
+					}
+					const size_t count = std::min(width - x, size_t(data[pos + 3]) << shift);
+					for (size_t i = 0; i < count; i++, x++)
+					{
+						memcpy(dst + x * 4, dst + (x - 1) * 4, 4);
+					}
+					shift += 8;
+				}
+				else
+				{
+					memcpy(dst + x * 4, &data[pos], 4);
+					x++;
+					shift = 0;
+				}
+				pos += 4;
+			}
+		}
+	}
+	return image;
+}
+
+std::shared_ptr<Image> Image::fromMemory(int width, int height, int channels, const std::shared_ptr<const void>& pixels)
+{
+	std::shared_ptr<Image> image { new Image };
+	image->m_width = width;
+	image->m_height = height;
+	image->m_channels = channels;
+	image->m_hdr = false;
+	image->m_pixels = std::const_pointer_cast<void>(pixels);
+	return image;
+}
+
+std::shared_ptr<Image> Image::packChannels(const std::vector<Channel>& channels)
+{
+	std::shared_ptr<Image> image { new Image };
+
+	image->m_width = image->m_height = 1;
+	for (const auto &ch : channels)
+	{
+		if (nullptr != ch.image)
+		{
+			assert(!ch.image->isHDR() && ch.channel < ch.image->channels());
+			image->m_width  = std::max(image->m_width,  ch.image->width());
+			image->m_height = std::max(image->m_height, ch.image->height());
+		}
+	}
+	image->m_channels = int(channels.size());
+	image->m_hdr = false;
+
+	const size_t count = size_t(image->m_width) * size_t(image->m_height);
+	unsigned char *dst = new unsigned char[count * channels.size()];
+	image->m_pixels = std::shared_ptr<void>(dst, [](void *Ptr) { delete[] static_cast<unsigned char*>(Ptr); });
+
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		const auto &ch = channels[c];
+		if (nullptr == ch.image)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				dst[i * channels.size() + c] = ch.value;
+			}
+			continue;
+		}
+		const unsigned char *src = ch.image->pixels<unsigned char>();
+		const size_t srcChannels = size_t(ch.image->channels());
+		for (int y = 0; y < image->m_height; y++)
+		{
+			const size_t sy = size_t(y) * size_t(ch.image->height()) / size_t(image->m_height);
+			for (int x = 0; x < image->m_width; x++)
+			{
+				const size_t sx = size_t(x) * size_t(ch.image->width()) / size_t(image->m_width);
+				dst[(size_t(y) * image->m_width + x) * channels.size() + c] =
+					src[(sy * ch.image->width() + sx) * srcChannels + ch.channel];
+			}
+		}
+	}
+	return image;
+}
+
+bool Image::isConstant() const
+{
+	if (m_hdr || !m_pixels)
+	{
+		return false;
+	}
+	const size_t bpp  = size_t(bytesPerPixel());
+	const size_t size = size_t(m_width) * size_t(m_height) * bpp;
+	const unsigned char *pix = pixels<unsigned char>();
+	for (size_t i = bpp; i < size; i++)
+	{
+		if (pix[i] != pix[i % bpp])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+std::shared_ptr<Image> Image::downsample(bool srgb) const
+{
+	assert(!m_hdr);
+
+	// Mips are built on several worker threads at once, static initialization runs exactly once
+	static const std::array<float, 256> srgbToLinear = []()
+	{
+		std::array<float, 256> table;
+		for (int i = 0; i < 256; i++)
+		{
+			const float c = i / 255.f;
+			table[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return table;
+	}();
+
+	std::shared_ptr<Image> image { new Image };
+	image->m_width = std::max(1, m_width / 2);
+	image->m_height = std::max(1, m_height / 2);
+	image->m_channels = m_channels;
+	image->m_hdr = false;
+
+	const size_t channels = size_t(m_channels);
+	unsigned char *dst = new unsigned char[size_t(image->m_width) * size_t(image->m_height) * channels];
+	image->m_pixels = std::shared_ptr<void>(dst, [](void *Ptr) { delete[] static_cast<unsigned char*>(Ptr); });
+
+	const unsigned char *src = pixels<unsigned char>();
+	for (int y = 0; y < image->m_height; y++)
+	{
+		const size_t y0 = size_t(std::min(2 * y, m_height - 1)) * size_t(m_width);
+		const size_t y1 = size_t(std::min(2 * y + 1, m_height - 1)) * size_t(m_width);
+		for (int x = 0; x < image->m_width; x++)
+		{
+			const size_t x0 = size_t(std::min(2 * x, m_width - 1));
+			const size_t x1 = size_t(std::min(2 * x + 1, m_width - 1));
+			for (size_t c = 0; c < channels; c++)
+			{
+				const unsigned char p00 = src[(y0 + x0) * channels + c], p01 = src[(y0 + x1) * channels + c];
+				const unsigned char p10 = src[(y1 + x0) * channels + c], p11 = src[(y1 + x1) * channels + c];
+				unsigned char &out = dst[(size_t(y) * image->m_width + x) * channels + c];
+				if (srgb && c < 3)
+				{
+					const float linear = 0.25f * (srgbToLinear[p00] + srgbToLinear[p01] + srgbToLinear[p10] + srgbToLinear[p11]);
+					const float encoded = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f;
+					out = static_cast<unsigned char>(std::min(255.f, encoded * 255.f + 0.5f));
+				}
+				else
+				{
+					out = static_cast<unsigned char>((p00 + p01 + p10 + p11 + 2) / 4);
+				}
+			}
+		}
+	}
+	return image;
+}
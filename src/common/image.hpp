@@ -8,6 +8,7 @@
 #include <cassert>
 #include <memory>
 #include <string>
+#include <vector>
 
 class Image
 {
@@ -15,6 +16,21 @@ public:
 	~Image();
 
 	static std::shared_ptr<Image> fromFile(const std::string& filename, int channels = 4);
+	// Radiance HDR file with pixels kept in 4-byte RGBE (shared exponent) form, decoded on GPU.
+	static std::shared_ptr<Image> fromRgbeFile(const std::string& filename);
+	// LDR image over existing pixel memory (e.g. memory mapped file), pixels are shared, not copied.
+	static std::shared_ptr<Image> fromMemory(int width, int height, int channels, const std::shared_ptr<const void>& pixels);
+
+	// Source of one channel for packChannels(), constant value is used if image is nullptr.
+	struct Channel
+	{
+		std::shared_ptr<Image> image;
+		int channel;
+		unsigned char value;
+	};
+	// Packs channels of several LDR images into a single image (e.g. occlusion/roughness/metalness),
+	// sources of different size are resampled (nearest) to the size of the largest one.
+	static std::shared_ptr<Image> packChannels(const std::vector<Channel>& channels);
 
 	int width() const { return m_width; }
 	int height() const { return m_height; }
@@ -23,6 +39,13 @@ public:
 	int pitch() const { return m_width * bytesPerPixel(); }
 
 	bool isHDR() const { return m_hdr; }
+	// 4 bytes per pixel: RGB mantissas and shared exponent, value = mantissa * 2^(exponent - 136).
+	bool isRGBE() const { return m_rgbe; }
+	// True if every pixel of LDR image has the same value (e.g. 1x1 placeholder maps).
+	bool isConstant() const;
+	// Returns LDR image of half size (2x2 box filter) for the next mipmap level,
+	// color channels of sRGB images are averaged in linear space.
+	std::shared_ptr<Image> downsample(bool srgb = false) const;
 
 	template<typename T>
 	const T* pixels() const
@@ -37,5 +60,6 @@ private:
 	int m_height;
 	int m_channels;
 	bool m_hdr;
+	bool m_rgbe;
 	std::shared_ptr<void> m_pixels;
 };
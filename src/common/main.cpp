@@ -4,6 +4,7 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <memory>
 #include <vector>
@@ -11,14 +12,29 @@
 #include "application.hpp"
 
 #include "../opengl.hpp"
+#include "../software.hpp"
 
-int main(int /*argc*/, char* /*argv*/[])
+int main(int argc, char* argv[])
 {
-	RendererInterface* renderer = new OpenGL::Renderer;
+	RendererInterface* renderer = nullptr;
+	bool benchmark = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		if(std::strcmp(argv[i], "-benchmark") == 0)
+			benchmark = true;
+		else if(renderer)
+			continue;
+		else if(std::strcmp(argv[i], "-software") == 0)
+			renderer = new Software::Renderer;
+		else if(std::strcmp(argv[i], "-pathtrace") == 0)
+			renderer = new Software::Renderer{ true };
+	}
+	if(!renderer)
+		renderer = new OpenGL::Renderer;
 
 	try
 	{
-		Application().run(std::unique_ptr<RendererInterface>{ renderer });
+		Application(benchmark).run(std::unique_ptr<RendererInterface>{ renderer });
 	}
 	catch(const std::exception& e)
 	{
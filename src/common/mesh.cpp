@@ -108,6 +108,27 @@ Mesh::Mesh(const aiScene *ScenePtr, size_t MeshIndex)
 	{
 		m_textures[Mesh::TextureType::Roughness] = getFileNameFromPath(std::string(textureStr.C_Str()));
 	}
+	if (materialPtr->GetTextureCount(aiTextureType_AMBIENT_OCCLUSION) > 0
+		&& AI_SUCCESS == materialPtr->GetTexture(aiTextureType_AMBIENT_OCCLUSION, 0, &textureStr))
+	{
+		m_textures[Mesh::TextureType::Occlusion] = getFileNameFromPath(std::string(textureStr.C_Str()));
+	}
+	else if (materialPtr->GetTextureCount(aiTextureType_LIGHTMAP) > 0
+		&& AI_SUCCESS == materialPtr->GetTexture(aiTextureType_LIGHTMAP, 0, &textureStr))
+	{
+		m_textures[Mesh::TextureType::Occlusion] = getFileNameFromPath(std::string(textureStr.C_Str()));
+	}
+
+	aiColor3D colorData;
+	if (AI_SUCCESS == materialPtr->Get(AI_MATKEY_COLOR_DIFFUSE, colorData))
+	{
+		m_material.albedo = glm::vec4{ colorData.r, colorData.g, colorData.b, m_material.albedo.a };
+	}
+	float opacity;
+	if (AI_SUCCESS == materialPtr->Get(AI_MATKEY_OPACITY, opacity))
+	{
+		m_material.albedo.a = opacity;
+	}
 
 // 	for (const auto &p : m_textures)
 // 	{
@@ -146,10 +167,6 @@ Mesh::Mesh(const aiScene *ScenePtr, size_t MeshIndex)
 // 			}
 // 		}
 // 	}
-// 	aiColor3D colorData;
-// 	if (AI_SUCCESS == materialPtr->Get(AI_MATKEY_COLOR_DIFFUSE, colorData))
-// 	{
-// 	}
 }
 
 std::shared_ptr<Mesh> Mesh::fromFile(const std::string& filename)
@@ -18,7 +18,7 @@
 class Mesh
 {
 public:
-	enum TextureType : char { Albedo = 0, Normals, Metalness, Roughness, Count };
+	enum TextureType : char { Albedo = 0, Normals, Metalness, Roughness, Occlusion, Count };
 
 	struct Vertex
 	{
@@ -31,6 +31,15 @@ public:
 	static_assert(sizeof(Vertex) == 14 * sizeof(float), "Vertex structure size is incorrect.");
 	static const int NumAttributes = 5;
 
+	// Constant material parameters, used for channels that have no texture map. Albedo is linear, default grey is
+	// sRGB 128 as the fallback albedo texture used to be.
+	struct Material
+	{
+		glm::vec4 albedo { 0.2158605f, 0.2158605f, 0.2158605f, 1.0f };
+		float metalness = 0.5f;
+		float roughness = 0.5f;
+	};
+
 	struct Face
 	{
 		uint32_t v1, v2, v3;
@@ -43,6 +52,7 @@ public:
 	const std::vector<Vertex>& vertices() const { return m_vertices; }
 	const std::vector<Face>& faces() const { return m_faces; }
 	std::string textureName(TextureType TexType) { return (m_textures.count(TexType) > 0) ? m_textures[TexType] : std::string(); }
+	const Material& material() const { return m_material; }
 
 private:
 	Mesh(const aiScene *ScenePtr, size_t MeshIndex = 0);
@@ -51,4 +61,5 @@ private:
 	std::vector<Face> m_faces;
 
 	std::unordered_map<TextureType, std::string> m_textures;
+	Material m_material;
 };
@@ -0,0 +1,370 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "occlusion.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+namespace {
+	// Vertices closer than this (clip space w) are treated as behind near plane
+	const float NearW = 1e-4f;
+	// Work smaller than this isn't split between threads
+	const size_t MinParallelTriangles = 512;
+	const size_t MinParallelBounds = 64;
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+	: m_width(std::max(TileSize, width / TileSize * TileSize))
+	, m_height(std::max(TileSize, height / TileSize * TileSize))
+	, m_depth(size_t(m_width) * m_height, 1.f)
+	, m_viewProjection(1.f)
+{
+	int levelWidth = m_width / TileSize, levelHeight = m_height / TileSize;
+	for (;;)
+	{
+		m_levels.push_back(Level{ levelWidth, levelHeight, std::vector<float>(size_t(levelWidth) * levelHeight, 1.f) });
+		if (1 == levelWidth && 1 == levelHeight)
+		{
+			break;
+		}
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+}
+
+std::shared_ptr<OcclusionCuller::Occluder> OcclusionCuller::makeOccluder(const Mesh& mesh)
+{
+	auto occluder = std::make_shared<Occluder>();
+	occluder->positions.reserve(mesh.vertices().size());
+	for (const auto& vertex : mesh.vertices())
+	{
+		occluder->positions.push_back(vertex.position);
+	}
+	occluder->indices.reserve(mesh.faces().size() * 3);
+	for (const auto& face : mesh.faces())
+	{
+		occluder->indices.insert(occluder->indices.end(), { face.v1, face.v2, face.v3 });
+	}
+	return occluder;
+}
+
+OcclusionCuller::Bounds OcclusionCuller::meshBounds(const Mesh& mesh)
+{
+	Bounds bounds{ glm::vec3{ std::numeric_limits<float>::max() }, glm::vec3{ -std::numeric_limits<float>::max() } };
+	for (const auto& vertex : mesh.vertices())
+	{
+		bounds.min = glm::min(bounds.min, vertex.position);
+		bounds.max = glm::max(bounds.max, vertex.position);
+	}
+	return bounds;
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection)
+{
+	m_viewProjection = viewProjection;
+	std::fill(m_depth.begin(), m_depth.end(), 1.f);
+	for (auto& level : m_levels)
+	{
+		std::fill(level.maxDepth.begin(), level.maxDepth.end(), 1.f);
+	}
+	m_occluders.clear();
+}
+
+void OcclusionCuller::addOccluder(const std::shared_ptr<const Occluder>& occluder, const glm::mat4& modelMatrix)
+{
+	m_occluders.emplace_back(occluder, modelMatrix);
+}
+
+void OcclusionCuller::rasterize()
+{
+	// Transform all occluder vertices to window space once
+	m_vertices.clear();
+	m_indices.clear();
+	for (const auto& occluder : m_occluders)
+	{
+		const glm::mat4 mvp = m_viewProjection * occluder.second;
+		const uint32_t base = uint32_t(m_vertices.size());
+		for (const auto& position : occluder.first->positions)
+		{
+			const glm::vec4 clip = mvp * glm::vec4{ position, 1.f };
+			// Geometry in front of near plane isn't drawn, so it must not occlude
+			ScreenVertex vertex{ glm::vec3{ 0.f }, clip.w < NearW || clip.z < -clip.w };
+			if (!vertex.clipped)
+			{
+				const glm::vec3 ndc = glm::vec3{ clip } / clip.w;
+				vertex.position = glm::vec3{ (ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height, ndc.z * 0.5f + 0.5f };
+			}
+			m_vertices.push_back(vertex);
+		}
+		for (uint32_t index : occluder.first->indices)
+		{
+			m_indices.push_back(base + index);
+		}
+	}
+	m_occluders.clear();
+
+	// Bands of whole tile rows are rasterized independently, every thread goes through all triangles
+	const size_t tileRows = size_t(m_height / TileSize);
+	const size_t minRows = std::max<size_t>(1, tileRows * MinParallelTriangles / std::max<size_t>(m_indices.size() / 3, 1));
+	parallelFor(tileRows, minRows, [this](size_t begin, size_t end)
+	{
+		rasterizeBand(int(begin) * TileSize, int(end) * TileSize);
+	});
+	updateLevels();
+}
+
+void OcclusionCuller::rasterizeBand(int y0, int y1)
+{
+	for (size_t i = 0; i + 2 < m_indices.size(); i += 3)
+	{
+		const ScreenVertex& v0 = m_vertices[m_indices[i]];
+		const ScreenVertex& v1 = m_vertices[m_indices[i + 1]];
+		const ScreenVertex& v2 = m_vertices[m_indices[i + 2]];
+		// Triangles crossing near plane are skipped, which only makes occlusion less aggressive
+		if (!v0.clipped && !v1.clipped && !v2.clipped)
+		{
+			rasterizeTriangle(v0, v1, v2, y0, y1);
+		}
+	}
+	updateTiles(y0, y1);
+}
+
+void OcclusionCuller::rasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, int y0, int y1)
+{
+	glm::vec3 p0 = v0.position, p1 = v1.position, p2 = v2.position;
+	float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+	if (std::abs(area) < 1e-6f)
+	{
+		return;
+	}
+	// Both faces are rasterized, orientation is made counter clockwise
+	if (area < 0.f)
+	{
+		std::swap(p1, p2);
+		area = -area;
+	}
+
+	// Pixel bounds of triangle in band, rows start at multiple of four pixels
+	const int minX = std::max(0, int(std::floor(std::min({ p0.x, p1.x, p2.x }))) & ~3);
+	const int maxX = std::min(m_width - 1, int(std::ceil(std::max({ p0.x, p1.x, p2.x }))));
+	const int minY = std::max(y0, int(std::floor(std::min({ p0.y, p1.y, p2.y }))));
+	const int maxY = std::min(y1 - 1, int(std::ceil(std::max({ p0.y, p1.y, p2.y }))));
+	if (minX > maxX || minY > maxY)
+	{
+		return;
+	}
+
+	// Edge functions e(x, y) = a * x + b * y + c, non negative inside, and depth plane
+	const glm::vec3 a{ p1.y - p2.y, p2.y - p0.y, p0.y - p1.y };
+	const glm::vec3 b{ p2.x - p1.x, p0.x - p2.x, p1.x - p0.x };
+	const glm::vec3 c{ p1.x * p2.y - p2.x * p1.y, p2.x * p0.y - p0.x * p2.y, p0.x * p1.y - p1.x * p0.y };
+	const glm::vec3 z{ p0.z / area, p1.z / area, p2.z / area };
+	const float za = glm::dot(a, z), zb = glm::dot(b, z), zc = glm::dot(c, z);
+
+	const Float4 ramp = Float4::ramp();
+	const Float4 step0{ 4.f * a.x }, step1{ 4.f * a.y }, step2{ 4.f * a.z }, stepZ{ 4.f * za };
+	for (int y = minY; y <= maxY; y++)
+	{
+		const float py = float(y) + 0.5f;
+		const Float4 px = Float4{ float(minX) + 0.5f } + ramp;
+		Float4 e0 = Float4{ a.x } * px + Float4{ b.x * py + c.x };
+		Float4 e1 = Float4{ a.y } * px + Float4{ b.y * py + c.y };
+		Float4 e2 = Float4{ a.z } * px + Float4{ b.z * py + c.z };
+		Float4 depth = Float4{ za } * px + Float4{ zb * py + zc };
+		float* row = &m_depth[size_t(y) * m_width];
+		for (int x = minX; x <= maxX; x += 4)
+		{
+			const Float4 stored = Float4::load(row + x);
+			// Depth is clamped so that interpolation outside of triangle doesn't produce values out of range
+			const Float4 clamped = max(depth, Float4{ 0.f });
+			select(insideMask(e0, e1, e2), min(stored, clamped), stored).store(row + x);
+			e0 = e0 + step0;
+			e1 = e1 + step1;
+			e2 = e2 + step2;
+			depth = depth + stepZ;
+		}
+	}
+}
+
+void OcclusionCuller::updateTiles(int y0, int y1)
+{
+	Level& tiles = m_levels[0];
+	for (int ty = y0 / TileSize; ty < y1 / TileSize; ty++)
+	{
+		for (int tx = 0; tx < tiles.width; tx++)
+		{
+			Float4 tileMax{ 0.f };
+			for (int y = ty * TileSize; y < (ty + 1) * TileSize; y++)
+			{
+				const float* row = &m_depth[size_t(y) * m_width + tx * TileSize];
+				for (int x = 0; x < TileSize; x += 4)
+				{
+					tileMax = max(tileMax, Float4::load(row + x));
+				}
+			}
+			float lanes[4];
+			tileMax.store(lanes);
+			tiles.maxDepth[size_t(ty) * tiles.width + tx] = std::max({ lanes[0], lanes[1], lanes[2], lanes[3] });
+		}
+	}
+}
+
+void OcclusionCuller::updateLevels()
+{
+	// Levels above tiles are small (a few hundred cells in total), they are built on calling thread
+	for (size_t i = 1; i < m_levels.size(); i++)
+	{
+		const Level& below = m_levels[i - 1];
+		Level& level = m_levels[i];
+		for (int y = 0; y < level.height; y++)
+		{
+			for (int x = 0; x < level.width; x++)
+			{
+				// Cells at odd right or bottom edge of level below have no neighbour
+				const int x1 = std::min(2 * x + 1, below.width - 1), y1 = std::min(2 * y + 1, below.height - 1);
+				const float* row0 = &below.maxDepth[size_t(2 * y) * below.width];
+				const float* row1 = &below.maxDepth[size_t(y1) * below.width];
+				level.maxDepth[size_t(y) * level.width + x] = std::max({ row0[2 * x], row0[x1], row1[2 * x], row1[x1] });
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::isInFrustum(const Bounds& bounds, const glm::mat4& modelViewProjection)
+{
+	// Bits of planes every corner is outside of, -w <= x, y, z <= w inside
+	int outside = 0x3F;
+	for (int i = 0; i < 8; i++)
+	{
+		const glm::vec3 corner{ (i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y,
+								(i & 4) ? bounds.max.z : bounds.min.z };
+		const glm::vec4 clip = modelViewProjection * glm::vec4{ corner, 1.f };
+		int planes = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			planes |= (clip[axis] < -clip.w) ? (1 << (2 * axis)) : 0;
+			planes |= (clip[axis] > clip.w) ? (2 << (2 * axis)) : 0;
+		}
+		outside &= planes;
+	}
+	return 0 == outside;
+}
+
+bool OcclusionCuller::isVisible(const Bounds& bounds, const glm::mat4& modelMatrix) const
+{
+	// Screen rectangle and nearest depth of box corners
+	const glm::mat4 mvp = m_viewProjection * modelMatrix;
+	glm::vec2 rectMin{ std::numeric_limits<float>::max() }, rectMax{ -std::numeric_limits<float>::max() };
+	float minDepth = std::numeric_limits<float>::max();
+	for (int i = 0; i < 8; i++)
+	{
+		const glm::vec3 corner{ (i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y,
+								(i & 4) ? bounds.max.z : bounds.min.z };
+		const glm::vec4 clip = mvp * glm::vec4{ corner, 1.f };
+		if (clip.w < NearW)
+		{
+			return true;	// crosses near plane
+		}
+		const glm::vec3 ndc = glm::vec3{ clip } / clip.w;
+		const glm::vec2 window{ (ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height };
+		rectMin = glm::min(rectMin, window);
+		rectMax = glm::max(rectMax, window);
+		minDepth = std::min(minDepth, ndc.z * 0.5f + 0.5f);
+	}
+
+	const Rect rect{ std::max(0, int(std::floor(rectMin.x))), std::max(0, int(std::floor(rectMin.y))),
+					 std::min(m_width - 1, int(std::ceil(rectMax.x))), std::min(m_height - 1, int(std::ceil(rectMax.y))),
+					 minDepth };
+	if (rect.x0 > rect.x1 || rect.y0 > rect.y1)
+	{
+		return false;	// outside of view
+	}
+
+	// Start from the finest level where rectangle touches at most 2x2 cells
+	int level = 0;
+	int cellSize = TileSize;
+	while (level + 1 < int(m_levels.size())
+		   && (rect.x1 / cellSize - rect.x0 / cellSize > 1 || rect.y1 / cellSize - rect.y0 / cellSize > 1))
+	{
+		level++;
+		cellSize *= 2;
+	}
+	for (int y = rect.y0 / cellSize; y <= rect.y1 / cellSize; y++)
+	{
+		for (int x = rect.x0 / cellSize; x <= rect.x1 / cellSize; x++)
+		{
+			if (isCellVisible(level, x, y, rect))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool OcclusionCuller::isCellVisible(int level, int cellX, int cellY, const Rect& rect) const
+{
+	// Cell whose farthest depth is in front of box occludes it
+	if (rect.minDepth >= levelMaxDepth(level, cellX, cellY))
+	{
+		return false;
+	}
+
+	if (level > 0)
+	{
+		// Children of cell overlapping rectangle
+		const int childSize = TileSize << (level - 1);
+		const int x0 = std::max(2 * cellX, rect.x0 / childSize), x1 = std::min(2 * cellX + 1, rect.x1 / childSize);
+		const int y0 = std::max(2 * cellY, rect.y0 / childSize), y1 = std::min(2 * cellY + 1, rect.y1 / childSize);
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				if (isCellVisible(level - 1, x, y, rect))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Tile that can't decide is tested per pixel
+	const Float4 boxDepth{ rect.minDepth };
+	const int px0 = std::max(rect.x0, cellX * TileSize) & ~3;
+	const int px1 = std::min(rect.x1, cellX * TileSize + TileSize - 1);
+	for (int y = std::max(rect.y0, cellY * TileSize); y <= std::min(rect.y1, cellY * TileSize + TileSize - 1); y++)
+	{
+		const float* row = &m_depth[size_t(y) * m_width];
+		for (int x = px0; x <= px1; x += 4)
+		{
+			if (anyLess(boxDepth, Float4::load(row + x)))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void OcclusionCuller::testVisibility(const std::vector<Bounds>& bounds, const std::vector<glm::mat4>& modelMatrices,
+									 std::vector<uint8_t>& visible) const
+{
+	assert(bounds.size() == modelMatrices.size());
+	visible.resize(bounds.size());
+	parallelFor(bounds.size(), MinParallelBounds, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			visible[i] = isVisible(bounds[i], modelMatrices[i]) ? 1 : 0;
+		}
+	});
+}
@@ -0,0 +1,102 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Mesh;
+
+// CPU occlusion culling: occluder triangles are rasterized into a low resolution depth buffer with SIMD. Hierarchy
+// above the buffer keeps the farthest depth of 8x8 tiles, then of 2x2 groups of cells of the level below up to a
+// single cell. Bounds are tested from the coarsest level that covers them with at most 2x2 cells and only cells that
+// can't decide are refined, down to pixels. Rasterization is split into horizontal bands and bounds are tested in
+// chunks, both run in parallel. Depth is NDC depth in [0, 1], near plane is 0 as in OpenGL depth buffer.
+class OcclusionCuller
+{
+public:
+	static const int TileSize = 8;
+
+	// Triangles used as occluder, either mesh itself or its simplified version which must not exceed the mesh.
+	struct Occluder
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	struct Bounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	explicit OcclusionCuller(int width = 256, int height = 128);
+
+	static std::shared_ptr<Occluder> makeOccluder(const Mesh& mesh);
+	static Bounds meshBounds(const Mesh& mesh);
+	// False if box is completely outside of one of clip planes, doesn't need depth buffer.
+	static bool isInFrustum(const Bounds& bounds, const glm::mat4& modelViewProjection);
+
+	// Clears depth buffer and occluder list.
+	void begin(const glm::mat4& viewProjection);
+	// Occluder is referenced until rasterize().
+	void addOccluder(const std::shared_ptr<const Occluder>& occluder, const glm::mat4& modelMatrix);
+	void rasterize();
+
+	// True if any part of bounds in front of near plane may be visible.
+	bool isVisible(const Bounds& bounds, const glm::mat4& modelMatrix) const;
+	// Tests many bounds in parallel, visible[i] is 1 if bounds[i] may be visible.
+	void testVisibility(const std::vector<Bounds>& bounds, const std::vector<glm::mat4>& modelMatrices,
+						std::vector<uint8_t>& visible) const;
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	float depth(int x, int y) const { return m_depth[size_t(y) * m_width + x]; }
+	// Level 0 cells are tiles, cell of level i covers 2x2 cells of level i - 1, the last level is one cell
+	int levelCount() const { return int(m_levels.size()); }
+	int levelWidth(int level) const { return m_levels[level].width; }
+	int levelHeight(int level) const { return m_levels[level].height; }
+	float levelMaxDepth(int level, int x, int y) const { return m_levels[level].maxDepth[size_t(y) * m_levels[level].width + x]; }
+
+private:
+	struct ScreenVertex
+	{
+		glm::vec3 position;	// window x, y and depth
+		bool clipped;		// behind near plane
+	};
+
+	struct Level
+	{
+		int width;
+		int height;
+		std::vector<float> maxDepth;	// farthest depth of cell
+	};
+
+	// Pixel rectangle and nearest depth of tested bounds
+	struct Rect
+	{
+		int x0, y0, x1, y1;
+		float minDepth;
+	};
+
+	void rasterizeBand(int y0, int y1);
+	void rasterizeTriangle(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, int y0, int y1);
+	void updateTiles(int y0, int y1);
+	void updateLevels();
+	bool isCellVisible(int level, int cellX, int cellY, const Rect& rect) const;
+
+	int m_width;
+	int m_height;
+	std::vector<float> m_depth;
+	std::vector<Level> m_levels;
+
+	glm::mat4 m_viewProjection;
+	std::vector<std::pair<std::shared_ptr<const Occluder>, glm::mat4>> m_occluders;
+	std::vector<ScreenVertex> m_vertices;	// occluder vertices of current frame
+	std::vector<uint32_t> m_indices;
+};
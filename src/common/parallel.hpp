@@ -0,0 +1,154 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent worker threads shared by parallel loops and background tasks (e.g. texture loading), so that
+// threads aren't created on every loop. Tasks run in order of submission.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t threads)
+	{
+		for (size_t i = 0; i < std::max<size_t>(1, threads); i++)
+		{
+			m_workers.emplace_back([this]() { work(); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (auto& worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// One worker per hardware thread except the calling one, which takes part in parallel loops
+	static ThreadPool& shared()
+	{
+		static ThreadPool pool{ std::max<size_t>(1, std::thread::hardware_concurrency()) - 1 };
+		return pool;
+	}
+
+	size_t size() const { return m_workers.size(); }
+
+	// Runs task on worker thread, its result (or exception) is delivered through the future
+	template<class F>
+	std::future<typename std::result_of<F()>::type> submit(F task)
+	{
+		using Result = typename std::result_of<F()>::type;
+		const auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+		auto result = packaged->get_future();
+		post([packaged]() { (*packaged)(); });
+		return result;
+	}
+
+	// Runs task on worker thread, nobody waits for it
+	void post(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock{ m_mutex };
+			m_tasks.push_back(std::move(task));
+		}
+		m_wake.notify_one();
+	}
+
+private:
+	void work()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock{ m_mutex };
+				m_wake.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+				if (m_tasks.empty())
+				{
+					return;
+				}
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stopping = false;
+};
+
+// Calls func(begin, end) for consecutive ranges of [0, count) on calling thread and workers of the shared pool.
+// Ranges are not shorter than minChunk unless count is. At most maxThreads ranges are made, 0 means one per
+// hardware thread. Ranges are claimed by whichever thread is free first, the calling thread included, so the loop
+// finishes even if every worker is busy (e.g. loop nested in a pool task).
+template<class F>
+void parallelFor(size_t count, size_t minChunk, F func, size_t maxThreads = 0)
+{
+	const size_t hardwareThreads = (0 != maxThreads) ? maxThreads : std::thread::hardware_concurrency();
+	const size_t ranges = std::max<size_t>(1, std::min<size_t>(hardwareThreads, count / std::max<size_t>(minChunk, 1)));
+	if (ranges <= 1)
+	{
+		func(size_t(0), count);
+		return;
+	}
+
+	// Helpers may start after the loop returned, then they find no range left and never touch func
+	struct Loop
+	{
+		std::atomic<size_t> next{ 0 };
+		size_t finished = 0;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	const auto loop = std::make_shared<Loop>();
+	const size_t chunk = (count + ranges - 1) / ranges;
+	const size_t numRanges = (count + chunk - 1) / chunk;
+	F* body = &func;
+	const auto runRanges = [loop, body, chunk, count, numRanges]()
+	{
+		for (size_t range = loop->next++; range < numRanges; range = loop->next++)
+		{
+			(*body)(range * chunk, std::min(count, (range + 1) * chunk));
+			std::lock_guard<std::mutex> lock{ loop->mutex };
+			if (++loop->finished == numRanges)
+			{
+				loop->done.notify_one();
+			}
+		}
+	};
+
+	ThreadPool& pool = ThreadPool::shared();
+	for (size_t i = 1; i < std::min(numRanges, pool.size() + 1); i++)
+	{
+		pool.post(runRanges);
+	}
+	runRanges();
+	std::unique_lock<std::mutex> lock{ loop->mutex };
+	loop->done.wait(lock, [&]() { return loop->finished == numRanges; });
+}
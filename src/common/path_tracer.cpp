@@ -0,0 +1,676 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+
+#include "path_tracer.hpp"
+#include "image.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+
+using namespace Shading;
+
+namespace {
+	// Surfaces are passed through at most this many times per ray (stochastic alpha)
+	const int MaxAlphaPasses = 16;
+	// Paths are terminated randomly from this bounce on
+	const int RussianRouletteBounce = 3;
+	// Perfectly smooth GGX is a delta distribution, sampling and evaluation need some width
+	const float MinRoughness = 0.02f;
+	// Ray origins are moved off surfaces by this fraction of scene size
+	const float RayOffsetScale = 1e-4f;
+
+	uint32_t hash(uint32_t value)
+	{
+		// PCG hash
+		const uint32_t state = value * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	float luminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3{ 0.2126f, 0.7152f, 0.0722f });
+	}
+
+	float powerHeuristic(float pdf, float otherPdf)
+	{
+		return (pdf * pdf) / std::max(pdf * pdf + otherPdf * otherPdf, 1e-30f);
+	}
+
+	// Material of surface point, physically based counterpart of pbr_fs.glsl shading
+	struct Lobes
+	{
+		glm::vec3 albedo;
+		float roughness;
+		float metalness;
+		glm::vec3 F0;
+		float specularProbability;	// of sampling specular lobe
+
+		Lobes(const SurfaceSample& surface, float cosLo)
+			: albedo{ surface.albedo }
+			, roughness{ std::max(surface.roughness, MinRoughness) }
+			, metalness{ surface.metalness }
+			, F0{ glm::mix(Fdielectric, albedo, metalness) }
+		{
+			const glm::vec3 F = fresnelSchlick(F0, cosLo);
+			const float specular = luminance(F);
+			const float diffuse = luminance((glm::vec3{ 1.f } - F) * (1.f - metalness) * albedo);
+			specularProbability = glm::clamp(specular / std::max(specular + diffuse, Epsilon), 0.1f, 0.9f);
+		}
+
+		// Lambert + Cook-Torrance with Smith-Schlick visibility of IBL (spbrdf_cs.glsl), reflectance (with 1/PI)
+		glm::vec3 brdf(const glm::vec3& N, const glm::vec3& Lo, const glm::vec3& Li) const
+		{
+			const float cosLi = glm::dot(N, Li), cosLo = glm::dot(N, Lo);
+			if (cosLi <= 0.f || cosLo <= 0.f)
+			{
+				return glm::vec3{ 0.f };
+			}
+			const glm::vec3 Lh = glm::normalize(Li + Lo);
+			const glm::vec3 F = fresnelSchlick(F0, std::max(0.f, glm::dot(Lh, Lo)));
+			const float D = ndfGGX(std::max(0.f, glm::dot(N, Lh)), roughness);
+			const float G = gaSchlickGGX_IBL(cosLi, cosLo, roughness);
+			const glm::vec3 kd = glm::mix(glm::vec3{ 1.f } - F, glm::vec3{ 0.f }, metalness);
+			return kd * albedo / PI + (F * D * G) / std::max(Epsilon, 4.f * cosLi * cosLo);
+		}
+
+		// Direct light as pbr_fs.glsl evaluates it (diffuse without 1/PI, visibility for analytic lights)
+		glm::vec3 directLight(const glm::vec3& N, const glm::vec3& Lo, const glm::vec3& Li) const
+		{
+			const float cosLi = std::max(0.f, glm::dot(N, Li)), cosLo = std::max(0.f, glm::dot(N, Lo));
+			const glm::vec3 Lh = glm::normalize(Li + Lo);
+			const glm::vec3 F = fresnelSchlick(F0, std::max(0.f, glm::dot(Lh, Lo)));
+			const float D = ndfGGX(std::max(0.f, glm::dot(N, Lh)), roughness);
+			const float G = gaSchlickGGX(cosLi, cosLo, roughness);
+			const glm::vec3 kd = glm::mix(glm::vec3{ 1.f } - F, glm::vec3{ 0.f }, metalness);
+			return (kd * albedo + (F * D * G) / std::max(Epsilon, 4.f * cosLi * cosLo)) * cosLi;
+		}
+
+		// Solid angle pdf of sample(), one sample MIS of both lobes
+		float pdf(const glm::vec3& N, const glm::vec3& Lo, const glm::vec3& Li) const
+		{
+			const float cosLi = glm::dot(N, Li);
+			if (cosLi <= 0.f)
+			{
+				return 0.f;
+			}
+			const glm::vec3 Lh = glm::normalize(Li + Lo);
+			const float cosLh = std::max(0.f, glm::dot(N, Lh));
+			const float specularPdf = ndfGGX(cosLh, roughness) * cosLh / std::max(Epsilon, 4.f * glm::dot(Lo, Lh));
+			return specularProbability * specularPdf + (1.f - specularProbability) * cosLi / PI;
+		}
+
+		glm::vec3 sample(const glm::vec3& N, const glm::vec3& Lo, float u0, float u1, float u2) const
+		{
+			const glm::mat3 basis = tangentBasis(N);
+			if (u0 < specularProbability)
+			{
+				const glm::vec3 Lh = basis * sampleGGX(u1, u2, roughness);
+				return 2.f * glm::dot(Lo, Lh) * Lh - Lo;
+			}
+			// Cosine weighted
+			const float r = std::sqrt(u1);
+			const float phi = TwoPI * u2;
+			return basis * glm::vec3{ r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1.f - u1)) };
+		}
+	};
+}
+
+// Random numbers of one pixel sample
+struct PathTracer::Sampler
+{
+	uint32_t state;
+
+	Sampler() : state(0) {}
+	Sampler(uint32_t pixel, uint32_t sample) : state(hash(pixel ^ hash(sample))) {}
+
+	float next()
+	{
+		state = hash(state);
+		return float(state >> 8) * (1.f / 16777216.f);
+	}
+};
+
+struct PathTracer::Path
+{
+	glm::vec3 origin;
+	glm::vec3 direction;
+	glm::vec3 throughput;
+	glm::vec3 radiance;
+	float directionPdf;		// 0 - direction wasn't sampled by BRDF (camera ray), environment isn't weighted
+	int bounce;
+	bool active;
+	Sampler sampler;
+};
+
+PathTracer::PathTracer(int width, int height)
+	: m_width(0)
+	, m_height(0)
+	, m_tilesX(0)
+	, m_tilesY(0)
+	, m_threads(0)
+	, m_maxBounces(8)
+	, m_rayOffset(0.f)
+	, m_samples(0)
+	, m_modelRotation(1.f)
+	, m_eyePosition(0.f)
+	, m_rayOrigin(0.f)
+	, m_rayDx(0.f)
+	, m_rayDy(0.f)
+{
+	m_environment.total = 0.f;
+	resize(width, height);
+}
+
+PathTracer::~PathTracer() = default;
+
+void PathTracer::loadScene()
+{
+	buildEnvironment(Image::fromFile("environment.hdr", 3));
+
+	m_draws.clear();
+	m_triangleDraws.clear();
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> indices;
+	for (const char* fileName : { "meshes/siuzanna.fbx", "meshes/plate.fbx" })
+	{
+		Draw draw;
+		draw.mesh = Mesh::fromFile(fileName);
+		draw.material = SurfaceMaterial::load(draw.mesh);
+		draw.firstVertex = uint32_t(positions.size());
+		draw.firstTriangle = uint32_t(m_triangleDraws.size());
+		for (const Mesh::Vertex& vertex : draw.mesh->vertices())
+		{
+			positions.push_back(vertex.position);
+		}
+		for (const Mesh::Face& face : draw.mesh->faces())
+		{
+			indices.insert(indices.end(), { draw.firstVertex + face.v1, draw.firstVertex + face.v2, draw.firstVertex + face.v3 });
+			m_triangleDraws.push_back(uint32_t(m_draws.size()));
+		}
+		m_draws.push_back(std::move(draw));
+	}
+	m_bvh.build(positions, indices, m_threads);
+
+	glm::vec3 min{ 0.f }, max{ 0.f };
+	for (const glm::vec3& position : positions)
+	{
+		min = glm::min(min, position);
+		max = glm::max(max, position);
+	}
+	m_rayOffset = RayOffsetScale * std::max(1.f, glm::length(max - min));
+	m_samples = 0;
+}
+
+void PathTracer::resize(int width, int height)
+{
+	m_width = std::max(1, width);
+	m_height = std::max(1, height);
+	m_tilesX = (m_width + TileSize - 1) / TileSize;
+	m_tilesY = (m_height + TileSize - 1) / TileSize;
+	m_accumulated.assign(size_t(m_width) * m_height, glm::vec3{ 0.f });
+	m_pixels.assign(size_t(m_width) * m_height, 0xFF000000u);
+	m_samples = 0;
+}
+
+bool PathTracer::sameFrame(const ViewSettings& view, const SceneSettings& scene) const
+{
+	if (view.pitch != m_view.pitch || view.yaw != m_view.yaw || view.distance != m_view.distance || view.fov != m_view.fov
+		|| scene.pitch != m_scene.pitch || scene.yaw != m_scene.yaw)
+	{
+		return false;
+	}
+	for (int i = 0; i < SceneSettings::NumLights; i++)
+	{
+		const SceneSettings::Light &a = scene.lights[i], &b = m_scene.lights[i];
+		if (a.enabled != b.enabled || (a.enabled && (a.direction != b.direction || a.radiance != b.radiance)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void PathTracer::render(const ViewSettings& view, const SceneSettings& scene)
+{
+	if (0 == m_samples || !sameFrame(view, scene))
+	{
+		m_view = view;
+		m_scene = scene;
+		m_samples = 0;
+		std::fill(m_accumulated.begin(), m_accumulated.end(), glm::vec3{ 0.f });
+
+		// Camera of OpenGL renderer, moved to object space
+		const glm::mat4 projectionMatrix = glm::perspectiveFov(glm::radians(view.fov), float(m_width), float(m_height), 1.f, 10000.0f);
+		const glm::mat4 viewRotationMatrix = glm::eulerAngleXY(glm::radians(view.pitch), glm::radians(view.yaw));
+		const glm::mat4 viewMatrix = glm::translate(glm::mat4{ 1.0f }, { 0.0f, 0.0f, -view.distance }) * viewRotationMatrix;
+		const glm::mat4 modelMatrix = glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
+		const glm::mat4 inverseViewProjection = glm::inverse(projectionMatrix * viewMatrix * modelMatrix);
+		m_modelRotation = glm::mat3{ modelMatrix };
+		m_eyePosition = glm::vec3{ glm::inverse(viewMatrix * modelMatrix) * glm::vec4{ 0, 0, 0, 1.f } };
+		const auto farPoint = [&](float x, float y)
+		{
+			const glm::vec4 p = inverseViewProjection * glm::vec4{ 2.f * x / float(m_width) - 1.f, 2.f * y / float(m_height) - 1.f, 1.f, 1.f };
+			return glm::vec3{ p } / p.w;
+		};
+		const glm::vec3 farOrigin = farPoint(0.f, 0.f);
+		m_rayOrigin = farOrigin - m_eyePosition;
+		m_rayDx = (farPoint(float(m_width), 0.f) - farOrigin) / float(m_width);
+		m_rayDy = (farPoint(0.f, float(m_height)) - farOrigin) / float(m_height);
+
+		const glm::mat3 worldToObject = glm::transpose(m_modelRotation);
+		for (int i = 0; i < SceneSettings::NumLights; i++)
+		{
+			m_lightDirections[i] = -(worldToObject * scene.lights[i].direction);
+			m_lightRadiance[i] = scene.lights[i].enabled ? scene.lights[i].radiance : glm::vec3{ 0.f };
+		}
+	}
+	m_samples++;
+
+	const size_t numTiles = size_t(m_tilesX) * m_tilesY;
+	const size_t threads = (0 != m_threads) ? m_threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+	const size_t workers = std::min(threads, numTiles);
+	std::atomic<size_t> nextTile{ 0 };
+	parallelFor(workers, 1, [&](size_t, size_t)
+	{
+		for (size_t tile = nextTile++; tile < numTiles; tile = nextTile++)
+		{
+			renderTile(int(tile));
+		}
+	}, workers);
+}
+
+std::vector<glm::vec3> PathTracer::radiance() const
+{
+	std::vector<glm::vec3> result(m_accumulated.size(), glm::vec3{ 0.f });
+	const float scale = 1.f / float(std::max(1, m_samples));
+	for (size_t i = 0; i < result.size(); i++)
+	{
+		result[i] = m_accumulated[i] * scale;
+	}
+	return result;
+}
+
+void PathTracer::buildEnvironment(const std::shared_ptr<Image>& image)
+{
+	if (!image || !image->isHDR() || image->channels() < 3)
+	{
+		throw std::runtime_error("Environment map must be HDR image");
+	}
+	const int width = image->width(), height = image->height(), channels = image->channels();
+	const float* pixels = image->pixels<float>();
+	m_environment.image = image;
+	m_environment.rowCdf.assign(size_t(height) + 1, 0.f);
+	m_environment.columnCdf.assign(size_t(width + 1) * height, 0.f);
+
+	// Texels are weighted by luminance and solid angle
+	for (int y = 0; y < height; y++)
+	{
+		const float sinTheta = std::sin(PI * (float(y) + 0.5f) / float(height));
+		float* cdf = &m_environment.columnCdf[size_t(width + 1) * y];
+		for (int x = 0; x < width; x++)
+		{
+			const float* p = pixels + (size_t(y) * width + x) * channels;
+			cdf[x + 1] = cdf[x] + std::max(0.f, luminance(glm::vec3{ p[0], p[1], p[2] })) * sinTheta;
+		}
+		m_environment.rowCdf[y + 1] = m_environment.rowCdf[y] + cdf[width];
+		for (int x = 1; x <= width; x++)
+		{
+			cdf[x] = (cdf[width] > 0.f) ? cdf[x] / cdf[width] : float(x) / float(width);
+		}
+	}
+	m_environment.total = m_environment.rowCdf[height];
+	for (float& value : m_environment.rowCdf)
+	{
+		value = (m_environment.total > 0.f) ? value / m_environment.total : 0.f;
+	}
+}
+
+glm::vec3 PathTracer::Environment::radiance(const glm::vec3& dir) const
+{
+	// Same mapping as IblMaps::environment(), nearest texel as sampling is piecewise constant
+	const int width = image->width(), height = image->height();
+	const float u = std::atan2(dir.z, dir.x) / TwoPI;
+	const float v = std::acos(glm::clamp(dir.y, -1.f, 1.f)) / PI;
+	const int x = std::min(width - 1, int((u - std::floor(u)) * float(width)));
+	const int y = glm::clamp(int(v * float(height)), 0, height - 1);
+	const float* p = image->pixels<float>() + (size_t(y) * width + x) * image->channels();
+	return glm::vec3{ p[0], p[1], p[2] };
+}
+
+glm::vec3 PathTracer::Environment::sample(const glm::vec2& u, float& pdf) const
+{
+	const int width = image->width(), height = image->height();
+	const int y = glm::clamp(int(std::upper_bound(rowCdf.begin(), rowCdf.end(), u.y) - rowCdf.begin()) - 1, 0, height - 1);
+	const float* cdf = &columnCdf[size_t(width + 1) * y];
+	const int x = glm::clamp(int(std::upper_bound(cdf, cdf + width + 1, u.x) - cdf) - 1, 0, width - 1);
+	const float rowPdf = rowCdf[y + 1] - rowCdf[y], columnPdf = cdf[x + 1] - cdf[x];
+
+	// Position inside of texel is uniform
+	const float fy = glm::clamp((u.y - rowCdf[y]) / std::max(rowPdf, 1e-30f), 0.f, 1.f);
+	const float fx = glm::clamp((u.x - cdf[x]) / std::max(columnPdf, 1e-30f), 0.f, 1.f);
+	const float theta = PI * (float(y) + fy) / float(height);
+	const float phi = TwoPI * (float(x) + fx) / float(width);
+	const float sinTheta = std::sin(theta);
+	pdf = (sinTheta > 0.f) ? rowPdf * columnPdf * float(width) * float(height) / (2.f * PI * PI * sinTheta) : 0.f;
+	return glm::vec3{ sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi) };
+}
+
+float PathTracer::Environment::pdf(const glm::vec3& dir) const
+{
+	if (!(total > 0.f))
+	{
+		return 0.f;
+	}
+	const int width = image->width(), height = image->height();
+	const float u = std::atan2(dir.z, dir.x) / TwoPI;
+	const float cosTheta = glm::clamp(dir.y, -1.f, 1.f);
+	const int x = std::min(width - 1, int((u - std::floor(u)) * float(width)));
+	const int y = glm::clamp(int(std::acos(cosTheta) / PI * float(height)), 0, height - 1);
+	const float* cdf = &columnCdf[size_t(width + 1) * y];
+	const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+	return (sinTheta > 0.f) ? (rowCdf[y + 1] - rowCdf[y]) * (cdf[x + 1] - cdf[x]) * float(width) * float(height) / (2.f * PI * PI * sinTheta) : 0.f;
+}
+
+void PathTracer::renderTile(int tile)
+{
+	const int tileX = (tile % m_tilesX) * TileSize, tileY = (tile / m_tilesX) * TileSize;
+	const int endX = std::min(tileX + TileSize, m_width), endY = std::min(tileY + TileSize, m_height);
+	const uint32_t sampleIndex = uint32_t(m_samples - 1);
+	const float scale = 1.f / float(m_samples);
+
+	// Paths of 2x2 pixels are traced together
+	for (int y = tileY; y < endY; y += 2)
+	{
+		for (int x = tileX; x < endX; x += 2)
+		{
+			Path paths[Bvh::PacketSize];
+			for (int lane = 0; lane < Bvh::PacketSize; lane++)
+			{
+				const int px = x + (lane & 1), py = y + (lane >> 1);
+				Path& path = paths[lane];
+				path.active = px < endX && py < endY;
+				path.sampler = Sampler{ uint32_t(py * m_width + px), sampleIndex };
+				const float jx = path.sampler.next(), jy = path.sampler.next();
+				path.origin = m_eyePosition;
+				path.direction = glm::normalize(m_rayOrigin + (float(px) + jx) * m_rayDx + (float(py) + jy) * m_rayDy);
+				path.throughput = glm::vec3{ 1.f };
+				path.radiance = glm::vec3{ 0.f };
+				path.directionPdf = 0.f;
+				path.bounce = 0;
+			}
+
+			tracePackets(paths);
+
+			for (int lane = 0; lane < Bvh::PacketSize; lane++)
+			{
+				const int px = x + (lane & 1), py = y + (lane >> 1);
+				if (px < endX && py < endY)
+				{
+					// Window Y goes up, rows of image go down
+					const size_t i = size_t(m_height - 1 - py) * m_width + px;
+					const glm::vec3& radiance = paths[lane].radiance;
+					m_accumulated[i] += (std::isfinite(radiance.x) && std::isfinite(radiance.y) && std::isfinite(radiance.z)) ? radiance : glm::vec3{ 0.f };
+					m_pixels[i] = tonemap(m_accumulated[i] * scale);
+				}
+			}
+		}
+	}
+}
+
+void PathTracer::tracePackets(Path (&paths)[Bvh::PacketSize]) const
+{
+	const int numShadowRays = SceneSettings::NumLights + 1;	// lights and environment
+	for (;;)
+	{
+		int activeMask = 0;
+		Bvh::RayPacket rays;
+		Sampler samplers[Bvh::PacketSize];
+		float origin[3][Bvh::PacketSize], direction[3][Bvh::PacketSize];
+		for (int lane = 0; lane < Bvh::PacketSize; lane++)
+		{
+			activeMask |= paths[lane].active ? (1 << lane) : 0;
+			samplers[lane] = paths[lane].sampler;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				origin[axis][lane] = paths[lane].origin[axis];
+				direction[axis][lane] = paths[lane].direction[axis];
+			}
+		}
+		if (0 == activeMask)
+		{
+			return;
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			rays.origin[axis] = Float4::load(origin[axis]);
+			rays.direction[axis] = Float4::load(direction[axis]);
+		}
+		Bvh::Hit hits[Bvh::PacketSize];
+		closestHits(rays, activeMask, samplers, hits);
+
+		// Shadow rays of all lanes to one light are traced as packet
+		glm::vec3 shadowOrigin[Bvh::PacketSize];
+		glm::vec3 shadowDirection[numShadowRays][Bvh::PacketSize];
+		glm::vec3 shadowRadiance[numShadowRays][Bvh::PacketSize];
+		int shadowMask[numShadowRays] = {};
+
+		for (int lane = 0; lane < Bvh::PacketSize; lane++)
+		{
+			Path& path = paths[lane];
+			path.sampler = samplers[lane];
+			if (!path.active)
+			{
+				continue;
+			}
+			if (~0u == hits[lane].triangle)
+			{
+				// Environment seen directly or found by BRDF sampling, weighted against environment sampling
+				const glm::vec3 worldDirection = toWorld(path.direction);
+				const float weight = (path.directionPdf > 0.f) ? powerHeuristic(path.directionPdf, m_environment.pdf(worldDirection)) : 1.f;
+				path.radiance += path.throughput * m_environment.radiance(worldDirection) * weight;
+				path.active = false;
+				continue;
+			}
+
+			const SurfaceHit hit = surfaceHit(hits[lane], path.origin, path.direction);
+			const SurfaceSample surface = hit.material->sample(hit.texcoord, glm::vec2{ 0.f }, glm::vec2{ 0.f });
+			const glm::vec3 Lo = -path.direction;
+			glm::vec3 N = glm::normalize(hit.tangentBasis * surface.normal);
+			N = (glm::dot(N, Lo) > 0.f) ? N : hit.geometricNormal;
+			const Lobes lobes{ surface, glm::dot(N, Lo) };
+			shadowOrigin[lane] = hit.position + hit.geometricNormal * m_rayOffset;
+
+			// Next event estimation, occlusion of ambient light is found by tracing, baked occlusion isn't used
+			for (int i = 0; i < SceneSettings::NumLights; i++)
+			{
+				if (glm::vec3{ 0.f } != m_lightRadiance[i] && glm::dot(hit.geometricNormal, m_lightDirections[i]) > 0.f)
+				{
+					shadowDirection[i][lane] = m_lightDirections[i];
+					shadowRadiance[i][lane] = path.throughput * lobes.directLight(N, Lo, m_lightDirections[i]) * m_lightRadiance[i];
+					shadowMask[i] |= 1 << lane;
+				}
+			}
+			if (m_environment.total > 0.f)
+			{
+				float pdf;
+				const glm::vec2 u{ path.sampler.next(), path.sampler.next() };
+				const glm::vec3 worldLi = m_environment.sample(u, pdf);
+				const glm::vec3 Li = glm::transpose(m_modelRotation) * worldLi;
+				if (pdf > 0.f && glm::dot(hit.geometricNormal, Li) > 0.f)
+				{
+					const float weight = powerHeuristic(pdf, lobes.pdf(N, Lo, Li));
+					const glm::vec3 f = lobes.brdf(N, Lo, Li) * std::max(0.f, glm::dot(N, Li));
+					shadowDirection[numShadowRays - 1][lane] = Li;
+					shadowRadiance[numShadowRays - 1][lane] = path.throughput * f * m_environment.radiance(worldLi) * (weight / pdf);
+					shadowMask[numShadowRays - 1] |= 1 << lane;
+				}
+			}
+
+			// Continue by BRDF sampling
+			const float u0 = path.sampler.next(), u1 = path.sampler.next(), u2 = path.sampler.next();
+			const glm::vec3 Li = lobes.sample(N, Lo, u0, u1, u2);
+			const float pdf = lobes.pdf(N, Lo, Li);
+			if (!(pdf > 0.f) || glm::dot(hit.geometricNormal, Li) <= 0.f || ++path.bounce > m_maxBounces)
+			{
+				path.active = false;
+				continue;
+			}
+			path.throughput *= lobes.brdf(N, Lo, Li) * glm::dot(N, Li) / pdf;
+			path.origin = shadowOrigin[lane];
+			path.direction = Li;
+			path.directionPdf = pdf;
+			if (path.bounce >= RussianRouletteBounce)
+			{
+				const float survival = std::min(0.95f, std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z)));
+				if (path.sampler.next() >= survival)
+				{
+					path.active = false;
+					continue;
+				}
+				path.throughput /= survival;
+			}
+		}
+
+		for (int i = 0; i < numShadowRays; i++)
+		{
+			if (0 == shadowMask[i])
+			{
+				continue;
+			}
+			for (int lane = 0; lane < Bvh::PacketSize; lane++)
+			{
+				const bool used = 0 != (shadowMask[i] & (1 << lane));
+				samplers[lane] = paths[lane].sampler;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					origin[axis][lane] = used ? shadowOrigin[lane][axis] : 0.f;
+					direction[axis][lane] = used ? shadowDirection[i][lane][axis] : 1.f;
+				}
+			}
+			for (int axis = 0; axis < 3; axis++)
+			{
+				rays.origin[axis] = Float4::load(origin[axis]);
+				rays.direction[axis] = Float4::load(direction[axis]);
+			}
+			rays.tMax = Float4{ 3.4e38f };
+			closestHits(rays, shadowMask[i], samplers, hits);
+			for (int lane = 0; lane < Bvh::PacketSize; lane++)
+			{
+				paths[lane].sampler = samplers[lane];
+				if (0 != (shadowMask[i] & (1 << lane)) && ~0u == hits[lane].triangle)
+				{
+					paths[lane].radiance += shadowRadiance[i][lane];
+				}
+			}
+		}
+	}
+}
+
+void PathTracer::closestHits(Bvh::RayPacket& rays, int activeMask, Sampler (&samplers)[Bvh::PacketSize], Bvh::Hit (&hits)[Bvh::PacketSize]) const
+{
+	m_bvh.intersect(rays, activeMask, hits);
+
+	// Surfaces are passed through with probability of their transparency, rays go on from hit point
+	float travelled[Bvh::PacketSize] = {};
+	for (int pass = 0; pass < MaxAlphaPasses; pass++)
+	{
+		int passMask = 0;
+		for (int lane = 0; lane < Bvh::PacketSize; lane++)
+		{
+			if (0 != (activeMask & (1 << lane)) && ~0u != hits[lane].triangle)
+			{
+				const float alpha = coverage(hits[lane]);
+				passMask |= (alpha < 1.f && samplers[lane].next() >= alpha) ? (1 << lane) : 0;
+			}
+		}
+		if (0 == passMask)
+		{
+			return;
+		}
+
+		float origin[3][Bvh::PacketSize], direction[3][Bvh::PacketSize], t[Bvh::PacketSize];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			rays.origin[axis].store(origin[axis]);
+			rays.direction[axis].store(direction[axis]);
+		}
+		for (int lane = 0; lane < Bvh::PacketSize; lane++)
+		{
+			t[lane] = (0 != (passMask & (1 << lane))) ? hits[lane].t + m_rayOffset : 0.f;
+			travelled[lane] += t[lane];
+		}
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int lane = 0; lane < Bvh::PacketSize; lane++)
+			{
+				origin[axis][lane] += direction[axis][lane] * t[lane];
+			}
+			rays.origin[axis] = Float4::load(origin[axis]);
+		}
+
+		Bvh::Hit passHits[Bvh::PacketSize];
+		m_bvh.intersect(rays, passMask, passHits);
+		for (int lane = 0; lane < Bvh::PacketSize; lane++)
+		{
+			if (0 != (passMask & (1 << lane)))
+			{
+				hits[lane] = passHits[lane];
+				hits[lane].t += travelled[lane];	// from origin of ray
+			}
+		}
+	}
+}
+
+PathTracer::SurfaceHit PathTracer::surfaceHit(const Bvh::Hit& hit, const glm::vec3& origin, const glm::vec3& direction) const
+{
+	const Draw& draw = m_draws[m_triangleDraws[hit.triangle]];
+	const Mesh::Face& face = draw.mesh->faces()[hit.triangle - draw.firstTriangle];
+	const Mesh::Vertex& v0 = draw.mesh->vertices()[face.v1];
+	const Mesh::Vertex& v1 = draw.mesh->vertices()[face.v2];
+	const Mesh::Vertex& v2 = draw.mesh->vertices()[face.v3];
+	const glm::vec3 w{ 1.f - hit.u - hit.v, hit.u, hit.v };
+
+	SurfaceHit result;
+	result.position = origin + direction * hit.t;
+	result.geometricNormal = glm::normalize(glm::cross(v1.position - v0.position, v2.position - v0.position));
+	result.tangentBasis = glm::mat3{ v0.tangent * w.x + v1.tangent * w.y + v2.tangent * w.z,
+									 v0.bitangent * w.x + v1.bitangent * w.y + v2.bitangent * w.z,
+									 v0.normal * w.x + v1.normal * w.y + v2.normal * w.z };
+	const glm::vec2 texcoord = v0.texcoord * w.x + v1.texcoord * w.y + v2.texcoord * w.z;
+	result.texcoord = glm::vec2{ texcoord.x, 1.f - texcoord.y };	// as in pbr_vs.glsl
+	result.material = &draw.material;
+
+	// Surfaces are two sided
+	if (glm::dot(result.geometricNormal, direction) > 0.f)
+	{
+		result.geometricNormal = -result.geometricNormal;
+		result.tangentBasis[2] = -result.tangentBasis[2];
+	}
+	return result;
+}
+
+float PathTracer::coverage(const Bvh::Hit& hit) const
+{
+	const Draw& draw = m_draws[m_triangleDraws[hit.triangle]];
+	const SurfaceMaterial& material = draw.material;
+	if (AlphaMode::Opaque == material.alphaMode)
+	{
+		return 1.f;
+	}
+	const Mesh::Face& face = draw.mesh->faces()[hit.triangle - draw.firstTriangle];
+	const glm::vec2 texcoord = draw.mesh->vertices()[face.v1].texcoord * (1.f - hit.u - hit.v)
+							 + draw.mesh->vertices()[face.v2].texcoord * hit.u + draw.mesh->vertices()[face.v3].texcoord * hit.v;
+	const float alpha = material.alpha(glm::vec2{ texcoord.x, 1.f - texcoord.y }, glm::vec2{ 0.f }, glm::vec2{ 0.f });
+	return (AlphaMode::Cutout == material.alphaMode) ? ((alpha < 0.5f) ? 0.f : 1.f) : alpha;
+}
@@ -0,0 +1,125 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+#include "renderer.hpp"
+#include "surface.hpp"
+
+class Image;
+class Mesh;
+
+// Reference renderer of the scene drawn by OpenGL renderer: unidirectional path tracing with next event estimation
+// of lights and environment (multiple importance sampling with BRDF sampling), exact alpha (stochastic coverage)
+// and no precomputed lighting, as ground truth for split-sum IBL and order independent transparency. Every render()
+// adds one sample per pixel, the image converges while view and scene stay the same. Pixels are traced in 2x2
+// packets by tiles taken by threads one by one. Random numbers depend on pixel and sample only, so images don't
+// depend on number of threads.
+class PathTracer
+{
+public:
+	static const int TileSize = 16;
+
+	explicit PathTracer(int width = 1280, int height = 720);
+	~PathTracer();
+
+	// Loads environment and meshes drawn by OpenGL renderer (paths relative to data directory), builds BVH.
+	void loadScene();
+	void resize(int width, int height);
+	// Threads used by render() and BVH build, 0 means one per hardware thread.
+	void setThreads(size_t threads) { m_threads = threads; }
+	// Longest path in surface bounces, paths may end earlier by russian roulette.
+	void setMaxBounces(int bounces) { m_maxBounces = bounces; m_samples = 0; }
+	// Adds sample per pixel, accumulation restarts when view or scene differ from the previous call.
+	void render(const ViewSettings& view, const SceneSettings& scene);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	int samples() const { return m_samples; }
+	// RGBA8 of the tonemapped average, R in the lowest byte, rows from top to bottom.
+	const std::vector<uint32_t>& pixels() const { return m_pixels; }
+	// Linear average radiance, rows from top to bottom.
+	std::vector<glm::vec3> radiance() const;
+	size_t numTriangles() const { return m_triangleDraws.size(); }
+
+private:
+	struct Draw
+	{
+		std::shared_ptr<Mesh> mesh;
+		SurfaceMaterial material;
+		uint32_t firstVertex;
+		uint32_t firstTriangle;
+	};
+
+	// Equirectangular environment with piecewise constant importance sampling of radiance * sin(theta)
+	struct Environment
+	{
+		std::shared_ptr<Image> image;
+		std::vector<float> rowCdf;			// height + 1 values
+		std::vector<float> columnCdf;		// (width + 1) values per row
+		float total;
+
+		glm::vec3 radiance(const glm::vec3& dir) const;
+		// Returns direction, pdf is per solid angle
+		glm::vec3 sample(const glm::vec2& u, float& pdf) const;
+		float pdf(const glm::vec3& dir) const;
+	};
+
+	// Surface hit by ray, object space
+	struct SurfaceHit
+	{
+		glm::vec3 position;
+		glm::vec3 geometricNormal;	// faces the ray
+		glm::mat3 tangentBasis;
+		glm::vec2 texcoord;
+		const SurfaceMaterial* material;
+	};
+
+	struct Sampler;
+	struct Path;
+
+	void buildEnvironment(const std::shared_ptr<Image>& image);
+	bool sameFrame(const ViewSettings& view, const SceneSettings& scene) const;
+	void renderTile(int tile);
+	void tracePackets(Path (&paths)[Bvh::PacketSize]) const;
+	void closestHits(Bvh::RayPacket& rays, int activeMask, Sampler (&samplers)[Bvh::PacketSize], Bvh::Hit (&hits)[Bvh::PacketSize]) const;
+	SurfaceHit surfaceHit(const Bvh::Hit& hit, const glm::vec3& origin, const glm::vec3& direction) const;
+	float coverage(const Bvh::Hit& hit) const;
+	glm::vec3 toWorld(const glm::vec3& dir) const { return m_modelRotation * dir; }
+
+	int m_width;
+	int m_height;
+	int m_tilesX;
+	int m_tilesY;
+	size_t m_threads;
+	int m_maxBounces;
+	float m_rayOffset;					// ray origins are moved off surfaces by this
+
+	// Scene in object space, all objects share model matrix, so rays are transformed instead of geometry
+	std::vector<Draw> m_draws;
+	std::vector<uint32_t> m_triangleDraws;	// draw of every triangle
+	Bvh m_bvh;
+	Environment m_environment;
+
+	// Accumulation
+	ViewSettings m_view;
+	SceneSettings m_scene;
+	int m_samples;
+	glm::mat3 m_modelRotation;			// object to world
+	glm::vec3 m_eyePosition;			// object space
+	glm::vec3 m_rayOrigin;				// ray direction of window point (x, y) is m_rayOrigin + x * m_rayDx + y * m_rayDy
+	glm::vec3 m_rayDx;
+	glm::vec3 m_rayDy;
+	glm::vec3 m_lightDirections[SceneSettings::NumLights];	// object space, towards light
+	glm::vec3 m_lightRadiance[SceneSettings::NumLights];
+	std::vector<glm::vec3> m_accumulated;
+	std::vector<uint32_t> m_pixels;
+};
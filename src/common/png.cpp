@@ -0,0 +1,306 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "png.hpp"
+
+namespace {
+	const int WindowSize = 32768;
+	const int HashBits = 15;
+	const int MinMatch = 3;
+	const int MaxMatch = 258;
+	const int MaxChainLength = 32;		// candidates tried per position
+
+	struct CrcTable
+	{
+		uint32_t values[256];
+		CrcTable()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t c = i;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				values[i] = c;
+			}
+		}
+	};
+	const CrcTable crcTable;
+
+	uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+	{
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+		{
+			crc = crcTable.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	uint32_t adler32(const unsigned char* data, size_t size)
+	{
+		uint32_t a = 1, b = 0;
+		while (size > 0)
+		{
+			// Sums don't overflow within 5552 bytes
+			const size_t block = std::min<size_t>(size, 5552);
+			for (size_t i = 0; i < block; i++)
+			{
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			data += block;
+			size -= block;
+		}
+		return (b << 16) | a;
+	}
+
+	// Bits go to bytes from the lowest one, as deflate stores them
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<unsigned char>& output) : m_output(output), m_bits(0), m_count(0) {}
+
+		void write(uint32_t value, int count)
+		{
+			m_bits |= uint64_t(value) << m_count;
+			m_count += count;
+			while (m_count >= 8)
+			{
+				m_output.push_back((unsigned char)(m_bits & 0xFF));
+				m_bits >>= 8;
+				m_count -= 8;
+			}
+		}
+		// Huffman codes are stored from the highest bit
+		void writeCode(uint32_t code, int length)
+		{
+			uint32_t reversed = 0;
+			for (int i = 0; i < length; i++)
+			{
+				reversed |= ((code >> i) & 1) << (length - 1 - i);
+			}
+			write(reversed, length);
+		}
+		void flush()
+		{
+			if (m_count > 0)
+			{
+				m_output.push_back((unsigned char)(m_bits & 0xFF));
+			}
+			m_bits = 0;
+			m_count = 0;
+		}
+
+	private:
+		std::vector<unsigned char>& m_output;
+		uint64_t m_bits;
+		int m_count;
+	};
+
+	// Fixed Huffman code of literal/length symbol
+	void writeLiteral(BitWriter& writer, int symbol)
+	{
+		if (symbol < 144)
+			writer.writeCode(0x30 + symbol, 8);
+		else if (symbol < 256)
+			writer.writeCode(0x190 + symbol - 144, 9);
+		else if (symbol < 280)
+			writer.writeCode(symbol - 256, 7);
+		else
+			writer.writeCode(0xC0 + symbol - 280, 8);
+	}
+
+	void writeMatch(BitWriter& writer, int length, int distance)
+	{
+		static const int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+											35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+											 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const int distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+											  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const int distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+											   7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		const int lengthCode = int(std::upper_bound(lengthBase, lengthBase + 29, length) - lengthBase) - 1;
+		writeLiteral(writer, 257 + lengthCode);
+		writer.write(uint32_t(length - lengthBase[lengthCode]), lengthExtra[lengthCode]);
+
+		const int distanceCode = int(std::upper_bound(distanceBase, distanceBase + 30, distance) - distanceBase) - 1;
+		writer.writeCode(uint32_t(distanceCode), 5);
+		writer.write(uint32_t(distance - distanceBase[distanceCode]), distanceExtra[distanceCode]);
+	}
+
+	// zlib stream of data: one final deflate block with fixed codes
+	std::vector<unsigned char> compress(const std::vector<unsigned char>& data)
+	{
+		std::vector<unsigned char> output{ 0x78, 0x01 };
+		BitWriter writer{ output };
+		writer.write(1, 1);		// final block
+		writer.write(1, 2);		// fixed Huffman codes
+
+		const int size = int(data.size());
+		const auto hash = [&](int i)
+		{
+			return ((uint32_t(data[i]) << 16 | uint32_t(data[i + 1]) << 8 | data[i + 2]) * 2654435761u) >> (32 - HashBits);
+		};
+		std::vector<int> head(size_t(1) << HashBits, -1);
+		std::vector<int> previous(WindowSize, -1);		// previous position of the same hash, by position % WindowSize
+		const auto insert = [&](int i)
+		{
+			const uint32_t h = hash(i);
+			previous[i % WindowSize] = head[h];
+			head[h] = i;
+		};
+
+		int i = 0;
+		while (i < size)
+		{
+			int bestLength = 0, bestDistance = 0;
+			if (i + MinMatch <= size)
+			{
+				const int maxLength = std::min(MaxMatch, size - i);
+				int candidate = head[hash(i)];
+				for (int chain = 0; chain < MaxChainLength && candidate >= 0 && i - candidate <= WindowSize; chain++)
+				{
+					if (data[candidate + bestLength] == data[i + bestLength])
+					{
+						int length = 0;
+						while (length < maxLength && data[candidate + length] == data[i + length])
+						{
+							length++;
+						}
+						if (length > bestLength)
+						{
+							bestLength = length;
+							bestDistance = i - candidate;
+							if (length == maxLength)
+							{
+								break;
+							}
+						}
+					}
+					candidate = previous[candidate % WindowSize];
+				}
+				insert(i);
+			}
+
+			if (bestLength >= MinMatch)
+			{
+				writeMatch(writer, bestLength, bestDistance);
+				for (int j = i + 1; j < i + bestLength && j + MinMatch <= size; j++)
+				{
+					insert(j);
+				}
+				i += bestLength;
+			}
+			else
+			{
+				writeLiteral(writer, data[i]);
+				i++;
+			}
+		}
+		writeLiteral(writer, 256);
+		writer.flush();
+
+		const uint32_t checksum = adler32(data.data(), data.size());
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			output.push_back((unsigned char)(checksum >> shift));
+		}
+		return output;
+	}
+
+	void appendChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data)
+	{
+		const auto appendUint = [&](uint32_t value)
+		{
+			for (int shift = 24; shift >= 0; shift -= 8)
+			{
+				png.push_back((unsigned char)(value >> shift));
+			}
+		};
+		appendUint(uint32_t(data.size()));
+		const size_t start = png.size();
+		png.insert(png.end(), type, type + 4);
+		png.insert(png.end(), data.begin(), data.end());
+		appendUint(crc32(&png[start], png.size() - start));
+	}
+
+	unsigned char paeth(int a, int b, int c)
+	{
+		const int p = a + b - c;
+		const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		return (unsigned char)((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+	}
+}
+
+std::vector<unsigned char> encodePng(int width, int height, const uint32_t* pixels)
+{
+	const size_t count = size_t(width) * height;
+	const bool opaque = std::all_of(pixels, pixels + count, [](uint32_t pixel) { return (pixel >> 24) == 0xFF; });
+	const int channels = opaque ? 3 : 4;
+	const size_t rowSize = size_t(width) * channels;
+
+	// Filtered rows, each starts with its filter type
+	std::vector<unsigned char> filtered((rowSize + 1) * height);
+	std::vector<unsigned char> previousRow(rowSize, 0), row(rowSize), candidate(rowSize);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const uint32_t pixel = pixels[size_t(y) * width + x];
+			for (int c = 0; c < channels; c++)
+			{
+				row[size_t(x) * channels + c] = (unsigned char)(pixel >> (8 * c));
+			}
+		}
+
+		unsigned char* out = &filtered[(rowSize + 1) * y];
+		uint64_t bestCost = ~uint64_t(0);
+		for (int filter = 0; filter < 5; filter++)
+		{
+			uint64_t cost = 0;
+			for (size_t i = 0; i < rowSize; i++)
+			{
+				const int a = (i >= size_t(channels)) ? row[i - channels] : 0;
+				const int b = previousRow[i];
+				const int c = (i >= size_t(channels)) ? previousRow[i - channels] : 0;
+				const int predicted = (0 == filter) ? 0 : (1 == filter) ? a : (2 == filter) ? b : (3 == filter) ? (a + b) / 2 : paeth(a, b, c);
+				candidate[i] = (unsigned char)(row[i] - predicted);
+				cost += uint64_t(std::abs(int(static_cast<signed char>(candidate[i]))));
+			}
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				out[0] = (unsigned char)filter;
+				std::memcpy(out + 1, candidate.data(), rowSize);
+			}
+		}
+		std::swap(previousRow, row);
+	}
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<unsigned char> png(signature, signature + 8);
+	std::vector<unsigned char> header(13, 0);
+	for (int i = 0; i < 4; i++)
+	{
+		header[i] = (unsigned char)(uint32_t(width) >> (24 - 8 * i));
+		header[4 + i] = (unsigned char)(uint32_t(height) >> (24 - 8 * i));
+	}
+	header[8] = 8;									// bits per channel
+	header[9] = opaque ? 2 : 6;						// RGB or RGBA
+	appendChunk(png, "IHDR", header);
+	appendChunk(png, "IDAT", compress(filtered));
+	appendChunk(png, "IEND", {});
+	return png;
+}
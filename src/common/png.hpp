@@ -0,0 +1,14 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// PNG file of RGBA8 pixels (R in the lowest byte, rows from top to bottom), RGB if every pixel is opaque.
+// Rows are filtered with the filter of smallest sum of absolute differences, zlib stream is one deflate block with
+// fixed Huffman codes and greedy LZ77 matches, so encoding is fast and images with flat areas compress well.
+std::vector<unsigned char> encodePng(int width, int height, const uint32_t* pixels);
@@ -0,0 +1,71 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <array>
+#include <cstring>
+
+#include "radix_sort.hpp"
+#include "mesh.hpp"
+
+uint32_t sortableFloat(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	// Negative values have all bits flipped, positive ones only the sign bit
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+void radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values)
+{
+	std::vector<uint32_t> keysTemp(keys.size()), valuesTemp(values.size());
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		std::array<size_t, 256> offsets{};
+		for (uint32_t key : keys)
+		{
+			offsets[(key >> shift) & 0xFF]++;
+		}
+		size_t sum = 0;
+		for (auto& offset : offsets)
+		{
+			const size_t count = offset;
+			offset = sum;
+			sum += count;
+		}
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			const size_t pos = offsets[(keys[i] >> shift) & 0xFF]++;
+			keysTemp[pos] = keys[i];
+			valuesTemp[pos] = values[i];
+		}
+		keys.swap(keysTemp);
+		values.swap(valuesTemp);
+	}
+}
+
+void sortTrianglesBackToFront(const Mesh& mesh, const glm::mat4& modelView, std::vector<uint32_t>& indices)
+{
+	const auto& vertices = mesh.vertices();
+	const auto& faces = mesh.faces();
+	std::vector<uint32_t> keys(faces.size()), triangles(faces.size());
+	const glm::vec4 depthRow{ modelView[0][2], modelView[1][2], modelView[2][2], modelView[3][2] };
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		const glm::vec3 centroid = (vertices[faces[i].v1].position + vertices[faces[i].v2].position
+									+ vertices[faces[i].v3].position) / 3.f;
+		keys[i] = sortableFloat(glm::dot(depthRow, glm::vec4{ centroid, 1.f }));
+		triangles[i] = uint32_t(i);
+	}
+	radixSort(keys, triangles);
+
+	indices.resize(faces.size() * 3);
+	for (size_t i = 0; i < triangles.size(); i++)
+	{
+		const auto& face = faces[triangles[i]];
+		indices[3 * i] = face.v1;
+		indices[3 * i + 1] = face.v2;
+		indices[3 * i + 2] = face.v3;
+	}
+}
@@ -0,0 +1,22 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Mesh;
+
+// Maps float to unsigned integer with the same order, negative values included.
+uint32_t sortableFloat(float value);
+
+// Stable LSD radix sort of 32 bit keys (four 8 bit passes), values are reordered with keys.
+void radixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values);
+
+// Triangle indices of mesh ordered by view depth of centroids, farthest first (view looks along -Z).
+// CPU counterpart of sort_cs.glsl and radix_sort_cs.glsl.
+void sortTrianglesBackToFront(const Mesh& mesh, const glm::mat4& modelView, std::vector<uint32_t>& indices);
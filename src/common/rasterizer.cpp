@@ -0,0 +1,585 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+
+#include "rasterizer.hpp"
+#include "ibl.hpp"
+#include "image.hpp"
+#include "mesh.hpp"
+#include "parallel.hpp"
+#include "radix_sort.hpp"
+#include "simd.hpp"
+
+namespace {
+	// Work smaller than this isn't split between threads
+	const size_t MinParallelVertices = 1024;
+
+	// Pixel centers exactly on edge are inside only for top-left edges, so that pixels of shared edges are drawn once
+	inline Float4 edgeMask(Float4 edge, bool inclusive)
+	{
+		return inclusive ? greaterEqualMask(edge, Float4{ 0.f }) : greaterMask(edge, Float4{ 0.f });
+	}
+
+	// Calls func(x, y, depth) for pixels of tile covered by triangle whose depth is less than depth in buffer.
+	// Coverage and depth test are done on four pixels at once.
+	template<class T, class F>
+	void coveredPixels(const T& tri, int tileX, int tileY, const float* depthBuffer, F func)
+	{
+		const int tileSize = Rasterizer::TileSize;
+		const int x0 = std::max(tri.rect.x, tileX), x1 = std::min(tri.rect.z, tileX + tileSize - 1);
+		const int y0 = std::max(tri.rect.y, tileY), y1 = std::min(tri.rect.w, tileY + tileSize - 1);
+		if (x0 > x1 || y0 > y1)
+		{
+			return;
+		}
+		const int startX = tileX + ((x0 - tileX) & ~3);
+		const bool inclusive0 = 0 != (tri.topLeft & 1), inclusive1 = 0 != (tri.topLeft & 2), inclusive2 = 0 != (tri.topLeft & 4);
+		const Float4 ramp = Float4::ramp();
+		const Float4 step0{ 4.f * tri.a.x }, step1{ 4.f * tri.a.y }, step2{ 4.f * tri.a.z }, stepZ{ 4.f * tri.depth.x };
+		for (int y = y0; y <= y1; y++)
+		{
+			const float py = float(y) + 0.5f;
+			const Float4 px = Float4{ float(startX) + 0.5f } + ramp;
+			Float4 e0 = Float4{ tri.a.x } * px + Float4{ tri.b.x * py + tri.c.x };
+			Float4 e1 = Float4{ tri.a.y } * px + Float4{ tri.b.y * py + tri.c.y };
+			Float4 e2 = Float4{ tri.a.z } * px + Float4{ tri.b.z * py + tri.c.z };
+			Float4 depth = Float4{ tri.depth.x } * px + Float4{ tri.depth.y * py + tri.depth.z };
+			const float* row = depthBuffer + size_t(y - tileY) * tileSize - tileX;
+			for (int x = startX; x <= x1; x += 4)
+			{
+				const Float4 inside = both(both(edgeMask(e0, inclusive0), edgeMask(e1, inclusive1)), edgeMask(e2, inclusive2));
+				const int mask = bits(both(inside, lessMask(depth, Float4::load(row + x))));
+				if (0 != mask)
+				{
+					float lanes[4];
+					depth.store(lanes);
+					for (int lane = 0; lane < 4 && x + lane <= x1; lane++)
+					{
+						if (0 != (mask & (1 << lane)))
+						{
+							func(x + lane, y, lanes[lane]);
+						}
+					}
+				}
+				e0 = e0 + step0;
+				e1 = e1 + step1;
+				e2 = e2 + step2;
+				depth = depth + stepZ;
+			}
+		}
+	}
+}
+
+Rasterizer::Rasterizer(int width, int height)
+	: m_width(0)
+	, m_height(0)
+	, m_tilesX(0)
+	, m_tilesY(0)
+	, m_threads(0)
+	, m_numTriangles(0)
+	, m_eyePosition(0.f)
+	, m_rayOrigin(0.f)
+	, m_rayDx(0.f)
+	, m_rayDy(0.f)
+	, m_firstTransparent(0)
+	, m_numChunks(0)
+{
+	resize(width, height);
+}
+
+Rasterizer::~Rasterizer() = default;
+
+Rasterizer::Model Rasterizer::Model::fromFile(const std::string& filename)
+{
+	Model model;
+	model.mesh = Mesh::fromFile(filename);
+	model.material = SurfaceMaterial::load(model.mesh);
+	return model;
+}
+
+void Rasterizer::loadScene()
+{
+	setScene(IblMaps::bake(Image::fromFile("environment.hdr", 3), m_threads),
+			 { Model::fromFile("meshes/siuzanna.fbx"), Model::fromFile("meshes/plate.fbx") });
+}
+
+void Rasterizer::setScene(const std::shared_ptr<IblMaps>& ibl, const std::vector<Model>& models)
+{
+	m_ibl = ibl;
+
+	m_draws.clear();
+	uint32_t numVertices = 0, numTriangles = 0;
+	for (const Model& model : models)
+	{
+		Draw draw;
+		draw.mesh = model.mesh;
+		draw.material = model.material;
+		draw.firstVertex = numVertices;
+		draw.firstTriangle = numTriangles;
+		numVertices += uint32_t(draw.mesh->vertices().size());
+		numTriangles += uint32_t(draw.mesh->faces().size());
+		m_draws.push_back(std::move(draw));
+	}
+	m_numTriangles = numTriangles;
+	m_vertices.resize(numVertices);
+	m_triangles.resize(2 * size_t(numTriangles));
+}
+
+void Rasterizer::resize(int width, int height)
+{
+	m_width = std::max(1, width);
+	m_height = std::max(1, height);
+	m_tilesX = (m_width + TileSize - 1) / TileSize;
+	m_tilesY = (m_height + TileSize - 1) / TileSize;
+	m_pixels.assign(size_t(m_width) * m_height, 0xFF000000u);
+}
+
+void Rasterizer::render(const ViewSettings& view, const SceneSettings& scene)
+{
+	// Same camera and model transform as OpenGL renderer
+	const glm::mat4 projectionMatrix = glm::perspectiveFov(glm::radians(view.fov), float(m_width), float(m_height), 1.f, 10000.0f);
+	const glm::mat4 viewRotationMatrix = glm::eulerAngleXY(glm::radians(view.pitch), glm::radians(view.yaw));
+	const glm::mat4 viewMatrix = glm::translate(glm::mat4{ 1.0f }, { 0.0f, 0.0f, -view.distance }) * viewRotationMatrix;
+	const glm::mat4 modelMatrix = glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
+	const glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+
+	m_eyePosition = glm::vec3{ glm::inverse(viewMatrix) * glm::vec4{ 0, 0, 0, 1.f } };
+	for (int i = 0; i < SceneSettings::NumLights; i++)
+	{
+		m_lightDirections[i] = scene.lights[i].direction;
+		m_lightRadiance[i] = scene.lights[i].enabled ? scene.lights[i].radiance : glm::vec3{ 0.f };
+	}
+
+	// Points of far plane are linear in window coordinates, so are view rays
+	const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+	const auto farPoint = [&](float x, float y)
+	{
+		const glm::vec4 p = inverseViewProjection * glm::vec4{ 2.f * x / float(m_width) - 1.f, 2.f * y / float(m_height) - 1.f, 1.f, 1.f };
+		return glm::vec3{ p } / p.w;
+	};
+	const glm::vec3 farOrigin = farPoint(0.f, 0.f);
+	m_rayOrigin = farOrigin - m_eyePosition;
+	m_rayDx = (farPoint(float(m_width), 0.f) - farOrigin) / float(m_width);
+	m_rayDy = (farPoint(0.f, float(m_height)) - farOrigin) / float(m_height);
+
+	transformVertices(viewProjection, modelMatrix);
+	sortTransparent(viewMatrix * modelMatrix);
+
+	// Every chunk of submitted triangles has its own bins
+	const size_t numTiles = size_t(m_tilesX) * m_tilesY;
+	m_numChunks = threads();
+	m_opaqueBins.resize(m_numChunks * numTiles);
+	m_transparentBins.resize(m_numChunks * numTiles);
+	parallelFor(m_numChunks, 1, [this](size_t begin, size_t end)
+	{
+		for (size_t chunk = begin; chunk < end; chunk++)
+		{
+			setupChunk(chunk, m_numChunks);
+		}
+	}, m_threads);
+
+	// Tiles differ in cost a lot, so threads take them one by one
+	std::atomic<size_t> nextTile{ 0 };
+	const size_t workers = std::min(threads(), numTiles);
+	parallelFor(workers, 1, [&](size_t, size_t)
+	{
+		TileBuffers buffers;
+		buffers.depth.resize(size_t(TileSize) * TileSize);
+		buffers.ids.resize(size_t(TileSize) * TileSize);
+		buffers.color.resize(size_t(TileSize) * TileSize);
+		for (size_t tile = nextTile++; tile < numTiles; tile = nextTile++)
+		{
+			renderTile(int(tile), buffers);
+		}
+	}, workers);
+}
+
+size_t Rasterizer::threads() const
+{
+	return (0 != m_threads) ? m_threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+void Rasterizer::transformVertices(const glm::mat4& viewProjection, const glm::mat4& modelMatrix)
+{
+	// All objects of the scene share the model matrix. Vertices of all draws are split between threads at once, so
+	// that small draws don't each make a parallel loop of their own.
+	const glm::mat3 normalMatrix{ glm::transpose(glm::inverse(modelMatrix)) };
+	parallelFor(m_vertices.size(), MinParallelVertices, [&](size_t begin, size_t end)
+	{
+		// Last draw that starts at or before the range
+		size_t draw = size_t(std::upper_bound(m_draws.begin(), m_draws.end(), begin,
+			[](size_t vertex, const Draw& d) { return vertex < d.firstVertex; }) - m_draws.begin()) - 1;
+		for (size_t i = begin; i < end; i++)
+		{
+			while (draw + 1 < m_draws.size() && i >= m_draws[draw + 1].firstVertex)
+			{
+				draw++;
+			}
+			const Mesh::Vertex& vertex = m_draws[draw].mesh->vertices()[i - m_draws[draw].firstVertex];
+			const glm::vec4 world = modelMatrix * glm::vec4{ vertex.position, 1.f };
+			Vertex& out = m_vertices[i];
+			out.clip = viewProjection * world;
+			out.position = glm::vec3{ world };
+			out.tangent = normalMatrix * vertex.tangent;
+			out.bitangent = normalMatrix * vertex.bitangent;
+			out.normal = normalMatrix * vertex.normal;
+			out.texcoord = glm::vec2{ vertex.texcoord.x, 1.f - vertex.texcoord.y };	// as in pbr_vs.glsl
+		}
+	}, m_threads);
+}
+
+void Rasterizer::sortTransparent(const glm::mat4& modelView)
+{
+	m_order.clear();
+	for (const Draw& draw : m_draws)
+	{
+		if (AlphaMode::Blended != draw.material.alphaMode)
+		{
+			for (uint32_t i = 0; i < uint32_t(draw.mesh->faces().size()); i++)
+			{
+				m_order.push_back(draw.firstTriangle + i);
+			}
+		}
+	}
+	m_firstTransparent = m_order.size();
+
+	std::vector<uint32_t> sorted;
+	for (const Draw& draw : m_draws)
+	{
+		if (AlphaMode::Blended == draw.material.alphaMode)
+		{
+			sortTrianglesBackToFront(*draw.mesh, modelView, sorted);
+			for (uint32_t i : sorted)
+			{
+				m_order.push_back(draw.firstTriangle + i);
+			}
+		}
+	}
+}
+
+void Rasterizer::setupChunk(size_t chunk, size_t numChunks)
+{
+	const size_t numTiles = size_t(m_tilesX) * m_tilesY;
+	for (size_t tile = 0; tile < numTiles; tile++)
+	{
+		m_opaqueBins[chunk * numTiles + tile].clear();
+		m_transparentBins[chunk * numTiles + tile].clear();
+	}
+
+	const size_t begin = m_order.size() * chunk / numChunks;
+	const size_t end = m_order.size() * (chunk + 1) / numChunks;
+	for (size_t i = begin; i < end; i++)
+	{
+		const uint32_t source = m_order[i];
+		uint32_t drawIndex = 0;
+		while (drawIndex + 1 < m_draws.size() && m_draws[drawIndex + 1].firstTriangle <= source)
+		{
+			drawIndex++;
+		}
+		const Draw& draw = m_draws[drawIndex];
+		const Mesh::Face& face = draw.mesh->faces()[source - draw.firstTriangle];
+		const Vertex* vertices = &m_vertices[draw.firstVertex];
+		const glm::vec4 clip[3] = { vertices[face.v1].clip, vertices[face.v2].clip, vertices[face.v3].clip };
+
+		// Near plane (z >= -w) clipping, polygon of up to four vertices is split into two triangles, slots of
+		// source triangle
+		const float distance[3] = { clip[0].z + clip[0].w, clip[1].z + clip[1].w, clip[2].z + clip[2].w };
+		uint32_t slots[2];
+		int numSlots = 0;
+		if (distance[0] >= 0.f && distance[1] >= 0.f && distance[2] >= 0.f)
+		{
+			if (setupTriangle(source, drawIndex, clip, glm::mat3{ 1.f }, 2 * source))
+			{
+				slots[numSlots++] = 2 * source;
+			}
+		}
+		else
+		{
+			glm::vec4 polygon[4];
+			glm::vec3 barycentric[4];
+			int count = 0;
+			for (int j = 0; j < 3; j++)
+			{
+				const int k = (j + 1) % 3;
+				const glm::vec3 bj{ j == 0 ? 1.f : 0.f, j == 1 ? 1.f : 0.f, j == 2 ? 1.f : 0.f };
+				const glm::vec3 bk{ k == 0 ? 1.f : 0.f, k == 1 ? 1.f : 0.f, k == 2 ? 1.f : 0.f };
+				if (distance[j] >= 0.f)
+				{
+					polygon[count] = clip[j];
+					barycentric[count++] = bj;
+				}
+				if ((distance[j] >= 0.f) != (distance[k] >= 0.f))
+				{
+					const float t = distance[j] / (distance[j] - distance[k]);
+					polygon[count] = glm::mix(clip[j], clip[k], t);
+					barycentric[count++] = glm::mix(bj, bk, t);
+				}
+			}
+			for (int t = 0; t + 2 < count; t++)
+			{
+				const glm::vec4 part[3] = { polygon[0], polygon[t + 1], polygon[t + 2] };
+				const uint32_t slot = 2 * source + uint32_t(t);
+				if (setupTriangle(source, drawIndex, part, glm::mat3{ barycentric[0], barycentric[t + 1], barycentric[t + 2] }, slot))
+				{
+					slots[numSlots++] = slot;
+				}
+			}
+		}
+
+		// Triangle goes to tiles its bounds overlap, unless tile is completely outside of one of edges
+		auto& bins = (i < m_firstTransparent) ? m_opaqueBins : m_transparentBins;
+		for (int s = 0; s < numSlots; s++)
+		{
+			const Triangle& tri = m_triangles[slots[s]];
+			const int tx0 = tri.rect.x / TileSize, tx1 = tri.rect.z / TileSize;
+			const int ty0 = tri.rect.y / TileSize, ty1 = tri.rect.w / TileSize;
+			for (int ty = ty0; ty <= ty1; ty++)
+			{
+				for (int tx = tx0; tx <= tx1; tx++)
+				{
+					bool outside = false;
+					if (tx0 != tx1 || ty0 != ty1)
+					{
+						const float x0 = float(tx * TileSize) + 0.5f, x1 = x0 + float(TileSize - 1);
+						const float y0 = float(ty * TileSize) + 0.5f, y1 = y0 + float(TileSize - 1);
+						for (int e = 0; e < 3; e++)
+						{
+							outside |= tri.a[e] * (tri.a[e] > 0.f ? x1 : x0) + tri.b[e] * (tri.b[e] > 0.f ? y1 : y0) + tri.c[e] < 0.f;
+						}
+					}
+					if (!outside)
+					{
+						bins[chunk * numTiles + size_t(ty) * m_tilesX + tx].push_back(slots[s]);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool Rasterizer::setupTriangle(uint32_t source, uint32_t draw, const glm::vec4 (&clip)[3], const glm::mat3& barycentric, uint32_t slot)
+{
+	Triangle& tri = m_triangles[slot];
+	glm::vec3 p[3];
+	for (int i = 0; i < 3; i++)
+	{
+		tri.invW[i] = 1.f / clip[i].w;
+		const glm::vec3 ndc = glm::vec3{ clip[i] } * tri.invW[i];
+		p[i] = glm::vec3{ (ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height, ndc.z * 0.5f + 0.5f };
+	}
+
+	// Counter clockwise triangles are front facing, back faces are culled as in OpenGL renderer
+	const float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+	if (!(area > 0.f))
+	{
+		return false;
+	}
+
+	// Pixels whose centers may be inside
+	tri.rect.x = std::max(0, int(std::ceil(std::min({ p[0].x, p[1].x, p[2].x }) - 0.5f)));
+	tri.rect.y = std::max(0, int(std::ceil(std::min({ p[0].y, p[1].y, p[2].y }) - 0.5f)));
+	tri.rect.z = std::min(m_width - 1, int(std::floor(std::max({ p[0].x, p[1].x, p[2].x }) - 0.5f)));
+	tri.rect.w = std::min(m_height - 1, int(std::floor(std::max({ p[0].y, p[1].y, p[2].y }) - 0.5f)));
+	if (tri.rect.x > tri.rect.z || tri.rect.y > tri.rect.w)
+	{
+		return false;
+	}
+
+	tri.a = glm::vec3{ p[1].y - p[2].y, p[2].y - p[0].y, p[0].y - p[1].y };
+	tri.b = glm::vec3{ p[2].x - p[1].x, p[0].x - p[2].x, p[1].x - p[0].x };
+	tri.c = glm::vec3{ p[1].x * p[2].y - p[2].x * p[1].y, p[2].x * p[0].y - p[0].x * p[2].y, p[0].x * p[1].y - p[1].x * p[0].y };
+	tri.invArea = 1.f / area;
+	const glm::vec3 z = glm::vec3{ p[0].z, p[1].z, p[2].z } * tri.invArea;
+	tri.depth = glm::vec3{ glm::dot(tri.a, z), glm::dot(tri.b, z), glm::dot(tri.c, z) };
+	tri.barycentric = barycentric;
+	tri.source = source;
+	tri.draw = draw;
+	// Edge i goes from vertex i + 1 to i + 2, edges going down or left along horizontal are inclusive
+	tri.topLeft = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		tri.topLeft |= (tri.a[i] > 0.f || (tri.a[i] == 0.f && tri.b[i] < 0.f)) ? (1 << i) : 0;
+	}
+	return true;
+}
+
+void Rasterizer::renderTile(int tile, TileBuffers& buffers)
+{
+	const int tileX = (tile % m_tilesX) * TileSize, tileY = (tile / m_tilesX) * TileSize;
+	const size_t numTiles = size_t(m_tilesX) * m_tilesY;
+	std::fill(buffers.depth.begin(), buffers.depth.end(), 1.f);
+	std::fill(buffers.ids.begin(), buffers.ids.end(), 0u);
+
+	// Visibility of opaque surfaces, bins of chunks are in submission order
+	for (size_t chunk = 0; chunk < m_numChunks; chunk++)
+	{
+		for (uint32_t slot : m_opaqueBins[chunk * numTiles + size_t(tile)])
+		{
+			rasterizeOpaque(slot, tileX, tileY, buffers);
+		}
+	}
+
+	// Every visible pixel is shaded once
+	const int width = std::min(TileSize, m_width - tileX), height = std::min(TileSize, m_height - tileY);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const size_t i = size_t(y) * TileSize + x;
+			const float px = float(tileX + x) + 0.5f, py = float(tileY + y) + 0.5f;
+			if (0 == buffers.ids[i])
+			{
+				buffers.color[i] = background(px, py);
+			}
+			else
+			{
+				const Triangle& tri = m_triangles[buffers.ids[i] - 1];
+				buffers.color[i] = glm::vec3{ shade(fragment(tri, px, py), m_draws[tri.draw].material) };
+			}
+		}
+	}
+
+	// Transparent triangles come back to front, like sorted transparency of OpenGL renderer
+	for (size_t chunk = 0; chunk < m_numChunks; chunk++)
+	{
+		for (uint32_t slot : m_transparentBins[chunk * numTiles + size_t(tile)])
+		{
+			blendTransparent(m_triangles[slot], tileX, tileY, buffers);
+		}
+	}
+
+	for (int y = 0; y < height; y++)
+	{
+		uint32_t* row = &m_pixels[size_t(m_height - 1 - (tileY + y)) * m_width + tileX];
+		for (int x = 0; x < width; x++)
+		{
+			row[x] = tonemap(buffers.color[size_t(y) * TileSize + x]);
+		}
+	}
+}
+
+void Rasterizer::rasterizeOpaque(uint32_t slot, int tileX, int tileY, TileBuffers& buffers) const
+{
+	const Triangle& tri = m_triangles[slot];
+	const bool cutout = AlphaMode::Cutout == m_draws[tri.draw].material.alphaMode;
+	coveredPixels(tri, tileX, tileY, buffers.depth.data(), [&](int x, int y, float depth)
+	{
+		// Cutout surfaces are opaque where alpha passes 0.5
+		if (cutout && alpha(tri, float(x) + 0.5f, float(y) + 0.5f) < 0.5f)
+		{
+			return;
+		}
+		const size_t i = size_t(y - tileY) * TileSize + size_t(x - tileX);
+		buffers.depth[i] = depth;
+		buffers.ids[i] = slot + 1;
+	});
+}
+
+void Rasterizer::blendTransparent(const Triangle& tri, int tileX, int tileY, TileBuffers& buffers) const
+{
+	const SurfaceMaterial& material = m_draws[tri.draw].material;
+	coveredPixels(tri, tileX, tileY, buffers.depth.data(), [&](int x, int y, float)
+	{
+		const glm::vec4 color = shade(fragment(tri, float(x) + 0.5f, float(y) + 0.5f), material);
+		glm::vec3& dst = buffers.color[size_t(y - tileY) * TileSize + size_t(x - tileX)];
+		dst = glm::vec3{ color } * color.a + dst * (1.f - color.a);
+	});
+}
+
+Rasterizer::Fragment Rasterizer::fragment(const Triangle& tri, float x, float y) const
+{
+	// Perspective correct barycentric coordinates in source triangle
+	const auto sourceBarycentric = [&tri](float px, float py)
+	{
+		const glm::vec3 perspective = (tri.a * px + tri.b * py + tri.c) * tri.invArea * tri.invW;
+		return tri.barycentric * (perspective / (perspective.x + perspective.y + perspective.z));
+	};
+	const Draw& draw = m_draws[tri.draw];
+	const Mesh::Face& face = draw.mesh->faces()[tri.source - draw.firstTriangle];
+	const Vertex* vertices = &m_vertices[draw.firstVertex];
+	const Vertex& v0 = vertices[face.v1];
+	const Vertex& v1 = vertices[face.v2];
+	const Vertex& v2 = vertices[face.v3];
+	const auto texcoord = [&](const glm::vec3& w) { return v0.texcoord * w.x + v1.texcoord * w.y + v2.texcoord * w.z; };
+
+	const glm::vec3 w = sourceBarycentric(x, y);
+	Fragment frag;
+	frag.position = v0.position * w.x + v1.position * w.y + v2.position * w.z;
+	frag.tangentBasis = glm::mat3{ v0.tangent * w.x + v1.tangent * w.y + v2.tangent * w.z,
+								   v0.bitangent * w.x + v1.bitangent * w.y + v2.bitangent * w.z,
+								   v0.normal * w.x + v1.normal * w.y + v2.normal * w.z };
+	frag.texcoord = texcoord(w);
+	// Differences to neighbour pixels stand for dFdx() and dFdy()
+	frag.texcoordDx = texcoord(sourceBarycentric(x + 1.f, y)) - frag.texcoord;
+	frag.texcoordDy = texcoord(sourceBarycentric(x, y + 1.f)) - frag.texcoord;
+	return frag;
+}
+
+float Rasterizer::alpha(const Triangle& tri, float x, float y) const
+{
+	const Fragment frag = fragment(tri, x, y);
+	return m_draws[tri.draw].material.alpha(frag.texcoord, frag.texcoordDx, frag.texcoordDy);
+}
+
+glm::vec4 Rasterizer::shade(const Fragment& frag, const SurfaceMaterial& material) const
+{
+	using namespace Shading;
+
+	const SurfaceSample surface = material.sample(frag.texcoord, frag.texcoordDx, frag.texcoordDy);
+	const glm::vec3 albedo{ surface.albedo };
+	const float roughness = surface.roughness;
+	const float metalness = surface.metalness;
+	const glm::vec3 N = glm::normalize(frag.tangentBasis * surface.normal);
+
+	const glm::vec3 Lo = glm::normalize(m_eyePosition - frag.position);
+	const float cosLo = std::max(0.f, glm::dot(N, Lo));
+	const glm::vec3 Lr = 2.f * cosLo * N - Lo;
+	const glm::vec3 F0 = glm::mix(Fdielectric, albedo, metalness);
+
+	// Direct lighting, lights that are off contribute nothing
+	glm::vec3 directLighting{ 0.f };
+	for (int i = 0; i < SceneSettings::NumLights; i++)
+	{
+		if (glm::vec3{ 0.f } == m_lightRadiance[i])
+		{
+			continue;
+		}
+		const glm::vec3 Li = -m_lightDirections[i];
+		const glm::vec3 Lh = glm::normalize(Li + Lo);
+		const float cosLi = std::max(0.f, glm::dot(N, Li));
+		const float cosLh = std::max(0.f, glm::dot(N, Lh));
+		const glm::vec3 F = fresnelSchlick(F0, std::max(0.f, glm::dot(Lh, Lo)));
+		const float D = ndfGGX(cosLh, roughness);
+		const float G = gaSchlickGGX(cosLi, cosLo, roughness);
+		const glm::vec3 kd = glm::mix(glm::vec3{ 1.f } - F, glm::vec3{ 0.f }, metalness);
+		const glm::vec3 diffuseBRDF = kd * albedo;
+		const glm::vec3 specularBRDF = (F * D * G) / std::max(Epsilon, 4.f * cosLi * cosLo);
+		directLighting += (diffuseBRDF + specularBRDF) * m_lightRadiance[i] * cosLi;
+	}
+
+	// Ambient lighting from baked environment (split-sum approximation)
+	const glm::vec3 irradiance = m_ibl->irradiance(N);
+	const glm::vec3 F = fresnelSchlick(F0, cosLo);
+	const glm::vec3 kd = glm::mix(glm::vec3{ 1.f } - F, glm::vec3{ 0.f }, metalness);
+	const glm::vec3 diffuseIBL = kd * albedo * irradiance;
+	const glm::vec3 specularIrradiance = m_ibl->specular(Lr, roughness * float(m_ibl->specularLevels()));
+	const glm::vec2 specularBRDF = m_ibl->brdf(cosLo, roughness);
+	const glm::vec3 specularIBL = (F0 * specularBRDF.x + specularBRDF.y) * specularIrradiance;
+	const glm::vec3 ambientLighting = (diffuseIBL + specularIBL) * surface.occlusion;
+
+	return glm::vec4{ directLighting + ambientLighting, surface.albedo.a };
+}
+
+glm::vec3 Rasterizer::background(float x, float y) const
+{
+	return m_ibl->environment(glm::normalize(m_rayOrigin + x * m_rayDx + y * m_rayDy));
+}
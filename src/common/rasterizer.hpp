@@ -0,0 +1,152 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "renderer.hpp"
+#include "surface.hpp"
+
+class Mesh;
+class IblMaps;
+
+// Software renderer of the scene drawn by OpenGL renderer, for machines without GPU. Every stage of a frame is
+// split between threads:
+// - vertices are transformed to world and clip space,
+// - triangles are clipped by near plane, set up and binned into screen tiles, every thread fills its own bins, so
+//   submission order is kept without locks,
+// - threads take tiles one by one: opaque triangles are rasterized with SIMD into depth and triangle id (visibility
+//   buffer), then every pixel is shaded once with the shading model of pbr_fs.glsl, transparent triangles sorted
+//   back to front are shaded and blended over it, and the tile is tonemapped as in tonemap_fs.glsl.
+// Image based lighting is baked on CPU. Window space has Y up as in OpenGL, pixels() rows go from top to bottom.
+class Rasterizer
+{
+public:
+	static const int TileSize = 64;
+
+	// Mesh with its material, loaded once and shared by scenes
+	struct Model
+	{
+		std::shared_ptr<Mesh> mesh;
+		SurfaceMaterial material;
+
+		static Model fromFile(const std::string& filename);
+	};
+
+	explicit Rasterizer(int width = 1280, int height = 720);
+	~Rasterizer();
+
+	// Loads environment and meshes drawn by OpenGL renderer (paths relative to data directory), bakes lighting.
+	void loadScene();
+	// Scene of already loaded models lit by baked environment, nothing is copied but draw list.
+	void setScene(const std::shared_ptr<IblMaps>& ibl, const std::vector<Model>& models);
+	void resize(int width, int height);
+	// Threads used by render() and bake, 0 means one per hardware thread.
+	void setThreads(size_t threads) { m_threads = threads; }
+	void render(const ViewSettings& view, const SceneSettings& scene);
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	// RGBA8 of the last frame, R in the lowest byte.
+	const std::vector<uint32_t>& pixels() const { return m_pixels; }
+	size_t numTriangles() const { return m_numTriangles; }
+
+private:
+	struct Draw
+	{
+		std::shared_ptr<Mesh> mesh;
+		SurfaceMaterial material;
+		uint32_t firstVertex;		// in m_vertices
+		uint32_t firstTriangle;		// in triangles of all draws
+	};
+
+	struct Vertex
+	{
+		glm::vec4 clip;
+		glm::vec3 position;			// world space
+		glm::vec3 tangent;
+		glm::vec3 bitangent;
+		glm::vec3 normal;
+		glm::vec2 texcoord;
+	};
+
+	// Triangle set up for rasterization, part of source triangle if that was clipped by near plane.
+	struct Triangle
+	{
+		glm::vec3 a, b, c;			// edge i(x, y) = a[i] * x + b[i] * y + c[i], positive inside, edge i is opposite vertex i
+		float invArea;				// edges times invArea are barycentric coordinates
+		glm::vec3 depth;			// depth(x, y) = depth.x * x + depth.y * y + depth.z
+		glm::vec3 invW;				// 1 / clip w of vertices
+		glm::ivec4 rect;			// pixel bounds, inclusive
+		glm::mat3 barycentric;		// column i - barycentric coordinates of vertex i in source triangle
+		uint32_t source;			// triangle of all draws
+		uint32_t draw;
+		int topLeft;				// bit i - pixel centers on edge i are inside
+	};
+
+	// Surface at pixel, inputs of shading.
+	struct Fragment
+	{
+		glm::vec3 position;
+		glm::mat3 tangentBasis;
+		glm::vec2 texcoord;
+		glm::vec2 texcoordDx;		// difference to pixel on the right
+		glm::vec2 texcoordDy;		// difference to pixel above
+	};
+
+	// Per thread storage of tile being rendered.
+	struct TileBuffers
+	{
+		std::vector<float> depth;
+		std::vector<uint32_t> ids;	// triangle index + 1, 0 - background
+		std::vector<glm::vec3> color;
+	};
+
+	size_t threads() const;
+	void transformVertices(const glm::mat4& viewProjection, const glm::mat4& modelMatrix);
+	void sortTransparent(const glm::mat4& modelView);
+	void setupChunk(size_t chunk, size_t numChunks);
+	// Returns false if triangle is culled or covers no pixel centers.
+	bool setupTriangle(uint32_t source, uint32_t draw, const glm::vec4 (&clip)[3], const glm::mat3& barycentric, uint32_t slot);
+	void renderTile(int tile, TileBuffers& buffers);
+	void rasterizeOpaque(uint32_t slot, int tileX, int tileY, TileBuffers& buffers) const;
+	void blendTransparent(const Triangle& tri, int tileX, int tileY, TileBuffers& buffers) const;
+
+	Fragment fragment(const Triangle& tri, float x, float y) const;
+	float alpha(const Triangle& tri, float x, float y) const;
+	glm::vec4 shade(const Fragment& frag, const SurfaceMaterial& material) const;
+	glm::vec3 background(float x, float y) const;
+
+	int m_width;
+	int m_height;
+	int m_tilesX;
+	int m_tilesY;
+	size_t m_threads;
+
+	std::shared_ptr<IblMaps> m_ibl;
+	std::vector<Draw> m_draws;
+	size_t m_numTriangles;
+
+	// Frame state
+	glm::vec3 m_eyePosition;
+	glm::vec3 m_lightDirections[SceneSettings::NumLights];
+	glm::vec3 m_lightRadiance[SceneSettings::NumLights];
+	glm::vec3 m_rayOrigin;			// view ray of pixel (x, y) is m_rayOrigin + x * m_rayDx + y * m_rayDy
+	glm::vec3 m_rayDx;
+	glm::vec3 m_rayDy;
+	std::vector<Vertex> m_vertices;
+	std::vector<uint32_t> m_order;	// source triangles in submission order, transparent ones last, back to front
+	size_t m_firstTransparent;		// in m_order
+	std::vector<Triangle> m_triangles;	// two slots per source triangle
+	size_t m_numChunks;
+	std::vector<std::vector<uint32_t>> m_opaqueBins;		// [chunk * tiles + tile] - indices of m_triangles
+	std::vector<std::vector<uint32_t>> m_transparentBins;
+	std::vector<uint32_t> m_pixels;
+};
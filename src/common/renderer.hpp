@@ -30,6 +30,24 @@ struct SceneSettings
 	} lights[NumLights];
 };
 
+// Optional rendering features, toggled at runtime
+struct RenderSettings
+{
+	bool textureFeedback = false;	// track mip levels sampled by shaders to drive texture residency
+	bool octahedralEnvironment = false;	// sample environment from octahedral probe arrays instead of cube maps
+	bool reflectionProbes = false;		// capture and use reflection probes at runtime
+	bool occlusionCulling = false;		// skip draws hidden behind occluders, tested on CPU
+	bool gpuOcclusionCulling = false;	// two-phase hierarchical depth culling on GPU
+	bool impostors = false;				// draw objects small on screen as impostors
+	bool singlePass = false;			// depth prepass, then opaque and transparent geometry in one pass
+
+	enum class Transparency { WeightedOit, SortedGpu, SortedCpu };
+	Transparency transparency = Transparency::WeightedOit;	// weighted blended OIT or triangles sorted back to front
+	bool commandLists = false;			// draws recorded into command lists on worker threads, replayed by renderer
+	bool benchmark = false;				// measure every transparency mode, renderer reports timings when mode changes
+	bool occluderRow = false;			// row of model copies behind the model, gives occlusion culling work
+};
+
 class RendererInterface
 {
 public:
@@ -38,5 +56,5 @@ public:
 	virtual GLFWwindow* initialize(int width, int height, int maxSamples) = 0;
 	virtual void shutdown() = 0;
 	virtual std::function<void (int w, int h)> setup() = 0;
-	virtual void render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene) = 0;
+	virtual void render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings) = 0;
 };
@@ -0,0 +1,105 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Four lanes of float, SSE or plain arrays. Masks have all bits of lane set (SSE) or are 1 (plain), lanes of
+// mask may only be combined with both(), either(), select() and bits().
+#ifdef SIMD_SSE
+struct Float4
+{
+	__m128 v;
+	Float4(__m128 value) : v(value) {}
+	explicit Float4(float value) : v(_mm_set1_ps(value)) {}
+	static Float4 load(const float* p) { return _mm_loadu_ps(p); }
+	static Float4 ramp() { return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+	Float4 operator + (Float4 o) const { return _mm_add_ps(v, o.v); }
+	Float4 operator - (Float4 o) const { return _mm_sub_ps(v, o.v); }
+	Float4 operator * (Float4 o) const { return _mm_mul_ps(v, o.v); }
+	Float4 operator / (Float4 o) const { return _mm_div_ps(v, o.v); }
+};
+inline Float4 min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 lessMask(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 greaterMask(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 greaterEqualMask(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 both(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 either(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+// Lanes where all three are non negative
+inline Float4 insideMask(Float4 a, Float4 b, Float4 c)
+{
+	const __m128 zero = _mm_setzero_ps();
+	return _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a.v, zero), _mm_cmpge_ps(b.v, zero)), _mm_cmpge_ps(c.v, zero));
+}
+inline Float4 select(Float4 mask, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+// Bit i is set if lane i of mask is
+inline int bits(Float4 mask) { return _mm_movemask_ps(mask.v); }
+inline bool anyLess(Float4 a, Float4 b) { return 0 != _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+#else
+struct Float4
+{
+	float v[4];
+	explicit Float4(float value) : v{ value, value, value, value } {}
+	Float4(float a, float b, float c, float d) : v{ a, b, c, d } {}
+	static Float4 load(const float* p) { return Float4{ p[0], p[1], p[2], p[3] }; }
+	static Float4 ramp() { return Float4{ 0.f, 1.f, 2.f, 3.f }; }
+	void store(float* p) const { std::copy(v, v + 4, p); }
+	Float4 operator + (Float4 o) const { return Float4{ v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3] }; }
+	Float4 operator - (Float4 o) const { return Float4{ v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3] }; }
+	Float4 operator * (Float4 o) const { return Float4{ v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3] }; }
+	Float4 operator / (Float4 o) const { return Float4{ v[0] / o.v[0], v[1] / o.v[1], v[2] / o.v[2], v[3] / o.v[3] }; }
+};
+inline Float4 min(Float4 a, Float4 b)
+{
+	return Float4{ std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]) };
+}
+inline Float4 max(Float4 a, Float4 b)
+{
+	return Float4{ std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]) };
+}
+inline Float4 lessMask(Float4 a, Float4 b)
+{
+	return Float4{ a.v[0] < b.v[0] ? 1.f : 0.f, a.v[1] < b.v[1] ? 1.f : 0.f, a.v[2] < b.v[2] ? 1.f : 0.f, a.v[3] < b.v[3] ? 1.f : 0.f };
+}
+inline Float4 greaterMask(Float4 a, Float4 b) { return lessMask(b, a); }
+inline Float4 greaterEqualMask(Float4 a, Float4 b)
+{
+	return Float4{ a.v[0] >= b.v[0] ? 1.f : 0.f, a.v[1] >= b.v[1] ? 1.f : 0.f, a.v[2] >= b.v[2] ? 1.f : 0.f, a.v[3] >= b.v[3] ? 1.f : 0.f };
+}
+inline Float4 both(Float4 a, Float4 b) { return a * b; }
+inline Float4 either(Float4 a, Float4 b) { return max(a, b); }
+// Lanes where all three are non negative are 1, others 0
+inline Float4 insideMask(Float4 a, Float4 b, Float4 c)
+{
+	Float4 mask{ 0.f };
+	for (int i = 0; i < 4; i++)
+	{
+		mask.v[i] = (a.v[i] >= 0.f && b.v[i] >= 0.f && c.v[i] >= 0.f) ? 1.f : 0.f;
+	}
+	return mask;
+}
+inline Float4 select(Float4 mask, Float4 a, Float4 b)
+{
+	return Float4{ mask.v[0] != 0.f ? a.v[0] : b.v[0], mask.v[1] != 0.f ? a.v[1] : b.v[1],
+				   mask.v[2] != 0.f ? a.v[2] : b.v[2], mask.v[3] != 0.f ? a.v[3] : b.v[3] };
+}
+// Bit i is set if lane i of mask is
+inline int bits(Float4 mask)
+{
+	return (mask.v[0] != 0.f ? 1 : 0) | (mask.v[1] != 0.f ? 2 : 0) | (mask.v[2] != 0.f ? 4 : 0) | (mask.v[3] != 0.f ? 8 : 0);
+}
+inline bool anyLess(Float4 a, Float4 b)
+{
+	return a.v[0] < b.v[0] || a.v[1] < b.v[1] || a.v[2] < b.v[2] || a.v[3] < b.v[3];
+}
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "surface.hpp"
+#include "image.hpp"
+#include "mesh.hpp"
+
+namespace {
+	// Same as tonemap_fs.glsl
+	const float Gamma = 2.2f;
+	const float Exposure = 1.0f;
+	const float PureWhite = 1.0f;
+
+	struct SrgbTable
+	{
+		float values[256];
+		SrgbTable()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				const float c = i / 255.f;
+				values[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+	const SrgbTable srgbTable;
+}
+
+float srgbToLinear(unsigned char value)
+{
+	return srgbTable.values[value];
+}
+
+uint32_t tonemap(const glm::vec3& color)
+{
+	const glm::vec3 scaled = color * Exposure;
+	const float luminance = glm::dot(scaled, glm::vec3{ 0.2126f, 0.7152f, 0.0722f });
+	const float mappedLuminance = (luminance * (1.f + luminance / (PureWhite * PureWhite))) / (1.f + luminance);
+	const glm::vec3 mappedColor = (luminance > 0.f) ? (mappedLuminance / luminance) * scaled : glm::vec3{ 0.f };
+	const glm::vec3 encoded = glm::pow(glm::clamp(mappedColor, 0.f, 1.f), glm::vec3{ 1.f / Gamma });
+	const glm::uvec3 bytes{ encoded * 255.f + 0.5f };
+	return 0xFF000000u | (bytes.b << 16) | (bytes.g << 8) | bytes.r;
+}
+
+SurfaceTexture::SurfaceTexture(const std::shared_ptr<Image>& image, bool srgb)
+	: m_srgb(srgb)
+{
+	m_levels.push_back(image);
+	while (m_levels.back()->width() > 1 || m_levels.back()->height() > 1)
+	{
+		m_levels.push_back(m_levels.back()->downsample(srgb));
+	}
+}
+
+glm::vec4 SurfaceTexture::sample(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const
+{
+	// Level from texel footprint of the pixel, as textureQueryLod()
+	const glm::vec2 size{ float(m_levels[0]->width()), float(m_levels[0]->height()) };
+	const float footprint = std::max(glm::length(dx * size), glm::length(dy * size));
+	const float lod = glm::clamp(std::log2(std::max(footprint, Shading::Epsilon)), 0.f, float(m_levels.size() - 1));
+	const int l0 = int(lod);
+	const int l1 = std::min(l0 + 1, int(m_levels.size() - 1));
+	const glm::vec4 c0 = sampleLevel(l0, uv);
+	return (l1 == l0) ? c0 : glm::mix(c0, sampleLevel(l1, uv), lod - float(l0));
+}
+
+glm::vec4 SurfaceTexture::sampleLevel(int level, const glm::vec2& uv) const
+{
+	const Image& image = *m_levels[size_t(level)];
+	const int width = image.width(), height = image.height(), channels = image.channels();
+	const unsigned char* pixels = image.pixels<unsigned char>();
+	const float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+	const float fx = std::floor(x), fy = std::floor(y);
+	const auto wrap = [](int value, int size) { return ((value % size) + size) % size; };
+	const int x0 = wrap(int(fx), width), x1 = wrap(int(fx) + 1, width);
+	const int y0 = wrap(int(fy), height), y1 = wrap(int(fy) + 1, height);
+	const auto texel = [&](int tx, int ty)
+	{
+		const unsigned char* p = pixels + (size_t(ty) * width + tx) * channels;
+		glm::vec4 value{ 0.f, 0.f, 0.f, 1.f };
+		for (int c = 0; c < channels; c++)
+		{
+			value[c] = (m_srgb && c < 3) ? srgbTable.values[p[c]] : p[c] / 255.f;
+		}
+		return value;
+	};
+	return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), x - fx), glm::mix(texel(x0, y1), texel(x1, y1), x - fx), y - fy);
+}
+
+AlphaMode SurfaceMaterial::classifyAlpha(const Image& albedo)
+{
+	const unsigned char* pix = albedo.pixels<unsigned char>();
+	const size_t texels = size_t(albedo.width()) * size_t(albedo.height());
+	size_t translucent = 0, partial = 0;
+	for (size_t i = 0; i < texels; i++)
+	{
+		const unsigned char alpha = pix[4 * i + 3];
+		translucent += (alpha < 255) ? 1 : 0;
+		partial += (alpha > 8 && alpha < 247) ? 1 : 0;
+	}
+	return (0 == translucent) ? AlphaMode::Opaque
+		 : (partial * 10 < translucent) ? AlphaMode::Cutout : AlphaMode::Blended;
+}
+
+SurfaceMaterial SurfaceMaterial::load(const std::shared_ptr<Mesh>& mesh)
+{
+	const auto loadImage = [&mesh](Mesh::TextureType type, int channels)
+	{
+		const std::string name = mesh->textureName(type);
+		return name.empty() ? nullptr : Image::fromFile("textures/" + name, channels);
+	};
+	const auto foldConstant = [](std::shared_ptr<Image>& image, float& factor)
+	{
+		if (image && image->isConstant())
+		{
+			factor = image->pixels<unsigned char>()[0] / 255.f;
+			image.reset();
+		}
+	};
+
+	SurfaceMaterial material;
+	material.albedoFactor = mesh->material().albedo;
+	material.metalnessFactor = mesh->material().metalness;
+	material.roughnessFactor = mesh->material().roughness;
+	material.occlusionFactor = 1.f;
+	material.alphaMode = AlphaMode::Opaque;
+
+	const auto albedo = loadImage(Mesh::TextureType::Albedo, 4);
+	if (albedo && albedo->isConstant())
+	{
+		const unsigned char* pix = albedo->pixels<unsigned char>();
+		material.albedoFactor = glm::vec4{ srgbToLinear(pix[0]), srgbToLinear(pix[1]), srgbToLinear(pix[2]), pix[3] / 255.f };
+	}
+	else if (albedo)
+	{
+		material.albedo = std::make_shared<SurfaceTexture>(albedo, true);
+		material.alphaMode = classifyAlpha(*albedo);
+	}
+	material.alphaMode = (material.albedoFactor.a < 1.f) ? AlphaMode::Blended : material.alphaMode;
+
+	const auto normals = loadImage(Mesh::TextureType::Normals, 3);
+	if (normals)
+	{
+		material.normals = std::make_shared<SurfaceTexture>(normals, false);
+	}
+
+	auto occlusion = loadImage(Mesh::TextureType::Occlusion, 1);
+	auto roughness = loadImage(Mesh::TextureType::Roughness, 1);
+	auto metalness = loadImage(Mesh::TextureType::Metalness, 1);
+	foldConstant(occlusion, material.occlusionFactor);
+	foldConstant(roughness, material.roughnessFactor);
+	foldConstant(metalness, material.metalnessFactor);
+	material.occlusionMap = nullptr != occlusion;
+	material.roughnessMap = nullptr != roughness;
+	material.metalnessMap = nullptr != metalness;
+	if (material.occlusionMap || material.roughnessMap || material.metalnessMap)
+	{
+		material.orm = std::make_shared<SurfaceTexture>(Image::packChannels({ { occlusion, 0, 255 }, { roughness, 0, 0 }, { metalness, 0, 0 } }), false);
+	}
+	return material;
+}
+
+SurfaceSample SurfaceMaterial::sample(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const
+{
+	SurfaceSample result;
+	result.albedo = albedo ? albedo->sample(uv, dx, dy) : albedoFactor;
+	if (AlphaMode::Cutout == alphaMode)
+	{
+		result.albedo.a = 1.f;	// alpha tested when surface is hit
+	}
+
+	const glm::vec3 maps = orm ? glm::vec3{ orm->sample(uv, dx, dy) } : glm::vec3{ 0.f };
+	result.occlusion = occlusionMap ? maps.r : occlusionFactor;
+	result.roughness = roughnessMap ? maps.g : roughnessFactor;
+	result.metalness = metalnessMap ? maps.b : metalnessFactor;
+
+	result.normal = glm::vec3{ 0.f, 0.f, 1.f };
+	if (normals)
+	{
+		const glm::vec2 Nxy = 2.f * glm::vec2{ normals->sample(uv, dx, dy) } - 1.f;
+		result.normal = glm::vec3{ Nxy, std::sqrt(std::max(0.f, 1.f - glm::dot(Nxy, Nxy))) };
+	}
+	return result;
+}
+
+float SurfaceMaterial::alpha(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const
+{
+	return albedo ? albedo->sample(uv, dx, dy).a : albedoFactor.a;
+}
@@ -0,0 +1,133 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+class Image;
+class Mesh;
+
+// Materials and shading model of pbr_fs.glsl and tonemap_fs.glsl for renderers running on CPU.
+
+// Mip chain of LDR image, sampled bilinearly from two levels with repeat wrap.
+class SurfaceTexture
+{
+public:
+	SurfaceTexture(const std::shared_ptr<Image>& image, bool srgb);
+
+	// Level is chosen by texel footprint of pixel, dx and dy are texcoord differences to neighbour pixels.
+	glm::vec4 sample(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const;
+	glm::vec4 sampleLevel(int level, const glm::vec2& uv) const;
+
+private:
+	std::vector<std::shared_ptr<Image>> m_levels;
+	bool m_srgb;
+};
+
+// How surfaces cover what is behind them, as MaterialPool of OpenGL renderer decides it.
+enum class AlphaMode { Opaque, Cutout, Blended };
+
+// Material parameters at a point of surface.
+struct SurfaceSample
+{
+	glm::vec4 albedo;
+	float occlusion;
+	float roughness;
+	float metalness;
+	glm::vec3 normal;		// tangent space
+};
+
+struct SurfaceMaterial
+{
+	glm::vec4 albedoFactor;
+	float metalnessFactor;
+	float roughnessFactor;
+	float occlusionFactor;
+	std::shared_ptr<SurfaceTexture> albedo;
+	std::shared_ptr<SurfaceTexture> normals;
+	std::shared_ptr<SurfaceTexture> orm;	// R - occlusion, G - roughness, B - metalness
+	bool occlusionMap, roughnessMap, metalnessMap;
+	AlphaMode alphaMode;
+
+	// Same as MaterialPool::Add() of OpenGL renderer, single color maps are replaced by constant factors.
+	static SurfaceMaterial load(const std::shared_ptr<Mesh>& mesh);
+	static AlphaMode classifyAlpha(const Image& albedo);
+
+	SurfaceSample sample(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const;
+	float alpha(const glm::vec2& uv, const glm::vec2& dx, const glm::vec2& dy) const;
+};
+
+// Decoded value of sRGB byte.
+float srgbToLinear(unsigned char value);
+// Reinhard operator on luminance and gamma correction as in tonemap_fs.glsl, RGBA8 with R in the lowest byte.
+uint32_t tonemap(const glm::vec3& color);
+
+// Shading model of pbr_fs.glsl
+namespace Shading {
+	const float PI = 3.141592f;
+	const float TwoPI = 2.f * PI;
+	const float Epsilon = 0.00001f;
+	// Constant normal incidence Fresnel factor for all dielectrics
+	const glm::vec3 Fdielectric{ 0.04f };
+
+	// GGX/Towbridge-Reitz normal distribution function
+	inline float ndfGGX(float cosLh, float roughness)
+	{
+		const float alpha = roughness * roughness;
+		const float alphaSq = alpha * alpha;
+		const float denom = (cosLh * cosLh) * (alphaSq - 1.f) + 1.f;
+		return alphaSq / (PI * denom * denom);
+	}
+
+	inline float gaSchlickG1(float cosTheta, float k)
+	{
+		return cosTheta / (cosTheta * (1.f - k) + k);
+	}
+
+	// Smith's method with Schlick-GGX, k is for analytic lights
+	inline float gaSchlickGGX(float cosLi, float cosLo, float roughness)
+	{
+		const float r = roughness + 1.f;
+		const float k = (r * r) / 8.f;
+		return gaSchlickG1(cosLi, k) * gaSchlickG1(cosLo, k);
+	}
+
+	// Smith's method with Schlick-GGX, k remapped for image based lighting as in spbrdf_cs.glsl
+	inline float gaSchlickGGX_IBL(float cosLi, float cosLo, float roughness)
+	{
+		const float k = (roughness * roughness) / 2.f;
+		return gaSchlickG1(cosLi, k) * gaSchlickG1(cosLo, k);
+	}
+
+	inline glm::vec3 fresnelSchlick(const glm::vec3& F0, float cosTheta)
+	{
+		return F0 + (glm::vec3{ 1.f } - F0) * std::pow(1.f - cosTheta, 5.f);
+	}
+
+	// Half vector around +Z, importance sampled by GGX normal distribution
+	inline glm::vec3 sampleGGX(float u1, float u2, float roughness)
+	{
+		const float alpha = roughness * roughness;
+		const float cosTheta = std::sqrt((1.f - u2) / (1.f + (alpha * alpha - 1.f) * u2));
+		const float sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+		const float phi = TwoPI * u1;
+		return glm::vec3{ sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+	}
+
+	// Rotation of +Z to N
+	inline glm::mat3 tangentBasis(const glm::vec3& N)
+	{
+		glm::vec3 T = glm::cross(N, glm::vec3{ 0.f, 1.f, 0.f });
+		T = (glm::dot(T, T) < Epsilon) ? glm::cross(N, glm::vec3{ 1.f, 0.f, 0.f }) : T;
+		T = glm::normalize(T);
+		const glm::vec3 S = glm::normalize(glm::cross(N, T));
+		return glm::mat3{ S, T, N };
+	}
+}
@@ -0,0 +1,175 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include "texture_cache.hpp"
+#include "image.hpp"
+#include "utils.hpp"
+
+namespace {
+	const uint64_t FnvOffsetBasis = 14695981039346656037ull;
+	const uint64_t FnvPrime       = 1099511628211ull;
+
+	// Entry layout: header, level headers, pixels of every level
+	const char     Magic[4] = { 'A', 'V', 'T', 'C' };
+	const uint32_t Version  = 1;
+	// Larger levels are never stored, so their sizes can't overflow
+	const int32_t MaxLevelSize = 1 << 16;
+
+	struct EntryHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t levels;
+		uint32_t reserved;
+	};
+
+	struct LevelHeader
+	{
+		int32_t width;
+		int32_t height;
+		int32_t channels;
+		uint32_t reserved;
+		uint64_t offset;	// from the beginning of the file
+	};
+
+	uint64_t fnv1a(uint64_t hash, const char* data, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ uint64_t(static_cast<unsigned char>(data[i]))) * FnvPrime;
+		}
+		return hash;
+	}
+}
+
+TextureCache::TextureCache(const std::string& directory)
+	: m_directory(directory)
+	, m_writable(File::makeDirectory(directory))
+{
+}
+
+uint64_t TextureCache::hashFile(const std::string& filename)
+{
+	if (filename.empty())
+	{
+		return 0;
+	}
+	auto hashIt = m_fileHashes.find(filename);
+	if (m_fileHashes.end() == hashIt)
+	{
+		const auto contents = File::readBinary(filename);
+		hashIt = m_fileHashes.emplace(filename, fnv1a(FnvOffsetBasis, contents.data(), contents.size())).first;
+	}
+	return hashIt->second;
+}
+
+uint64_t TextureCache::combine(uint64_t hash, uint64_t value)
+{
+	return fnv1a(hash, reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string TextureCache::entryName(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.tex", static_cast<unsigned long long>(key));
+	return m_directory + "/" + name;
+}
+
+bool TextureCache::load(uint64_t key, int channels, std::vector<std::shared_ptr<Image>>& mips) const
+{
+	const std::shared_ptr<const MappedFile> file = MappedFile::open(entryName(key));
+	if (nullptr == file || file->size() < sizeof(EntryHeader))
+	{
+		return false;
+	}
+
+	EntryHeader header;
+	memcpy(&header, file->data(), sizeof(header));
+	if (0 != memcmp(header.magic, Magic, sizeof(Magic)) || Version != header.version || key != header.key
+		|| file->size() < sizeof(EntryHeader) + header.levels * sizeof(LevelHeader))
+	{
+		return false;
+	}
+
+	// Entry may be corrupt: every level must have the requested channels and half the size of the previous one,
+	// and lie within the file
+	std::vector<std::shared_ptr<Image>> levels;
+	for (uint32_t level = 0; level < header.levels; level++)
+	{
+		LevelHeader levelHeader;
+		memcpy(&levelHeader, file->data() + sizeof(EntryHeader) + level * sizeof(LevelHeader), sizeof(levelHeader));
+		if (channels != levelHeader.channels || levelHeader.width <= 0 || levelHeader.height <= 0
+			|| levelHeader.width > MaxLevelSize || levelHeader.height > MaxLevelSize)
+		{
+			return false;
+		}
+		if (!levels.empty())
+		{
+			const Image& previous = *levels.back();
+			if ((1 == previous.width() && 1 == previous.height())
+				|| levelHeader.width != std::max(1, previous.width() / 2) || levelHeader.height != std::max(1, previous.height() / 2))
+			{
+				return false;
+			}
+		}
+		const uint64_t size = uint64_t(levelHeader.width) * uint64_t(levelHeader.height) * uint64_t(levelHeader.channels);
+		if (size > file->size() || levelHeader.offset > file->size() - size)
+		{
+			return false;
+		}
+		// pixels share ownership of the mapping
+		const std::shared_ptr<const void> pixels(file, file->data() + levelHeader.offset);
+		levels.push_back(Image::fromMemory(levelHeader.width, levelHeader.height, levelHeader.channels, pixels));
+	}
+	mips = std::move(levels);
+	return true;
+}
+
+void TextureCache::store(uint64_t key, const std::vector<std::shared_ptr<Image>>& mips) const
+{
+	if (!m_writable)
+	{
+		return;
+	}
+
+	EntryHeader header{ { Magic[0], Magic[1], Magic[2], Magic[3] }, Version, key, uint32_t(mips.size()), 0 };
+	std::vector<LevelHeader> levels;
+	uint64_t offset = sizeof(EntryHeader) + mips.size() * sizeof(LevelHeader);
+	for (const auto& mip : mips)
+	{
+		levels.push_back(LevelHeader{ mip->width(), mip->height(), mip->channels(), 0, offset });
+		offset += uint64_t(mip->pitch()) * uint64_t(mip->height());
+	}
+
+	// Written to temporary file first so that interrupted write doesn't leave broken entry, the file is per thread
+	// since textures are loaded on worker threads and two of them may store the same entry
+	const std::string name = entryName(key);
+	const std::string tempName = name + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file{ tempName, std::ios::binary | std::ios::trunc };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(levels.data()), std::streamsize(levels.size() * sizeof(LevelHeader)));
+		for (const auto& mip : mips)
+		{
+			file.write(mip->pixels<char>(), std::streamsize(mip->pitch()) * mip->height());
+		}
+		if (!file)
+		{
+			std::cout << "Failed to write texture cache entry: " << name << std::endl;
+			return;
+		}
+	}
+	std::remove(name.c_str());
+	std::rename(tempName.c_str(), name.c_str());
+}
@@ -0,0 +1,39 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Image;
+
+// On-disk cache of decoded LDR textures in upload layout: every mip level as tightly packed pixels, finest first.
+// Entries are keyed by hash of source files and target format, so textures are decoded again when sources change.
+// Cached entries are memory mapped, images returned by load() point into the mapping.
+class TextureCache
+{
+public:
+	explicit TextureCache(const std::string& directory);
+
+	// FNV-1a hash of file contents (hash of empty name is 0), hashes are remembered per file name.
+	uint64_t hashFile(const std::string& filename);
+	// Combines hash with another value.
+	static uint64_t combine(uint64_t hash, uint64_t value);
+
+	// Returns false if there is no valid entry of images with the given channels for the key, entry may have no mip levels.
+	bool load(uint64_t key, int channels, std::vector<std::shared_ptr<Image>>& mips) const;
+	void store(uint64_t key, const std::vector<std::shared_ptr<Image>>& mips) const;
+
+private:
+	std::string entryName(uint64_t key) const;
+
+	std::string m_directory;
+	bool m_writable;
+	std::map<std::string, uint64_t> m_fileHashes;
+};
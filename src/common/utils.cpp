@@ -6,9 +6,16 @@
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <cerrno>
 
 #if _WIN32
 #include <Windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif // _WIN32
 
 #include "utils.hpp"
@@ -42,6 +49,86 @@ std::vector<char> File::readBinary(const std::string& filename)
 	return buffer;
 }
 
+bool File::makeDirectory(const std::string& path)
+{
+#if _WIN32
+	return 0 == _mkdir(path.c_str()) || EEXIST == errno;
+#else
+	return 0 == mkdir(path.c_str(), 0755) || EEXIST == errno;
+#endif // _WIN32
+}
+
+MappedFile::MappedFile()
+	: m_data(nullptr)
+	, m_size(0)
+#if _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(nullptr)
+#endif // _WIN32
+{
+}
+
+MappedFile::~MappedFile()
+{
+#if _WIN32
+	if (nullptr != m_data)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (nullptr != m_mapping)
+	{
+		CloseHandle(m_mapping);
+	}
+	if (INVALID_HANDLE_VALUE != m_file)
+	{
+		CloseHandle(m_file);
+	}
+#else
+	if (nullptr != m_data)
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+#endif // _WIN32
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& filename)
+{
+	std::shared_ptr<MappedFile> file { new MappedFile };
+#if _WIN32
+	file->m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (INVALID_HANDLE_VALUE == file->m_file || !GetFileSizeEx(file->m_file, &size) || 0 == size.QuadPart)
+	{
+		return nullptr;
+	}
+	file->m_mapping = CreateFileMappingA(file->m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (nullptr == file->m_mapping)
+	{
+		return nullptr;
+	}
+	file->m_data = static_cast<const char*>(MapViewOfFile(file->m_mapping, FILE_MAP_READ, 0, 0, 0));
+	file->m_size = size_t(size.QuadPart);
+#else
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return nullptr;
+	}
+	struct stat st;
+	if (0 == fstat(fd, &st) && st.st_size > 0)
+	{
+		void *ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED != ptr)
+		{
+			file->m_data = static_cast<const char*>(ptr);
+			file->m_size = size_t(st.st_size);
+		}
+	}
+	close(fd);	// mapping stays valid after descriptor is closed
+#endif // _WIN32
+	return (nullptr != file->m_data) ? file : nullptr;
+}
+
 // #if _WIN32
 // std::string Utility::convertToUTF8(const std::wstring& wstr)
 // {
@@ -7,12 +7,40 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 class File
 {
 public:
 	static std::string readText(const std::string& filename);
 	static std::vector<char> readBinary(const std::string& filename);
+	// Creates directory if it doesn't exist, returns false on failure.
+	static bool makeDirectory(const std::string& path);
+};
+
+// Read-only memory mapped file.
+class MappedFile
+{
+public:
+	~MappedFile();
+
+	// Returns nullptr if file can't be opened or is empty.
+	static std::shared_ptr<MappedFile> open(const std::string& filename);
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* m_data;
+	size_t m_size;
+#if _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif // _WIN32
 };
 
 class Utility
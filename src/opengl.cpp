@@ -7,6 +7,8 @@
 
 #include <stdexcept>
 #include <memory>
+#include <chrono>
+#include <thread>
 
 #include <GLFW/glfw3.h>
 
@@ -61,7 +63,7 @@ GLFWwindow* Renderer::initialize(int width, int height, int maxSamples)
 		mFramebuffer->AttachRenderbuffer(GL_COLOR_ATTACHMENT0, GL_RGBA16F, width, height, samples);
 		mFramebuffer->AttachRenderbuffer(GL_COLOR_ATTACHMENT1, GL_RGBA16F, width, height, samples);
 		mFramebuffer->AttachRenderbuffer(GL_COLOR_ATTACHMENT2, GL_R16F,    width, height, samples);
-		mFramebuffer->AttachRenderbuffer(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT, width, height, samples);
+		mFramebuffer->AttachTexture(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT32F, width, height, samples);	// read by hi-Z culling
 		mFramebuffer->DrawBuffers({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 });
 		auto status = mFramebuffer->CheckStatus();
 		if (status != GL_FRAMEBUFFER_COMPLETE)
@@ -91,23 +93,39 @@ GLFWwindow* Renderer::initialize(int width, int height, int maxSamples)
 
 void Renderer::shutdown()
 {
+	reportBenchmark();	// timings of the last mode
 	mResolveFramebuffer->Release();
 	mFramebuffer->Release();
 
-	mEmptyVao.Release();
-
 	mSkyboxUB.Release();
 	mTransformUB.Release();
 	mShadingUB.Release();
 	mBaseInfoUB.Release();
 
 	mSkybox.Release();
-	mPbrModel.Release();
-	mGlass.Release();
+	mDrawCommands.Release();
+	mDrawData.Release();
+	mOpaqueReplayCommands.Release();
+	mTransparentReplayCommands.Release();
+	mTextureFeedback.Release();
+	mHiZCuller.Release();
+	releaseImpostors();
+	mOitTiles.Release();
+	mTriangleSorter.Release();
+	mTransparencyTimer.Release();
+	mCompositeTimer.Release();
+	mEnvProbes.Release();
+	mReflectionProbes.Release();
+	mMaterialPool.Release();
+	mGeometryPool.Release();
+	mUploadManager.Release();
 	mFullScreenQuad.Release();
 
 	mTonemapProgram.Release();
+	mOitCompositeProgram.Release();
 	mSkyboxProgram.Release();
+	mPbrProgram.Release();
+	mDepthPrepassProgram.Release();
 
 	mEnvPtr->Release();
 }
@@ -118,9 +136,7 @@ std::function<void (int w, int h)> Renderer::setup()
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 	glFrontFace(GL_CCW);
-
-	// Create empty VAO for rendering full screen triangle
-	mEmptyVao = MeshGeometry(nullptr, true);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);	// packed RG/RGB images have tightly packed rows
 
 	// Create uniform buffers.
 	mSkyboxUB.Create();
@@ -131,42 +147,631 @@ std::function<void (int w, int h)> Renderer::setup()
 	mTonemapProgram =
 		ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/tonemap_vs.glsl")),
 						std::make_tuple(GL_FRAGMENT_SHADER, Shader::GetFileContents("shaders/tonemap_fs.glsl")) }};
+	std::string compositeVsSource = Shader::GetFileContents("shaders/tonemap_vs.glsl");
+	std::string compositeFsSource = Shader::GetFileContents("shaders/tonemap_fs.glsl");
+	compositeVsSource.insert(compositeVsSource.find('\n') + 1, "#define OIT\n");		// after #version
+	compositeFsSource.insert(compositeFsSource.find('\n') + 1, "#define OIT\n");
+	mOitCompositeProgram =
+		ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, compositeVsSource),
+						std::make_tuple(GL_FRAGMENT_SHADER, compositeFsSource) }};
 
 	mSkyboxProgram =
 		ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/skybox_vs.glsl")),
 						std::make_tuple(GL_FRAGMENT_SHADER, Shader::GetFileContents("shaders/skybox_fs.glsl")) }};
 
-	mEnvPtr = std::make_shared<Environment>(Image::fromFile("environment.hdr", 3));
+	mPbrProgram =
+		ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/pbr_vs.glsl")),
+						std::make_tuple(GL_FRAGMENT_SHADER, Shader::GetFileContents("shaders/pbr_fs.glsl")) }};
+
+	std::string prepassSource = Shader::GetFileContents("shaders/pbr_fs.glsl");
+	prepassSource.insert(prepassSource.find('\n') + 1, "#define DEPTH_PREPASS\n");		// after #version
+	mDepthPrepassProgram =
+		ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/pbr_vs.glsl")),
+						std::make_tuple(GL_FRAGMENT_SHADER, prepassSource) }};
+
+	mEnvPtr = std::make_shared<Environment>(Image::fromRgbeFile("environment.hdr"));
+	mEnvProbes.Create();
+	mEnvProbe = mEnvProbes.Add(*mEnvPtr);
+
+	mUploadManager.Create(kStagingBufferSize, kUploadBudget);
+	mGeometryPool.Create();
+	mMaterialPool.SetMemoryBudget(kTextureMemoryBudget);
+	mTextureFeedback.Create();
+	mReflectionProbes.Create();
+	mHiZCuller.Create();
+	mOitTiles.Create();
+	mTriangleSorter.Create();
+	mTransparencyTimer.Create();
+	mCompositeTimer.Create();
+	// Probes around the model, surfaces blend the two nearest
+	for (const glm::vec3 &position : { glm::vec3{ 0.f, 100.f, 0.f }, glm::vec3{ -150.f, 0.f, 0.f }, glm::vec3{ 150.f, 0.f, 0.f },
+									   glm::vec3{ 0.f, 0.f, 150.f }, glm::vec3{ 0.f, -100.f, 0.f } })
+	{
+		mReflectionProbes.Add(position, 1000.f);
+	}
 
 	mSkybox   = MeshGeometry{ Mesh::fromFile("meshes/skybox.obj") };
-	mPbrModel = PbrMesh{ Mesh::fromFile("meshes/siuzanna.fbx"), mEnvPtr };
-	mGlass    = PbrMesh{ Mesh::fromFile("meshes/plate.fbx"), mEnvPtr };
+	const auto modelMesh = Mesh::fromFile("meshes/siuzanna.fbx");
+	const auto glassMesh = Mesh::fromFile("meshes/plate.fbx");
+	mMeshes = { PbrMesh{ modelMesh, mGeometryPool, mMaterialPool, mUploadManager },
+				PbrMesh{ glassMesh, mGeometryPool, mMaterialPool, mUploadManager } };
+	mUploadManager.EndFrame();
+
+	// Glass is transparent and doesn't occlude
+	mSceneObjects = { SceneObject{ &mMeshes[0], glm::vec3{ 0.f }, OcclusionCuller::makeOccluder(*modelMesh), modelMesh },
+					  SceneObject{ &mMeshes[1], glm::vec3{ 0.f }, nullptr, glassMesh } };
+	createImpostors();
+
+	buildDrawBatches();
 
 	return [&](int w, int h) { glViewport(0, 0, w, h); };
 }
 
-void Renderer::renderScene(const ViewSettings& /*view*/, const SceneSettings& scene)
+void Renderer::renderScene(const ViewSettings& /*view*/, const SceneSettings& scene, const StorageBuffer<DrawElementsIndirectCommand> &commands,
+						   const ShaderProgram &program, bool blendedOnly)
+{
+	bindSceneResources(program);
+
+	commands.Bind(GL_DRAW_INDIRECT_BUFFER);
+	for (const auto &batch : mDrawBatches)
+	{
+		const GLsizei first = blendedOnly ? batch.firstBlended : 0;
+		if (GLsizei(batch.commands.size()) > first)
+		{
+			MaterialPool::BindArrays(batch.arrays);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+										reinterpret_cast<const void*>((batch.firstCommand + first) * sizeof(DrawElementsIndirectCommand)),
+										GLsizei(batch.commands.size()) - first, 0);
+		}
+	}
+}
+
+void Renderer::recordCommandLists(const glm::mat4 &viewProjection, bool singlePass)
+{
+	// Every worker culls and encodes its slice of draws, transparency pass gets only blended draws unless it draws all
+	const auto &commands = mDrawCommands.GetReference();
+	const auto &draws = mDrawData.GetReference();
+	const auto recordPass = [&](bool transparencyPass)
+	{
+		return [&, transparencyPass](CommandList &list, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const DrawBatch &batch = mDrawBatches[mDrawBatchIndices[i]];
+				const GLsizei inBatch = GLsizei(i) - batch.firstCommand;
+				if (0 == commands[i].instanceCount || (transparencyPass && !singlePass && inBatch < batch.firstBlended)
+					|| !OcclusionCuller::isInFrustum(batch.objects[inBatch]->mesh->GetBounds(), viewProjection * draws[i].modelMatrix))
+				{
+					continue;
+				}
+				list.bindResourceSet(mDrawBatchIndices[i]);
+				list.drawIndexed({ commands[i].count, commands[i].firstIndex, commands[i].baseVertex, commands[i].baseInstance });
+			}
+		};
+	};
+	mOpaqueCommandLists.record(commands.size(), kMinCommandSlice, recordPass(false));
+	mTransparentCommandLists.record(commands.size(), kMinCommandSlice, recordPass(true));
+}
+
+void Renderer::replayScene(const CommandRecorder &lists, StorageBuffer<DrawElementsIndirectCommand> &indirect,
+						   const ShaderProgram &program)
+{
+	bindSceneResources(program);
+
+	// OpenGL backend of command lists, resource set is texture arrays of draw batch. Draws between binds are
+	// collected into indirect buffer, so every run of draws is a single multi-draw call.
+	struct Run
+	{
+		uint32_t resourceSet;
+		GLsizei first, count;
+	};
+	struct Backend
+	{
+		std::vector<DrawElementsIndirectCommand> &commands;
+		std::vector<Run> runs;
+
+		void bindResourceSet(uint32_t id)
+		{
+			if (runs.empty() || runs.back().resourceSet != id)	// lists of slices start with bind
+			{
+				runs.push_back(Run{ id, GLsizei(commands.size()), 0 });
+			}
+		}
+		void drawIndexed(const CommandList::DrawIndexedArgs &args)
+		{
+			commands.push_back({ args.count, 1, args.firstIndex, args.baseVertex, args.baseInstance });
+			runs.back().count++;	// lists bind resource set before the first draw
+		}
+	} backend{ indirect.GetReference(), {} };
+	backend.commands.clear();
+	lists.replay(backend);
+	if (backend.commands.empty())
+	{
+		return;
+	}
+
+	indirect.Update();
+	indirect.Bind(GL_DRAW_INDIRECT_BUFFER);
+	for (const Run &run : backend.runs)
+	{
+		if (run.count > 0)
+		{
+			MaterialPool::BindArrays(mDrawBatches[run.resourceSet].arrays);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+										reinterpret_cast<const void*>(run.first * sizeof(DrawElementsIndirectCommand)), run.count, 0);
+		}
+	}
+}
+
+void Renderer::bindSceneResources(const ShaderProgram &program)
+{
+	// Transform uniforms and draw data are uploaded once per view and frame, only bound here
+	mTransformUB.BindBase(0);
+	mDrawData.BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+
+	program.Use();
+	mGeometryPool.Bind();
+	mMaterialPool.Bind(0);
+	mEnvPtr->BindTextureUnit(4);
+	mEnvPtr->GetIrmapTexture().BindTextureUnit(5);
+	mEnvPtr->GetSpBrdfLutTexture().BindTextureUnit(6);
+	mEnvProbes.BindTextureUnits(7, 8);
+}
+
+void Renderer::renderSortedTransparency(const glm::mat4 &viewMatrix, bool gpuSort)
+{
+	// Visible blended draws go back to front by view depth of their bounds center, triangles of every draw are sorted
+	const auto &commands = mDrawCommands.GetReference();
+	const auto &draws = mDrawData.GetReference();
+	std::vector<std::pair<float, size_t>> blended;	// view depth and draw
+	GLuint numTriangles = 0;
+	for (const DrawBatch &batch : mDrawBatches)
+	{
+		for (GLsizei i = batch.firstBlended; i < GLsizei(batch.commands.size()); i++)
+		{
+			const size_t draw = size_t(batch.firstCommand + i);
+			if (0 != mDrawVisibility[draw])
+			{
+				const OcclusionCuller::Bounds &bounds = mDrawObjects[draw]->mesh->GetBounds();
+				const glm::vec4 center = viewMatrix * draws[draw].modelMatrix * glm::vec4{ 0.5f * (bounds.min + bounds.max), 1.f };
+				blended.emplace_back(center.z, draw);
+				numTriangles += commands[draw].count / 3;
+			}
+		}
+	}
+	if (blended.empty())
+	{
+		return;
+	}
+	std::sort(blended.begin(), blended.end());	// farthest have the most negative view Z
+
+	// All draws are sorted before the first is drawn, each into its own range of sorted indices
+	const auto sortStart = std::chrono::steady_clock::now();
+	mTriangleSorter.Reserve(numTriangles);
+	GLuint firstTriangle = 0;
+	for (const auto &entry : blended)
+	{
+		const glm::mat4 modelView = viewMatrix * draws[entry.second].modelMatrix;
+		if (gpuSort)
+		{
+			mTriangleSorter.SortGpu(mGeometryPool, commands[entry.second], modelView, firstTriangle);
+		}
+		else
+		{
+			mTriangleSorter.SortCpu(*mDrawObjects[entry.second]->source, modelView, firstTriangle);
+		}
+		firstTriangle += commands[entry.second].count / 3;
+	}
+	mBenchmark.sortMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count();
+
+	bindSceneResources(mPbrProgram);
+	firstTriangle = 0;
+	for (const auto &entry : blended)
+	{
+		MaterialPool::BindArrays(mDrawBatches[mDrawBatchIndices[entry.second]].arrays);
+		mTriangleSorter.Draw(mGeometryPool, commands[entry.second], firstTriangle);
+		firstTriangle += commands[entry.second].count / 3;
+	}
+}
+
+void Renderer::updateBenchmark(RenderSettings::Transparency mode)
+{
+	// Timings of a mode are reported when the next one starts, measurements of warm up frames are dropped
+	if (mode != mBenchmark.mode)
+	{
+		reportBenchmark();
+		mBenchmark = TransparencyBenchmark{ mode, kBenchmarkWarmupFrames, 0, 0. };
+	}
+	if (mBenchmark.warmupFrames > 0)
+	{
+		mBenchmark.warmupFrames--;
+		mBenchmark.frames = 0;
+		mBenchmark.sortMs = 0.;
+		mTransparencyTimer.TakeAverageMs();
+		mCompositeTimer.TakeAverageMs();
+	}
+	mBenchmark.frames++;
+}
+
+void Renderer::reportBenchmark()
+{
+	if (0 == mBenchmark.frames)
+	{
+		return;
+	}
+	const char *modeNames[] = { "weighted OIT", "sorted on GPU", "sorted on CPU" };
+	const double sortMs = mBenchmark.sortMs / double(mBenchmark.frames);
+	const double passMs = mTransparencyTimer.TakeAverageMs();
+	const double compositeMs = mCompositeTimer.TakeAverageMs();
+	std::cout << "Transparency benchmark, " << modeNames[int(mBenchmark.mode)] << " (" << mBenchmark.frames << " frames): "
+			  << "sorting " << sortMs << " ms CPU, transparency pass " << passMs << " ms GPU, composite "
+			  << compositeMs << " ms GPU" << std::endl;
+	mBenchmark.frames = 0;
+}
+
+void Renderer::buildDrawBatches()
+{
+	// Greedily put every object into the first batch whose texture arrays are compatible with its material
+	mDrawBatches.clear();
+	for (const SceneObject &object : mSceneObjects)
+	{
+		const auto arrays = mMaterialPool.GetArrays(object.mesh->GetMaterialIndex());
+		auto batchIt = std::find_if(mDrawBatches.begin(), mDrawBatches.end(),
+			[&arrays](DrawBatch &Batch) { return MaterialPool::Merge(Batch.arrays, arrays); });
+		if (mDrawBatches.end() == batchIt)
+		{
+			batchIt = mDrawBatches.insert(mDrawBatches.end(), DrawBatch{ arrays, {}, {}, 0, 0 });
+		}
+		batchIt->objects.push_back(&object);
+	}
+
+	auto &commands = mDrawCommands.GetReference();
+	commands.clear();
+	for (auto &batch : mDrawBatches)
+	{
+		// Opaque and cutout meshes first, so that transparency pass draws the tail of the batch
+		const auto blendedIt = std::stable_partition(batch.objects.begin(), batch.objects.end(), [this](const SceneObject *Object)
+			{ return MaterialPool::AlphaMode::Blended != mMaterialPool.GetAlphaMode(Object->mesh->GetMaterialIndex()); });
+		batch.firstBlended = GLsizei(blendedIt - batch.objects.begin());
+		batch.firstCommand = GLsizei(commands.size());
+		for (const SceneObject *object : batch.objects)
+		{
+			batch.commands.push_back(object->mesh->GetDrawCommand(GLuint(commands.size() + batch.commands.size())));
+		}
+		commands.insert(commands.end(), batch.commands.begin(), batch.commands.end());
+	}
+	mDrawCommands.Update();
+
+	// Material of every draw, matrices are written every frame
+	auto &draws = mDrawData.GetReference();
+	draws.clear();
+	mDrawBatchIndices.clear();
+	mDrawObjects.clear();
+	for (const auto &batch : mDrawBatches)
+	{
+		for (const SceneObject *object : batch.objects)
+		{
+			draws.push_back(DrawData{ glm::mat4{ 1.f }, glm::mat4{ 1.f }, glm::uvec4{ object->mesh->GetMaterialIndex() } });
+			mDrawBatchIndices.push_back(uint32_t(&batch - &mDrawBatches[0]));
+			mDrawObjects.push_back(object);
+		}
+	}
+	mDrawBatchesVersion = mMaterialPool.GetVersion();
+	mDrawsCulled = false;
+
+	std::vector<OcclusionCuller::Bounds> bounds;
+	for (const SceneObject *object : mDrawObjects)
+	{
+		bounds.push_back(object->mesh->GetBounds());
+	}
+	mHiZCuller.SetDraws(commands, bounds);
+}
+
+void Renderer::createImpostors()
+{
+	// Bake renders opaque surfaces only, blended meshes would be empty
+	for (const SceneObject &object : mSceneObjects)
+	{
+		if (MaterialPool::AlphaMode::Blended != mMaterialPool.GetAlphaMode(object.mesh->GetMaterialIndex())
+			&& 0 == mImpostors.count(object.mesh))
+		{
+			auto &impostor = mImpostors[object.mesh];
+			impostor.reset(new Impostor());
+			impostor->Create();
+		}
+	}
+}
+
+void Renderer::releaseImpostors()
+{
+	for (const auto &impostor : mImpostors)
+	{
+		impostor.second->Release();
+	}
+	mImpostors.clear();
+	mImpostorObjects.clear();
+}
+
+void Renderer::updateDrawData(const SceneSettings& scene)
+{
+	// All objects of the scene share the model matrix, offset doesn't change normal matrix
+	const glm::mat4 modelMatrix = getModelMatrix(scene);
+	const glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelMatrix));
+	auto &draws = mDrawData.GetReference();
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		draws[i].modelMatrix = glm::translate(modelMatrix, mDrawObjects[i]->offset);
+		draws[i].normalMatrix = normalMatrix;
+	}
+	mDrawData.Update();
+}
+
+glm::mat4 Renderer::getModelMatrix(const SceneSettings& scene)
+{
+	return /*glm::translate(glm::mat4{ 1.0f }, { 0.f, 0.0f, 40.0f })
+		   * */glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
+}
+
+void Renderer::cullDraws(const glm::mat4 &ViewProjection, const SceneSettings& scene)
+{
+	// Rasterize occluders into CPU depth buffer and test bounds of every draw against it
+	const glm::mat4 modelMatrix = getModelMatrix(scene);
+	mOcclusionCuller.begin(ViewProjection);
+	for (const SceneObject &object : mSceneObjects)
+	{
+		if (object.occluder)
+		{
+			mOcclusionCuller.addOccluder(object.occluder, glm::translate(modelMatrix, object.offset));
+		}
+	}
+	mOcclusionCuller.rasterize();
+
+	std::vector<OcclusionCuller::Bounds> bounds;
+	for (const SceneObject *object : mDrawObjects)
+	{
+		bounds.push_back(object->mesh->GetBounds());
+	}
+	std::vector<glm::mat4> modelMatrices;
+	for (const auto &draw : mDrawData.GetReference())
+	{
+		modelMatrices.push_back(draw.modelMatrix);
+	}
+	mOcclusionCuller.testVisibility(bounds, modelMatrices, mDrawVisibility);
+	// Occluder's own bounds are always in front of its depth, so occluders are never culled by themselves
+}
+
+void Renderer::setDrawVisibility(const std::vector<uint8_t> &Visible)
+{
+	// Empty list makes all draws visible
+	if (Visible.empty() && !mDrawsCulled)
+	{
+		return;
+	}
+	auto &commands = mDrawCommands.GetReference();
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		commands[i].instanceCount = (Visible.empty() || 0 != Visible[i]) ? 1 : 0;
+	}
+	mDrawCommands.Update();
+	mDrawsCulled = !Visible.empty();
+}
+
+void Renderer::touchVisibleMaterials(const glm::mat4 &ViewProjection)
+{
+	// Only draws that survived CPU culling and frustum test keep their textures resident (GPU culling results
+	// stay on GPU, draws it culls count as visible)
+	const auto &draws = mDrawData.GetReference();
+	for (size_t draw = 0; draw < mDrawObjects.size(); draw++)
+	{
+		const PbrMesh *meshPtr = mDrawObjects[draw]->mesh;
+		if (0 != mDrawVisibility[draw]
+			&& OcclusionCuller::isInFrustum(meshPtr->GetBounds(), ViewProjection * draws[draw].modelMatrix))
+		{
+			mMaterialPool.Touch(meshPtr->GetMaterialIndex());
+		}
+	}
+}
+
+void Renderer::readTextureFeedback()
 {
-	// update uniforms
-	auto &transformUniforms = mTransformUB.GetReference();
-	transformUniforms.modelMatrix = /*glm::translate(glm::mat4{ 1.0f }, { 0.f, 0.0f, 40.0f })
-									* */glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
-	mTransformUB.Bind(0);	// Update and bind uniform buffer
+	mTextureFeedback.Read([this](GLuint MaterialIndex, float FootprintLog2)
+		{ mMaterialPool.SetFootprint(MaterialIndex, FootprintLog2); });
+}
+
+void Renderer::renderProbeFace(const glm::mat4 &ViewProjection, const glm::mat4 &SkyViewProjection, glm::vec3 EyePosition,
+							   const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings)
+{
+	glDepthMask(GL_TRUE);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glDisable(GL_BLEND);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_DEPTH_TEST);
+	{
+		auto &skyboxUniforms = mSkyboxUB.GetReference();
+		skyboxUniforms.skyViewProjectionMatrix = SkyViewProjection;
+		skyboxUniforms.octahedralEnvironment = settings.octahedralEnvironment ? 1 : 0;
+		skyboxUniforms.environmentProbe = mEnvProbe;
+		mSkyboxUB.Bind(0);
+	}
+	mSkyboxProgram.Use();
+	mEnvPtr->BindTextureUnit(0);
+	mEnvProbes.BindTextureUnits(1, 2);
+	mSkybox.Render();
+
+	{
+		auto &shadingUniforms = mShadingUB.GetReference();
+		shadingUniforms.eyePosition = glm::vec4(EyePosition, 0.0f);
+		for (int i = 0; i < SceneSettings::NumLights; ++i)
+		{
+			const SceneSettings::Light& light = scene.lights[i];
+			shadingUniforms.lights[i].direction = glm::vec4{light.direction, 0.0f};
+			shadingUniforms.lights[i].radiance = light.enabled ? glm::vec4{light.radiance, 0.0f} : glm::vec4{};
+		}
+		mShadingUB.Bind(1);
+	}
+
+	// Only opaque geometry is captured
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+	mTransformUB.GetReference().viewProjectionMatrix = ViewProjection;
+	mTransformUB.Bind(0);
+	{
+		auto &baseInfoUniforms = mBaseInfoUB.GetReference();
+		baseInfoUniforms.opaquePass = 1;
+		baseInfoUniforms.feedbackPass = 0;
+		baseInfoUniforms.octahedralEnvironment = settings.octahedralEnvironment ? 1 : 0;
+		baseInfoUniforms.environmentProbe = mEnvProbe;
+		baseInfoUniforms.singlePass = 0;
+		baseInfoUniforms.sortedPass = 0;
+		baseInfoUniforms.alphaToCoverage = 0;
+		mBaseInfoUB.Bind(2);
+	}
+	renderScene(view, scene, mDrawCommands, mPbrProgram);
+}
+
+void Renderer::loadScene(const std::vector<std::string>& meshFiles, const std::string& environmentFile)
+{
+	// Files are read first, so that the current scene stays if any of them fails
+	std::vector<std::shared_ptr<Mesh>> meshes;
+	for (const std::string &file : meshFiles)
+	{
+		meshes.push_back(Mesh::fromFile(file));
+	}
+	const auto environmentImage = Image::fromRgbeFile(environmentFile);
+
+	// Environment is converted into the probe layer of the previous one
+	mEnvPtr->Release();
+	mEnvPtr = std::make_shared<Environment>(environmentImage);
+	mEnvProbes.Convert(mEnvProbe, *mEnvPtr, mEnvPtr->GetIrmapTexture());
+
+	// Pools start over, impostor and reflection probes are captured again for the new scene
+	mReflectionProbes.Invalidate();
+	mSceneObjects.clear();
+	mOccluderRow = false;
+	mMeshes.clear();
+	mMaterialPool.Release();
+	mGeometryPool.Release();
+	mGeometryPool.Create();
+	releaseImpostors();
+	for (const auto &mesh : meshes)
+	{
+		mMeshes.push_back(PbrMesh{ mesh, mGeometryPool, mMaterialPool, mUploadManager });
+	}
+	mUploadManager.EndFrame();
+
+	// Meshes are placed at origin, blended ones don't occlude
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		const bool blended = MaterialPool::AlphaMode::Blended == mMaterialPool.GetAlphaMode(mMeshes[i].GetMaterialIndex());
+		mSceneObjects.push_back(SceneObject{ &mMeshes[i], glm::vec3{ 0.f }, blended ? nullptr : OcclusionCuller::makeOccluder(*meshes[i]),
+											 meshes[i] });
+	}
+	createImpostors();
 
-	mPbrModel.Render();
+	// Single image must not show textures still streaming in, mip chains are built on worker threads meanwhile
+	while (mMaterialPool.IsStreaming())
+	{
+		mMaterialPool.Update(mUploadManager);
+		mUploadManager.EndFrame();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	buildDrawBatches();
+}
 
-// 		// update uniforms
-// 		transformUniforms.modelMatrix = /*glm::translate(glm::mat4{ 1.0f }, { 10.f, 0.0f, 0.0f })
-// 										* */glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
-// 		mTransformUB.Bind(0);	// Update and bind uniform buffer
+void Renderer::renderImage(int width, int height, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings,
+						   std::vector<uint32_t>& pixels)
+{
+	if (!mOutputFramebuffer)
+	{
+		mOutputFramebuffer = std::make_shared<Framebuffer>();
+		mOutputFramebuffer->AttachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA8, width, height);
+	}
+	mOutputFramebuffer->ResizeAll(width, height);
+	glViewport(0, 0, width, height);
+	renderFrame(width, height, view, scene, settings, mOutputFramebuffer.get());
 
-	mGlass.Render();
+	// RGBA bytes are pixels with red in the lowest byte, rows are flipped to go from top to bottom
+	std::vector<uint32_t> rows(size_t(width) * height);
+	mOutputFramebuffer->Bind();
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rows.data());
+	mOutputFramebuffer->Unbind();
+	pixels.resize(rows.size());
+	for (int y = 0; y < height; y++)
+	{
+		std::copy_n(&rows[size_t(height - 1 - y) * width], width, &pixels[size_t(y) * width]);
+	}
 }
 
-void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene)
+void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings)
 {
 	int fbWidth, fbHeight;
 	glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+	renderFrame(fbWidth, fbHeight, view, scene, settings, nullptr);
+	glfwSwapBuffers(window);
+}
+
+void Renderer::renderFrame(int fbWidth, int fbHeight, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings,
+						   Framebuffer *output)
+{
+	// Feedback of previous frames tells which mip levels of material textures are needed
+	if (settings.textureFeedback != mTextureFeedbackEnabled)
+	{
+		mTextureFeedbackEnabled = settings.textureFeedback;
+		if (!mTextureFeedbackEnabled)
+		{
+			mMaterialPool.ResetFootprints();
+		}
+	}
+	if (mTextureFeedbackEnabled)
+	{
+		readTextureFeedback();
+	}
+
+	// Row of model copies behind the model as seen from initial view, they hide behind it and behind each other
+	if (settings.occluderRow != mOccluderRow)
+	{
+		const std::array<float, 3> rowOffsets = { 300.f, 550.f, 800.f };
+		mOccluderRow = settings.occluderRow;
+		if (mOccluderRow)
+		{
+			const SceneObject model = mSceneObjects.front();
+			for (float x : rowOffsets)
+			{
+				mSceneObjects.push_back(SceneObject{ model.mesh, glm::vec3{ x, 0.f, 0.f }, model.occluder, model.source });
+			}
+		}
+		else
+		{
+			mSceneObjects.resize(mSceneObjects.size() - rowOffsets.size());
+		}
+		buildDrawBatches();
+	}
+
+	// Fit material textures into memory budget and stream in next mip levels,
+	// textures moved to other arrays need new draw batches
+	mMaterialPool.Update(mUploadManager);
+	if (mMaterialPool.GetVersion() != mDrawBatchesVersion)
+	{
+		buildDrawBatches();
+	}
+	updateDrawData(scene);					// one upload serves every pass of the frame
+
+	// Reflection probe update steps within GPU time budget, probes are refreshed round robin
+	mReflectionProbes.Bind(3, 9, 10, settings.reflectionProbes);
+	if (settings.reflectionProbes)
+	{
+		setDrawVisibility({});				// probes see draws culled for the camera
+		glClearColor(0.f, 0.f, 0.f, 0.f);
+		mReflectionProbes.Update(kProbeBudgetMs,
+			[&](const glm::mat4 &viewProjection, const glm::mat4 &skyViewProjection, glm::vec3 eyePosition)
+			{
+				renderProbeFace(viewProjection, skyViewProjection, eyePosition, view, scene, settings);
+			});
+		glViewport(0, 0, fbWidth, fbHeight);
+	}
 
 	mFramebuffer->ResizeAll(fbWidth, fbHeight);
 	mResolveFramebuffer->ResizeAll(fbWidth, fbHeight);
@@ -180,6 +785,47 @@ void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneS
 	const glm::mat4 viewRotationMatrix = glm::eulerAngleXY(glm::radians(view.pitch), glm::radians(view.yaw));
 	const glm::mat4 viewMatrix = glm::translate(glm::mat4{ 1.0f }, { 0.0f, 0.0f, -view.distance }) * viewRotationMatrix;
 
+	// Draws hidden behind occluders or replaced by impostor get zero instance count before any of them is submitted
+	if (settings.occlusionCulling)
+	{
+		cullDraws(projectionMatrix * viewMatrix, scene);
+	}
+	else
+	{
+		mDrawVisibility.assign(mDrawCommands.GetReference().size(), 1);
+	}
+	if (settings.impostors && !mMaterialPool.IsStreaming())
+	{
+		for (const auto &impostor : mImpostors)
+		{
+			if (!impostor.second->IsBaked())
+			{
+				impostor.second->Bake(*impostor.first, mGeometryPool, mMaterialPool);
+				glViewport(0, 0, fbWidth, fbHeight);
+			}
+		}
+	}
+	const glm::vec3 eyePosition = glm::vec3{ glm::inverse(viewMatrix) * glm::vec4{ 0, 0, 0, 1.f } };
+	mImpostorObjects.clear();
+	for (const SceneObject &object : mSceneObjects)
+	{
+		const auto impostorIt = mImpostors.find(object.mesh);
+		if (settings.impostors && mImpostors.end() != impostorIt && impostorIt->second->IsBaked()
+			&& impostorIt->second->GetScreenSize(glm::translate(getModelMatrix(scene), object.offset), eyePosition,
+												 glm::radians(view.fov), fbHeight) < kImpostorScreenSize)
+		{
+			mImpostorObjects.push_back(&object);
+		}
+	}
+	for (size_t draw = 0; draw < mDrawObjects.size() && !mImpostorObjects.empty(); draw++)
+	{
+		const bool impostor = mImpostorObjects.end() != std::find(mImpostorObjects.begin(), mImpostorObjects.end(), mDrawObjects[draw]);
+		mDrawVisibility[draw] &= impostor ? 0 : 1;
+	}
+	const bool allVisible = std::all_of(mDrawVisibility.begin(), mDrawVisibility.end(), [](uint8_t v) { return 0 != v; });
+	setDrawVisibility(allVisible ? std::vector<uint8_t>{} : mDrawVisibility);
+	touchVisibleMaterials(projectionMatrix * viewMatrix);
+
 	// Prepare framebuffer for rendering
 	mFramebuffer->Bind();
 	// opaque pass
@@ -196,15 +842,17 @@ void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneS
 	{
 		auto &skyboxUniforms = mSkyboxUB.GetReference();
 		skyboxUniforms.skyViewProjectionMatrix = projectionMatrix * viewRotationMatrix;
+		skyboxUniforms.octahedralEnvironment = settings.octahedralEnvironment ? 1 : 0;
+		skyboxUniforms.environmentProbe = mEnvProbe;
 		mSkyboxUB.Bind(0);
 	}
 	mSkyboxProgram.Use();
 	mEnvPtr->BindTextureUnit(0);
+	mEnvProbes.BindTextureUnits(1, 2);
 	mSkybox.Render();
 
 	// Update shading uniform buffer
 	{
-		const glm::vec3 eyePosition = glm::vec3{ glm::inverse(viewMatrix) * glm::vec4{ 0, 0, 0, 1.f } };
 		auto &shadingUniforms = mShadingUB.GetReference();
 		shadingUniforms.eyePosition = glm::vec4(eyePosition, 0.0f);
 		for (int i = 0; i < SceneSettings::NumLights; ++i)
@@ -223,33 +871,140 @@ void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneS
 	{
 		auto &transformUniforms = mTransformUB.GetReference();
 		transformUniforms.viewProjectionMatrix = projectionMatrix * viewMatrix;
-		transformUniforms.modelMatrix = glm::translate(glm::mat4{ 1.0f }, { 10.f, 0.0f, 0.0f })
-										* glm::eulerAngleXY(glm::radians(scene.pitch), glm::radians(scene.yaw));
+		transformUniforms.modelMatrix = getModelMatrix(scene);
+		mTransformUB.Bind(0);
 	}
 
 	// Update base info buffer
 	{
 		auto &baseInfoUniforms = mBaseInfoUB.GetReference();
 		baseInfoUniforms.opaquePass = 1;	// don't draw transparent geometry
+		baseInfoUniforms.feedbackPass = mTextureFeedbackEnabled ? 1 : 0;
+		baseInfoUniforms.octahedralEnvironment = settings.octahedralEnvironment ? 1 : 0;
+		baseInfoUniforms.environmentProbe = mEnvProbe;
+		baseInfoUniforms.singlePass = 0;
+		baseInfoUniforms.sortedPass = 0;
+		baseInfoUniforms.alphaToCoverage = 0;
+		if (mTextureFeedbackEnabled)
+		{
+			baseInfoUniforms.feedbackOffset = mTextureFeedback.Begin(fbWidth, fbHeight);
+		}
 		mBaseInfoUB.Bind(2);
 	}
-	// Draw scene
-	renderScene(view, scene);
+	// Draw scene, with GPU culling draws visible in the previous frame are drawn first and the rest is tested against
+	// their depth and drawn if visible. In single pass mode this is depth prepass of opaque geometry.
+	const bool sortedTransparency = RenderSettings::Transparency::WeightedOit != settings.transparency;
+	const bool singlePass = settings.singlePass && !sortedTransparency;	// sorted triangles need their own pass
+	const ShaderProgram &opaqueProgram = singlePass ? mDepthPrepassProgram : mPbrProgram;
+	const bool commandLists = settings.commandLists && !settings.gpuOcclusionCulling;	// GPU culling needs indirect draws
+	if (commandLists)
+	{
+		recordCommandLists(projectionMatrix * viewMatrix, singlePass);
+	}
+	if (singlePass)
+	{
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	}
+	else
+	{
+		// Cutout materials are drawn with opaque geometry, their alpha becomes sample coverage of MSAA target
+		glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+		mBaseInfoUB.GetReference().alphaToCoverage = 1;
+		mBaseInfoUB.Bind(2);
+	}
+	if (settings.gpuOcclusionCulling)
+	{
+		renderScene(view, scene, mHiZCuller.GetVisibleCommands(), opaqueProgram);
+		mHiZCuller.BuildPyramid(*mFramebuffer, fbWidth, fbHeight);
+		mHiZCuller.Cull(mDrawCommands, mDrawData);
+		renderScene(view, scene, mHiZCuller.GetNewlyVisibleCommands(), opaqueProgram);
+	}
+	else if (commandLists)
+	{
+		replayScene(mOpaqueCommandLists, mOpaqueReplayCommands, opaqueProgram);
+	}
+	else
+	{
+		renderScene(view, scene, mDrawCommands, opaqueProgram);
+	}
+	if (singlePass)
+	{
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+	glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+	for (const SceneObject *object : mImpostorObjects)
+	{
+		mTransformUB.GetReference().modelMatrix = glm::translate(getModelMatrix(scene), object->offset);
+		mTransformUB.Bind(0);
+		mImpostors.at(object->mesh)->Render();
+	}
 
 	// transparency pass (Order Independent Transparency (OIT), see https://developer.download.nvidia.com/SDK/10/opengl/src/dual_depth_peeling/doc/DualDepthPeeling.pdf)
 	glDepthMask(GL_FALSE);					// do not write new data to depth buffer
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_BLEND);						// enable blending so that transparent geometry sum up
-	glBlendFunc(GL_ONE, GL_ONE);			// weights for data in FB and new data
+	if (settings.benchmark)
+	{
+		updateBenchmark(settings.transparency);
+		mTransparencyTimer.Begin();
+	}
+	if (sortedTransparency)
+	{
+		// Exact order: triangles sorted back to front are blended over color target, OIT targets stay empty
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glColorMaski(2, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	}
+	else if (singlePass)
+	{
+		// Opaque and transparent geometry at once: opaque fragments pass depth test against prepass depth and replace
+		// color (source alpha is 1), transparent fragments leave color (source alpha is 0) and sum up in OIT targets
+		glDepthFunc(GL_LEQUAL);
+		glBlendFunci(0, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glBlendFunci(1, GL_ONE, GL_ONE);
+		glBlendFunci(2, GL_ONE, GL_ONE);
+	}
+	else
+	{
+		glBlendFunc(GL_ONE, GL_ONE);		// weights for data in FB and new data
+	}
 
 	{
 		auto &baseInfoUniforms = mBaseInfoUB.GetReference();
 		baseInfoUniforms.opaquePass = 0;	// draw transparent geometry
+		baseInfoUniforms.singlePass = singlePass ? 1 : 0;
+		baseInfoUniforms.sortedPass = sortedTransparency ? 1 : 0;
+		baseInfoUniforms.alphaToCoverage = 0;
 		mBaseInfoUB.Bind(2);				// update and bind uniform buffer
 	}
 
 	// Draw scene
-	renderScene(view, scene);
+	if (sortedTransparency)
+	{
+		renderSortedTransparency(viewMatrix, RenderSettings::Transparency::SortedGpu == settings.transparency);
+		glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glColorMaski(2, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+	else if (commandLists)
+	{
+		replayScene(mTransparentCommandLists, mTransparentReplayCommands, mPbrProgram);
+	}
+	else
+	{
+		// Single pass draws opaque geometry too, otherwise only blended materials
+		renderScene(view, scene, settings.gpuOcclusionCulling ? mHiZCuller.GetVisibleCommands() : mDrawCommands, mPbrProgram,
+					!singlePass);
+	}
+	glDepthFunc(GL_LESS);
+	if (settings.benchmark)
+	{
+		mTransparencyTimer.End();
+	}
+
+	if (mTextureFeedbackEnabled)
+	{
+		mTextureFeedback.End(GLuint(mMaterialPool.GetMaterialCount()));
+	}
 
 	mFramebuffer->Unbind();
 
@@ -264,21 +1019,43 @@ void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneS
 		});
 	mFramebuffer->InvalidateAttachments({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 });
 
-	// Draw a full screen triangle for postprocessing/tone mapping
-	mTonemapProgram.Use();
+	// Draw screen tiles for postprocessing/tone mapping
+	if (output)
+	{
+		output->Bind();
+	}
 	try
 	{
+		// Tiles with transparent pixels are found first, only they read OIT targets
+		const auto counterPtr = std::dynamic_pointer_cast<const Texture>(mResolveFramebuffer->GetRenderTarget(GL_COLOR_ATTACHMENT2));
+		if (settings.benchmark)
+		{
+			mCompositeTimer.Begin();
+		}
+		mOitTiles.Classify(*counterPtr);
+
 		std::dynamic_pointer_cast<const Texture>(mResolveFramebuffer->GetRenderTarget(GL_COLOR_ATTACHMENT0))->BindTextureUnit(0);
 		std::dynamic_pointer_cast<const Texture>(mResolveFramebuffer->GetRenderTarget(GL_COLOR_ATTACHMENT1))->BindTextureUnit(1);
-		std::dynamic_pointer_cast<const Texture>(mResolveFramebuffer->GetRenderTarget(GL_COLOR_ATTACHMENT2))->BindTextureUnit(2);
-		mEmptyVao.Render();
+		counterPtr->BindTextureUnit(2);
+		mOitCompositeProgram.Use();
+		mOitTiles.DrawTiles(true);
+		if (settings.benchmark)
+		{
+			mCompositeTimer.End();
+		}
+		mTonemapProgram.Use();
+		mOitTiles.DrawTiles(false);
 	}
 	catch (std::exception &e)
 	{
 		std::cout << e.what() << std::endl;
 	}
+	if (output)
+	{
+		output->Unbind();
+	}
 
-	glfwSwapBuffers(window);
+	mUploadManager.EndFrame();
 }
 
 #ifdef _DEBUG
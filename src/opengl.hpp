@@ -13,6 +13,11 @@
 #include "common/utils.hpp"
 #include "common/renderer.hpp"
 #include "common/mesh.hpp"
+#include "common/occlusion.hpp"
+#include "common/command_list.hpp"
+#include "common/radix_sort.hpp"
+#include "common/texture_cache.hpp"
+#include "common/parallel.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -25,9 +30,16 @@
 #include <iostream>
 #include <vector>
 #include <functional>
+#include <future>
 #include <memory>
 #include <algorithm>
+#include <array>
+#include <deque>
+#include <map>
+#include <cstring>
 #include <unordered_map>
+#include <cstddef>
+#include <limits>
 
 namespace OpenGL {
 
@@ -208,6 +220,16 @@ public:
 		glProgramUniform1f(mProgram, location, v0);
 	}
 
+	void SetInt(GLint location, GLint v0)
+	{
+		glProgramUniform1i(mProgram, location, v0);
+	}
+
+	void SetMatrix(GLint location, const glm::mat4 &v0)
+	{
+		glProgramUniformMatrix4fv(mProgram, location, 1, GL_FALSE, glm::value_ptr(v0));
+	}
+
 	void SetVector(GLint location, glm::vec2 v0)
 	{
 		glProgramUniform2f(mProgram, location, v0.x, v0.y);
@@ -312,36 +334,42 @@ public:
 		createTexture(Target, Width, Height, InternalFormat, Levels);
 	}
 
-	Texture(const std::shared_ptr<class Image>& Img, GLenum Format, GLenum InternalFormat, int Levels = 0)
+	// Only level 0 is uploaded, finer levels of texture created with more levels are generated with
+	// Downsampler::Generate (glGenerateTextureMipmap isn't used)
+	Texture(const std::shared_ptr<class Image>& Img, GLenum Format, GLenum InternalFormat, int Levels = 1)
 	{
 		createTexture(GL_TEXTURE_2D, Img->width(), Img->height(), InternalFormat, Levels);
 		glTextureSubImage2D(mId, 0, 0, 0, mWidth, mHeight, Format,
 							Img->isHDR() ? GL_FLOAT : GL_UNSIGNED_BYTE,
 							Img->pixels<void>());
-		if (mLevels > 1)
-		{
-			GenerateMipmap();
-		}
 	}
 
 	Texture(GLenum Target, GLint Width, GLint Height, GLenum Format, GLenum InternalFormat,
-			int Levels = 0, GLenum Type = GL_UNSIGNED_BYTE, void *DataPtr = nullptr)
+			int Levels = 1, GLenum Type = GL_UNSIGNED_BYTE, void *DataPtr = nullptr)
 	{
 		createTexture(Target, Width, Height, InternalFormat, Levels);
 		glTextureSubImage2D(mId, 0, 0, 0, mWidth, mHeight, Format, Type, DataPtr);
-		if (mLevels > 1)
-		{
-			GenerateMipmap();
-		}
 	}
 
 	GLint GetLevels() const { return mLevels; }
 
+	// Levels of full mip chain
+	static int GetLevelCount(int Width, int Height)
+	{
+		return int(1. + log(std::max(Width, Height)) / log(2.f));//Utility::numMipmapLevels(Width, Height);
+	}
+
 	void AttachTo(GLuint Fb, GLenum Attachment) const override
 	{
 		glNamedFramebufferTexture(Fb, Attachment, mId, 0);
 	}
 
+	// Attaches single layer (e.g. cube map face) of level
+	void AttachLayerTo(GLuint Fb, GLenum Attachment, GLint Level, GLint Layer) const
+	{
+		glNamedFramebufferTextureLayer(Fb, Attachment, mId, Level, Layer);
+	}
+
 	void Storage(GLenum InternalFormat, GLint Width, GLint Height, GLint Levels)
 	{
 		if (0 == mWidth && 0 == mHeight)
@@ -353,6 +381,18 @@ public:
 		}
 	}
 
+	// Texture must be created with GL_TEXTURE_2D_MULTISAMPLE target
+	void StorageMultisample(GLenum InternalFormat, GLint Width, GLint Height, GLint Samples)
+	{
+		if (0 == mWidth && 0 == mHeight)
+		{
+			glTextureStorage2DMultisample(mId, Samples, InternalFormat, Width, Height, GL_TRUE);
+			mWidth = Width;
+			mHeight = Height;
+			mLevels = 1;
+		}
+	}
+
 	void BindTextureUnit(GLuint unit) const
 	{
 		glBindTextureUnit(unit, mId);
@@ -363,9 +403,44 @@ public:
 		glBindImageTexture(Unit, mId, Level, Layered, Layer, Access, Format);
 	}
 
-	void GenerateMipmap() const
+	// View of all levels of 2D texture in another format of the same size class, e.g. GL_RGBA8 view of sRGB texture
+	// for image units, which don't take sRGB formats
+	Texture CreateView(GLenum InternalFormat) const
+	{
+		Texture view;
+		glGenTextures(1, &view.mId);
+		glTextureView(view.mId, GL_TEXTURE_2D, mId, InternalFormat, 0, mLevels, 0, 1);
+		view.mWidth = mWidth;
+		view.mHeight = mHeight;
+		view.mLevels = mLevels;
+		return view;
+	}
+
+	// Replaces whole level, Depth is number of cube map faces (or 1 for 2D texture)
+	void SubImageLevel(GLint Level, GLsizei Depth, GLenum Format, GLenum Type, const void *DataPtr) const
+	{
+		const GLsizei width = std::max(1, mWidth >> Level), height = std::max(1, mHeight >> Level);
+		if (Depth > 1)
+		{
+			glTextureSubImage3D(mId, Level, 0, 0, 0, width, height, Depth, Format, Type, DataPtr);
+		}
+		else
+		{
+			glTextureSubImage2D(mId, Level, 0, 0, width, height, Format, Type, DataPtr);
+		}
+	}
+
+	void Clear(GLint Level, GLenum Format, GLenum Type, const void *DataPtr) const
+	{
+		glClearTexImage(mId, Level, Format, Type, DataPtr);
+	}
+
+	// Copies level of cube map (all faces) or 2D texture into the same level of texture of the same size
+	void CopyLevelTo(GLint Level, GLsizei Depth, const Texture &Dst) const
 	{
-		glGenerateTextureMipmap(mId);
+		glCopyImageSubData(mId, (Depth > 1) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, Level, 0, 0, 0,
+						   Dst.mId, (Depth > 1) ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, Level, 0, 0, 0,
+						   std::max(1, mWidth >> Level), std::max(1, mHeight >> Level), Depth);
 	}
 
 	void CopyImageSubData(GLenum SrcTarget, GLint SrcLevel, GLint SrcX, GLint SrcY, GLint SrcZ,
@@ -381,6 +456,12 @@ public:
 		glTextureParameteri(mId, GL_TEXTURE_WRAP_T, WrapT);
 	}
 
+	void SetFilter(GLint MinFilter, GLint MagFilter) const
+	{
+		glTextureParameteri(mId, GL_TEXTURE_MIN_FILTER, MinFilter);
+		glTextureParameteri(mId, GL_TEXTURE_MAG_FILTER, MagFilter);
+	}
+
 	void Release() override
 	{
 		if (0 != mId)
@@ -393,14 +474,21 @@ public:
 	}
 
 protected:
-	void createTexture(GLenum Target, int Width, int Height, GLenum InternalFormat, int Levels = 0)
+	void createTexture(GLenum Target, int Width, int Height, GLenum InternalFormat, int Levels = 0, int Depth = 1)
 	{
 		mWidth  = Width;
 		mHeight = Height;
-		mLevels = (Levels > 0) ? Levels : int(1. + log(std::max(Width, Height)) / log(2.f));//Utility::numMipmapLevels(Width, Height);
+		mLevels = (Levels > 0) ? Levels : GetLevelCount(Width, Height);
 
 		glCreateTextures(Target, 1, &mId);
-		glTextureStorage2D(mId, mLevels, InternalFormat, mWidth, mHeight);
+		if (GL_TEXTURE_2D_ARRAY == Target)
+		{
+			glTextureStorage3D(mId, mLevels, InternalFormat, mWidth, mHeight, Depth);
+		}
+		else
+		{
+			glTextureStorage2D(mId, mLevels, InternalFormat, mWidth, mHeight);
+		}
 		glTextureParameteri(mId, GL_TEXTURE_MIN_FILTER, (mLevels > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 		glTextureParameteri(mId, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		static float maxAnisotropy = -1;
@@ -414,6 +502,275 @@ protected:
 	GLint mLevels;
 };
 
+// Array of equally sized 2D textures, layers are added to the end and storage grows as needed
+class TextureArray : public Texture
+{
+public:
+	TextureArray()
+		: Texture(), mInternalFormat(0), mLayers(0), mBaseLevel(0)
+	{
+	}
+
+	~TextureArray() override { Release(); }
+
+	TextureArray(TextureArray &&Other)
+		: Texture(std::move(Other)), mInternalFormat(Other.mInternalFormat), mLayers(Other.mLayers)
+			, mBaseLevel(Other.mBaseLevel), mResidentLevels(std::move(Other.mResidentLevels))
+	{
+		Other.mInternalFormat = 0;
+		Other.mLayers = 0;
+		Other.mBaseLevel = 0;
+	}
+
+	TextureArray &operator = (TextureArray &&Other)
+	{
+		if (&Other != this)
+		{
+			Release();
+
+			Texture::operator = (std::move(Other));
+			std::swap(mInternalFormat, Other.mInternalFormat);
+			std::swap(mLayers, Other.mLayers);
+			std::swap(mBaseLevel, Other.mBaseLevel);
+			std::swap(mResidentLevels, Other.mResidentLevels);
+		}
+		return *this;
+	}
+
+	TextureArray(GLint Width, GLint Height, GLenum InternalFormat, GLint Layers, int Levels = 0)
+		: Texture(), mInternalFormat(InternalFormat), mLayers(Layers), mBaseLevel(0)
+	{
+		createTexture(GL_TEXTURE_2D_ARRAY, Width, Height, InternalFormat, Levels, Layers);
+	}
+
+	GLint GetLayers() const { return mLayers; }
+	GLenum GetInternalFormat() const { return mInternalFormat; }
+
+	// Finest mip level of layer that has data, finer levels must not be sampled
+	GLint GetResidentLevel(GLint Layer) const
+	{
+		return (Layer < GLint(mResidentLevels.size())) ? mResidentLevels[Layer] : mLevels - 1;
+	}
+
+	void SetResidentLevel(GLint Layer, GLint Level)
+	{
+		if (Layer >= GLint(mResidentLevels.size()))
+		{
+			mResidentLevels.resize(Layer + 1, mLevels - 1);
+		}
+		mResidentLevels[Layer] = Level;
+		updateBaseLevel();
+	}
+
+	// Base level is the finest level resident in any layer, layers clamp their LOD in shader
+	GLint GetBaseLevel() const { return mBaseLevel; }
+
+	// Makes room for at least Layers layers, existing layers are copied to the new storage
+	void Reserve(GLint Layers)
+	{
+		if (Layers > mLayers)
+		{
+			TextureArray grown{ mWidth, mHeight, mInternalFormat, std::max(Layers, 2 * mLayers), mLevels };
+			for (int level = 0; level < mLevels; level++)
+			{
+				glCopyImageSubData(mId, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+								   grown.mId, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+								   std::max(1, mWidth >> level), std::max(1, mHeight >> level), mLayers);
+			}
+			grown.mResidentLevels = std::move(mResidentLevels);
+			*this = std::move(grown);
+			mBaseLevel = -1;
+			updateBaseLevel();
+		}
+	}
+
+	void SubImage(GLint Layer, GLint Level, GLenum Format, GLenum Type, const void *DataPtr) const
+	{
+		glTextureSubImage3D(mId, Level, 0, 0, Layer, std::max(1, mWidth >> Level), std::max(1, mHeight >> Level), 1,
+							Format, Type, DataPtr);
+	}
+
+	// Copies mip level of layer into level of the same size in another (or the same) array
+	void CopyLayerTo(GLint Level, GLint Layer, const TextureArray &Dst, GLint DstLevel, GLint DstLayer) const
+	{
+		glCopyImageSubData(mId, GL_TEXTURE_2D_ARRAY, Level, 0, 0, Layer, Dst.mId, GL_TEXTURE_2D_ARRAY, DstLevel, 0, 0, DstLayer,
+						   std::max(1, mWidth >> Level), std::max(1, mHeight >> Level), 1);
+	}
+
+	// Bytes of storage of one layer with all mip levels
+	size_t GetLayerSize() const
+	{
+		return GetLayerSize(mWidth, mHeight, mInternalFormat, mLevels);
+	}
+
+	// Bytes of storage of one layer of array that doesn't have to exist
+	static size_t GetLayerSize(GLint Width, GLint Height, GLenum InternalFormat, GLint Levels)
+	{
+		const size_t texelSize = (GL_RG8 == InternalFormat) ? 2 : 4;	// RGB8 is usually padded to 4 bytes
+		size_t size = 0;
+		for (int level = 0; level < Levels; level++)
+		{
+			size += size_t(std::max(1, Width >> level)) * size_t(std::max(1, Height >> level)) * texelSize;
+		}
+		return size;
+	}
+
+	void Release() override
+	{
+		Texture::Release();
+		mInternalFormat = 0;
+		mLayers = 0;
+		mBaseLevel = 0;
+		mResidentLevels.clear();
+	}
+
+protected:
+	void updateBaseLevel()
+	{
+		GLint base = mLevels - 1;
+		for (const GLint level : mResidentLevels)
+		{
+			base = std::min(base, level);
+		}
+		if (base != mBaseLevel)
+		{
+			mBaseLevel = base;
+			glTextureParameteri(mId, GL_TEXTURE_BASE_LEVEL, mBaseLevel);
+		}
+	}
+
+	GLenum mInternalFormat;
+	GLint mLayers;
+	GLint mBaseLevel;
+	std::vector<GLint> mResidentLevels;
+};
+
+// Generates all mip levels of RGBA16F or RGBA8 2D texture or cube map with single compute dispatch
+// (see downsample_cs.glsl), replaces glGenerateTextureMipmap which goes through the chain level by level
+class Downsampler : public NonCopyable
+{
+	static constexpr int kMaxSize = 4096;		// level 6 of larger texture doesn't fit into single work group tile
+	static constexpr int kFirstTailLevel = 7;	// levels from this one are written into buffer
+
+public:
+	Downsampler() : mTailBuffer(0), mCounterBuffer(0) {}
+
+	~Downsampler() override { Release(); }
+
+	// Generates levels after level 0 with box filter. sRGB textures (2D only) are filtered in linear space. With
+	// AlphaWeighted color is weighted by alpha, so that texels with zero alpha don't contribute to color.
+	void Generate(const Texture &Src, bool Cube, GLenum InternalFormat, bool AlphaWeighted = false)
+	{
+		assert(GL_RGBA16F == InternalFormat || GL_RGBA8 == InternalFormat || (GL_SRGB8_ALPHA8 == InternalFormat && !Cube));
+		assert(std::max(Src.GetWidth(), Src.GetHeight()) <= kMaxSize);
+		const GLint numLevels = Src.GetLevels() - 1;
+		const GLsizei slices = Cube ? 6 : 1;
+		if (numLevels < 1)
+		{
+			return;
+		}
+		auto &program = getProgram(Cube, InternalFormat, AlphaWeighted);
+		program.Use();
+		program.SetInt(0, numLevels);
+
+		// sRGB is decoded and encoded by shader
+		Texture srgbView;
+		if (GL_SRGB8_ALPHA8 == InternalFormat)
+		{
+			srgbView = Src.CreateView(GL_RGBA8);
+			InternalFormat = GL_RGBA8;
+		}
+		const Texture &Tex = srgbView.IsUsable() ? srgbView : Src;
+		for (GLint level = 0; level < std::min(numLevels + 1, kFirstTailLevel); level++)
+		{
+			Tex.BindImageTexture(level, level, Cube ? GL_TRUE : GL_FALSE, 0, (0 == level) ? GL_READ_ONLY : GL_READ_WRITE,
+								 InternalFormat);
+		}
+
+		// Tail levels and finished work group counters
+		const size_t texelSize = (GL_RGBA16F == InternalFormat) ? 8 : 4;
+		std::vector<size_t> tailOffsets;
+		size_t tailSize = 0;
+		for (GLint level = kFirstTailLevel; level <= numLevels; level++)
+		{
+			tailOffsets.push_back(tailSize);
+			tailSize += levelTexels(Tex, level) * slices * texelSize;
+		}
+		glCreateBuffers(1, &mCounterBuffer);
+		glNamedBufferStorage(mCounterBuffer, slices * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		const GLuint zero = 0;
+		glClearNamedBufferData(mCounterBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mCounterBuffer);
+		if (tailSize > 0)
+		{
+			glCreateBuffers(1, &mTailBuffer);
+			glNamedBufferStorage(mTailBuffer, tailSize, nullptr, 0);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mTailBuffer);
+		}
+
+		ShaderProgram::DispatchCompute((Tex.GetWidth() + 63) / 64, (Tex.GetHeight() + 63) / 64, slices);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+
+		if (tailSize > 0)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mTailBuffer);
+			for (GLint level = kFirstTailLevel; level <= numLevels; level++)
+			{
+				Tex.SubImageLevel(level, slices, GL_RGBA, (GL_RGBA16F == InternalFormat) ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE,
+								  reinterpret_cast<const void*>(tailOffsets[level - kFirstTailLevel]));
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		releaseBuffers();
+	}
+
+	void Release() override
+	{
+		releaseBuffers();
+		mPrograms.clear();
+	}
+
+protected:
+	static size_t levelTexels(const Texture &Tex, GLint Level)
+	{
+		return size_t(std::max(1, Tex.GetWidth() >> Level)) * size_t(std::max(1, Tex.GetHeight() >> Level));
+	}
+
+	// Program variant for texture type, format and weighting, compiled on first use
+	ShaderProgram &getProgram(bool Cube, GLenum InternalFormat, bool AlphaWeighted)
+	{
+		auto &program = mPrograms[std::make_tuple(Cube, InternalFormat, AlphaWeighted)];
+		if (!program.IsUsable())
+		{
+			std::string source = Shader::GetFileContents("shaders/downsample_cs.glsl");
+			const bool half = (GL_RGBA16F == InternalFormat);
+			const std::string defines = std::string("#define IMAGE_FORMAT ") + (half ? "rgba16f" : "rgba8")
+				+ "\n#define IMAGE_FORMAT_ID " + (half ? "0" : "1") + "\n" + (Cube ? "#define CUBE\n" : "")
+				+ ((GL_SRGB8_ALPHA8 == InternalFormat) ? "#define SRGB\n" : "") + (AlphaWeighted ? "#define ALPHA_WEIGHTED\n" : "");
+			source.insert(source.find('\n') + 1, defines);		// after #version
+			program = ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, source) }};
+		}
+		return program;
+	}
+
+	void releaseBuffers()
+	{
+		if (0 != mTailBuffer)
+		{
+			glDeleteBuffers(1, &mTailBuffer);
+			mTailBuffer = 0;
+		}
+		if (0 != mCounterBuffer)
+		{
+			glDeleteBuffers(1, &mCounterBuffer);
+			mCounterBuffer = 0;
+		}
+	}
+
+	std::map<std::tuple<bool, GLenum, bool>, ShaderProgram> mPrograms;
+	GLuint mTailBuffer, mCounterBuffer;
+};
+
 class Environment : public Texture
 {
 protected:
@@ -450,20 +807,27 @@ public:
 	Environment(const std::shared_ptr<class Image>& Img)
 		: Texture(GL_TEXTURE_CUBE_MAP, kEnvMapSize, kEnvMapSize, GL_RGBA16F)
 	{	//------------------------------------------------------------------------------------------------------------------
-		Texture envTextureEquirect{ Img, GL_RGB, GL_RGB16F, 1 };
+		// RGBE pixels are uploaded as is and decoded by compute shader (integer texture is fetched, not filtered)
+		const bool rgbe = Img->isRGBE();
+		Texture envTextureEquirect = rgbe ? Texture{ Img, GL_RGBA_INTEGER, GL_RGBA8UI, 1 } : Texture{ Img, GL_RGB, GL_RGB16F, 1 };
+		if (rgbe)
+		{
+			envTextureEquirect.SetFilter(GL_NEAREST, GL_NEAREST);
+		}
 		Texture envTextureUnfiltered{ GL_TEXTURE_CUBE_MAP, kEnvMapSize, kEnvMapSize, GL_RGBA16F };
 		ShaderProgram equirectToCubeProgram =
 			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/equirect2cube_cs.glsl")) }};
 
 		equirectToCubeProgram.Use();
-		envTextureEquirect.BindTextureUnit(0);
+		equirectToCubeProgram.SetInt(0, rgbe ? 1 : 0);
+		envTextureEquirect.BindTextureUnit(rgbe ? 1 : 0);
 		envTextureUnfiltered.BindImageTexture(0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
 
 		ShaderProgram::DispatchCompute(envTextureUnfiltered.GetWidth() / 32, envTextureUnfiltered.GetHeight() / 32, 6);
 
 		envTextureEquirect.Release();
 		equirectToCubeProgram.Release();
-		envTextureUnfiltered.GenerateMipmap();
+		Downsampler{}.Generate(envTextureUnfiltered, true, GL_RGBA16F);
 		//-------------------------------------------------------------------------------------------------------------------
 		ShaderProgram spmapProgram =
 			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/spmap_cs.glsl")) }};
@@ -526,6 +890,100 @@ protected:
 	Texture mIrmap, mSpBrdfLut;
 };
 
+// Prefiltered environments in octahedral encoding: every probe is a layer of two 2D array textures (specular with
+// roughness mip chain and irradiance), so the number of probes doesn't change the number of bound textures.
+// Every mip level has one texel border filled across octahedron edges, so that bilinear filtering has no seams.
+class EnvironmentProbeArray : public NonCopyable
+{
+	// Octahedral map of this size has about as many texels as cube map with 1024x1024 faces
+	static constexpr int kSpecularSize = 2048;
+	static constexpr int kIrradianceSize = 64;
+
+public:
+	EnvironmentProbeArray() : mSpecularSize(0), mIrradianceSize(0), mProbes(0) {}
+
+	~EnvironmentProbeArray() override { Release(); }
+
+	void Create(GLint SpecularSize = kSpecularSize, GLint IrradianceSize = kIrradianceSize)
+	{
+		mSpecularSize = SpecularSize;
+		mIrradianceSize = IrradianceSize;
+		mConvertProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/cube2oct_cs.glsl")) }};
+	}
+
+	// Converts prefiltered cube maps of environment into a new probe, returns its layer
+	GLint Add(const Environment &Env)
+	{
+		const GLint layer = AddLayer();
+		Convert(layer, Env, Env.GetIrmapTexture());
+		return layer;
+	}
+
+	// Adds probe layer, its contents are undefined until Convert()
+	GLint AddLayer()
+	{
+		const GLint layer = mProbes++;
+		if (0 == layer)
+		{
+			mSpecular = TextureArray{ mSpecularSize, mSpecularSize, GL_RGBA16F, 1 };
+			mIrradiance = TextureArray{ mIrradianceSize, mIrradianceSize, GL_RGBA16F, 1, 1 };
+			mSpecular.SetWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+			mIrradiance.SetWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+		}
+		mSpecular.Reserve(mProbes);
+		mIrradiance.Reserve(mProbes);
+		mSpecular.SetResidentLevel(layer, 0);
+		mIrradiance.SetResidentLevel(layer, 0);
+		return layer;
+	}
+
+	// Converts prefiltered specular cube map (with mip chain) and irradiance cube map into probe layer
+	void Convert(GLint Layer, const Texture &Specular, const Texture &Irradiance)
+	{
+		mConvertProgram.Use();
+		// Roughness of level is level / levels in pbr_fs.glsl for both encodings, so levels are matched by roughness
+		Specular.BindTextureUnit(0);
+		for (GLint level = 0; level < mSpecular.GetLevels(); level++)
+		{
+			convert(mSpecular, level, Layer, float(level * Specular.GetLevels()) / float(mSpecular.GetLevels()));
+		}
+		Irradiance.BindTextureUnit(0);
+		convert(mIrradiance, 0, Layer, 0.f);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	GLint GetProbeCount() const { return mProbes; }
+
+	void BindTextureUnits(GLuint SpecularUnit, GLuint IrradianceUnit) const
+	{
+		mSpecular.BindTextureUnit(SpecularUnit);
+		mIrradiance.BindTextureUnit(IrradianceUnit);
+	}
+
+	void Release() override
+	{
+		mSpecular.Release();
+		mIrradiance.Release();
+		mConvertProgram.Release();
+		mProbes = 0;
+	}
+
+protected:
+	void convert(const TextureArray &Dst, GLint Level, GLint Layer, float SourceLod)
+	{
+		const GLint size = std::max(1, Dst.GetWidth() >> Level);
+		Dst.BindImageTexture(0, Level, GL_FALSE, Layer, GL_WRITE_ONLY, GL_RGBA16F);
+		mConvertProgram.SetFloat(0, SourceLod);
+		ShaderProgram::DispatchCompute((size + 7) / 8, (size + 7) / 8, 1);
+	}
+
+	GLint mSpecularSize, mIrradianceSize;
+	TextureArray mSpecular, mIrradiance;
+	ShaderProgram mConvertProgram;
+	GLint mProbes;
+};
+
 class Renderbuffer : public RenderTarget
 {
 public:
@@ -640,9 +1098,10 @@ public:
 		updateDrawBuffers();
 	}
 
-	void AttachTexture(GLenum Attachment, GLenum Format, GLint Width, GLint Height)
+	// Texture is multisampled if Samples is nonzero, so that shaders can read its samples
+	void AttachTexture(GLenum Attachment, GLenum Format, GLint Width, GLint Height, GLint Samples = 0)
 	{
-		mRbParams[Attachment] = std::make_tuple(RenderTargetType::TypeTexture, Format, 0);
+		mRbParams[Attachment] = std::make_tuple(RenderTargetType::TypeTexture, Format, Samples);
 		recreateIfNeeded(Attachment, Width, Height);
 		updateDrawBuffers();
 	}
@@ -655,11 +1114,21 @@ public:
 		}
 	}
 
+	bool HasAttachment(GLenum Attachment) const
+	{
+		return 0 != mRenderbuffers.count(Attachment);
+	}
+
 	const std::shared_ptr<const RenderTarget> GetRenderTarget(GLenum Attachment) const
 	{
 		return mRenderbuffers.at(Attachment);
 	}
 
+	GLint GetSamples(GLenum Attachment) const
+	{
+		return std::get<2>(mRbParams.at(Attachment));
+	}
+
 	GLenum CheckStatus() const
 	{
 		return glCheckNamedFramebufferStatus(mId, GL_DRAW_FRAMEBUFFER);
@@ -752,9 +1221,16 @@ protected:
 					break;
 				case RenderTargetType::TypeTexture:
 					{
-						auto texturePtr = std::make_shared<Texture>(GL_TEXTURE_2D);
+						auto texturePtr = std::make_shared<Texture>((samples > 0) ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D);
 						mRenderbuffers[Attachment] = std::static_pointer_cast<RenderTarget>(texturePtr);
-						texturePtr->Storage(format, Width, Height, 1);
+						if (samples > 0)
+						{
+							texturePtr->StorageMultisample(format, Width, Height, samples);
+						}
+						else
+						{
+							texturePtr->Storage(format, Width, Height, 1);
+						}
 					}
 					break;
 			}
@@ -772,11 +1248,13 @@ class UniformBuffer : public NonCopyable
 {
 public:
 	UniformBuffer()
-		: mId(0)
+		: mId(0), mData()
 	{}
 
+	~UniformBuffer() override { Release(); }
+
 	UniformBuffer(UniformBuffer &&Other)
-		: mId(Other.mId)
+		: mId(Other.mId), mData(Other.mData)
 	{
 		Other.mId = 0;
 	}
@@ -788,6 +1266,7 @@ public:
 			Release();
 
 			std::swap(mId, Other.mId);
+			std::swap(mData, Other.mData);
 		}
 		return *this;
 	}
@@ -809,12 +1288,21 @@ public:
 		glBindBufferBase(GL_UNIFORM_BUFFER, Slot, mId);
 	}
 
+	// Bind without uploading, for buffers whose data doesn't change between draws
+	void BindBase(GLuint Slot) const
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, Slot, mId);
+	}
+
 	T &GetReference() { return mData; }
 
 	void Release() override
 	{
-		glDeleteBuffers(1, &mId);
-		mId = 0;
+		if (0 != mId)
+		{
+			glDeleteBuffers(1, &mId);
+			mId = 0;
+		}
 	}
 
 protected:
@@ -822,57 +1310,305 @@ protected:
 	T mData;
 };
 
-struct MeshBuffer
-{
-	MeshBuffer() : vbo(0), ibo(0), vao(0), numElements(0) {}
-	GLuint vbo, ibo, vao;
-	GLuint numElements;
-};
-
-class MeshGeometry : public NonCopyable
+// GPU buffer holding array of T (shader storage, indirect commands etc.)
+template <class T>
+class StorageBuffer : public NonCopyable
 {
 public:
-	MeshGeometry() : mEmpty(false), mVbo(0), mIbo(0), mVao(0), mNumElements(0)
-	{
-	}
+	StorageBuffer()
+		: mId(0), mCapacity(0)
+	{}
 
-	MeshGeometry(MeshGeometry &&Other)
-		: mEmpty(Other.mEmpty), mVbo(Other.mVbo), mIbo(Other.mIbo), mVao(Other.mVao), mNumElements(Other.mNumElements)
+	~StorageBuffer() override { Release(); }
+
+	StorageBuffer(StorageBuffer &&Other)
+		: mId(Other.mId), mCapacity(Other.mCapacity), mData(std::move(Other.mData))
 	{
-		Other.mEmpty = false;
-		Other.mVao = 0;
-		Other.mVbo = 0;
-		Other.mIbo = 0;
-		Other.mNumElements = 0;
+		Other.mId = 0;
+		Other.mCapacity = 0;
 	}
 
-	MeshGeometry &operator = (MeshGeometry &&Other)
+	StorageBuffer &operator = (StorageBuffer &&Other)
 	{
 		if (&Other != this)
 		{
 			Release();
 
-			std::swap(mEmpty, Other.mEmpty);
-			std::swap(mVao, Other.mVao);
-			std::swap(mVbo, Other.mVbo);
-			std::swap(mIbo, Other.mIbo);
-			std::swap(mNumElements, Other.mNumElements);
+			std::swap(mId, Other.mId);
+			std::swap(mCapacity, Other.mCapacity);
+			std::swap(mData, Other.mData);
 		}
 		return *this;
 	}
 
-	MeshGeometry(const std::shared_ptr<Mesh> &MeshPtr, bool FullScreenTriangle = false)
+	// Uploads data, buffer storage is recreated if data doesn't fit into it
+	void Update()
 	{
-		mEmpty = FullScreenTriangle;
-		if (false != FullScreenTriangle)
+		if (mData.size() > mCapacity || 0 == mId)
 		{
-			mNumElements = 0;
-			mVbo = 0;
-			mIbo = 0;
-			glCreateVertexArrays(1, &mVao);
-// 			std::vector<glm::vec2> vert = { glm::vec2 {-1.f, -1.f}, glm::vec2{1.f, -1.f}, glm::vec2{-1.f,  1.f}, glm::vec2{1.f,  1.f} };
-// 			std::vector<GLuint> ind = { 0, 1, 2, 3, 2, 1 };
-//
+			Release();
+			mCapacity = std::max<size_t>(std::max<size_t>(mData.size(), 2 * mCapacity), 1);
+			glCreateBuffers(1, &mId);
+			glNamedBufferStorage(mId, mCapacity * sizeof(T), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		if (!mData.empty())
+		{
+			glNamedBufferSubData(mId, 0, mData.size() * sizeof(T), &mData[0]);
+		}
+	}
+
+	void Bind(GLenum Target) const
+	{
+		glBindBuffer(Target, mId);
+	}
+
+	void BindBase(GLenum Target, GLuint Slot) const
+	{
+		glBindBufferBase(Target, Slot, mId);
+	}
+
+	std::vector<T> &GetReference() { return mData; }
+	const std::vector<T> &GetReference() const { return mData; }
+	GLuint GetId() const { return mId; }
+
+	void Release() override
+	{
+		if (0 != mId)
+		{
+			glDeleteBuffers(1, &mId);
+			mId = 0;
+		}
+		mCapacity = 0;
+	}
+
+protected:
+	GLuint mId;
+	size_t mCapacity;
+	std::vector<T> mData;
+};
+
+// Uploads buffer and texture data through persistently mapped staging ring buffer: data is written (memcpy'ed or
+// decoded) directly into mapped memory and copied to destination by GPU. Ring memory is reused once fence placed
+// at the end of frame is signaled. Non-blocking allocations are limited by bytes per frame budget so that
+// streaming doesn't cause frame time spikes.
+class UploadManager : public NonCopyable
+{
+	static constexpr size_t kAlignment = 256;
+
+public:
+	struct Allocation
+	{
+		void *ptr;
+		GLintptr offset;
+		size_t size;
+	};
+
+	UploadManager()
+		: mBuffer(0), mMappedPtr(nullptr), mSize(0), mHead(0), mUsed(0), mFrameBytes(0), mFrameBudget(0), mFrameUploaded(0)
+	{}
+
+	~UploadManager() override { Release(); }
+
+	void Create(size_t RingSize, size_t FrameBudget)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		mSize = RingSize;
+		mFrameBudget = FrameBudget;
+		glCreateBuffers(1, &mBuffer);
+		glNamedBufferStorage(mBuffer, mSize, nullptr, flags);
+		mMappedPtr = static_cast<char*>(glMapNamedBufferRange(mBuffer, 0, mSize, flags));
+	}
+
+	void SetFrameBudget(size_t FrameBudget) { mFrameBudget = FrameBudget; }
+	size_t GetFrameBudget() const { return mFrameBudget; }
+	size_t GetSize() const { return mSize; }
+
+	// Allocates staging memory within frame budget, fails if budget is spent or ring is full.
+	// First allocation of a frame is allowed to exceed budget so that large uploads make progress.
+	bool TryAllocate(size_t Size, Allocation &Alloc)
+	{
+		retire(false);
+		if ((mFrameUploaded > 0 && mFrameUploaded + Size > mFrameBudget) || !allocate(Size, Alloc))
+		{
+			return false;
+		}
+		mFrameUploaded += Size;
+		return true;
+	}
+
+	// Allocates staging memory regardless of budget, waits for GPU if ring is full
+	Allocation Allocate(size_t Size)
+	{
+		assert(Size <= mSize);
+		Allocation alloc;
+		while (!allocate(Size, alloc))
+		{
+			Fence();
+			retire(true);
+		}
+		return alloc;
+	}
+
+	void CopyToBuffer(const Allocation &Alloc, GLuint Buffer, GLintptr Offset) const
+	{
+		glCopyNamedBufferSubData(mBuffer, Buffer, Alloc.offset, Offset, Alloc.size);
+	}
+
+	// Calls Upload (e.g. texture sub image call) with staging buffer bound as pixel unpack buffer,
+	// pointer passed to it is the offset of allocation in the buffer
+	template <class F>
+	void CopyToTexture(const Allocation &Alloc, F Upload) const
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+		Upload(reinterpret_cast<const void*>(Alloc.offset));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// Copies data to buffer, large data is split into chunks that fit into ring
+	void UploadBuffer(GLuint Buffer, GLintptr Offset, const void *DataPtr, size_t Size)
+	{
+		const size_t chunkSize = mSize / 4;
+		for (size_t done = 0; done < Size; done += chunkSize)
+		{
+			const auto alloc = Allocate(std::min(chunkSize, Size - done));
+			memcpy(alloc.ptr, static_cast<const char*>(DataPtr) + done, alloc.size);
+			CopyToBuffer(alloc, Buffer, Offset + GLintptr(done));
+		}
+	}
+
+	// Places fence after copies issued since previous call, their memory is reused when it's signaled
+	void Fence()
+	{
+		if (mFrameBytes > 0)
+		{
+			mFences.push_back(std::make_tuple(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), mFrameBytes));
+			mFrameBytes = 0;
+		}
+	}
+
+	// Called once per frame after all uploads
+	void EndFrame()
+	{
+		Fence();
+		mFrameUploaded = 0;
+	}
+
+	void Release() override
+	{
+		for (const auto &fence : mFences)
+		{
+			glDeleteSync(std::get<0>(fence));
+		}
+		mFences.clear();
+		if (0 != mBuffer)
+		{
+			glUnmapNamedBuffer(mBuffer);
+			glDeleteBuffers(1, &mBuffer);
+			mBuffer = 0;
+		}
+		mMappedPtr = nullptr;
+		mSize = mHead = mUsed = mFrameBytes = mFrameUploaded = 0;
+	}
+
+protected:
+	bool allocate(size_t Size, Allocation &Alloc)
+	{
+		size_t start = (mHead + kAlignment - 1) & ~(kAlignment - 1);
+		size_t consumed = start - mHead + Size;
+		if (start + Size > mSize)
+		{
+			start = 0;	// wrap around, the rest of the ring is wasted until fence is signaled
+			consumed = mSize - mHead + Size;
+		}
+		if (Size > mSize || mUsed + consumed > mSize)
+		{
+			return false;
+		}
+		Alloc = Allocation{ mMappedPtr + start, GLintptr(start), Size };
+		mHead = start + Size;
+		mUsed += consumed;
+		mFrameBytes += consumed;
+		return true;
+	}
+
+	// Releases memory of signaled fences, if Wait is true waits for the oldest fence
+	void retire(bool Wait)
+	{
+		while (!mFences.empty())
+		{
+			const GLsync fence = std::get<0>(mFences.front());
+			const GLenum result = glClientWaitSync(fence, Wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, Wait ? GLuint64(1000000000) : 0);
+			if (GL_ALREADY_SIGNALED != result && GL_CONDITION_SATISFIED != result)
+			{
+				break;
+			}
+			glDeleteSync(fence);
+			mUsed -= std::get<1>(mFences.front());
+			mFences.pop_front();
+			Wait = false;
+		}
+	}
+
+	GLuint mBuffer;
+	char *mMappedPtr;
+	size_t mSize;
+	size_t mHead, mUsed;
+	size_t mFrameBytes;
+	size_t mFrameBudget, mFrameUploaded;
+	std::deque<std::tuple<GLsync, size_t>> mFences;
+};
+
+struct MeshBuffer
+{
+	MeshBuffer() : vbo(0), ibo(0), vao(0), numElements(0) {}
+	GLuint vbo, ibo, vao;
+	GLuint numElements;
+};
+
+class MeshGeometry : public NonCopyable
+{
+public:
+	MeshGeometry() : mEmpty(false), mVbo(0), mIbo(0), mVao(0), mNumElements(0)
+	{
+	}
+
+	MeshGeometry(MeshGeometry &&Other)
+		: mEmpty(Other.mEmpty), mVbo(Other.mVbo), mIbo(Other.mIbo), mVao(Other.mVao), mNumElements(Other.mNumElements)
+	{
+		Other.mEmpty = false;
+		Other.mVao = 0;
+		Other.mVbo = 0;
+		Other.mIbo = 0;
+		Other.mNumElements = 0;
+	}
+
+	MeshGeometry &operator = (MeshGeometry &&Other)
+	{
+		if (&Other != this)
+		{
+			Release();
+
+			std::swap(mEmpty, Other.mEmpty);
+			std::swap(mVao, Other.mVao);
+			std::swap(mVbo, Other.mVbo);
+			std::swap(mIbo, Other.mIbo);
+			std::swap(mNumElements, Other.mNumElements);
+		}
+		return *this;
+	}
+
+	MeshGeometry(const std::shared_ptr<Mesh> &MeshPtr, bool FullScreenTriangle = false)
+	{
+		mEmpty = FullScreenTriangle;
+		if (false != FullScreenTriangle)
+		{
+			mNumElements = 0;
+			mVbo = 0;
+			mIbo = 0;
+			glCreateVertexArrays(1, &mVao);
+// 			std::vector<glm::vec2> vert = { glm::vec2 {-1.f, -1.f}, glm::vec2{1.f, -1.f}, glm::vec2{-1.f,  1.f}, glm::vec2{1.f,  1.f} };
+// 			std::vector<GLuint> ind = { 0, 1, 2, 3, 2, 1 };
+//
 // 			mNumElements = ind.size();
 //
 // 			glCreateBuffers(1, &mVbo);
@@ -955,172 +1691,2137 @@ public:
 		}
 	}
 
+	// Draws vertices without attributes, vertex shader builds them from gl_VertexID
+	void RenderVertices(GLenum Mode, GLsizei Count)
+	{
+		glBindVertexArray(mVao);
+		glDrawArrays(Mode, 0, Count);
+	}
+
+	// The same with counts taken from bound GL_DRAW_INDIRECT_BUFFER at Offset
+	void RenderVerticesIndirect(GLenum Mode, GLintptr Offset)
+	{
+		glBindVertexArray(mVao);
+		glDrawArraysIndirect(Mode, reinterpret_cast<const void*>(Offset));
+	}
+
 protected:
 	GLboolean mEmpty;
 	GLuint mVbo, mIbo, mVao;
 	GLuint mNumElements;
 };
 
-class PbrMesh : public MeshGeometry
+// Layout of glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint  baseVertex;
+	GLuint baseInstance;
+};
+
+// Per draw data (std430), shaders index it by draw id, which is base instance of the draw, must match pbr_vs.glsl
+// and cull_cs.glsl
+struct DrawData
+{
+	glm::mat4 modelMatrix;
+	glm::mat4 normalMatrix;		// inverse transpose of model matrix, upper 3x3 is used
+	glm::uvec4 materialIndex;	// x, rest is padding
+};
+
+// Vertices and indices of many meshes in shared buffers, so that they can be drawn with a single indirect call.
+// Besides mesh attributes vertex array has per instance draw id (attribute 5) which equals base instance of the draw,
+// this way shaders know which draw they belong to without GL_ARB_shader_draw_parameters.
+class GeometryPool : public NonCopyable
 {
 public:
-	PbrMesh()
-		: MeshGeometry()
-	{}
+	static constexpr GLuint kMaxDraws = 1 << 16;
+	static constexpr GLuint kDrawIdAttribute = Mesh::NumAttributes;
 
-	PbrMesh(PbrMesh &&Other)
-		: MeshGeometry(std::move(Other))
+	struct Range
 	{
-		mAlbedo = std::move(Other.mAlbedo);
-		mNormals = std::move(Other.mNormals);
-		mMetalness = std::move(Other.mMetalness);
-		mRoughness = std::move(Other.mRoughness);
-		mEnvironmentPtr = std::move(Other.mEnvironmentPtr);
-	}
+		GLuint firstIndex;
+		GLuint numElements;
+		GLint baseVertex;
+	};
 
-	PbrMesh &operator = (PbrMesh &&Other)
+	GeometryPool()
+		: mVbo(0), mIbo(0), mDrawIds(0), mVao(0), mNumVertices(0), mNumIndices(0), mVertexCapacity(0), mIndexCapacity(0)
 	{
-		if (&Other != this)
-		{
-			MeshGeometry::operator = (std::move(Other));
-			mAlbedo = std::move(Other.mAlbedo);
-			mNormals = std::move(Other.mNormals);
-			mMetalness = std::move(Other.mMetalness);
-			mRoughness = std::move(Other.mRoughness);
-			mEnvironmentPtr = std::move(Other.mEnvironmentPtr);
-		}
-
-		return *this;
 	}
 
-	PbrMesh(const std::shared_ptr<Mesh> &MeshPtr, const std::shared_ptr<const Environment> &EnvironmentPtr = nullptr)
-		: MeshGeometry(MeshPtr, false)
+	~GeometryPool() override { Release(); }
+
+	void Create()
 	{
-		mEnvironmentPtr = EnvironmentPtr;
-		auto albedoFileName = "textures/"+ MeshPtr->textureName(Mesh::TextureType::Albedo);
-		if (albedoFileName.empty())
+		std::vector<GLuint> drawIds(kMaxDraws);
+		for (GLuint i = 0; i < kMaxDraws; i++)
 		{
-			GLubyte pix[] = { 128, 128, 128, 255 };
-			mAlbedo = Texture{ GL_TEXTURE_2D, 1, 1, GL_RGBA, GL_RGBA8, 0, GL_UNSIGNED_BYTE, &pix };
-		}
-		else
-		{
-			mAlbedo = Texture{ Image::fromFile(albedoFileName, 4), GL_RGBA, GL_SRGB8_ALPHA8 };
+			drawIds[i] = i;
 		}
+		glCreateBuffers(1, &mDrawIds);
+		glNamedBufferStorage(mDrawIds, drawIds.size() * sizeof(drawIds[0]), &drawIds[0], 0);
 
-		auto normalsFileName = "textures/"+ MeshPtr->textureName(Mesh::TextureType::Normals);
-		if (normalsFileName.empty())
+		glCreateVertexArrays(1, &mVao);
+		const std::array<std::tuple<GLint, GLuint>, Mesh::NumAttributes> attributes =
 		{
-			GLubyte pix[] = { 0, 0, 255 };
-			mNormals = Texture{ GL_TEXTURE_2D, 1, 1, GL_RGB, GL_RGB8, 0, GL_UNSIGNED_BYTE, &pix };
-		}
-		else
+			std::make_tuple(3, GLuint(offsetof(Mesh::Vertex, position))),
+			std::make_tuple(3, GLuint(offsetof(Mesh::Vertex, normal))),
+			std::make_tuple(3, GLuint(offsetof(Mesh::Vertex, tangent))),
+			std::make_tuple(3, GLuint(offsetof(Mesh::Vertex, bitangent))),
+			std::make_tuple(2, GLuint(offsetof(Mesh::Vertex, texcoord))),
+		};
+		for (GLuint i = 0; i < Mesh::NumAttributes; i++)
 		{
-			mNormals = Texture{ Image::fromFile(normalsFileName, 3), GL_RGB, GL_RGB8 };
+			glEnableVertexArrayAttrib(mVao, i);
+			glVertexArrayAttribFormat(mVao, i, std::get<0>(attributes[i]), GL_FLOAT, GL_FALSE, std::get<1>(attributes[i]));
+			glVertexArrayAttribBinding(mVao, i, 0);
 		}
+		glVertexArrayVertexBuffer(mVao, 1, mDrawIds, 0, sizeof(GLuint));
+		glVertexArrayBindingDivisor(mVao, 1, 1);
+		glEnableVertexArrayAttrib(mVao, kDrawIdAttribute);
+		glVertexArrayAttribIFormat(mVao, kDrawIdAttribute, 1, GL_UNSIGNED_INT, 0);
+		glVertexArrayAttribBinding(mVao, kDrawIdAttribute, 1);
+	}
+
+	Range Add(const std::shared_ptr<Mesh> &MeshPtr, UploadManager &Uploads)
+	{
+		const auto &vertices = MeshPtr->vertices();
+		const auto &faces = MeshPtr->faces();
+		const Range range{ mNumIndices, GLuint(faces.size() * 3), GLint(mNumVertices) };
 
-		auto metalnessFileName = "textures/"+ MeshPtr->textureName(Mesh::TextureType::Metalness);
-		if (metalnessFileName.empty())
+		reserve(mNumVertices + GLuint(vertices.size()), mNumIndices + range.numElements);
+		Uploads.UploadBuffer(mVbo, mNumVertices * sizeof(Mesh::Vertex), &vertices[0], vertices.size() * sizeof(Mesh::Vertex));
+		Uploads.UploadBuffer(mIbo, mNumIndices * sizeof(GLuint), &faces[0], faces.size() * sizeof(Mesh::Face));
+		mNumVertices += GLuint(vertices.size());
+		mNumIndices += range.numElements;
+		return range;
+	}
+
+	void Bind() const
+	{
+		glBindVertexArray(mVao);
+	}
+
+	// Vertex and index buffers as shader storage, for compute shaders reading mesh data
+	void BindStorage(GLuint VertexSlot, GLuint IndexSlot) const
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VertexSlot, mVbo);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, IndexSlot, mIbo);
+	}
+
+	// Draws take indices from Buffer instead of pool's index buffer, 0 restores pool's index buffer
+	void SetElementBuffer(GLuint Buffer) const
+	{
+		glVertexArrayElementBuffer(mVao, (0 != Buffer) ? Buffer : mIbo);
+	}
+
+	void Release() override
+	{
+		for (GLuint *buffer : { &mVbo, &mIbo, &mDrawIds })
 		{
-			GLubyte pix[] = { 128 };
-			mMetalness = Texture{ GL_TEXTURE_2D, 1, 1, GL_RED, GL_R8, 0, GL_UNSIGNED_BYTE, &pix };
+			if (0 != *buffer)
+			{
+				glDeleteBuffers(1, buffer);
+				*buffer = 0;
+			}
 		}
-		else
+		if (0 != mVao)
 		{
-			mMetalness = Texture{ Image::fromFile(metalnessFileName, 1), GL_RED, GL_R8 };
+			glDeleteVertexArrays(1, &mVao);
+			mVao = 0;
 		}
+		mNumVertices = mNumIndices = mVertexCapacity = mIndexCapacity = 0;
+	}
 
-		auto roughnessFileName = "textures/"+ MeshPtr->textureName(Mesh::TextureType::Roughness);
-		if (roughnessFileName.empty())
+protected:
+	// Grows buffers (at least twice) and copies existing data if new data doesn't fit
+	void reserve(GLuint Vertices, GLuint Indices)
+	{
+		if (Vertices > mVertexCapacity)
 		{
-			GLubyte pix[] = { 128 };
-			mRoughness = Texture{ GL_TEXTURE_2D, 1, 1, GL_RED, GL_R8, 0, GL_UNSIGNED_BYTE, &pix };
+			mVertexCapacity = std::max(Vertices, 2 * mVertexCapacity);
+			mVbo = grow(mVbo, mNumVertices * sizeof(Mesh::Vertex), mVertexCapacity * sizeof(Mesh::Vertex));
+			glVertexArrayVertexBuffer(mVao, 0, mVbo, 0, sizeof(Mesh::Vertex));
 		}
-		else
+		if (Indices > mIndexCapacity)
 		{
-			mRoughness = Texture{ Image::fromFile(roughnessFileName, 1), GL_RED, GL_R8 };
+			mIndexCapacity = std::max(Indices, 2 * mIndexCapacity);
+			mIbo = grow(mIbo, mNumIndices * sizeof(GLuint), mIndexCapacity * sizeof(GLuint));
+			glVertexArrayElementBuffer(mVao, mIbo);
 		}
 	}
 
-	void Render()
+	static GLuint grow(GLuint Buffer, size_t UsedSize, size_t NewSize)
 	{
-		static ShaderProgram pbrProgram;
-		if (!pbrProgram.IsUsable())
-		{
-			pbrProgram =
-				ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/pbr_vs.glsl")),
-								std::make_tuple(GL_FRAGMENT_SHADER, Shader::GetFileContents("shaders/pbr_fs.glsl")) }};
-		}
-		pbrProgram.Use();
-
-		mAlbedo.BindTextureUnit(0);
-		mNormals.BindTextureUnit(1);
-		mMetalness.BindTextureUnit(2);
-		mRoughness.BindTextureUnit(3);
-		if (nullptr != mEnvironmentPtr)
+		GLuint newBuffer;
+		glCreateBuffers(1, &newBuffer);
+		glNamedBufferStorage(newBuffer, NewSize, nullptr, 0);
+		if (0 != Buffer)
 		{
-			mEnvironmentPtr->BindTextureUnit(4);
-			mEnvironmentPtr->GetIrmapTexture().BindTextureUnit(5);
-			mEnvironmentPtr->GetSpBrdfLutTexture().BindTextureUnit(6);
+			if (UsedSize > 0)
+			{
+				glCopyNamedBufferSubData(Buffer, newBuffer, 0, 0, UsedSize);
+			}
+			glDeleteBuffers(1, &Buffer);
 		}
-		MeshGeometry::Render();
+		return newBuffer;
 	}
 
-protected:
-	Texture mAlbedo, mNormals, mMetalness, mRoughness;
-	std::shared_ptr<const Environment> mEnvironmentPtr;
+	GLuint mVbo, mIbo, mDrawIds, mVao;
+	GLuint mNumVertices, mNumIndices;
+	GLuint mVertexCapacity, mIndexCapacity;
 };
 
-//==========================================================================================================================
-//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//==========================================================================================================================
-class Renderer final : public RendererInterface
+// Materials of all PBR meshes: constant factors are in shader storage buffer, textures are stored in
+// texture arrays shared by all textures of the same size and format, so that meshes with different materials
+// can be drawn with a single draw call. Material index comes to shaders as draw id (see GeometryPool).
+// Textures are streamed by mip level: small levels are uploaded when material is added, larger ones
+// are uploaded smallest first within per frame upload budget, shaders clamp LOD to what is resident.
+// Texture memory is limited by budget: least recently used textures are moved to arrays of half size (their top
+// mip level is dropped) until arrays fit into it, dropped levels are reloaded when texture is used again.
+class MaterialPool : public NonCopyable
 {
+	// Mip levels not larger than this are uploaded immediately so that material is visible right away,
+	// textures are never reduced below this size
+	static constexpr int kResidentTailSize = 64;
+	// Distinguishes cache entries of constant color checks from texture entries of the same source
+	static constexpr uint64_t kConstantColorKey = 0x436F6E7374;
+
 public:
-	GLFWwindow* initialize(int width, int height, int maxSamples) override;
-	void shutdown() override;
-	std::function<void (int w, int h)> setup() override;
-	void render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene) override;
+	// Material flags, must match pbr_fs.glsl
+	enum MaterialFlags : int
+	{
+		AlbedoMap    = 1 << 0,
+		NormalMap    = 1 << 1,
+		MetalnessMap = 1 << 2,
+		RoughnessMap = 1 << 3,
+		OcclusionMap = 1 << 4,
+		AlphaCutout  = 1 << 5,
+	};
 
-protected:
-	void renderScene(const ViewSettings& view, const SceneSettings& scene);
+	// How surfaces of material cover what is behind them: fully, fully where alpha passes 0.5 (drawn with opaque
+	// geometry using alpha-to-coverage) or partially (drawn in transparency pass)
+	enum class AlphaMode { Opaque, Cutout, Blended };
 
-#ifdef _DEBUG
-	static void logMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
-#endif
+	// Texture slots, texture array of the slot is bound to texture unit with the same number
+	enum Slot { AlbedoSlot = 0, NormalSlot, OrmSlot, NumSlots };
 
-// 	struct
-// 	{
-// 		float maxAnisotropy = 1.0f;
-// 	}
-// 	mCapabilities;
+	// Texture arrays used by material (or batch of materials), nullptr for slots without texture
+	using ArraySet = std::array<std::shared_ptr<TextureArray>, NumSlots>;
 
-	std::shared_ptr<Framebuffer> mFramebuffer, mResolveFramebuffer;
+	MaterialPool()
+		: mMemoryBudget(std::numeric_limits<size_t>::max()), mFrame(0), mVersion(0), mDirty(false)
+	{}
 
-	MeshGeometry mFullScreenQuad;
-	MeshGeometry mSkybox;
-	PbrMesh mPbrModel;
-	PbrMesh mGlass;
+	~MaterialPool() override { Release(); }
+
+	void SetMemoryBudget(size_t Bytes) { mMemoryBudget = Bytes; }
+
+	// Loads material textures of mesh and returns index of the new material
+	GLuint Add(const std::shared_ptr<Mesh> &MeshPtr, UploadManager &Uploads)
+	{
+		// Channels without texture (or with single color texture) use constant factors, so that shader doesn't sample them
+		const auto &material = MeshPtr->material();
+		MaterialData data;
+		data.albedoFactor = material.albedo;
+		data.metalnessFactor = material.metalness;
+		data.roughnessFactor = material.roughness;
+		data.occlusionFactor = 1.f;
+		data.flags = 0;
+		data.layers = glm::ivec4{ 0 };
+		data.minLod = glm::vec4{ 0.f };
+		std::array<TextureRecord*, NumSlots> textures{};
+		AlphaMode alphaMode = AlphaMode::Opaque;
+
+		const auto albedoName = textureFileName(MeshPtr, Mesh::TextureType::Albedo);
+		const auto albedoColor = constantColor(albedoName, 4);
+		if (nullptr != albedoColor)
+		{
+			const GLubyte *pix = albedoColor->pixels<GLubyte>();
+			data.albedoFactor = glm::vec4{ srgbToLinear(pix[0]), srgbToLinear(pix[1]), srgbToLinear(pix[2]), pix[3] / 255.f };
+		}
+		else if (!albedoName.empty())
+		{
+			const auto albedoSource = mipSource({ albedoName }, GL_SRGB8_ALPHA8, 4, true,
+				[albedoName]() { return loadImage(albedoName, 4); });
+			const auto albedoMips = albedoSource.Load(true);
+			alphaMode = classifyAlpha(*albedoMips[0]);
+			textures[AlbedoSlot] = addTexture(albedoSource, albedoMips, GL_RGBA, GL_SRGB8_ALPHA8, Uploads);
+			data.flags |= AlbedoMap;
+		}
+		alphaMode = (data.albedoFactor.a < 1.f) ? AlphaMode::Blended : alphaMode;
+		data.flags |= (AlphaMode::Cutout == alphaMode) ? AlphaCutout : 0;
 
-	MeshGeometry mEmptyVao;
+		// Normal map is stored as two channels, Z is reconstructed in shader
+		const auto normalsName = textureFileName(MeshPtr, Mesh::TextureType::Normals);
+		if (!normalsName.empty())
+		{
+			const auto normalsSource = mipSource({ normalsName }, GL_RG8, 2, false, [normalsName]()
+				{
+					const auto normalsImg = loadImage(normalsName, 3);
+					return Image::packChannels({ { normalsImg, 0, 0 }, { normalsImg, 1, 0 } });
+				});
+			textures[NormalSlot] = addTexture(normalsSource, normalsSource.Load(true), GL_RG, GL_RG8, Uploads);
+			data.flags |= NormalMap;
+		}
 
-// 	Camera mCamera { glm::vec3(0, 0.3f, 5), glm::vec3(0, 0.3f, 0), glm::vec3(0, 1, 0) };
+		// Occlusion, roughness and metalness are packed into R, G and B channels of one texture
+		auto occlusionName = textureFileName(MeshPtr, Mesh::TextureType::Occlusion);
+		auto roughnessName = textureFileName(MeshPtr, Mesh::TextureType::Roughness);
+		auto metalnessName = textureFileName(MeshPtr, Mesh::TextureType::Metalness);
+		foldConstant(occlusionName, data.occlusionFactor);
+		foldConstant(roughnessName, data.roughnessFactor);
+		foldConstant(metalnessName, data.metalnessFactor);
+		data.flags |= occlusionName.empty() ? 0 : OcclusionMap;
+		data.flags |= roughnessName.empty() ? 0 : RoughnessMap;
+		data.flags |= metalnessName.empty() ? 0 : MetalnessMap;
+		if (0 != (data.flags & (OcclusionMap | RoughnessMap | MetalnessMap)))
+		{
+			const auto ormSource = mipSource({ occlusionName, roughnessName, metalnessName }, GL_RGB8, 3, false,
+				[occlusionName, roughnessName, metalnessName]()
+				{
+					return Image::packChannels({ { loadImage(occlusionName, 1), 0, 255 },
+												 { loadImage(roughnessName, 1), 0, 0 },
+												 { loadImage(metalnessName, 1), 0, 0 } });
+				});
+			textures[OrmSlot] = addTexture(ormSource, ormSource.Load(true), GL_RGB, GL_RGB8, Uploads);
+		}
 
-	ShaderProgram mSkyboxProgram;
-	ShaderProgram mTonemapProgram;
+		mMaterials.GetReference().push_back(data);
+		mMaterialFlags.push_back(data.flags);
+		mMaterialTextures.push_back(textures);
+		mAlphaModes.push_back(alphaMode);
+		mDirty = true;
+		return GLuint(mMaterialTextures.size() - 1);
+	}
 
-	std::shared_ptr<Environment> mEnvPtr;
+	AlphaMode GetAlphaMode(GLuint MaterialIndex) const { return mAlphaModes.at(MaterialIndex); }
 
-	struct SkyboxUB
+	// Marks textures of material as used in current frame, called for draws that survived culling
+	void Touch(GLuint MaterialIndex)
 	{
-		glm::mat4 skyViewProjectionMatrix;
-	};
-	UniformBuffer<SkyboxUB> mSkyboxUB;
+		for (TextureRecord *record : mMaterialTextures.at(MaterialIndex))
+		{
+			if (nullptr != record)
+			{
+				record->lastUsedFrame = mFrame;
+			}
+		}
+	}
 
-	struct TransformUB
+	// Texture feedback: log2 of the finest UV footprint of a pixel seen for material (0 means the whole texture
+	// fits into a pixel), desired mip level of every texture of the material follows from its size
+	void SetFootprint(GLuint MaterialIndex, float FootprintLog2)
 	{
-		glm::mat4 viewProjectionMatrix;
-		glm::mat4 modelMatrix;
+		for (TextureRecord *record : mMaterialTextures.at(MaterialIndex))
+		{
+			if (nullptr != record)
+			{
+				const float topLevel = std::log2(float(std::max(record->width, record->height)));
+				record->desiredLevel = std::max(0, GLint(std::floor(topLevel + FootprintLog2)));
+			}
+		}
+	}
+
+	// Without texture feedback every texture is streamed up to its full resolution
+	void ResetFootprints()
+	{
+		for (const auto &record : mTextures)
+		{
+			record->desiredLevel = 0;
+		}
+	}
+
+	// Called once per frame: keeps texture arrays within memory budget and streams in pending mip levels
+	void Update(UploadManager &Uploads)
+	{
+		mFrame++;
+
+		// Textures whose mip chain is being built on worker thread are left as they are until it arrives
+		std::vector<TextureRecord*> records;
+		for (const auto &record : mTextures)
+		{
+			if (record->loading.valid()
+				&& std::future_status::ready == record->loading.wait_for(std::chrono::seconds(0)))
+			{
+				finishLoading(*record, Uploads);
+			}
+			if (!record->loading.valid())
+			{
+				records.push_back(record.get());
+			}
+		}
+		if (GetUsedSize() > mMemoryBudget)
+		{
+			// Drop top level of least recently used textures until used layers fit into budget,
+			// textures whose top level isn't sampled according to feedback go first
+			std::sort(records.begin(), records.end(),
+				[](const TextureRecord *A, const TextureRecord *B)
+				{
+					const bool unusedTopA = A->desiredLevel > A->droppedLevels;
+					const bool unusedTopB = B->desiredLevel > B->droppedLevels;
+					return (unusedTopA != unusedTopB) ? unusedTopA : A->lastUsedFrame < B->lastUsedFrame;
+				});
+			for (TextureRecord *record : records)
+			{
+				if (GetUsedSize() <= mMemoryBudget)
+				{
+					break;
+				}
+				if (std::max(record->texture->GetWidth(), record->texture->GetHeight()) > kResidentTailSize)
+				{
+					dropTopLevel(*record);
+				}
+			}
+			compactArrays();
+		}
+		else
+		{
+			// Reload dropped level of the most recently used texture if it fits into budget (one per frame,
+			// since its image is decoded again on worker thread)
+			std::sort(records.begin(), records.end(),
+				[](const TextureRecord *A, const TextureRecord *B) { return A->lastUsedFrame > B->lastUsedFrame; });
+			for (TextureRecord *record : records)
+			{
+				if (record->droppedLevels > record->desiredLevel && record->lastUsedFrame + 1 >= mFrame)
+				{
+					const size_t size = GetUsedSize() + restoreCost(*record);
+					if (size <= mMemoryBudget)
+					{
+						restoreTopLevel(*record);
+						compactArrays();
+					}
+					break;
+				}
+			}
+		}
+
+		stream(Uploads);
+	}
+
+	// Bytes of texture array layers used by textures (arrays are compacted to that size when over budget)
+	size_t GetUsedSize() const
+	{
+		size_t size = 0;
+		for (const auto &array : mArrays)
+		{
+			size += array.second.usedLayers * array.second.texture->GetLayerSize();
+		}
+		return size;
+	}
+
+	bool IsStreaming() const
+	{
+		return mTextures.end() != std::find_if(mTextures.begin(), mTextures.end(),
+			[](const std::unique_ptr<TextureRecord> &Record) { return isPending(*Record) || Record->loading.valid(); });
+	}
+
+	size_t GetMaterialCount() const { return mMaterialTextures.size(); }
+
+	// Incremented when textures move to other texture arrays, so draw batches have to be rebuilt
+	uint64_t GetVersion() const { return mVersion; }
+
+	ArraySet GetArrays(GLuint MaterialIndex) const
+	{
+		ArraySet arrays;
+		for (int slot = 0; slot < NumSlots; slot++)
+		{
+			const TextureRecord *record = mMaterialTextures.at(MaterialIndex)[slot];
+			arrays[slot] = (nullptr != record) ? record->texture : nullptr;
+		}
+		return arrays;
+	}
+
+	// Two sets can be drawn together if every slot is either unused by one of them or is the same array
+	static bool Merge(ArraySet &Dst, const ArraySet &Src)
+	{
+		for (int slot = 0; slot < NumSlots; slot++)
+		{
+			if (nullptr != Dst[slot] && nullptr != Src[slot] && Dst[slot] != Src[slot])
+			{
+				return false;
+			}
+		}
+		for (int slot = 0; slot < NumSlots; slot++)
+		{
+			Dst[slot] = (nullptr != Dst[slot]) ? Dst[slot] : Src[slot];
+		}
+		return true;
+	}
+
+	static void BindArrays(const ArraySet &Arrays)
+	{
+		for (int slot = 0; slot < NumSlots; slot++)
+		{
+			if (nullptr != Arrays[slot])
+			{
+				Arrays[slot]->BindTextureUnit(slot);
+			}
+		}
+	}
+
+	// Uploads materials changed since last call and binds material storage buffer
+	void Bind(GLuint Slot)
+	{
+		if (mDirty)
+		{
+			// Layers and minimal LOD of every texture relative to base level of its array, textures without any
+			// level uploaded yet are not sampled (constant factors are used instead)
+			static const GLint slotFlags[NumSlots] = { AlbedoMap | AlphaCutout, NormalMap, OcclusionMap | RoughnessMap | MetalnessMap };
+			auto &materials = mMaterials.GetReference();
+			for (size_t i = 0; i < materials.size(); i++)
+			{
+				materials[i].flags = mMaterialFlags[i];
+				for (int slot = 0; slot < NumSlots; slot++)
+				{
+					const TextureRecord *record = mMaterialTextures[i][slot];
+					materials[i].flags &= (nullptr != record && !record->hasLevels) ? ~slotFlags[slot] : ~0;
+					materials[i].layers[slot] = (nullptr == record) ? 0 : record->layer;
+					materials[i].minLod[slot] = (nullptr == record) ? 0.f
+						: float(record->texture->GetResidentLevel(record->layer) - record->texture->GetBaseLevel());
+				}
+			}
+			mMaterials.Update();
+			mDirty = false;
+		}
+		mMaterials.BindBase(GL_SHADER_STORAGE_BUFFER, Slot);
+	}
+
+	void Release() override
+	{
+		// Loads running on worker threads refer to the cache
+		for (const auto &record : mTextures)
+		{
+			if (record->loading.valid())
+			{
+				record->loading.wait();
+			}
+		}
+		mMaterialTextures.clear();
+		mMaterialFlags.clear();
+		mAlphaModes.clear();
+		mTextures.clear();
+		mArrays.clear();
+		mMaterials.Release();
+		mMaterials.GetReference().clear();
+	}
+
+protected:
+	using MipChain = std::vector<std::shared_ptr<Image>>;
+
+	// Shader storage layout (std430) of material, must match pbr_fs.glsl
+	struct MaterialData
+	{
+		glm::vec4 albedoFactor;
+		float metalnessFactor;
+		float roughnessFactor;
+		float occlusionFactor;
+		GLint flags;
+		glm::ivec4 layers;	// layer of every slot in its texture array
+		glm::vec4 minLod;	// finest resident mip level of every slot, relative to base level of the array
+	};
+
+	// Source files of texture and the way its mip chain is made of them, loading may run on worker thread
+	struct MipSource
+	{
+		const TextureCache *cache;
+		uint64_t key;
+		int channels;
+		bool srgb;
+		std::function<std::shared_ptr<Image>()> decode;
+
+		// Full mip chain from decoded texture cache, or only the decoded top level if TopOnly and chain isn't cached
+		MipChain Load(bool TopOnly) const
+		{
+			MipChain mips;
+			if (!cache->load(key, channels, mips) || mips.empty())
+			{
+				mips = { decode() };
+			}
+			return TopOnly ? mips : Complete(mips);
+		}
+
+		// Downsamples the chain down to 1x1 and stores it to cache if it had to be built
+		MipChain Complete(MipChain Mips) const
+		{
+			if (Mips.back()->width() > 1 || Mips.back()->height() > 1)
+			{
+				while (Mips.back()->width() > 1 || Mips.back()->height() > 1)
+				{
+					Mips.push_back(Mips.back()->downsample(srgb));
+				}
+				cache->store(key, Mips);
+			}
+			return Mips;
+		}
+	};
+
+	// Material texture, it occupies a layer of texture array
+	struct TextureRecord
+	{
+		MipSource source;
+		GLenum format;
+		GLenum internalFormat;
+		GLint width, height;	// full resolution size
+		GLint droppedLevels;	// top mip levels dropped to fit into memory budget
+		std::shared_ptr<TextureArray> texture;
+		GLint layer;
+		MipChain mips;	// levels which are not uploaded yet, the last one is uploaded next
+		uint64_t lastUsedFrame;
+		GLint desiredLevel;		// finest full resolution level sampled by shaders according to texture feedback
+		std::future<MipChain> loading;	// mip chain being built (or loaded) on worker thread
+		GLint loadingLevels;	// levels of the loading chain (after dropped ones) which become pending
+		bool hasLevels;			// some level was uploaded
+
+		size_t NextLevelSize() const { return size_t(mips.back()->pitch()) * size_t(mips.back()->height()); }
+	};
+
+	struct ArrayInfo
+	{
+		std::shared_ptr<TextureArray> texture;
+		std::vector<TextureRecord*> layers;	// texture in every layer, nullptr for free layers
+		size_t usedLayers;
+	};
+
+	using ArrayKey = std::tuple<GLenum, GLint, GLint>;
+
+	static ArrayKey arrayKey(const TextureArray &Texture)
+	{
+		return std::make_tuple(Texture.GetInternalFormat(), Texture.GetWidth(), Texture.GetHeight());
+	}
+
+	// Mips are full chain from decoded texture cache or just the top level, then the rest is built on worker thread
+	TextureRecord *addTexture(const MipSource &Source, const MipChain &Mips, GLenum Format, GLenum InternalFormat,
+							  UploadManager &Uploads)
+	{
+		mTextures.emplace_back(new TextureRecord{ Source, Format, InternalFormat, Mips[0]->width(), Mips[0]->height(), 0,
+												  nullptr, 0, {}, mFrame, 0, {}, 0, true });
+		TextureRecord &record = *mTextures.back();
+		allocateLayer(record);
+		if (GLint(Mips.size()) == record.texture->GetLevels())
+		{
+			record.mips = Mips;
+			uploadTail(record, Uploads);
+		}
+		else
+		{
+			record.hasLevels = false;
+			record.loadingLevels = record.texture->GetLevels();
+			record.loading = ThreadPool::shared().submit([Source, Mips]() { return Source.Complete(Mips); });
+		}
+		return &record;
+	}
+
+	// Loads mip chain of texture made of source files, cache key is computed here since file hashes are remembered
+	// by the cache on this thread
+	MipSource mipSource(const std::vector<std::string> &FileNames, GLenum InternalFormat, int Channels, bool Srgb,
+						std::function<std::shared_ptr<Image>()> Decode)
+	{
+		uint64_t key = TextureCache::combine(InternalFormat, Srgb ? 1 : 0);
+		for (const auto &fileName : FileNames)
+		{
+			key = TextureCache::combine(key, mCache.hashFile(fileName));
+		}
+		return MipSource{ &mCache, key, Channels, Srgb, std::move(Decode) };
+	}
+
+	// Mip chain loaded on worker thread arrived, its levels not finer than resident level are pending
+	void finishLoading(TextureRecord &Record, UploadManager &Uploads)
+	{
+		auto mips = Record.loading.get();
+		mips.erase(mips.begin(), mips.begin() + std::min(size_t(Record.droppedLevels), mips.size()));
+		mips.resize(std::min(mips.size(), size_t(Record.loadingLevels)));
+		Record.mips = std::move(mips);
+		uploadTail(Record, Uploads);
+		Record.hasLevels = true;
+		mDirty = true;
+	}
+
+	// Alpha of albedo texture: opaque if there is no alpha below 1, cutout if alpha is almost only 0 or 1 (few texels
+	// in between come from filtering of edges), blended otherwise
+	static AlphaMode classifyAlpha(const Image &Albedo)
+	{
+		const GLubyte *pix = Albedo.pixels<GLubyte>();
+		const size_t texels = size_t(Albedo.width()) * size_t(Albedo.height());
+		size_t translucent = 0, partial = 0;
+		for (size_t i = 0; i < texels; i++)
+		{
+			const GLubyte alpha = pix[4 * i + 3];
+			translucent += (alpha < 255) ? 1 : 0;
+			partial += (alpha > 8 && alpha < 247) ? 1 : 0;
+		}
+		return (0 == translucent) ? AlphaMode::Opaque
+			 : (partial * 10 < translucent) ? AlphaMode::Cutout : AlphaMode::Blended;
+	}
+
+	// Single color texture as 1x1 image, nullptr if there is no texture or it isn't constant,
+	// so that constant textures are not decoded on every start
+	std::shared_ptr<Image> constantColor(const std::string &FileName, int Channels)
+	{
+		if (FileName.empty())
+		{
+			return nullptr;
+		}
+		const uint64_t key = TextureCache::combine(TextureCache::combine(mCache.hashFile(FileName), Channels), kConstantColorKey);
+		MipChain color;
+		if (!mCache.load(key, Channels, color))
+		{
+			const auto img = loadImage(FileName, Channels);
+			if (img->isConstant())
+			{
+				std::vector<Image::Channel> channels;
+				for (int c = 0; c < Channels; c++)
+				{
+					channels.push_back(Image::Channel{ nullptr, 0, img->pixels<GLubyte>()[c] });
+				}
+				color = { Image::packChannels(channels) };
+			}
+			mCache.store(key, color);
+		}
+		return color.empty() ? nullptr : color[0];
+	}
+
+	// Puts texture into the first free layer of texture array of its current size
+	void allocateLayer(TextureRecord &Record)
+	{
+		const GLint width = std::max(1, Record.width >> Record.droppedLevels);
+		const GLint height = std::max(1, Record.height >> Record.droppedLevels);
+		auto &info = mArrays[std::make_tuple(Record.internalFormat, width, height)];
+		if (nullptr == info.texture)
+		{
+			info.texture = std::make_shared<TextureArray>(width, height, Record.internalFormat, 1);
+			info.usedLayers = 0;
+		}
+		auto freeIt = std::find(info.layers.begin(), info.layers.end(), nullptr);
+		Record.layer = GLint(freeIt - info.layers.begin());
+		if (info.layers.end() == freeIt)
+		{
+			info.layers.push_back(nullptr);
+		}
+		info.layers[Record.layer] = &Record;
+		info.usedLayers++;
+		info.texture->Reserve(GLint(info.layers.size()));
+		info.texture->SetResidentLevel(Record.layer, info.texture->GetLevels() - 1);
+		Record.texture = info.texture;
+	}
+
+	void freeLayer(const std::shared_ptr<TextureArray> &Texture, GLint Layer)
+	{
+		auto infoIt = mArrays.find(arrayKey(*Texture));
+		infoIt->second.layers[Layer] = nullptr;
+		infoIt->second.usedLayers--;
+		// free layer must not keep base level of the array low
+		Texture->SetResidentLevel(Layer, Texture->GetLevels() - 1);
+		if (0 == infoIt->second.usedLayers)
+		{
+			mArrays.erase(infoIt);
+		}
+	}
+
+	// Reallocates arrays that have free or reserved layers, so that storage holds only used layers
+	void compactArrays()
+	{
+		for (auto &array : mArrays)
+		{
+			auto &info = array.second;
+			if (GLint(info.usedLayers) == info.texture->GetLayers())
+			{
+				continue;
+			}
+			const auto &texture = *info.texture;
+			TextureArray compacted{ texture.GetWidth(), texture.GetHeight(), texture.GetInternalFormat(),
+									GLint(info.usedLayers), texture.GetLevels() };
+			std::vector<TextureRecord*> layers;
+			for (TextureRecord *record : info.layers)
+			{
+				if (nullptr != record)
+				{
+					const GLint layer = GLint(layers.size());
+					const GLint resident = texture.GetResidentLevel(record->layer);
+					for (GLint level = resident; level < texture.GetLevels(); level++)
+					{
+						texture.CopyLayerTo(level, record->layer, compacted, level, layer);
+					}
+					compacted.SetResidentLevel(layer, resident);
+					record->layer = layer;
+					layers.push_back(record);
+				}
+			}
+			// move into the same object, so that shared pointers held by records stay valid
+			*info.texture = std::move(compacted);
+			info.layers = layers;
+		}
+		mDirty = true;
+	}
+
+	// Moves texture into array of half size, dropping its top mip level
+	void dropTopLevel(TextureRecord &Record)
+	{
+		const auto oldTexture = Record.texture;
+		const GLint oldLayer = Record.layer;
+		const GLint oldResident = oldTexture->GetResidentLevel(oldLayer);
+
+		Record.droppedLevels++;
+		allocateLayer(Record);
+		const GLint resident = std::min(std::max(0, oldResident - 1), Record.texture->GetLevels() - 1);
+		for (GLint level = resident; level < Record.texture->GetLevels() && level + 1 < oldTexture->GetLevels(); level++)
+		{
+			oldTexture->CopyLayerTo(level + 1, oldLayer, *Record.texture, level, Record.layer);
+		}
+		Record.texture->SetResidentLevel(Record.layer, resident);
+		if (!Record.mips.empty())
+		{
+			Record.mips.erase(Record.mips.begin());	// pending image of dropped level isn't needed any more
+		}
+		Record.mips.resize(resident);
+		freeLayer(oldTexture, oldLayer);
+		mVersion++;
+		mDirty = true;
+	}
+
+	// Moves texture back into array of twice the size, the top level is reloaded on worker thread and streamed in
+	void restoreTopLevel(TextureRecord &Record)
+	{
+		const auto oldTexture = Record.texture;
+		const GLint oldLayer = Record.layer;
+		const GLint oldResident = oldTexture->GetResidentLevel(oldLayer);
+
+		Record.droppedLevels--;
+		allocateLayer(Record);
+		const GLint resident = std::min(oldResident + 1, Record.texture->GetLevels() - 1);
+		for (GLint level = oldResident; level < oldTexture->GetLevels() && level + 1 < Record.texture->GetLevels(); level++)
+		{
+			oldTexture->CopyLayerTo(level, oldLayer, *Record.texture, level + 1, Record.layer);
+		}
+		Record.texture->SetResidentLevel(Record.layer, resident);
+
+		// Levels pending in the old layout are loaded again with the rest
+		Record.mips.clear();
+		Record.loadingLevels = resident;
+		const MipSource source = Record.source;
+		Record.loading = ThreadPool::shared().submit([source]() { return source.Load(false); });
+		freeLayer(oldTexture, oldLayer);
+		mVersion++;
+		mDirty = true;
+	}
+
+	// Additional storage that restoring top level of texture takes, arrays are created with full mip chain
+	static size_t restoreCost(const TextureRecord &Record)
+	{
+		const GLint width = std::max(1, Record.width >> (Record.droppedLevels - 1));
+		const GLint height = std::max(1, Record.height >> (Record.droppedLevels - 1));
+		return TextureArray::GetLayerSize(width, height, Record.internalFormat, Texture::GetLevelCount(width, height))
+			- Record.texture->GetLayerSize();
+	}
+
+	// Uploads mip levels that are not larger than resident tail size
+	void uploadTail(TextureRecord &Record, UploadManager &Uploads)
+	{
+		while (!Record.mips.empty()
+			   && std::max(Record.mips.back()->width(), Record.mips.back()->height()) <= kResidentTailSize)
+		{
+			uploadLevel(Record, Uploads.Allocate(Record.NextLevelSize()), Uploads);
+		}
+	}
+
+	// Uploads pending mip levels, smallest first, until frame budget of upload manager is spent
+	void stream(UploadManager &Uploads)
+	{
+		UploadManager::Allocation alloc;
+		for (;;)
+		{
+			TextureRecord *next = nullptr;
+			for (const auto &record : mTextures)
+			{
+				if (isPending(*record) && (nullptr == next || record->NextLevelSize() < next->NextLevelSize()))
+				{
+					next = record.get();
+				}
+			}
+			if (nullptr == next)
+			{
+				break;
+			}
+			if (next->NextLevelSize() > Uploads.GetSize())
+			{
+				// level doesn't fit into staging ring, upload it from client memory
+				const GLint level = GLint(next->mips.size()) - 1;
+				next->texture->SubImage(next->layer, level, next->format, GL_UNSIGNED_BYTE, next->mips.back()->pixels<void>());
+				next->texture->SetResidentLevel(next->layer, level);
+				next->mips.pop_back();
+			}
+			else if (Uploads.TryAllocate(next->NextLevelSize(), alloc))
+			{
+				uploadLevel(*next, alloc, Uploads);
+			}
+			else
+			{
+				break;
+			}
+			mDirty = true;
+		}
+	}
+
+	// Texture has mip levels to upload that are not finer than desired level
+	static bool isPending(const TextureRecord &Record)
+	{
+		return !Record.mips.empty() && GLint(Record.mips.size()) - 1 + Record.droppedLevels >= Record.desiredLevel;
+	}
+
+	// Copies the last pending mip level to staging memory and then to texture array
+	static void uploadLevel(TextureRecord &Record, const UploadManager::Allocation &Alloc, UploadManager &Uploads)
+	{
+		const GLint level = GLint(Record.mips.size()) - 1;
+		memcpy(Alloc.ptr, Record.mips.back()->pixels<void>(), Alloc.size);
+		Uploads.CopyToTexture(Alloc, [&](const void *Offset)
+			{ Record.texture->SubImage(Record.layer, level, Record.format, GL_UNSIGNED_BYTE, Offset); });
+		Record.texture->SetResidentLevel(Record.layer, level);
+		Record.mips.pop_back();
+	}
+
+	// Returns empty string if mesh has no texture of given type
+	static std::string textureFileName(const std::shared_ptr<Mesh> &MeshPtr, Mesh::TextureType TexType)
+	{
+		const auto textureName = MeshPtr->textureName(TexType);
+		return textureName.empty() ? textureName : "textures/" + textureName;
+	}
+
+	// Returns nullptr if file name is empty
+	static std::shared_ptr<Image> loadImage(const std::string &FileName, int Channels)
+	{
+		return FileName.empty() ? nullptr : Image::fromFile(FileName, Channels);
+	}
+
+	// Single color map is replaced by constant factor, file name is reset so that channel isn't sampled
+	void foldConstant(std::string &FileName, float &Factor)
+	{
+		const auto color = constantColor(FileName, 1);
+		if (nullptr != color)
+		{
+			Factor = color->pixels<GLubyte>()[0] / 255.f;
+			FileName.clear();
+		}
+	}
+
+	static float srgbToLinear(GLubyte Value)
+	{
+		const float c = Value / 255.f;
+		return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	TextureCache mCache{ "cache" };
+	size_t mMemoryBudget;
+	uint64_t mFrame;
+	uint64_t mVersion;
+	std::map<ArrayKey, ArrayInfo> mArrays;
+	std::vector<std::unique_ptr<TextureRecord>> mTextures;
+	std::vector<std::array<TextureRecord*, NumSlots>> mMaterialTextures;
+	std::vector<GLint> mMaterialFlags;	// of every material, maps of textures that aren't loaded yet are masked on upload
+	std::vector<AlphaMode> mAlphaModes;	// of every material
+	StorageBuffer<MaterialData> mMaterials;
+	bool mDirty;
+};
+
+// Emulation of sampler feedback: while enabled, PBR fragment shader writes material index and UV footprint of one
+// pixel of every screen tile into low resolution image (pixel within tile changes every frame), compute shader
+// reduces it to the finest footprint of every material and the result is read back a few frames later without stall.
+class TextureFeedback : public NonCopyable
+{
+	static constexpr GLuint kEmpty = 0xFFFFFFFF;
+	static constexpr int kReadbackSlots = 3;
+
+public:
+	static constexpr int kTileSize = 8;	// must match pbr_fs.glsl
+
+	TextureFeedback() : mFrame(0), mSlots{} {}
+
+	~TextureFeedback() override { Release(); }
+
+	void Create()
+	{
+		mReduceProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/feedback_cs.glsl")) }};
+	}
+
+	// Clears and binds feedback image for frame of given size, returns pixel of every tile written in this frame
+	glm::ivec2 Begin(GLint Width, GLint Height)
+	{
+		const GLint width = (Width + kTileSize - 1) / kTileSize;
+		const GLint height = (Height + kTileSize - 1) / kTileSize;
+		if (mImage.GetWidth() != width || mImage.GetHeight() != height)
+		{
+			mImage = Texture{ GL_TEXTURE_2D, width, height, GL_R32UI, 1 };
+		}
+		const GLuint empty = kEmpty;
+		mImage.Clear(0, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+		mImage.BindImageTexture(0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+		// step is coprime with number of tile pixels, so every pixel is visited once per kTileSize^2 frames
+		const int pixel = int((mFrame * 37) % (kTileSize * kTileSize));
+		return glm::ivec2{ pixel % kTileSize, pixel / kTileSize };
+	}
+
+	// Reduces feedback written since Begin() and queues its read back
+	void End(GLuint NumMaterials)
+	{
+		auto &slot = mSlots[mFrame++ % kReadbackSlots];
+		if (0 != slot.fence || 0 == NumMaterials)
+		{
+			return;		// reader is behind, drop this frame
+		}
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		mFootprints.GetReference().assign(NumMaterials, kEmpty);
+		mFootprints.Update();
+		mFootprints.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+		mImage.BindImageTexture(0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+		mReduceProgram.Use();
+		ShaderProgram::DispatchCompute((mImage.GetWidth() + 7) / 8, (mImage.GetHeight() + 7) / 8, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		if (slot.capacity < NumMaterials)
+		{
+			releaseSlot(slot);
+			const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			slot.capacity = std::max(NumMaterials, GLuint(64));
+			glCreateBuffers(1, &slot.buffer);
+			glNamedBufferStorage(slot.buffer, slot.capacity * sizeof(GLuint), nullptr, flags);
+			slot.mappedPtr = static_cast<const GLuint*>(glMapNamedBufferRange(slot.buffer, 0, slot.capacity * sizeof(GLuint), flags));
+		}
+		glCopyNamedBufferSubData(mFootprints.GetId(), slot.buffer, 0, 0, NumMaterials * sizeof(GLuint));
+		slot.count = NumMaterials;
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// Calls Callback(MaterialIndex, FootprintLog2) for materials seen in frames whose results arrived,
+	// returns false if nothing arrived
+	template <class F>
+	bool Read(F Callback)
+	{
+		bool read = false;
+		for (int i = 0; i < kReadbackSlots; i++)
+		{
+			auto &slot = mSlots[(mFrame + i) % kReadbackSlots];	// oldest first
+			if (0 == slot.fence || GL_TIMEOUT_EXPIRED == glClientWaitSync(slot.fence, 0, 0))
+			{
+				continue;
+			}
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			for (GLuint material = 0; material < slot.count; material++)
+			{
+				if (kEmpty != slot.mappedPtr[material])
+				{
+					Callback(material, float(slot.mappedPtr[material]) / 8.f - 32.f);	// see encoding in pbr_fs.glsl
+				}
+			}
+			read = true;
+		}
+		return read;
+	}
+
+	void Release() override
+	{
+		for (auto &slot : mSlots)
+		{
+			releaseSlot(slot);
+		}
+		mImage.Release();
+		mFootprints.Release();
+		mReduceProgram.Release();
+	}
+
+protected:
+	// Read back buffer of one frame in flight
+	struct Slot
+	{
+		GLuint buffer;
+		const GLuint *mappedPtr;
+		GLuint capacity, count;
+		GLsync fence;
+	};
+
+	static void releaseSlot(Slot &S)
+	{
+		if (0 != S.fence)
+		{
+			glDeleteSync(S.fence);
+		}
+		if (0 != S.buffer)
+		{
+			glUnmapNamedBuffer(S.buffer);
+			glDeleteBuffers(1, &S.buffer);
+		}
+		S = Slot{};
+	}
+
+	uint64_t mFrame;
+	Texture mImage;
+	StorageBuffer<GLuint> mFootprints;
+	ShaderProgram mReduceProgram;
+	std::array<Slot, kReadbackSlots> mSlots;
+};
+
+// Reflection probes rendered at runtime: scene is captured into cube map from probe position, prefiltered with
+// spmap_cs and irmap_cs and converted into layer of octahedral probe array. Update is split into steps (one face,
+// one mip level, ...). GPU time of every step is measured with timer queries and steps are done until their
+// expected time fills per frame budget, so frame cost doesn't depend on number of probes, they are refreshed round
+// robin. Intermediate cube maps are shared, since one probe is updated at a time.
+class ReflectionProbes : public NonCopyable
+{
+	static constexpr int kCaptureSize = 128;
+	static constexpr int kIrradianceSize = 32;
+	static constexpr int kOctahedralSize = 256;
+	static constexpr float kNearPlane = 1.f;
+	static constexpr float kFarPlane = 10000.f;
+	static constexpr float kCostSmoothing = 0.1f;	// weight of new measurement in step cost average
+
+public:
+	static constexpr int kMaxProbes = 16;	// must match pbr_fs.glsl
+
+	ReflectionProbes() : mCurrent(0), mStep(0) {}
+
+	~ReflectionProbes() override { Release(); }
+
+	void Create()
+	{
+		mProbeArray.Create(kOctahedralSize, kIrradianceSize);
+		mCapture = Texture{ GL_TEXTURE_CUBE_MAP, kCaptureSize, kCaptureSize, GL_RGBA16F };
+		mPrefiltered = Texture{ GL_TEXTURE_CUBE_MAP, kCaptureSize, kCaptureSize, GL_RGBA16F };
+		mIrradiance = Texture{ GL_TEXTURE_CUBE_MAP, kIrradianceSize, kIrradianceSize, GL_RGBA16F, 1 };
+		mFramebuffer = std::make_shared<Framebuffer>();
+		mFramebuffer->AttachRenderbuffer(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT24, kCaptureSize, kCaptureSize);
+		mSpmapProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/spmap_cs.glsl")) }};
+		mIrmapProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/irmap_cs.glsl")) }};
+		mProbesUB.Create();
+		mStepCostsMs.assign(9 + mPrefiltered.GetLevels(), -1.f);	// see step()
+	}
+
+	// Probe affects surfaces closer than Radius, two nearest probes are blended
+	GLint Add(glm::vec3 Position, float Radius)
+	{
+		assert(mProbes.size() < size_t(kMaxProbes));
+		mProbes.push_back(Probe{ Position, Radius, mProbeArray.AddLayer(), false });
+		return GLint(mProbes.size() - 1);
+	}
+
+	// Captures show the previous scene, probes are left out until captured again from the first one
+	void Invalidate()
+	{
+		for (auto &probe : mProbes)
+		{
+			probe.ready = false;
+		}
+		mCurrent = 0;
+		mStep = 0;
+	}
+
+	// Does update steps while their average GPU time fits into BudgetMs, at least one step and at most update of one
+	// whole probe. Step not measured yet counts as the whole budget. RenderFace(ViewProjection, SkyViewProjection,
+	// EyePosition) renders scene into bound framebuffer, viewport is left set to capture size.
+	template <class F>
+	void Update(float BudgetMs, F RenderFace)
+	{
+		readTimings();
+		float spentMs = 0.f;
+		for (size_t i = 0; i < mStepCostsMs.size() && !mProbes.empty(); i++)
+		{
+			const float costMs = (mStepCostsMs[mStep] < 0.f) ? BudgetMs : mStepCostsMs[mStep];
+			if (i > 0 && spentMs + costMs > BudgetMs)
+			{
+				break;
+			}
+			GLuint query = 0;
+			if (mFreeQueries.empty())
+			{
+				glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+			}
+			else
+			{
+				query = mFreeQueries.back();
+				mFreeQueries.pop_back();
+			}
+			mPendingQueries.push_back(std::make_pair(query, mStep));
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			step(RenderFace);
+			glEndQuery(GL_TIME_ELAPSED);
+			spentMs += costMs;
+		}
+	}
+
+	// Uploads probes that have been captured at least once and binds probe uniforms and textures
+	void Bind(GLuint UniformSlot, GLuint SpecularUnit, GLuint IrradianceUnit, bool Enabled)
+	{
+		auto &uniforms = mProbesUB.GetReference();
+		uniforms.numProbes = 0;
+		for (const auto &probe : mProbes)
+		{
+			if (Enabled && probe.ready)
+			{
+				uniforms.probes[uniforms.numProbes++] =
+					ProbeData{ glm::vec4{ probe.position, probe.radius }, glm::ivec4{ probe.layer, 0, 0, 0 } };
+			}
+		}
+		mProbesUB.Bind(UniformSlot);
+		if (mProbeArray.GetProbeCount() > 0)
+		{
+			mProbeArray.BindTextureUnits(SpecularUnit, IrradianceUnit);
+		}
+	}
+
+	void Release() override
+	{
+		mProbes.clear();
+		mProbeArray.Release();
+		mCapture.Release();
+		mPrefiltered.Release();
+		mIrradiance.Release();
+		if (nullptr != mFramebuffer)
+		{
+			mFramebuffer->Release();
+		}
+		mSpmapProgram.Release();
+		mIrmapProgram.Release();
+		mProbesUB.Release();
+		mDownsampler.Release();
+		for (const auto &pending : mPendingQueries)
+		{
+			mFreeQueries.push_back(pending.first);
+		}
+		mPendingQueries.clear();
+		if (!mFreeQueries.empty())
+		{
+			glDeleteQueries(GLsizei(mFreeQueries.size()), mFreeQueries.data());
+			mFreeQueries.clear();
+		}
+	}
+
+protected:
+	struct Probe
+	{
+		glm::vec3 position;
+		float radius;
+		GLint layer;
+		bool ready;		// captured at least once
+	};
+
+	// std140 layout, must match pbr_vs.glsl
+	struct ProbeData
+	{
+		glm::vec4 positionRadius;
+		glm::ivec4 layer;
+	};
+	struct ProbesUB
+	{
+		ProbeData probes[kMaxProbes];
+		GLint numProbes;
+	};
+
+	// Takes results of step timer queries that are available, oldest first
+	void readTimings()
+	{
+		while (!mPendingQueries.empty())
+		{
+			const auto &pending = mPendingQueries.front();
+			GLint available = 0;
+			glGetQueryObjectiv(pending.first, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (0 == available)
+			{
+				break;
+			}
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(pending.first, GL_QUERY_RESULT, &ns);
+			float &costMs = mStepCostsMs[pending.second];
+			costMs = (costMs < 0.f) ? float(ns) * 1e-6f : glm::mix(costMs, float(ns) * 1e-6f, kCostSmoothing);
+			mFreeQueries.push_back(pending.first);
+			mPendingQueries.pop_front();
+		}
+	}
+
+	// Steps: 6 faces, mip chain of capture, prefiltered levels, irradiance, conversion into probe array
+	template <class F>
+	void step(F RenderFace)
+	{
+		Probe &probe = mProbes[mCurrent];
+		const GLint levels = mPrefiltered.GetLevels();
+		if (mStep < 6)
+		{
+			renderFace(probe, mStep, RenderFace);
+		}
+		else if (6 == mStep)
+		{
+			mDownsampler.Generate(mCapture, true, GL_RGBA16F);
+		}
+		else if (mStep < 7 + levels)
+		{
+			prefilterLevel(mStep - 7);
+		}
+		else if (7 + levels == mStep)
+		{
+			mIrmapProgram.Use();
+			mPrefiltered.BindTextureUnit(0);
+			mIrradiance.BindImageTexture(0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+			ShaderProgram::DispatchCompute(1, 1, 6);	// local size is 32x32
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		}
+		else
+		{
+			mProbeArray.Convert(probe.layer, mPrefiltered, mIrradiance);
+			probe.ready = true;
+			mCurrent = (mCurrent + 1) % mProbes.size();
+			mStep = 0;
+			return;
+		}
+		mStep++;
+	}
+
+	template <class F>
+	void renderFace(const Probe &P, int Face, F RenderFace)
+	{
+		// Cube map face directions and up vectors (OpenGL cube map convention)
+		static const glm::vec3 directions[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+		static const glm::vec3 ups[6] = { { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+		const glm::mat4 projection = glm::perspective(glm::radians(90.f), 1.f, kNearPlane, kFarPlane);
+		const glm::mat4 view = glm::lookAt(P.position, P.position + directions[Face], ups[Face]);
+
+		mCapture.AttachLayerTo(mFramebuffer->GetId(), GL_COLOR_ATTACHMENT0, 0, Face);
+		mFramebuffer->DrawBuffer(GL_COLOR_ATTACHMENT0);
+		mFramebuffer->Bind();
+		glViewport(0, 0, kCaptureSize, kCaptureSize);
+		RenderFace(projection * view, projection * glm::mat4{ glm::mat3{ view } }, P.position);
+		mFramebuffer->Unbind();
+	}
+
+	void prefilterLevel(GLint Level)
+	{
+		if (0 == Level)
+		{
+			mCapture.CopyLevelTo(0, 6, mPrefiltered);
+			return;
+		}
+		const float deltaRoughness = 1.f / std::max(float(mPrefiltered.GetLevels() - 1), 1.f);
+		const GLint size = std::max(1, kCaptureSize >> Level);
+		mSpmapProgram.Use();
+		mCapture.BindTextureUnit(0);
+		mPrefiltered.BindImageTexture(0, Level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		mSpmapProgram.SetFloat(0, Level * deltaRoughness);
+		ShaderProgram::DispatchCompute((size + 31) / 32, (size + 31) / 32, 6);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	std::vector<Probe> mProbes;
+	size_t mCurrent;
+	int mStep;
+	EnvironmentProbeArray mProbeArray;
+	Texture mCapture, mPrefiltered, mIrradiance;
+	std::shared_ptr<Framebuffer> mFramebuffer;
+	Downsampler mDownsampler;
+	ShaderProgram mSpmapProgram, mIrmapProgram;
+	UniformBuffer<ProbesUB> mProbesUB;
+	std::vector<float> mStepCostsMs;	// average GPU time of every step, negative until measured
+	std::deque<std::pair<GLuint, int>> mPendingQueries;		// timer query and its step
+	std::vector<GLuint> mFreeQueries;
+};
+
+// Two-phase GPU occlusion culling: draws visible in the previous frame are drawn first, their depth is reduced into
+// hierarchical depth buffer (farthest depth per texel) and bounds of all draws are tested against it in compute shader.
+// Draws that became visible are drawn in the second phase. Instance counts of indirect commands are written on GPU,
+// so there is no readback.
+class HiZCuller : public NonCopyable
+{
+public:
+	HiZCuller() : mSceneDepthSamples(-1), mNumDraws(0) {}
+
+	~HiZCuller() override { Release(); }
+
+	void Create()
+	{
+		mPyramidProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/hiz_cs.glsl")) }};
+		mCullProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/cull_cs.glsl")) }};
+	}
+
+	// Draws changed: every draw is assumed visible in the previous frame, Bounds are indexed as Commands
+	void SetDraws(const std::vector<DrawElementsIndirectCommand> &Commands, const std::vector<OcclusionCuller::Bounds> &Bounds)
+	{
+		mNumDraws = GLuint(Commands.size());
+		mVisibleCommands.GetReference() = Commands;
+		mVisibleCommands.Update();
+		mNewlyVisibleCommands.GetReference() = Commands;
+		mNewlyVisibleCommands.Update();
+		auto &bounds = mBounds.GetReference();
+		bounds.clear();
+		for (const auto &b : Bounds)
+		{
+			bounds.push_back(DrawBounds{ glm::vec4{ b.min, 1.f }, glm::vec4{ b.max, 1.f } });
+		}
+		mBounds.Update();
+	}
+
+	// Draws visible in the previous frame until Cull(), then draws visible in this frame
+	const StorageBuffer<DrawElementsIndirectCommand> &GetVisibleCommands() const { return mVisibleCommands; }
+	// Draws that weren't visible in the previous frame, valid after Cull()
+	const StorageBuffer<DrawElementsIndirectCommand> &GetNewlyVisibleCommands() const { return mNewlyVisibleCommands; }
+
+	// Reduces depth of framebuffer into depth pyramid, depth attachment must be (multisampled) texture. Level 0 takes
+	// the farthest of samples of every pixel, so partly covered pixels don't hide what is behind them.
+	void BuildPyramid(const Framebuffer &Src, GLint Width, GLint Height)
+	{
+		if (mPyramid.GetWidth() != Width || mPyramid.GetHeight() != Height)
+		{
+			mPyramid = Texture{ GL_TEXTURE_2D, Width, Height, GL_R32F };
+			mPyramid.SetFilter(GL_NEAREST_MIPMAP_NEAREST, GL_NEAREST);
+		}
+		const GLint samples = Src.GetSamples(GL_DEPTH_ATTACHMENT);
+		if (samples != mSceneDepthSamples)
+		{
+			std::string source = Shader::GetFileContents("shaders/hiz_cs.glsl");
+			source.insert(source.find('\n') + 1, (samples > 0) ? "#define SCENE_DEPTH\n#define MULTISAMPLED\n" : "#define SCENE_DEPTH\n");
+			mSceneDepthProgram = ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, source) }};
+			mSceneDepthSamples = samples;
+		}
+
+		mSceneDepthProgram.Use();
+		std::dynamic_pointer_cast<const Texture>(Src.GetRenderTarget(GL_DEPTH_ATTACHMENT))->BindTextureUnit(0);
+		dispatchLevel(0);
+		mPyramidProgram.Use();
+		mPyramid.BindTextureUnit(0);
+		for (GLint level = 1; level < mPyramid.GetLevels(); level++)
+		{
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+			mPyramidProgram.SetInt(0, level - 1);
+			dispatchLevel(level);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	// Transform uniforms (binding 0) must be bound, Commands are all draws with instance count 0 for culled ones,
+	// model matrices are taken from Draws
+	void Cull(const StorageBuffer<DrawElementsIndirectCommand> &Commands, const StorageBuffer<DrawData> &Draws)
+	{
+		mCullProgram.Use();
+		Commands.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+		mVisibleCommands.BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+		mNewlyVisibleCommands.BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+		mBounds.BindBase(GL_SHADER_STORAGE_BUFFER, 3);
+		Draws.BindBase(GL_SHADER_STORAGE_BUFFER, 4);
+		mPyramid.BindTextureUnit(0);
+		mCullProgram.SetInt(0, GLint(mNumDraws));
+		ShaderProgram::DispatchCompute((mNumDraws + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	void Release() override
+	{
+		mPyramidProgram.Release();
+		mSceneDepthProgram.Release();
+		mSceneDepthSamples = -1;
+		mCullProgram.Release();
+		mPyramid.Release();
+		mVisibleCommands.Release();
+		mNewlyVisibleCommands.Release();
+		mBounds.Release();
+		mNumDraws = 0;
+	}
+
+protected:
+	// std430 layout, must match cull_cs.glsl
+	struct DrawBounds
+	{
+		glm::vec4 boundsMin;
+		glm::vec4 boundsMax;
+	};
+
+	void dispatchLevel(GLint Level)
+	{
+		const GLint width = std::max(1, mPyramid.GetWidth() >> Level);
+		const GLint height = std::max(1, mPyramid.GetHeight() >> Level);
+		mPyramid.BindImageTexture(1, Level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		ShaderProgram::DispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+	}
+
+	ShaderProgram mPyramidProgram, mCullProgram;
+	ShaderProgram mSceneDepthProgram;	// builds level 0, compiled for sample count of scene depth
+	GLint mSceneDepthSamples;
+	Texture mPyramid;
+	StorageBuffer<DrawElementsIndirectCommand> mVisibleCommands, mNewlyVisibleCommands;
+	StorageBuffer<DrawBounds> mBounds;
+	GLuint mNumDraws;
+};
+
+// Sorts 16x16 screen tiles into two lists by transparency (nonzero OIT counter in any pixel), lists are drawn with
+// indirect draws of tile quads: composite reads OIT targets only in tiles with transparent pixels and opaque tiles
+// are only tonemapped
+class OitTileClassifier : public NonCopyable
+{
+	static constexpr int kTileSize = 16;	// must match oit_tiles_cs.glsl and tonemap_vs.glsl
+
+public:
+	OitTileClassifier() : mTileLists(0), mNumTiles(0) {}
+
+	~OitTileClassifier() override { Release(); }
+
+	void Create()
+	{
+		mProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/oit_tiles_cs.glsl")) }};
+		mQuad = MeshGeometry(nullptr, true);
+	}
+
+	void Classify(const Texture &Counter)
+	{
+		const GLint tilesX = (Counter.GetWidth() + kTileSize - 1) / kTileSize;
+		const GLint tilesY = (Counter.GetHeight() + kTileSize - 1) / kTileSize;
+		if (GLuint(tilesX * tilesY) != mNumTiles)
+		{
+			releaseBuffer();
+			mNumTiles = GLuint(tilesX * tilesY);
+			glCreateBuffers(1, &mTileLists);
+			glNamedBufferStorage(mTileLists, sizeof(ListCommands) + mNumTiles * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		// Tile quad is triangle strip, instances are tiles
+		const ListCommands commands = { { { 4, 0, 0, 0 }, { 4, 0, 0, 0 } } };
+		glNamedBufferSubData(mTileLists, 0, sizeof(commands), &commands);
+
+		mProgram.Use();
+		Counter.BindTextureUnit(0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mTileLists);
+		ShaderProgram::DispatchCompute(tilesX, tilesY, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// Draws tiles of one list with bound program, tonemap_vs.glsl compiled for the same list
+	void DrawTiles(bool Transparent)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mTileLists);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mTileLists);
+		mQuad.RenderVerticesIndirect(GL_TRIANGLE_STRIP, Transparent ? 0 : sizeof(DrawArraysIndirectCommand));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	void Release() override
+	{
+		mProgram.Release();
+		mQuad.Release();
+		releaseBuffer();
+	}
+
+protected:
+	struct DrawArraysIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+	// Head of tile list buffer, tile indices follow, must match oit_tiles_cs.glsl
+	struct ListCommands
+	{
+		DrawArraysIndirectCommand commands[2];	// transparent tiles, opaque tiles
+	};
+
+	void releaseBuffer()
+	{
+		if (0 != mTileLists)
+		{
+			glDeleteBuffers(1, &mTileLists);
+			mTileLists = 0;
+		}
+		mNumTiles = 0;
+	}
+
+	ShaderProgram mProgram;
+	MeshGeometry mQuad;
+	GLuint mTileLists;
+	GLuint mNumTiles;
+};
+
+// Sorts triangles of draws back to front by view depth of centroids, on GPU (sort_cs.glsl and radix sort in
+// radix_sort_cs.glsl) or on CPU, and draws them in that order from its own index buffer
+class TriangleSorter : public NonCopyable
+{
+	static constexpr GLuint kBlockSize = 1024;	// must match radix_sort_cs.glsl
+
+public:
+	TriangleSorter() : mCapacity(0), mHistogramCapacity(0) {}
+
+	~TriangleSorter() override { Release(); }
+
+	void Create()
+	{
+		mKeysProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/sort_cs.glsl")) }};
+		mRadixProgram =
+			ShaderProgram{{ std::make_tuple(GL_COMPUTE_SHADER, Shader::GetFileContents("shaders/radix_sort_cs.glsl")) }};
+	}
+
+	// Makes room for sorted triangles of all draws of a frame, previously sorted triangles are lost if it grows
+	void Reserve(GLuint Triangles)
+	{
+		if (Triangles > mCapacity)
+		{
+			const GLuint capacity = std::max(Triangles, 2 * mCapacity);
+			releaseBuffers();
+			mCapacity = capacity;
+			for (GLuint *buffer : { &mKeys[0], &mKeys[1], &mValues[0], &mValues[1] })
+			{
+				glCreateBuffers(1, buffer);
+				glNamedBufferStorage(*buffer, mCapacity * sizeof(GLuint), nullptr, 0);
+			}
+			glCreateBuffers(1, &mSortedIndices);
+			glNamedBufferStorage(mSortedIndices, 3 * mCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_STORAGE_BIT);
+			mHistogramCapacity = 256 * ((mCapacity + kBlockSize - 1) / kBlockSize);
+			glCreateBuffers(1, &mHistograms);
+			glNamedBufferStorage(mHistograms, mHistogramCapacity * sizeof(GLuint), nullptr, 0);
+		}
+	}
+
+	// Sorted triangles of draw are stored from FirstTriangle on, draws share key buffers and are sorted one by one
+	void SortGpu(const GeometryPool &Geometry, const DrawElementsIndirectCommand &Command, const glm::mat4 &ModelView,
+				 GLuint FirstTriangle)
+	{
+		const GLuint numTriangles = Command.count / 3;
+		assert(FirstTriangle + numTriangles <= mCapacity);
+		const GLuint groups = (numTriangles + 255) / 256;
+
+		// Keys and triangle indices into buffers 0
+		mKeysProgram.Use();
+		Geometry.BindStorage(0, 1);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mKeys[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mValues[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mSortedIndices);
+		mKeysProgram.SetMatrix(0, ModelView);
+		mKeysProgram.SetInt(1, GLint(numTriangles));
+		mKeysProgram.SetInt(2, GLint(Command.firstIndex));
+		mKeysProgram.SetInt(3, Command.baseVertex);
+		mKeysProgram.SetInt(4, 0);
+		mKeysProgram.SetInt(5, GLint(FirstTriangle));
+		ShaderProgram::DispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Four 8 bit passes, ping-pong between buffers 0 and 1 ends in buffers 0
+		mRadixProgram.Use();
+		mRadixProgram.SetInt(0, GLint(numTriangles));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mHistograms);
+		const GLuint blocks = (numTriangles + kBlockSize - 1) / kBlockSize;
+		for (int pass = 0; pass < 4; pass++)
+		{
+			const int src = pass & 1;
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mKeys[src]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mValues[src]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mKeys[1 - src]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mValues[1 - src]);
+			mRadixProgram.SetInt(1, 8 * pass);
+			for (int stage = 0; stage < 3; stage++)
+			{
+				mRadixProgram.SetInt(2, stage);
+				ShaderProgram::DispatchCompute((1 == stage) ? 1 : blocks, 1, 1);
+				glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			}
+		}
+
+		// Indices of sorted triangles
+		mKeysProgram.Use();
+		Geometry.BindStorage(0, 1);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mKeys[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mValues[0]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mSortedIndices);
+		mKeysProgram.SetInt(4, 1);
+		ShaderProgram::DispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);	// next draw reuses key buffers
+	}
+
+	// Fallback without compute shaders, indices are sorted on CPU and uploaded
+	void SortCpu(const Mesh &MeshRef, const glm::mat4 &ModelView, GLuint FirstTriangle)
+	{
+		sortTrianglesBackToFront(MeshRef, ModelView, mCpuIndices);
+		assert(FirstTriangle + mCpuIndices.size() / 3 <= mCapacity);
+		if (!mCpuIndices.empty())
+		{
+			glNamedBufferSubData(mSortedIndices, 3 * FirstTriangle * sizeof(GLuint), mCpuIndices.size() * sizeof(GLuint),
+								 &mCpuIndices[0]);
+		}
+	}
+
+	// Draws sorted triangles stored from FirstTriangle on with vertices and base instance of Command
+	void Draw(const GeometryPool &Geometry, const DrawElementsIndirectCommand &Command, GLuint FirstTriangle) const
+	{
+		Geometry.Bind();
+		Geometry.SetElementBuffer(mSortedIndices);
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, GLsizei(Command.count), GL_UNSIGNED_INT,
+													  reinterpret_cast<const void*>(3 * FirstTriangle * sizeof(GLuint)),
+													  1, Command.baseVertex, Command.baseInstance);
+		Geometry.SetElementBuffer(0);
+	}
+
+	void Release() override
+	{
+		mKeysProgram.Release();
+		mRadixProgram.Release();
+		releaseBuffers();
+	}
+
+protected:
+	void releaseBuffers()
+	{
+		for (GLuint *buffer : { &mKeys[0], &mKeys[1], &mValues[0], &mValues[1], &mSortedIndices, &mHistograms })
+		{
+			if (0 != *buffer)
+			{
+				glDeleteBuffers(1, buffer);
+				*buffer = 0;
+			}
+		}
+		mCapacity = mHistogramCapacity = 0;
+	}
+
+	ShaderProgram mKeysProgram, mRadixProgram;
+	GLuint mKeys[2] = { 0, 0 }, mValues[2] = { 0, 0 };
+	GLuint mSortedIndices = 0, mHistograms = 0;
+	GLuint mCapacity, mHistogramCapacity;
+	std::vector<GLuint> mCpuIndices;
+};
+
+// GPU time of a span of commands, measured with ring of queries so that results are read without waiting
+class GpuTimer : public NonCopyable
+{
+	static constexpr int kQueries = 4;
+
+public:
+	GpuTimer() : mQueries{}, mPending{}, mFrame(0), mTotalNs(0), mSamples(0) {}
+
+	~GpuTimer() override { Release(); }
+
+	void Create()
+	{
+		glCreateQueries(GL_TIME_ELAPSED, kQueries, mQueries);
+	}
+
+	void Begin()
+	{
+		const int slot = mFrame % kQueries;
+		if (mPending[slot])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(mQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (0 != available)
+			{
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(mQueries[slot], GL_QUERY_RESULT, &ns);
+				mTotalNs += ns;
+				mSamples++;
+			}
+		}
+		glBeginQuery(GL_TIME_ELAPSED, mQueries[slot]);
+	}
+
+	void End()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		mPending[mFrame % kQueries] = true;
+		mFrame++;
+	}
+
+	// Average of measurements since last call, in milliseconds
+	double TakeAverageMs()
+	{
+		const double average = (mSamples > 0) ? double(mTotalNs) / double(mSamples) * 1e-6 : 0.;
+		mTotalNs = 0;
+		mSamples = 0;
+		return average;
+	}
+
+	void Release() override
+	{
+		if (0 != mQueries[0])
+		{
+			glDeleteQueries(kQueries, mQueries);
+			std::fill(mQueries, mQueries + kQueries, 0);
+		}
+		std::fill(mPending, mPending + kQueries, false);
+	}
+
+protected:
+	GLuint mQueries[kQueries];
+	bool mPending[kQueries];
+	uint64_t mFrame;
+	uint64_t mTotalNs;
+	uint64_t mSamples;
+};
+
+// Mesh drawn with PBR program, geometry and material are stored in shared pools
+class PbrMesh
+{
+public:
+	PbrMesh()
+		: mRange{ 0, 0, 0 }, mMaterialIndex(0), mBounds{ glm::vec3{ 0.f }, glm::vec3{ 0.f } }
+	{}
+
+	PbrMesh(const std::shared_ptr<Mesh> &MeshPtr, GeometryPool &Geometry, MaterialPool &Materials, UploadManager &Uploads)
+		: mRange(Geometry.Add(MeshPtr, Uploads)), mMaterialIndex(Materials.Add(MeshPtr, Uploads))
+		, mBounds(OcclusionCuller::meshBounds(*MeshPtr))
+	{
+	}
+
+	// Index of draw data is passed to shaders as base instance (draw id)
+	DrawElementsIndirectCommand GetDrawCommand(GLuint DrawId) const
+	{
+		return { mRange.numElements, 1, mRange.firstIndex, mRange.baseVertex, DrawId };
+	}
+
+	GLuint GetMaterialIndex() const { return mMaterialIndex; }
+	// Object space bounding box
+	const OcclusionCuller::Bounds &GetBounds() const { return mBounds; }
+
+protected:
+	GeometryPool::Range mRange;
+	GLuint mMaterialIndex;
+	OcclusionCuller::Bounds mBounds;
+};
+
+// Impostor of PbrMesh: mesh is rendered with orthographic projection from kGridSize x kGridSize directions (octahedral
+// map of the sphere) into atlases of albedo, object space normal, ORM and depth. Impostor is drawn as camera facing
+// quad shaded by pbr_fs.glsl, which blends the four views nearest to the view direction at the surface found by depth
+// and writes depth of that surface.
+class Impostor : public NonCopyable
+{
+	static constexpr int kGridSize = 8;
+	static constexpr int kFrameSize = 128;
+
+public:
+	Impostor() : mBaked(false), mCenter(0.f), mRadius(0.f) {}
+
+	~Impostor() override { Release(); }
+
+	void Create()
+	{
+		std::string bakeSource = Shader::GetFileContents("shaders/pbr_fs.glsl");
+		bakeSource.insert(bakeSource.find('\n') + 1, "#define IMPOSTOR_BAKE\n");		// after #version
+		mBakeProgram =
+			ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/pbr_vs.glsl")),
+							std::make_tuple(GL_FRAGMENT_SHADER, bakeSource) }};
+		std::string impostorSource = Shader::GetFileContents("shaders/pbr_fs.glsl");
+		impostorSource.insert(impostorSource.find('\n') + 1, "#define IMPOSTOR\n");
+		mImpostorProgram =
+			ShaderProgram{{ std::make_tuple(GL_VERTEX_SHADER, Shader::GetFileContents("shaders/impostor_vs.glsl")),
+							std::make_tuple(GL_FRAGMENT_SHADER, impostorSource) }};
+		mBakeTransformUB.Create();
+		mImpostorUB.Create();
+		mQuad = MeshGeometry(nullptr, true);
+	}
+
+	bool IsBaked() const { return mBaked; }
+
+	// Material textures of mesh should be streamed in, viewport and framebuffer binding are changed
+	void Bake(const PbrMesh &Mesh, const GeometryPool &Geometry, MaterialPool &Materials)
+	{
+		const auto &bounds = Mesh.GetBounds();
+		mCenter = 0.5f * (bounds.min + bounds.max);
+		mRadius = std::max(0.5f * glm::length(bounds.max - bounds.min), 1e-3f);
+
+		// Levels end at one texel per cell, so that views don't bleed into each other
+		const GLint size = kGridSize * kFrameSize;
+		const GLint levels = Texture::GetLevelCount(kFrameSize, kFrameSize);
+		mAlbedo = Texture{ GL_TEXTURE_2D, size, size, GL_SRGB8_ALPHA8, levels };
+		mNormal = Texture{ GL_TEXTURE_2D, size, size, GL_RGBA16F, levels };
+		mOrm = Texture{ GL_TEXTURE_2D, size, size, GL_RGBA8, levels };
+		mDepth = Texture{ GL_TEXTURE_2D, size, size, GL_RGBA8, levels };
+		Framebuffer framebuffer;
+		mAlbedo.AttachTo(framebuffer.GetId(), GL_COLOR_ATTACHMENT0);
+		mNormal.AttachTo(framebuffer.GetId(), GL_COLOR_ATTACHMENT1);
+		mOrm.AttachTo(framebuffer.GetId(), GL_COLOR_ATTACHMENT2);
+		mDepth.AttachTo(framebuffer.GetId(), GL_COLOR_ATTACHMENT3);
+		framebuffer.AttachRenderbuffer(GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT24, size, size);
+		framebuffer.DrawBuffers({ GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 });
+
+		framebuffer.Bind();
+		glEnable(GL_FRAMEBUFFER_SRGB);		// linear albedo is encoded into sRGB atlas
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		const GLfloat zero[4] = { 0.f, 0.f, 0.f, 0.f };
+		const GLfloat one = 1.f;
+		for (GLint buffer = 0; buffer < 4; buffer++)
+		{
+			glClearNamedFramebufferfv(framebuffer.GetId(), GL_COLOR, buffer, zero);
+		}
+		glClearNamedFramebufferfv(framebuffer.GetId(), GL_DEPTH, 0, &one);
+
+		mBakeDraw.GetReference() = { DrawData{ glm::mat4{ 1.f }, glm::mat4{ 1.f }, glm::uvec4{ Mesh.GetMaterialIndex() } } };
+		mBakeDraw.Update();
+
+		mBakeProgram.Use();
+		Geometry.Bind();
+		Materials.Bind(0);
+		mBakeDraw.BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+		MaterialPool::BindArrays(Materials.GetArrays(Mesh.GetMaterialIndex()));
+		const DrawElementsIndirectCommand command = Mesh.GetDrawCommand(0);
+		const glm::mat4 projection = glm::ortho(-mRadius, mRadius, -mRadius, mRadius, mRadius, 3.f * mRadius);
+		for (int y = 0; y < kGridSize; y++)
+		{
+			for (int x = 0; x < kGridSize; x++)
+			{
+				glm::vec3 dir, right, up;
+				getFrame(x, y, dir, right, up);
+				auto &transform = mBakeTransformUB.GetReference();
+				transform.viewProjectionMatrix = projection * glm::lookAt(mCenter + 2.f * mRadius * dir, mCenter, up);
+				mBakeTransformUB.Bind(0);
+				glViewport(x * kFrameSize, y * kFrameSize, kFrameSize, kFrameSize);
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+					reinterpret_cast<const void*>(command.firstIndex * sizeof(GLuint)), 1, command.baseVertex, command.baseInstance);
+			}
+		}
+		framebuffer.Unbind();
+		glDisable(GL_FRAMEBUFFER_SRGB);
+
+		// Alpha of every atlas is coverage, empty texels around silhouette don't darken or bend mip levels
+		Downsampler downsampler;
+		downsampler.Generate(mAlbedo, false, GL_SRGB8_ALPHA8, true);
+		downsampler.Generate(mNormal, false, GL_RGBA16F, true);
+		downsampler.Generate(mOrm, false, GL_RGBA8, true);
+		downsampler.Generate(mDepth, false, GL_RGBA8);		// stays premultiplied by coverage, pbr_fs.glsl divides
+		mImpostorUB.GetReference() = ImpostorUB{ glm::vec4{ mCenter, mRadius }, kGridSize };
+		mBaked = true;
+	}
+
+	// Height of bounding sphere on screen in pixels, FovY in radians
+	float GetScreenSize(const glm::mat4 &ModelMatrix, glm::vec3 EyePosition, float FovY, GLint ViewportHeight) const
+	{
+		const glm::vec3 center = glm::vec3{ ModelMatrix * glm::vec4{ mCenter, 1.f } };
+		const float distance = std::max(glm::length(center - EyePosition), 1e-3f);
+		return mRadius / (distance * std::tan(0.5f * FovY)) * float(ViewportHeight);
+	}
+
+	// Transform, shading and base info uniforms and environment textures are expected to be bound
+	void Render()
+	{
+		mImpostorProgram.Use();
+		mImpostorUB.Bind(4);
+		mAlbedo.BindTextureUnit(11);
+		mNormal.BindTextureUnit(12);
+		mOrm.BindTextureUnit(13);
+		mDepth.BindTextureUnit(14);
+		mQuad.RenderVertices(GL_TRIANGLE_STRIP, 4);
+	}
+
+	void Release() override
+	{
+		mBakeProgram.Release();
+		mImpostorProgram.Release();
+		mBakeTransformUB.Release();
+		mBakeDraw.Release();
+		mImpostorUB.Release();
+		mQuad.Release();
+		mAlbedo.Release();
+		mNormal.Release();
+		mOrm.Release();
+		mDepth.Release();
+		mBaked = false;
+	}
+
+protected:
+	// View direction (from object to camera) and view plane axes of atlas cell, must match pbr_fs.glsl
+	static void getFrame(int X, int Y, glm::vec3 &Dir, glm::vec3 &Right, glm::vec3 &Up)
+	{
+		const glm::vec2 f = 2.f * glm::vec2{ float(X), float(Y) } / float(kGridSize - 1) - 1.f;
+		glm::vec3 n{ f, 1.f - std::abs(f.x) - std::abs(f.y) };
+		const float t = std::max(-n.z, 0.f);
+		n.x += (n.x >= 0.f) ? -t : t;
+		n.y += (n.y >= 0.f) ? -t : t;
+		Dir = glm::normalize(n);
+		Up = (std::abs(Dir.y) > 0.999f) ? glm::vec3{ 0.f, 0.f, 1.f } : glm::vec3{ 0.f, 1.f, 0.f };
+		Right = glm::normalize(glm::cross(Up, Dir));
+		Up = glm::cross(Dir, Right);
+	}
+
+	struct TransformUB
+	{
+		glm::mat4 viewProjectionMatrix;
+		glm::mat4 modelMatrix;
+	};
+	struct ImpostorUB
+	{
+		glm::vec4 centerRadius;
+		GLint gridSize;
+	};
+
+	bool mBaked;
+	glm::vec3 mCenter;
+	float mRadius;
+	Texture mAlbedo, mNormal, mOrm;		// alpha is coverage
+	Texture mDepth;		// depth of orthographic view, from one radius in front of center to one behind it
+	ShaderProgram mBakeProgram, mImpostorProgram;
+	UniformBuffer<TransformUB> mBakeTransformUB;
+	StorageBuffer<DrawData> mBakeDraw;		// mesh in object space
+	UniformBuffer<ImpostorUB> mImpostorUB;
+	MeshGeometry mQuad;
+};
+
+//==========================================================================================================================
+//++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//==========================================================================================================================
+class Renderer final : public RendererInterface
+{
+	// Size of staging ring and bytes uploaded through it per frame while streaming
+	static constexpr size_t kStagingBufferSize = 32 << 20;
+	static constexpr size_t kUploadBudget = 4 << 20;
+	// Texture memory of material texture arrays, least recently used textures are reduced to fit
+	static constexpr size_t kTextureMemoryBudget = size_t(256) << 20;
+	// GPU time of reflection probe update steps (cube face, mip level, ...) per frame
+	static constexpr float kProbeBudgetMs = 0.5f;
+	// Objects smaller on screen (pixels) are drawn as impostors
+	static constexpr float kImpostorScreenSize = 64.f;
+	// Draws recorded into one command list at least, smaller scenes aren't split between threads
+	static constexpr size_t kMinCommandSlice = 256;
+	// Frames of every transparency mode skipped by benchmark, queries of the previous mode are read meanwhile
+	static constexpr int kBenchmarkWarmupFrames = 30;
+
+public:
+	GLFWwindow* initialize(int width, int height, int maxSamples) override;
+	void shutdown() override;
+	std::function<void (int w, int h)> setup() override;
+	void render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings) override;
+
+	// Offscreen use on hidden window (render server). Scene of the given meshes and environment replaces the current
+	// one while programs, render targets and upload ring stay created. Images of any size are rendered into offscreen
+	// target with all textures streamed in and read back with rows from top to bottom.
+	void loadScene(const std::vector<std::string>& meshFiles, const std::string& environmentFile);
+	void renderImage(int width, int height, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings,
+					 std::vector<uint32_t>& pixels);
+
+protected:
+	// Frame into the window (output is null) or into output framebuffer of the same size
+	void renderFrame(int fbWidth, int fbHeight, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings,
+					 Framebuffer *output);
+	void renderScene(const ViewSettings& view, const SceneSettings& scene, const StorageBuffer<DrawElementsIndirectCommand> &commands,
+					 const ShaderProgram &program, bool blendedOnly = false);
+	void bindSceneResources(const ShaderProgram &program);
+	void recordCommandLists(const glm::mat4 &viewProjection, bool singlePass);
+	void replayScene(const CommandRecorder &lists, StorageBuffer<DrawElementsIndirectCommand> &indirect,
+					 const ShaderProgram &program);
+	void updateDrawData(const SceneSettings& scene);
+	void renderSortedTransparency(const glm::mat4 &viewMatrix, bool gpuSort);
+	void updateBenchmark(RenderSettings::Transparency mode);
+	void reportBenchmark();
+	void buildDrawBatches();
+	void createImpostors();
+	void releaseImpostors();
+	void readTextureFeedback();
+	void cullDraws(const glm::mat4 &ViewProjection, const SceneSettings& scene);
+	void setDrawVisibility(const std::vector<uint8_t> &Visible);
+	void touchVisibleMaterials(const glm::mat4 &ViewProjection);
+	static glm::mat4 getModelMatrix(const SceneSettings& scene);
+	void renderProbeFace(const glm::mat4 &ViewProjection, const glm::mat4 &SkyViewProjection, glm::vec3 EyePosition,
+						 const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings);
+
+#ifdef _DEBUG
+	static void logMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
+#endif
+
+// 	struct
+// 	{
+// 		float maxAnisotropy = 1.0f;
+// 	}
+// 	mCapabilities;
+
+	std::shared_ptr<Framebuffer> mFramebuffer, mResolveFramebuffer;
+	std::shared_ptr<Framebuffer> mOutputFramebuffer;	// tonemapped images of renderImage()
+
+	MeshGeometry mFullScreenQuad;
+	MeshGeometry mSkybox;
+	UploadManager mUploadManager;
+	GeometryPool mGeometryPool;
+	MaterialPool mMaterialPool;
+	std::vector<PbrMesh> mMeshes;	// scene objects point into it, so it is filled before them
+
+	// Objects of the scene share the model matrix and are placed at offset from its origin
+	struct SceneObject
+	{
+		const PbrMesh *mesh;
+		glm::vec3 offset;
+		std::shared_ptr<const OcclusionCuller::Occluder> occluder;	// null if object doesn't occlude
+		std::shared_ptr<const Mesh> source;		// triangles of blended objects are sorted from it on CPU
+	};
+	std::vector<SceneObject> mSceneObjects;	// the model is the first
+
+	// Draws that share texture arrays, each batch is drawn with a single indirect call
+	struct DrawBatch
+	{
+		MaterialPool::ArraySet arrays;
+		std::vector<DrawElementsIndirectCommand> commands;
+		std::vector<const SceneObject*> objects;	// object of every command
+		GLsizei firstCommand;
+		GLsizei firstBlended;	// blended materials come last, only they are drawn in transparency pass
+	};
+	std::vector<DrawBatch> mDrawBatches;
+	std::vector<uint32_t> mDrawBatchIndices;	// batch of every draw command
+	std::vector<const SceneObject*> mDrawObjects;	// object of every draw command
+	uint64_t mDrawBatchesVersion = 0;	// version of material pool batches were built for
+	StorageBuffer<DrawElementsIndirectCommand> mDrawCommands;
+	StorageBuffer<DrawData> mDrawData;		// in order of draw commands, uploaded once per frame
+
+	// Occluded draws have zero instance count in draw commands
+	OcclusionCuller mOcclusionCuller;
+	std::vector<uint8_t> mDrawVisibility;
+	bool mDrawsCulled = false;
+	bool mOccluderRow = false;		// model copies added behind the model
+	HiZCuller mHiZCuller;
+
+	// Draws culled against frustum and encoded on worker threads, command lists refer to draw batches
+	CommandRecorder mOpaqueCommandLists, mTransparentCommandLists;
+	StorageBuffer<DrawElementsIndirectCommand> mOpaqueReplayCommands, mTransparentReplayCommands;	// replayed lists
+
+	OitTileClassifier mOitTiles;
+
+	TriangleSorter mTriangleSorter;
+
+	// Transparency benchmark, every mode is measured from its first frames after warm up until mode changes
+	struct TransparencyBenchmark
+	{
+		RenderSettings::Transparency mode;
+		int warmupFrames;
+		uint64_t frames;
+		double sortMs;		// CPU time of sorting, uploads and dispatches included
+	};
+	TransparencyBenchmark mBenchmark = { RenderSettings::Transparency::WeightedOit, kBenchmarkWarmupFrames, 0, 0. };
+	GpuTimer mTransparencyTimer, mCompositeTimer;	// transparency pass, tile classification and OIT composite
+
+	// Impostor of every opaque mesh, objects small on screen are drawn as impostor of their mesh
+	std::map<const PbrMesh*, std::unique_ptr<Impostor>> mImpostors;
+	std::vector<const SceneObject*> mImpostorObjects;	// drawn as impostors in this frame
+
+	TextureFeedback mTextureFeedback;
+	bool mTextureFeedbackEnabled = false;
+
+
+// 	Camera mCamera { glm::vec3(0, 0.3f, 5), glm::vec3(0, 0.3f, 0), glm::vec3(0, 1, 0) };
+
+	ShaderProgram mSkyboxProgram;
+	ShaderProgram mTonemapProgram, mOitCompositeProgram;	// opaque tiles, tiles with transparent pixels
+	ShaderProgram mPbrProgram;
+	ShaderProgram mDepthPrepassProgram;		// pbr_fs.glsl with DEPTH_PREPASS
+
+	std::shared_ptr<Environment> mEnvPtr;
+	EnvironmentProbeArray mEnvProbes;
+	GLint mEnvProbe = 0;
+	ReflectionProbes mReflectionProbes;
+
+	struct SkyboxUB
+	{
+		glm::mat4 skyViewProjectionMatrix;
+		int octahedralEnvironment;
+		int environmentProbe;
+	};
+	UniformBuffer<SkyboxUB> mSkyboxUB;
+
+	struct TransformUB
+	{
+		glm::mat4 viewProjectionMatrix;
+		glm::mat4 modelMatrix;			// of impostor, draws take model matrix from draw data
 	};
 	UniformBuffer<TransformUB> mTransformUB;
 
@@ -1138,6 +3839,13 @@ protected:
 	struct BaseInfoUB
 	{
 		int opaquePass;
+		int feedbackPass;				// write texture feedback
+		glm::ivec2 feedbackOffset;		// pixel of every feedback tile written in this frame
+		int octahedralEnvironment;		// sample environment from octahedral probe arrays
+		int environmentProbe;			// layer of probe arrays
+		int singlePass;					// opaque and transparent geometry in one pass
+		int sortedPass;					// transparent triangles drawn back to front with blending
+		int alphaToCoverage;			// cutout materials use alpha-to-coverage instead of alpha test
 	};
 	UniformBuffer<BaseInfoUB> mBaseInfoUB;
 };
@@ -0,0 +1,161 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Reference images rendered by path tracer, linear (.pfm) for comparisons or tonemapped (.ppm).
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "../common/path_tracer.hpp"
+
+namespace {
+	void printUsage()
+	{
+		std::printf("Usage: ave3d-reference [-w width] [-h height] [-spp samples] [-bounces count] [-threads count]\n"
+					"                       [-yaw degrees] [-pitch degrees] [-distance value] [-fov degrees]\n"
+					"                       [-model-yaw degrees] [-model-pitch degrees] [-lights mask] -o file.pfm|file.ppm\n"
+					"Run from data directory. Defaults are the initial view of application, lights off.\n");
+	}
+
+	bool endsWith(const std::string& value, const std::string& suffix)
+	{
+		return value.size() >= suffix.size() && 0 == value.compare(value.size() - suffix.size(), suffix.size(), suffix);
+	}
+
+	// Portable float map, bottom row first
+	bool writePfm(const std::string& filename, int width, int height, const std::vector<glm::vec3>& radiance)
+	{
+		FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file)
+		{
+			return false;
+		}
+		std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+		for (int y = height - 1; y >= 0; y--)
+		{
+			std::fwrite(&radiance[size_t(y) * width], sizeof(glm::vec3), size_t(width), file);
+		}
+		return 0 == std::fclose(file);
+	}
+
+	bool writePpm(const std::string& filename, int width, int height, const std::vector<uint32_t>& pixels)
+	{
+		FILE* file = std::fopen(filename.c_str(), "wb");
+		if (!file)
+		{
+			return false;
+		}
+		std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+		std::vector<unsigned char> row(size_t(width) * 3);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				const uint32_t pixel = pixels[size_t(y) * width + x];
+				row[3 * x + 0] = (unsigned char)(pixel & 0xFF);
+				row[3 * x + 1] = (unsigned char)((pixel >> 8) & 0xFF);
+				row[3 * x + 2] = (unsigned char)((pixel >> 16) & 0xFF);
+			}
+			std::fwrite(row.data(), 1, row.size(), file);
+		}
+		return 0 == std::fclose(file);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int width = 1280, height = 720, samples = 256, bounces = 8, lights = 0;
+	size_t threads = 0;
+	std::string output;
+	ViewSettings view;
+	view.distance = 400.0f;
+	view.fov = 35.0f;
+	SceneSettings scene;
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (hasValue && std::strcmp(argv[i], "-w") == 0)
+			width = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-h") == 0)
+			height = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-spp") == 0)
+			samples = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-bounces") == 0)
+			bounces = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-threads") == 0)
+			threads = size_t(std::max(0, std::atoi(argv[++i])));
+		else if (hasValue && std::strcmp(argv[i], "-yaw") == 0)
+			view.yaw = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-pitch") == 0)
+			view.pitch = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-distance") == 0)
+			view.distance = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-fov") == 0)
+			view.fov = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-model-yaw") == 0)
+			scene.yaw = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-model-pitch") == 0)
+			scene.pitch = float(std::atof(argv[++i]));
+		else if (hasValue && std::strcmp(argv[i], "-lights") == 0)
+			lights = std::atoi(argv[++i]);
+		else if (hasValue && std::strcmp(argv[i], "-o") == 0)
+			output = argv[++i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (width <= 0 || height <= 0 || samples <= 0 || bounces < 0 || !(endsWith(output, ".pfm") || endsWith(output, ".ppm")))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// Lights of application, bit i turns light i on
+	scene.lights[0] = { glm::normalize(glm::vec3{-1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 1) };
+	scene.lights[1] = { glm::normalize(glm::vec3{ 1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 2) };
+	scene.lights[2] = { glm::normalize(glm::vec3{ 0.0f, -1.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 4) };
+
+	try
+	{
+		PathTracer tracer{ width, height };
+		tracer.setThreads(threads);
+		tracer.setMaxBounces(bounces);
+		tracer.loadScene();
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int sample = 0; sample < samples; ++sample)
+		{
+			tracer.render(view, scene);
+			if (0 == (sample + 1) % 16 || sample + 1 == samples)
+			{
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::printf("\r%d/%d samples, %.1f s", sample + 1, samples, seconds);
+				std::fflush(stdout);
+			}
+		}
+		std::printf("\n");
+
+		const bool written = endsWith(output, ".pfm") ? writePfm(output, width, height, tracer.radiance())
+													  : writePpm(output, width, height, tracer.pixels());
+		if (!written)
+		{
+			std::fprintf(stderr, "Error: failed to write %s\n", output.c_str());
+			return 1;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Render server: product images on request over Unix domain socket.
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+
+#include <signal.h>
+
+#include "render_server.hpp"
+
+namespace {
+	volatile std::sig_atomic_t stopRequested = 0;
+
+	void requestStop(int /*signal*/)
+	{
+		stopRequested = 1;
+	}
+
+	void printUsage()
+	{
+		std::printf("Usage: ave3d-server [-socket path] [-threads count] [-models count] [-environments count] [-batch count]\n"
+					"                    [-batch-pixels count] [-opengl]\n"
+					"Run from data directory. Default socket is ave3d.sock, see README for the protocol.\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	RenderServer::Options options;
+	options.socketPath = "ave3d.sock";
+	for (int i = 1; i < argc; ++i)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (hasValue && std::strcmp(argv[i], "-socket") == 0)
+			options.socketPath = argv[++i];
+		else if (hasValue && std::strcmp(argv[i], "-threads") == 0)
+			options.threads = size_t(std::max(0, std::atoi(argv[++i])));
+		else if (hasValue && std::strcmp(argv[i], "-models") == 0)
+			options.maxModels = size_t(std::max(1, std::atoi(argv[++i])));
+		else if (hasValue && std::strcmp(argv[i], "-environments") == 0)
+			options.maxEnvironments = size_t(std::max(1, std::atoi(argv[++i])));
+		else if (hasValue && std::strcmp(argv[i], "-batch") == 0)
+			options.maxBatch = size_t(std::max(1, std::atoi(argv[++i])));
+		else if (hasValue && std::strcmp(argv[i], "-batch-pixels") == 0)
+			options.maxBatchPixels = size_t(std::max(1L, std::atol(argv[++i])));
+		else if (std::strcmp(argv[i], "-opengl") == 0)
+			options.opengl = true;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	// Interrupted wait for clients returns, so server notices stop request and removes its socket
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = requestStop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	std::signal(SIGPIPE, SIG_IGN);		// clients that went away are noticed by failed writes
+
+	try
+	{
+		RenderServer server{ options };
+		server.run(stopRequested);
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "Error: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
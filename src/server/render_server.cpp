@@ -0,0 +1,610 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Render server: product images on request over Unix domain socket.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "render_server.hpp"
+#include "../common/ibl.hpp"
+#include "../common/image.hpp"
+#include "../common/parallel.hpp"
+#include "../common/png.hpp"
+
+#if ENABLE_OPENGL
+#include <GLFW/glfw3.h>
+#include "../opengl.hpp"
+#endif
+
+namespace {
+	const size_t MaxRequestLine = 4096;
+	const int MaxImageSize = 8192;
+	const int ListenBacklog = 64;
+	// Hidden window only holds OpenGL context, images are rendered offscreen at requested size
+	const int OpenGlWindowSize = 64;
+	const int OpenGlSamples = 8;
+
+	std::runtime_error systemError(const std::string& what)
+	{
+		return std::runtime_error(what + ": " + std::strerror(errno));
+	}
+
+	void setNonBlocking(int fd)
+	{
+		const int flags = fcntl(fd, F_GETFL, 0);
+		if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		{
+			throw systemError("Failed to make socket non-blocking");
+		}
+	}
+
+	// Clients may only name files inside data directory
+	void checkFileName(const std::string& name)
+	{
+		if (name.empty() || '/' == name[0] || '\\' == name[0] || std::string::npos != name.find(".."))
+		{
+			throw std::runtime_error("invalid file name '" + name + "'");
+		}
+	}
+
+	// Comma separated file names, each checked
+	std::vector<std::string> splitFileNames(const std::string& names)
+	{
+		std::vector<std::string> result;
+		size_t start = 0;
+		while (start <= names.size())
+		{
+			size_t end = names.find(',', start);
+			end = (std::string::npos == end) ? names.size() : end;
+			result.push_back(names.substr(start, end - start));
+			checkFileName(result.back());
+			start = end + 1;
+		}
+		return result;
+	}
+
+	// strtof accepts nan and inf, no setting takes them
+	bool parseNumber(const std::string& text, float& value)
+	{
+		char* end = nullptr;
+		value = std::strtof(text.c_str(), &end);
+		return !text.empty() && '\0' == *end && std::isfinite(value);
+	}
+
+	bool parseNumber(const std::string& text, int& value)
+	{
+		char* end = nullptr;
+		const long parsed = std::strtol(text.c_str(), &end, 10);
+		value = int(parsed);
+		return !text.empty() && '\0' == *end && parsed == long(value);
+	}
+}
+
+RenderServer::RenderServer(const Options& options)
+	: m_options(options)
+	, m_listenSocket(-1)
+	, m_models(options.maxModels)
+	, m_environments(options.maxEnvironments)
+	, m_window(nullptr)
+	, m_rendered(0)
+{
+	m_options.maxBatch = std::max<size_t>(1, m_options.maxBatch);
+	m_rasterizer.setThreads(m_options.threads);
+}
+
+RenderServer::~RenderServer()
+{
+	for (const auto& entry : m_clients)
+	{
+		close(entry.first);
+	}
+	if (m_listenSocket >= 0)
+	{
+		close(m_listenSocket);
+		unlink(m_options.socketPath.c_str());
+	}
+#if ENABLE_OPENGL
+	if (m_options.opengl)
+	{
+		if (m_window)
+		{
+			m_glRenderer->shutdown();
+			glfwDestroyWindow(m_window);
+		}
+		glfwTerminate();
+	}
+#endif
+}
+
+void RenderServer::run(const volatile std::sig_atomic_t& stop)
+{
+	if (m_options.opengl)
+	{
+		createOpenGlRenderer();
+	}
+	listen();
+	std::cout << "Listening on " << m_options.socketPath << std::endl;
+
+	std::vector<pollfd> fds;
+	while (0 == stop)
+	{
+		fds.clear();
+		fds.push_back({ m_listenSocket, POLLIN, 0 });
+		for (const auto& entry : m_clients)
+		{
+			const short events = short((entry.second.inputClosed ? 0 : POLLIN) | (entry.second.output.empty() ? 0 : POLLOUT));
+			fds.push_back({ entry.first, events, 0 });
+		}
+
+		// Requests left over from the previous batch are rendered right after new ones are collected
+		if (poll(fds.data(), nfds_t(fds.size()), m_pending.empty() ? -1 : 0) < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			throw systemError("Failed to wait for clients");
+		}
+
+		for (size_t i = 1; i < fds.size(); i++)
+		{
+			if (0 == fds[i].revents)
+			{
+				continue;
+			}
+			Client& client = m_clients.at(fds[i].fd);
+			bool alive = true;
+			if (0 != (fds[i].revents & POLLIN))
+			{
+				alive = readClient(client);
+			}
+			else if (0 != (fds[i].revents & (POLLHUP | POLLERR)))
+			{
+				alive = false;
+			}
+			if (alive && 0 != (fds[i].revents & POLLOUT))
+			{
+				alive = writeClient(client);
+			}
+			if (!alive)
+			{
+				closeClient(fds[i].fd);
+			}
+		}
+		if (0 != (fds[0].revents & POLLIN))
+		{
+			acceptClients();
+		}
+
+		if (!m_pending.empty())
+		{
+			renderBatch();
+
+			// Most responses fit into socket buffer, the rest is sent as clients read
+			std::vector<int> gone;
+			for (auto& entry : m_clients)
+			{
+				if (!writeClient(entry.second))
+				{
+					gone.push_back(entry.first);
+				}
+			}
+			for (int clientSocket : gone)
+			{
+				closeClient(clientSocket);
+			}
+		}
+	}
+	std::cout << "Stopped after " << m_rendered << " images" << std::endl;
+}
+
+void RenderServer::listen()
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (m_options.socketPath.empty() || m_options.socketPath.size() >= sizeof(address.sun_path))
+	{
+		throw std::runtime_error("Invalid socket path: " + m_options.socketPath);
+	}
+	std::memcpy(address.sun_path, m_options.socketPath.c_str(), m_options.socketPath.size());
+
+	m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listenSocket < 0)
+	{
+		throw systemError("Failed to create socket");
+	}
+	unlink(m_options.socketPath.c_str());	// left by server that didn't exit cleanly
+	if (bind(m_listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+		|| ::listen(m_listenSocket, ListenBacklog) < 0)
+	{
+		throw systemError("Failed to listen on " + m_options.socketPath);
+	}
+	setNonBlocking(m_listenSocket);
+}
+
+void RenderServer::acceptClients()
+{
+	for (;;)
+	{
+		const int clientSocket = accept(m_listenSocket, nullptr, nullptr);
+		if (clientSocket < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+			{
+				std::cerr << "Failed to accept client: " << std::strerror(errno) << std::endl;
+			}
+			return;
+		}
+		setNonBlocking(clientSocket);
+		m_clients[clientSocket].socket = clientSocket;
+	}
+}
+
+bool RenderServer::readClient(Client& client)
+{
+	char buffer[65536];
+	while (!client.inputClosed)
+	{
+		const ssize_t received = read(client.socket, buffer, sizeof(buffer));
+		if (received < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+			{
+				break;
+			}
+			return false;
+		}
+		if (0 == received)
+		{
+			client.inputClosed = true;	// client may still wait for responses
+			break;
+		}
+		client.input.append(buffer, size_t(received));
+
+		size_t lineStart = 0, lineEnd;
+		while (std::string::npos != (lineEnd = client.input.find('\n', lineStart)))
+		{
+			std::string line = client.input.substr(lineStart, lineEnd - lineStart);
+			if (!line.empty() && '\r' == line.back())
+			{
+				line.pop_back();
+			}
+			if (!line.empty())
+			{
+				parseRequest(client, line);
+			}
+			lineStart = lineEnd + 1;
+		}
+		client.input.erase(0, lineStart);
+		if (client.input.size() > MaxRequestLine)
+		{
+			// Not a client of this protocol, answer and stop reading
+			respond(client.socket, client.nextRequest++, "error request too long\n");
+			client.input.clear();
+			client.inputClosed = true;
+		}
+	}
+	return !client.done();
+}
+
+bool RenderServer::writeClient(Client& client)
+{
+	size_t sent = 0;
+	while (sent < client.output.size())
+	{
+		const ssize_t written = write(client.socket, client.output.data() + sent, client.output.size() - sent);
+		if (written < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+			{
+				break;
+			}
+			return false;
+		}
+		sent += size_t(written);
+	}
+	client.output.erase(0, sent);
+	return !client.done();
+}
+
+void RenderServer::closeClient(int clientSocket)
+{
+	// Socket number may be reused by the next client, its requests must not get responses of this one
+	m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(), [&](const Request& request) { return request.client == clientSocket; }),
+					m_pending.end());
+	m_clients.erase(clientSocket);
+	close(clientSocket);
+}
+
+void RenderServer::parseRequest(Client& client, const std::string& line)
+{
+	Request request;
+	request.client = client.socket;
+	request.sequence = client.nextRequest++;
+	request.environment = "environment.hdr";
+	request.width = 1280;
+	request.height = 720;
+	request.view.distance = 400.0f;
+	request.view.fov = 35.0f;
+	int lights = 0;
+
+	std::string error;
+	size_t start = 0;
+	while (error.empty() && start < line.size())
+	{
+		size_t end = line.find(' ', start);
+		end = (std::string::npos == end) ? line.size() : end;
+		const std::string pair = line.substr(start, end - start);
+		start = end + 1;
+		if (pair.empty())
+		{
+			continue;
+		}
+
+		const size_t separator = pair.find('=');
+		const std::string key = pair.substr(0, separator);
+		const std::string value = (std::string::npos == separator) ? std::string() : pair.substr(separator + 1);
+		bool valid = true;
+		if ("model" == key)
+			request.models = value;
+		else if ("environment" == key)
+			request.environment = value;
+		else if ("width" == key)
+			valid = parseNumber(value, request.width);
+		else if ("height" == key)
+			valid = parseNumber(value, request.height);
+		else if ("yaw" == key)
+			valid = parseNumber(value, request.view.yaw);
+		else if ("pitch" == key)
+			valid = parseNumber(value, request.view.pitch);
+		else if ("distance" == key)
+			valid = parseNumber(value, request.view.distance);
+		else if ("fov" == key)
+			valid = parseNumber(value, request.view.fov);
+		else if ("model-yaw" == key)
+			valid = parseNumber(value, request.scene.yaw);
+		else if ("model-pitch" == key)
+			valid = parseNumber(value, request.scene.pitch);
+		else if ("lights" == key)
+			valid = parseNumber(value, lights);
+		else
+			error = "unknown key '" + key + "'";
+		if (!valid)
+		{
+			error = "invalid value of '" + key + "'";
+		}
+	}
+	if (error.empty() && request.models.empty())
+	{
+		error = "model is missing";
+	}
+	if (error.empty() && (request.width <= 0 || request.height <= 0 || request.width > MaxImageSize || request.height > MaxImageSize))
+	{
+		error = "image size out of range";
+	}
+	if (error.empty() && !(request.view.fov > 0.0f && request.view.fov < 180.0f))
+	{
+		error = "fov out of range";
+	}
+	if (error.empty() && !(request.view.distance > 0.0f))
+	{
+		error = "distance out of range";
+	}
+	if (!error.empty())
+	{
+		respond(client.socket, request.sequence, "error " + error + "\n");
+		return;
+	}
+
+	// Lights of application, bit i turns light i on
+	request.scene.lights[0] = { glm::normalize(glm::vec3{-1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 1) };
+	request.scene.lights[1] = { glm::normalize(glm::vec3{ 1.0f,  0.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 2) };
+	request.scene.lights[2] = { glm::normalize(glm::vec3{ 0.0f, -1.0f, 0.0f}), glm::vec3{1.0f}, 0 != (lights & 4) };
+	m_pending.push_back(std::move(request));
+}
+
+void RenderServer::respond(int clientSocket, uint64_t sequence, std::string response)
+{
+	auto it = m_clients.find(clientSocket);
+	if (it == m_clients.end())
+	{
+		return;
+	}
+	Client& client = it->second;
+	client.responses.emplace(sequence, std::move(response));
+	for (auto next = client.responses.begin(); next != client.responses.end() && next->first == client.nextResponse; )
+	{
+		client.output += next->second;
+		client.nextResponse++;
+		next = client.responses.erase(next);
+	}
+}
+
+void RenderServer::renderBatch()
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	// Images of the batch are held until encoded, so batch ends where its pixels would exceed the limit
+	size_t count = 0, pixels = 0;
+	while (count < m_pending.size() && count < m_options.maxBatch)
+	{
+		const size_t requestPixels = size_t(m_pending[count].width) * size_t(m_pending[count].height);
+		if (count > 0 && pixels + requestPixels > m_options.maxBatchPixels)
+		{
+			break;
+		}
+		pixels += requestPixels;
+		count++;
+	}
+	std::vector<Request> batch(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.begin() + count));
+	m_pending.erase(m_pending.begin(), m_pending.begin() + count);
+
+	// Requests of the same scene and size next to each other, otherwise in order of arrival
+	const auto sceneKey = [&](size_t i)
+	{
+		return std::tie(batch[i].models, batch[i].environment, batch[i].width, batch[i].height);
+	};
+	std::vector<size_t> order(count);
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sceneKey(a) < sceneKey(b); });
+
+	std::vector<std::vector<uint32_t>> images(count);
+	std::vector<std::string> errors(count);
+	size_t scenes = 0;
+	for (size_t first = 0, last; first < count; first = last)
+	{
+		for (last = first + 1; last < count && sceneKey(order[last]) == sceneKey(order[first]); last++) {}
+		scenes++;
+
+		const Request& request = batch[order[first]];
+		try
+		{
+			if (m_glRenderer)
+			{
+				for (size_t i = first; i < last; i++)
+				{
+					renderOpenGl(batch[order[i]], images[order[i]]);
+				}
+			}
+			else
+			{
+				m_rasterizer.setScene(environment(request.environment), models(request.models));
+				m_rasterizer.resize(request.width, request.height);
+				for (size_t i = first; i < last; i++)
+				{
+					m_rasterizer.render(batch[order[i]].view, batch[order[i]].scene);
+					images[order[i]] = m_rasterizer.pixels();
+				}
+			}
+		}
+		catch (const std::exception& e)
+		{
+			for (size_t i = first; i < last; i++)
+			{
+				errors[order[i]] = e.what();
+			}
+		}
+	}
+
+	// Encoder is single threaded, images are encoded in parallel
+	std::vector<std::vector<unsigned char>> encoded(count);
+	parallelFor(count, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (errors[i].empty())
+			{
+				encoded[i] = encodePng(batch[i].width, batch[i].height, images[i].data());
+			}
+		}
+	}, m_options.threads);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (errors[i].empty())
+		{
+			std::string response = "ok " + std::to_string(encoded[i].size()) + "\n";
+			response.append(encoded[i].begin(), encoded[i].end());
+			respond(batch[i].client, batch[i].sequence, std::move(response));
+			m_rendered++;
+		}
+		else
+		{
+			respond(batch[i].client, batch[i].sequence, "error " + errors[i] + "\n");
+		}
+	}
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Batch of " << count << " requests, " << scenes << " scenes: " << ms << " ms" << std::endl;
+}
+
+void RenderServer::createOpenGlRenderer()
+{
+#if ENABLE_OPENGL
+	if (!glfwInit())
+	{
+		throw std::runtime_error("Failed to initialize GLFW library");
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	m_glRenderer = std::make_shared<OpenGL::Renderer>();
+	GLFWwindow* window = m_glRenderer->initialize(OpenGlWindowSize, OpenGlWindowSize, OpenGlSamples);
+	m_glRenderer->setup();
+	m_window = window;		// renderer is shut down only after complete setup
+#else
+	throw std::runtime_error("Server was built without OpenGL renderer");
+#endif
+}
+
+void RenderServer::renderOpenGl(const Request& request, std::vector<uint32_t>& pixels)
+{
+#if ENABLE_OPENGL
+	// Programs and render targets stay from request to request, scene is loaded only when it changes
+	const std::string scene = request.models + ' ' + request.environment;
+	if (scene != m_glScene)
+	{
+		const std::vector<std::string> meshFiles = splitFileNames(request.models);
+		checkFileName(request.environment);
+		std::cout << "Loading scene " << scene << std::endl;
+		m_glScene.clear();		// scene may be left half loaded if loading fails
+		m_glRenderer->loadScene(meshFiles, request.environment);
+		m_glScene = scene;
+	}
+	m_glRenderer->renderImage(request.width, request.height, request.view, request.scene, RenderSettings{}, pixels);
+#else
+	(void)request;
+	(void)pixels;
+#endif
+}
+
+std::shared_ptr<IblMaps> RenderServer::environment(const std::string& name)
+{
+	checkFileName(name);
+	return m_environments.get(name, [&]()
+	{
+		std::cout << "Loading environment " << name << std::endl;
+		return IblMaps::bake(Image::fromFile(name, 3), m_options.threads);
+	});
+}
+
+std::vector<Rasterizer::Model> RenderServer::models(const std::string& names)
+{
+	std::vector<Rasterizer::Model> result;
+	for (const std::string& name : splitFileNames(names))
+	{
+		result.push_back(m_models.get(name, [&]()
+		{
+			std::cout << "Loading model " << name << std::endl;
+			return Rasterizer::Model::fromFile(name);
+		}));
+	}
+	return result;
+}
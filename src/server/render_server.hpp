@@ -0,0 +1,154 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Render server: product images on request over Unix domain socket.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/rasterizer.hpp"
+
+class IblMaps;
+namespace OpenGL { class Renderer; }
+
+// Least recently used resources by name, loaded on first use.
+template<class T>
+class ResourceCache
+{
+public:
+	explicit ResourceCache(size_t capacity) : m_capacity(std::max<size_t>(1, capacity)), m_clock(0) {}
+
+	template<class F>
+	const T& get(const std::string& name, F load)
+	{
+		auto it = m_entries.find(name);
+		if (it == m_entries.end())
+		{
+			T value = load();	// may throw, cache stays as it was
+			if (m_entries.size() >= m_capacity)
+			{
+				auto oldest = m_entries.begin();
+				for (auto entry = m_entries.begin(); entry != m_entries.end(); ++entry)
+				{
+					oldest = (entry->second.lastUse < oldest->second.lastUse) ? entry : oldest;
+				}
+				m_entries.erase(oldest);
+			}
+			it = m_entries.emplace(name, Entry{ std::move(value), 0 }).first;
+		}
+		it->second.lastUse = ++m_clock;
+		return it->second.value;
+	}
+
+	size_t size() const { return m_entries.size(); }
+
+private:
+	struct Entry
+	{
+		T value;
+		uint64_t lastUse;
+	};
+
+	size_t m_capacity;
+	uint64_t m_clock;
+	std::unordered_map<std::string, Entry> m_entries;
+};
+
+// Long-lived renderer answering requests of clients connected to Unix domain socket. Request is one line of
+// space separated key=value pairs:
+//   model=meshes/a.fbx[,meshes/b.fbx]  environment=environment.hdr  width=1280 height=720
+//   yaw=90 pitch=0 distance=400 fov=35  model-yaw=0 model-pitch=0  lights=0 (bit i turns light i on)
+// Only model is required, other values default to the initial view of application. Files are relative to data
+// directory. Response is "ok <size>\n" followed by PNG of that size, or "error <message>\n". Clients may send
+// several requests without waiting, responses come in order of requests.
+// Meshes with materials and baked environments stay loaded between requests (least recently used are dropped).
+// Requests that arrived while previous batch was rendered form the next batch (up to request and pixel limits):
+// requests of the same scene and size are rendered one after another on the loaded scene, then all images of the batch
+// are encoded in parallel. With OpenGL renderer frames are rendered on hidden window, the renderer stays initialized
+// between batches and only reloads its scene when the next request needs another one.
+class RenderServer
+{
+public:
+	struct Options
+	{
+		std::string socketPath;
+		size_t threads = 0;			// 0 - one per hardware thread
+		size_t maxModels = 16;		// cached meshes
+		size_t maxEnvironments = 4;	// cached baked environments
+		size_t maxBatch = 64;		// requests rendered at once
+		size_t maxBatchPixels = size_t(64) << 20;	// pixels of requests rendered at once, one request may exceed it
+		bool opengl = false;		// OpenGL renderer on hidden window instead of software rasterizer
+	};
+
+	explicit RenderServer(const Options& options);
+	~RenderServer();
+
+	// Serves clients until stop becomes nonzero (set by signal handler), throws if socket or renderer can't be created.
+	void run(const volatile std::sig_atomic_t& stop);
+
+private:
+	struct Client
+	{
+		int socket = -1;
+		std::string input;
+		std::string output;
+		uint64_t nextRequest = 0;
+		uint64_t nextResponse = 0;
+		std::map<uint64_t, std::string> responses;	// finished out of order
+		bool inputClosed = false;
+
+		// Everything requested was answered and sent, nothing more will come
+		bool done() const { return inputClosed && nextResponse == nextRequest && output.empty(); }
+	};
+
+	struct Request
+	{
+		int client;
+		uint64_t sequence;
+		std::string models;			// comma separated
+		std::string environment;
+		int width;
+		int height;
+		ViewSettings view;
+		SceneSettings scene;
+	};
+
+	RenderServer(const RenderServer&) = delete;
+	RenderServer& operator=(const RenderServer&) = delete;
+
+	void listen();
+	void acceptClients();
+	// Return false if client is gone or done
+	bool readClient(Client& client);
+	bool writeClient(Client& client);
+	void closeClient(int clientSocket);
+	void parseRequest(Client& client, const std::string& line);
+	void respond(int clientSocket, uint64_t sequence, std::string response);
+	void renderBatch();
+	void createOpenGlRenderer();
+	void renderOpenGl(const Request& request, std::vector<uint32_t>& pixels);
+	std::shared_ptr<IblMaps> environment(const std::string& name);
+	std::vector<Rasterizer::Model> models(const std::string& names);
+
+	Options m_options;
+	int m_listenSocket;
+	std::unordered_map<int, Client> m_clients;
+	std::vector<Request> m_pending;
+	Rasterizer m_rasterizer;
+	ResourceCache<Rasterizer::Model> m_models;
+	ResourceCache<std::shared_ptr<IblMaps>> m_environments;
+	std::shared_ptr<OpenGL::Renderer> m_glRenderer;		// declared only, server may be built without it
+	GLFWwindow* m_window;
+	std::string m_glScene;		// models and environment loaded into OpenGL renderer
+	uint64_t m_rendered;
+};
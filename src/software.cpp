@@ -0,0 +1,104 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Software renderer, frames are rasterized or path traced on CPU and presented through OpenGL.
+ */
+
+#include <stdexcept>
+#include <memory>
+
+#include <GLFW/glfw3.h>
+
+#include "software.hpp"
+
+
+namespace Software
+{
+
+GLFWwindow* Renderer::initialize(int width, int height, int /*maxSamples*/)
+{
+	// OpenGL only shows finished frames, so any context that can blit will do
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_DEPTH_BITS, 0);
+	glfwWindowHint(GLFW_STENCIL_BITS, 0);
+	glfwWindowHint(GLFW_SAMPLES, 0);
+
+	GLFWwindow* window = glfwCreateWindow(width, height, "Physically Based Rendering (Software)", nullptr, nullptr);
+	if (!window)
+	{
+		throw std::runtime_error("Failed to create OpenGL context");
+	}
+
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(-1);
+
+	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+	{
+		throw std::runtime_error("Failed to initialize OpenGL extensions loader");
+	}
+
+	int fbWidth, fbHeight;
+	glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+	mRasterizer.resize(fbWidth, fbHeight);
+	mPathTracer.resize(fbWidth, fbHeight);
+	mFramebuffer = std::make_shared<OpenGL::Framebuffer>();
+	mFramebuffer->AttachTexture(GL_COLOR_ATTACHMENT0, GL_RGBA8, mRasterizer.width(), mRasterizer.height());
+	mFramebuffer->ReadBuffer(GL_COLOR_ATTACHMENT0);
+	return window;
+}
+
+void Renderer::shutdown()
+{
+	mFramebuffer->Release();
+}
+
+std::function<void (int w, int h)> Renderer::setup()
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (mPathTracing)
+	{
+		mPathTracer.loadScene();
+	}
+	else
+	{
+		mRasterizer.loadScene();
+	}
+
+	return [this](int w, int h)
+	{
+		if (w > 0 && h > 0)
+		{
+			mRasterizer.resize(w, h);
+			mPathTracer.resize(w, h);
+			mFramebuffer->ResizeAll(mRasterizer.width(), mRasterizer.height());
+		}
+	};
+}
+
+void Renderer::render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& /*settings*/)
+{
+	// GPU specific settings (feedback, probes, culling, impostors) don't apply, transparency is always sorted (or exact)
+	if (mPathTracing)
+	{
+		mPathTracer.render(view, scene);
+	}
+	else
+	{
+		mRasterizer.render(view, scene);
+	}
+
+	const int width = mRasterizer.width(), height = mRasterizer.height();
+	const auto texture = std::static_pointer_cast<const OpenGL::Texture>(mFramebuffer->GetRenderTarget(GL_COLOR_ATTACHMENT0));
+	texture->SubImageLevel(0, 1, GL_RGBA, GL_UNSIGNED_BYTE, mPathTracing ? mPathTracer.pixels().data() : mRasterizer.pixels().data());
+
+	// Rows of frame go from top to bottom, flipped when blitted to window
+	glBlitNamedFramebuffer(mFramebuffer->GetId(), 0, 0, 0, width, height, 0, height, width, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	glfwSwapBuffers(window);
+}
+
+} // Software
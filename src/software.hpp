@@ -0,0 +1,35 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Software renderer, frames are rasterized or path traced on CPU and presented through OpenGL.
+ */
+
+#pragma once
+
+#include "opengl.hpp"
+#include "common/path_tracer.hpp"
+#include "common/rasterizer.hpp"
+
+namespace Software {
+
+class Renderer final : public RendererInterface
+{
+public:
+	// Path traced frames converge while view and scene stay the same
+	explicit Renderer(bool pathTracing = false) : mPathTracing(pathTracing) {}
+
+	GLFWwindow* initialize(int width, int height, int maxSamples) override;
+	void shutdown() override;
+	std::function<void (int w, int h)> setup() override;
+	void render(GLFWwindow* window, const ViewSettings& view, const SceneSettings& scene, const RenderSettings& settings) override;
+
+private:
+	bool mPathTracing;
+	Rasterizer mRasterizer;
+	PathTracer mPathTracer;
+	// Texture frames are uploaded to, blitted to window
+	std::shared_ptr<OpenGL::Framebuffer> mFramebuffer;
+};
+
+} // Software
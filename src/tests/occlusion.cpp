@@ -0,0 +1,167 @@
+/*
+ * Physically Based Rendering
+ * Forked from Michał Siejak PBR project
+ *
+ * Test of CPU occlusion culling: rasterized occluder depth, depth hierarchy and bounds tests.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../common/occlusion.hpp"
+
+namespace {
+	int failures = 0;
+
+	void check(bool condition, const char* what)
+	{
+		if (!condition)
+		{
+			std::printf("FAILED: %s\n", what);
+			failures++;
+		}
+	}
+
+	// Square in plane z = 0 facing +z
+	std::shared_ptr<OcclusionCuller::Occluder> makeSquare(float halfSize)
+	{
+		auto occluder = std::make_shared<OcclusionCuller::Occluder>();
+		occluder->positions = { { -halfSize, -halfSize, 0.f }, { halfSize, -halfSize, 0.f },
+								{ halfSize, halfSize, 0.f }, { -halfSize, halfSize, 0.f } };
+		occluder->indices = { 0, 1, 2, 0, 2, 3 };
+		return occluder;
+	}
+
+	OcclusionCuller::Bounds box(glm::vec3 center, float halfSize)
+	{
+		return OcclusionCuller::Bounds{ center - glm::vec3{ halfSize }, center + glm::vec3{ halfSize } };
+	}
+
+	// Window depth of point as OpenGL depth buffer stores it
+	float windowDepth(const glm::mat4& viewProjection, glm::vec3 point)
+	{
+		const glm::vec4 clip = viewProjection * glm::vec4{ point, 1.f };
+		return clip.z / clip.w * 0.5f + 0.5f;
+	}
+
+	// Visibility of bounds in front of near plane found by scanning every pixel of their rectangle
+	bool isVisibleInPixels(const OcclusionCuller& culler, const glm::mat4& viewProjection, const OcclusionCuller::Bounds& bounds)
+	{
+		glm::vec2 rectMin{ 1e30f }, rectMax{ -1e30f };
+		float minDepth = 1e30f;
+		for (int i = 0; i < 8; i++)
+		{
+			const glm::vec3 corner{ (i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y,
+									(i & 4) ? bounds.max.z : bounds.min.z };
+			const glm::vec4 clip = viewProjection * glm::vec4{ corner, 1.f };
+			const glm::vec3 ndc = glm::vec3{ clip } / clip.w;
+			rectMin = glm::min(rectMin, glm::vec2{ (ndc.x * 0.5f + 0.5f) * culler.width(), (ndc.y * 0.5f + 0.5f) * culler.height() });
+			rectMax = glm::max(rectMax, glm::vec2{ (ndc.x * 0.5f + 0.5f) * culler.width(), (ndc.y * 0.5f + 0.5f) * culler.height() });
+			minDepth = std::min(minDepth, ndc.z * 0.5f + 0.5f);
+		}
+		// Culler reads pixels in groups of four starting at multiple of four
+		const int x0 = std::max(0, int(std::floor(rectMin.x))) & ~3;
+		const int x1 = std::min(culler.width() - 1, (int(std::ceil(rectMax.x)) & ~3) + 3);
+		for (int y = std::max(0, int(std::floor(rectMin.y))); y <= std::min(culler.height() - 1, int(std::ceil(rectMax.y))); y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				if (minDepth < culler.depth(x, y))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+}
+
+int main()
+{
+	// Camera on +z axis looking at origin, occluders are squares at origin
+	const glm::mat4 viewProjection = glm::perspective(glm::radians(60.f), 2.f, 1.f, 100.f)
+		* glm::lookAt(glm::vec3{ 0.f, 0.f, 5.f }, glm::vec3{ 0.f }, glm::vec3{ 0.f, 1.f, 0.f });
+	const glm::mat4 identity{ 1.f };
+	OcclusionCuller culler{ 256, 128 };
+
+	// Square of half size 1 covers middle of the view, corners stay empty
+	culler.begin(viewProjection);
+	culler.addOccluder(makeSquare(1.f), identity);
+	culler.rasterize();
+
+	const float squareDepth = windowDepth(viewProjection, glm::vec3{ 0.f });
+	check(std::abs(culler.depth(culler.width() / 2, culler.height() / 2) - squareDepth) < 1e-4f, "depth of occluder at center");
+	check(culler.depth(0, 0) == 1.f && culler.depth(culler.width() - 1, culler.height() - 1) == 1.f, "depth of empty corners");
+
+	// Levels halve down to a single cell holding the farthest depth
+	const int top = culler.levelCount() - 1;
+	check(culler.levelCount() > 2, "depth hierarchy has several levels");
+	check(culler.levelWidth(0) == culler.width() / OcclusionCuller::TileSize, "tile level width");
+	check(1 == culler.levelWidth(top) && 1 == culler.levelHeight(top), "top level is one cell");
+	check(culler.levelMaxDepth(top, 0, 0) == 1.f, "top level of partly covered view is far plane");
+	for (int level = 1; level <= top; level++)
+	{
+		check(culler.levelWidth(level) == (culler.levelWidth(level - 1) + 1) / 2, "level halves width");
+	}
+
+	check(!culler.isVisible(box({ 0.f, 0.f, -2.f }, 0.2f), identity), "small box behind occluder is hidden");
+	check(!culler.isVisible(box({ 0.f, 0.f, -4.f }, 1.f), identity), "box behind occluder within its silhouette is hidden");
+	check(culler.isVisible(box({ 0.f, 0.f, 1.f }, 0.2f), identity), "box in front of occluder is visible");
+	check(culler.isVisible(box({ 3.f, 0.f, -2.f }, 0.2f), identity), "box beside occluder is visible");
+	check(culler.isVisible(box({ 1.f, 0.f, -2.f }, 0.2f), identity), "box sticking out of silhouette is visible");
+	check(culler.isVisible(box({ 0.f, 0.f, -2.f }, 3.f), identity), "box larger than occluder is visible");
+	check(culler.isVisible(box({ 0.f, 0.f, 5.f }, 0.5f), identity), "box crossing near plane is visible");
+	check(!culler.isVisible(box({ 30.f, 0.f, -2.f }, 0.5f), identity), "box outside of view is not visible");
+	check(culler.isVisible(box({ 0.f, 0.f, -2.f }, 0.2f), glm::translate(identity, glm::vec3{ 3.f, 0.f, 0.f })),
+		  "model matrix moves box beside occluder");
+
+	// Occluder filling the view decides large bounds on coarse levels
+	culler.begin(viewProjection);
+	culler.addOccluder(makeSquare(20.f), identity);
+	culler.addOccluder(makeSquare(1.f), glm::translate(identity, glm::vec3{ 0.f, 0.f, 1.f }));
+	culler.rasterize();
+	check(std::abs(culler.levelMaxDepth(top, 0, 0) - squareDepth) < 1e-4f, "top level of covered view is occluder depth");
+	check(culler.depth(culler.width() / 2, culler.height() / 2) < squareDepth, "nearer occluder wins");
+	check(!culler.isVisible(box({ 0.f, 0.f, -10.f }, 5.f), identity), "large box behind occluder is hidden");
+	check(!culler.isVisible(box({ 0.f, 0.f, 0.5f }, 0.3f), identity), "box between occluders is hidden");
+	check(culler.isVisible(box({ 2.f, 0.f, 0.f }, 0.5f), identity), "box intersecting occluder is visible");
+
+	check(OcclusionCuller::isInFrustum(box({ 0.f, 0.f, -2.f }, 0.5f), viewProjection), "box in view is in frustum");
+	check(!OcclusionCuller::isInFrustum(box({ 100.f, 0.f, -2.f }, 0.5f), viewProjection), "box beside view isn't in frustum");
+	check(!OcclusionCuller::isInFrustum(box({ 0.f, 0.f, 10.f }, 0.5f), viewProjection), "box behind camera isn't in frustum");
+
+	// Parallel test agrees with single bounds test and both agree with test of every pixel
+	std::vector<OcclusionCuller::Bounds> bounds;
+	std::vector<glm::mat4> modelMatrices;
+	for (int i = 0; i < 1000; i++)
+	{
+		const glm::vec3 center{ float(i % 21 - 10) * 2.f, float(i / 21 % 11 - 5) * 2.f, float(i % 7) * -3.f + 2.f };
+		bounds.push_back(box(center, 0.1f + float(i % 5) * 0.5f));
+		modelMatrices.push_back(identity);
+	}
+	std::vector<uint8_t> visible;
+	culler.testVisibility(bounds, modelMatrices, visible);
+	size_t mismatches = 0, pixelMismatches = 0, hidden = 0;
+	for (size_t i = 0; i < bounds.size(); i++)
+	{
+		mismatches += (0 != visible[i]) != culler.isVisible(bounds[i], modelMatrices[i]) ? 1 : 0;
+		const bool inView = OcclusionCuller::isInFrustum(bounds[i], viewProjection) && bounds[i].max.z < 4.f;
+		pixelMismatches += (inView && (0 != visible[i]) != isVisibleInPixels(culler, viewProjection, bounds[i])) ? 1 : 0;
+		hidden += (0 == visible[i]) ? 1 : 0;
+	}
+	check(0 == mismatches, "parallel test matches single test");
+	check(0 == pixelMismatches, "depth hierarchy matches test of every pixel");
+	check(hidden > 0 && hidden < bounds.size(), "parallel test hides some bounds");
+
+	if (0 == failures)
+	{
+		std::printf("All occlusion tests passed\n");
+	}
+	return (0 == failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}